@@ -0,0 +1,680 @@
+/* ******************************************************************************
+ * Copyright (c) 2015, Sam Gillingham <gillingham.sam@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+// Convert many AOI files into one or more vector datasets in a 
+// single process. Files are opened and read by a pool of worker 
+// threads (sharing the SRS and dictionary caches) and handed over in
+// batches, and all the writing is done by the main thread in large 
+// transactions.
+// Usage: see Usage() below.
+
+#include <gdal_priv.h>
+#include <cpl_string.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <thread>
+#include "aoidatasource.h"
+#include "aoithreads.h"
+
+// Name of the layer created in each output and the suffix of the
+// file listing the inputs that have been committed (for -resume)
+#define AOI2VEC_LAYER_NAME "aoi"
+#define AOI2VEC_JOURNAL_EXT ".aoi2vec_done"
+
+// Features handed to the writer at a time, and the batches each
+// worker can read ahead of it
+#define AOI2VEC_BATCH_SIZE 1000
+#define AOI2VEC_QUEUE_PER_THREAD 2
+
+static void Usage( const char *pszError = NULL )
+{
+    printf( "Usage: aoi2vec [-o format dst]+ [-threads n|ALL_CPUS] [-gt n]\n"
+            "               [-resume] [-progress] [-list filelist]\n"
+            "               [-oo NAME=VALUE]* [-dsco NAME=VALUE]* [-lco NAME=VALUE]*\n"
+            "               [src.aoi|srcdir]*\n"
+            "\n"
+            "Writes the objects from every .aoi file given (directories are\n"
+            "searched recursively) to an '" AOI2VEC_LAYER_NAME "' layer in each output,\n"
+            "with the source file in a 'Source' field. Files that fail are\n"
+            "reported and skipped. -gt sets the features per transaction\n"
+            "(default 100000). -resume skips files already written by an\n"
+            "earlier run that was interrupted and appends to the outputs.\n" );
+    if( pszError != NULL )
+        fprintf( stderr, "\nFAILURE: %s\n", pszError );
+    exit( 1 );
+}
+
+#define CHECK_ARGS(n) if( i + (n) >= nArgc ) \
+    Usage( CPLSPrintf( "%s option requires %d argument(s)", papszArgv[i], n ) )
+
+// Some of the features read from one input by a worker. The batches
+// of a file come one after another, the last with bLast set and
+// osError if reading failed part way through.
+struct AOI2VecBatch
+{
+    int                         iFile;
+    std::vector<OGRFeature*>    apoFeatures;
+    OGRSpatialReference        *poSRS;     // first batch only, referenced, may be NULL
+    int                         bFirst;
+    int                         bLast;
+    CPLString                   osError;    // empty if it worked
+};
+
+static AOI2VecBatch *NewBatch( int iFile, int bFirst )
+{
+    AOI2VecBatch *poBatch = new AOI2VecBatch();
+    poBatch->iFile = iFile;
+    poBatch->poSRS = NULL;
+    poBatch->bFirst = bFirst;
+    poBatch->bLast = FALSE;
+    return poBatch;
+}
+
+static void DeleteBatch( AOI2VecBatch *poBatch )
+{
+    for( size_t i = 0; i < poBatch->apoFeatures.size(); i++ )
+        delete poBatch->apoFeatures[i];
+    if( poBatch->poSRS != NULL )
+        poBatch->poSRS->Release();
+    delete poBatch;
+}
+
+// Batches waiting for the writer, kept per worker. The writer takes
+// all of one file before starting another so each worker blocks when
+// its own queue is full, and memory use is bounded however big the
+// files are and however slow the outputs.
+class AOI2VecQueue
+{
+    std::mutex                  m_oMutex;
+    std::condition_variable     m_oCond;
+    std::vector< std::deque<AOI2VecBatch*> > m_aapoBatches;   // by worker
+    size_t                      m_nMaxSize;
+    size_t                      m_iNextWorker;
+
+  public:
+                AOI2VecQueue( int nWorkers, size_t nMaxSize ) 
+                    : m_aapoBatches( nWorkers ), m_nMaxSize( nMaxSize ), 
+                      m_iNextWorker( 0 ) {}
+
+    void Push( int iWorker, AOI2VecBatch *poBatch )
+    {
+        std::unique_lock<std::mutex> oLock( m_oMutex );
+        std::deque<AOI2VecBatch*> &apoBatches = m_aapoBatches[iWorker];
+        m_oCond.wait( oLock, [&]() { return apoBatches.size() < m_nMaxSize; } );
+        apoBatches.push_back( poBatch );
+        m_oCond.notify_all();
+    }
+
+    // The next batch from *piWorker, or from whichever worker has one
+    // if *piWorker is -1, in which case *piWorker is set to it
+    AOI2VecBatch *Pop( int *piWorker )
+    {
+        std::unique_lock<std::mutex> oLock( m_oMutex );
+        m_oCond.wait( oLock, [&]() 
+        {
+            if( *piWorker >= 0 )
+                return !m_aapoBatches[*piWorker].empty();
+            for( size_t i = 0; i < m_aapoBatches.size(); i++ )
+            {
+                size_t iWorker = (m_iNextWorker + i) % m_aapoBatches.size();
+                if( !m_aapoBatches[iWorker].empty() )
+                {
+                    *piWorker = (int)iWorker;
+                    m_iNextWorker = iWorker + 1;
+                    return true;
+                }
+            }
+            return false;
+        } );
+        AOI2VecBatch *poBatch = m_aapoBatches[*piWorker].front();
+        m_aapoBatches[*piWorker].pop_front();
+        m_oCond.notify_all();
+        return poBatch;
+    }
+};
+
+// Open and read one file, handing its features to the writer in 
+// batches. Any error is kept in the last batch rather than stopping
+// the run.
+static void ReadAOIFile( AOI2VecQueue &oQueue, int iWorker, int iFile, 
+                         const char *pszFilename, char **papszOpenOptions )
+{
+    AOI2VecBatch *poBatch = NewBatch( iFile, TRUE );
+    OGRAOIDataSource *poDS = NULL;
+
+    // errors are collected for the report, not printed as they happen
+    CPLPushErrorHandler( CPLQuietErrorHandler );
+    CPLErrorReset();
+    try
+    {
+        poDS = AOIOpenDataSource( pszFilename, papszOpenOptions );
+        if( poDS == NULL )
+        {
+            poBatch->osError = CPLGetLastErrorMsg();
+            if( poBatch->osError.empty() )
+                poBatch->osError = "Not an AOI file";
+        }
+        else
+        {
+            OGRLayer *poLayer = poDS->GetLayer( 0 );
+            poBatch->poSRS = poLayer->GetSpatialRef();
+            if( poBatch->poSRS != NULL )
+                poBatch->poSRS->Reference();
+
+            OGRFeature *poFeature;
+            while( (poFeature = poLayer->GetNextFeature()) != NULL )
+            {
+                poBatch->apoFeatures.push_back( poFeature );
+                if( poBatch->apoFeatures.size() >= AOI2VEC_BATCH_SIZE )
+                {
+                    oQueue.Push( iWorker, poBatch );
+                    poBatch = NewBatch( iFile, FALSE );
+                }
+            }
+
+            if( CPLGetLastErrorType() == CE_Failure )
+                poBatch->osError = CPLGetLastErrorMsg();
+        }
+    }
+    catch( const std::exception &e )
+    {
+        poBatch->osError = e.what();
+    }
+    delete poDS;
+    CPLPopErrorHandler();
+
+    poBatch->bLast = TRUE;
+    oQueue.Push( iWorker, poBatch );
+}
+
+// Add the .aoi files in pszPath (a file or directory) to aosFiles
+static void AddInput( const char *pszPath, std::vector<CPLString> &aosFiles )
+{
+    VSIStatBufL sStat;
+    if( VSIStatL( pszPath, &sStat ) == 0 && VSI_ISDIR( sStat.st_mode ) )
+    {
+        char **papszFiles = VSIReadDirRecursive( pszPath );
+        for( int i = 0; papszFiles != NULL && papszFiles[i] != NULL; i++ )
+        {
+            if( EQUAL( CPLGetExtension( papszFiles[i] ), "aoi" ) )
+                aosFiles.push_back( CPLFormFilename( pszPath, papszFiles[i], NULL ) );
+        }
+        CSLDestroy( papszFiles );
+    }
+    else
+    {
+        aosFiles.push_back( pszPath );
+    }
+}
+
+// One output dataset with its layer
+struct AOI2VecOutput
+{
+    CPLString       osFormat;
+    CPLString       osFilename;
+    GDALDataset    *poDS;
+    OGRLayer       *poLayer;
+    int             bInTransaction;
+};
+
+// Open or create an output. The layer is created when the first 
+// features arrive so it can have their SRS.
+static int OpenOutput( AOI2VecOutput &sOutput, int bResume, char **papszDSCO )
+{
+    sOutput.poLayer = NULL;
+    sOutput.bInTransaction = FALSE;
+    if( bResume )
+    {
+        sOutput.poDS = (GDALDataset*)GDALOpenEx( sOutput.osFilename, 
+                GDAL_OF_VECTOR | GDAL_OF_UPDATE | GDAL_OF_VERBOSE_ERROR, NULL, NULL, NULL );
+        if( sOutput.poDS != NULL )
+        {
+            sOutput.poLayer = sOutput.poDS->GetLayerByName( AOI2VEC_LAYER_NAME );
+            return TRUE;
+        }
+        // not written to before - create it
+    }
+
+    GDALDriver *poDriver = GetGDALDriverManager()->GetDriverByName( sOutput.osFormat );
+    if( poDriver == NULL )
+    {
+        fprintf( stderr, "Output driver `%s' not recognised.\n", sOutput.osFormat.c_str() );
+        return FALSE;
+    }
+    sOutput.poDS = poDriver->Create( sOutput.osFilename, 0, 0, 0, GDT_Unknown, papszDSCO );
+    return sOutput.poDS != NULL;
+}
+
+static int CreateOutputLayer( AOI2VecOutput &sOutput, OGRSpatialReference *poSRS,
+                              char **papszLCO )
+{
+    sOutput.poLayer = sOutput.poDS->CreateLayer( AOI2VEC_LAYER_NAME, poSRS, 
+                                                 wkbGeometryCollection, papszLCO );
+    if( sOutput.poLayer == NULL )
+        return FALSE;
+    OGRFieldDefn oSource( "Source", OFTString );
+    OGRFieldDefn oName( "Name", OFTString );
+    OGRFieldDefn oDescription( "Description", OFTString );
+    return sOutput.poLayer->CreateField( &oSource ) == OGRERR_NONE
+        && sOutput.poLayer->CreateField( &oName ) == OGRERR_NONE
+        && sOutput.poLayer->CreateField( &oDescription ) == OGRERR_NONE;
+}
+
+// Commit the outputs and record the files written since the last 
+// commit in the journal. Starts new transactions unless bFinal.
+static int CommitOutputs( std::vector<AOI2VecOutput> &asOutputs, VSILFILE *fpJournal,
+                          std::vector<CPLString> &aosPending, int bFinal )
+{
+    int bOK = TRUE;
+    for( size_t i = 0; i < asOutputs.size(); i++ )
+    {
+        if( asOutputs[i].bInTransaction )
+        {
+            bOK &= asOutputs[i].poDS->CommitTransaction() == OGRERR_NONE;
+            asOutputs[i].bInTransaction = FALSE;
+        }
+        else
+        {
+            // no transactions - get as close as we can
+            asOutputs[i].poDS->FlushCache();
+        }
+        if( !bFinal )
+            asOutputs[i].bInTransaction = 
+                asOutputs[i].poDS->StartTransaction() == OGRERR_NONE;
+    }
+
+    if( bOK && fpJournal != NULL )
+    {
+        for( size_t i = 0; i < aosPending.size(); i++ )
+            VSIFPrintfL( fpJournal, "%s\n", aosPending[i].c_str() );
+        VSIFFlushL( fpJournal );
+    }
+    aosPending.clear();
+    return bOK;
+}
+
+// Write the features of a batch to every output. The FIDs written 
+// to outputs without a transaction are added to aanFIDs so they can
+// be deleted again if the file fails later.
+static int WriteBatch( std::vector<AOI2VecOutput> &asOutputs, AOI2VecBatch *poBatch,
+                       const char *pszFilename, 
+                       std::vector< std::vector<GIntBig> > &aanFIDs )
+{
+    for( size_t iOut = 0; iOut < asOutputs.size(); iOut++ )
+    {
+        OGRLayer *poLayer = asOutputs[iOut].poLayer;
+        OGRFeatureDefn *poDefn = poLayer->GetLayerDefn();
+        int iSource = poDefn->GetFieldIndex( "Source" );
+        int iName = poDefn->GetFieldIndex( "Name" );
+        int iDescription = poDefn->GetFieldIndex( "Description" );
+        for( size_t i = 0; i < poBatch->apoFeatures.size(); i++ )
+        {
+            OGRFeature *poSrcFeature = poBatch->apoFeatures[i];
+            OGRFeature oFeature( poDefn );
+            oFeature.SetField( iSource, pszFilename );
+            oFeature.SetField( iName, poSrcFeature->GetFieldAsString( 0 ) );
+            oFeature.SetField( iDescription, poSrcFeature->GetFieldAsString( 1 ) );
+            // the last output can have the geometry
+            if( iOut + 1 == asOutputs.size() )
+                oFeature.SetGeometryDirectly( poSrcFeature->StealGeometry() );
+            else
+                oFeature.SetGeometry( poSrcFeature->GetGeometryRef() );
+            if( poLayer->CreateFeature( &oFeature ) != OGRERR_NONE )
+            {
+                fprintf( stderr, "Failed writing to %s\n", 
+                         asOutputs[iOut].osFilename.c_str() );
+                return FALSE;
+            }
+            if( !asOutputs[iOut].bInTransaction )
+                aanFIDs[iOut].push_back( oFeature.GetFID() );
+        }
+    }
+    return TRUE;
+}
+
+// Take out what was written of a file that failed part way. It has 
+// the transaction to itself (see main()) so that is rolled back,
+// otherwise the features are deleted one by one. Returns FALSE if 
+// anything couldn't be undone.
+static int UndoFile( std::vector<AOI2VecOutput> &asOutputs, const char *pszFilename,
+                     std::vector< std::vector<GIntBig> > &aanFIDs )
+{
+    int bOK = TRUE;
+    for( size_t iOut = 0; iOut < asOutputs.size(); iOut++ )
+    {
+        AOI2VecOutput &sOutput = asOutputs[iOut];
+        if( sOutput.bInTransaction )
+        {
+            bOK &= sOutput.poDS->RollbackTransaction() == OGRERR_NONE;
+            sOutput.bInTransaction = sOutput.poDS->StartTransaction() == OGRERR_NONE;
+            continue;
+        }
+        for( size_t i = 0; i < aanFIDs[iOut].size(); i++ )
+        {
+            if( sOutput.poLayer->DeleteFeature( aanFIDs[iOut][i] ) != OGRERR_NONE )
+            {
+                fprintf( stderr, "ERROR: %s: couldn't remove the %d features already "
+                         "written to %s\n", pszFilename, (int)(aanFIDs[iOut].size() - i),
+                         sOutput.osFilename.c_str() );
+                bOK = FALSE;
+                break;
+            }
+        }
+    }
+    return bOK;
+}
+
+int main( int nArgc, char **papszArgv )
+{
+    GDALAllRegister();
+    nArgc = GDALGeneralCmdLineProcessor( nArgc, &papszArgv, 0 );
+    if( nArgc < 1 )
+        exit( -nArgc );
+
+    std::vector<AOI2VecOutput> asOutputs;
+    std::vector<CPLString> aosFiles;
+    char **papszOpenOptions = NULL, **papszDSCO = NULL, **papszLCO = NULL;
+    int nThreads = 1, bResume = FALSE, bProgress = FALSE;
+    GIntBig nGroupTransactions = 100000;
+
+    for( int i = 1; i < nArgc; i++ )
+    {
+        if( EQUAL(papszArgv[i], "-o") )
+        {
+            CHECK_ARGS(2);
+            AOI2VecOutput sOutput;
+            sOutput.osFormat = papszArgv[++i];
+            sOutput.osFilename = papszArgv[++i];
+            sOutput.poDS = NULL;
+            asOutputs.push_back( sOutput );
+        }
+        else if( EQUAL(papszArgv[i], "-threads") )
+        {
+            CHECK_ARGS(1);
+            nThreads = AOIGetThreadCount( papszArgv[++i] );
+        }
+        else if( EQUAL(papszArgv[i], "-gt") )
+        {
+            CHECK_ARGS(1);
+            nGroupTransactions = CPLAtoGIntBig( papszArgv[++i] );
+            if( nGroupTransactions <= 0 )
+                Usage( "-gt must be at least 1" );
+        }
+        else if( EQUAL(papszArgv[i], "-resume") )
+            bResume = TRUE;
+        else if( EQUAL(papszArgv[i], "-progress") )
+            bProgress = TRUE;
+        else if( EQUAL(papszArgv[i], "-list") )
+        {
+            CHECK_ARGS(1);
+            VSILFILE *fpList = VSIFOpenL( papszArgv[++i], "r" );
+            if( fpList == NULL )
+                Usage( CPLSPrintf( "Can't open %s", papszArgv[i] ) );
+            const char *pszLine;
+            while( (pszLine = CPLReadLineL( fpList )) != NULL )
+            {
+                if( *pszLine != '\0' )
+                    AddInput( pszLine, aosFiles );
+            }
+            VSIFCloseL( fpList );
+        }
+        else if( EQUAL(papszArgv[i], "-oo") )
+        {
+            CHECK_ARGS(1);
+            papszOpenOptions = CSLAddString( papszOpenOptions, papszArgv[++i] );
+        }
+        else if( EQUAL(papszArgv[i], "-dsco") )
+        {
+            CHECK_ARGS(1);
+            papszDSCO = CSLAddString( papszDSCO, papszArgv[++i] );
+        }
+        else if( EQUAL(papszArgv[i], "-lco") )
+        {
+            CHECK_ARGS(1);
+            papszLCO = CSLAddString( papszLCO, papszArgv[++i] );
+        }
+        else if( papszArgv[i][0] == '-' )
+            Usage( CPLSPrintf( "Unknown option name '%s'", papszArgv[i] ) );
+        else
+            AddInput( papszArgv[i], aosFiles );
+    }
+
+    if( asOutputs.empty() )
+        Usage( "No output given" );
+
+    // The journal lists the inputs that are safely in the outputs
+    CPLString osJournal = asOutputs[0].osFilename + AOI2VEC_JOURNAL_EXT;
+    std::set<CPLString> aosDone;
+    if( bResume )
+    {
+        VSILFILE *fpDone = VSIFOpenL( osJournal, "r" );
+        if( fpDone != NULL )
+        {
+            const char *pszLine;
+            while( (pszLine = CPLReadLineL( fpDone )) != NULL )
+                aosDone.insert( pszLine );
+            VSIFCloseL( fpDone );
+        }
+
+        std::vector<CPLString> aosRemaining;
+        for( size_t i = 0; i < aosFiles.size(); i++ )
+        {
+            if( aosDone.find( aosFiles[i] ) == aosDone.end() )
+                aosRemaining.push_back( aosFiles[i] );
+        }
+        printf( "Skipping %d files already converted\n", 
+                (int)(aosFiles.size() - aosRemaining.size()) );
+        aosFiles.swap( aosRemaining );
+    }
+
+    for( size_t i = 0; i < asOutputs.size(); i++ )
+    {
+        if( !OpenOutput( asOutputs[i], bResume, papszDSCO ) )
+            exit( 1 );
+        asOutputs[i].bInTransaction = 
+            asOutputs[i].poDS->StartTransaction() == OGRERR_NONE;
+    }
+
+    VSILFILE *fpJournal = VSIFOpenL( osJournal, bResume ? "a" : "w" );
+    if( fpJournal == NULL )
+        fprintf( stderr, "Warning: can't write %s. -resume won't be possible.\n", 
+                 osJournal.c_str() );
+
+    // Workers read files in any order and hand them to this thread
+    int nFiles = (int)aosFiles.size();
+    if( nThreads > nFiles )
+        nThreads = MAX( nFiles, 1 );
+    AOI2VecQueue oQueue( nThreads, AOI2VEC_QUEUE_PER_THREAD );
+    std::atomic<int> nNextFile( 0 );
+    std::vector<std::thread> aoWorkers;
+    for( int iThread = 0; iThread < nThreads; iThread++ )
+    {
+        aoWorkers.push_back( std::thread( [&, iThread]()
+        {
+            int iFile;
+            while( (iFile = nNextFile++) < nFiles )
+                ReadAOIFile( oQueue, iThread, iFile, aosFiles[iFile], papszOpenOptions );
+        } ) );
+    }
+
+    std::chrono::steady_clock::time_point oStart = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point oLastReport = oStart;
+    std::vector<CPLString> aosPending;
+    OGRSpatialReference *poOutputSRS = NULL;
+    GIntBig nFeatures = 0, nSinceCommit = 0;
+    int nFailed = 0;
+    int bWriteError = FALSE;
+    int bLayersReady = FALSE;
+
+    // state of the file being written
+    int iWorker = -1;
+    CPLString osFileError;
+    GIntBig nFileFeatures = 0;
+    std::vector< std::vector<GIntBig> > aanFIDs( asOutputs.size() );
+
+    for( int nDone = 0; nDone < nFiles; )
+    {
+        AOI2VecBatch *poBatch = oQueue.Pop( &iWorker );
+        const char *pszFilename = aosFiles[poBatch->iFile];
+
+        if( poBatch->bFirst )
+        {
+            osFileError = "";
+            nFileFeatures = 0;
+            for( size_t i = 0; i < aanFIDs.size(); i++ )
+                aanFIDs[i].clear();
+
+            // A file that doesn't fit in one batch gets a transaction 
+            // to itself so it can be rolled back if it fails part way
+            if( !poBatch->bLast && nSinceCommit > 0 && !bWriteError )
+            {
+                bWriteError = !CommitOutputs( asOutputs, fpJournal, aosPending, FALSE );
+                nSinceCommit = 0;
+            }
+        }
+
+        // the outputs only have one layer so everything must match
+        if( poBatch->bFirst && poBatch->osError.empty() && !bWriteError )
+        {
+            if( !bLayersReady )
+            {
+                // use the SRS of anything written before when resuming,
+                // otherwise that of the first file
+                OGRSpatialReference *poSRS = poBatch->poSRS;
+                for( size_t i = 0; i < asOutputs.size(); i++ )
+                {
+                    if( asOutputs[i].poLayer != NULL )
+                    {
+                        poSRS = asOutputs[i].poLayer->GetSpatialRef();
+                        break;
+                    }
+                }
+                if( poSRS != NULL )
+                    poOutputSRS = poSRS->Clone();
+
+                for( size_t i = 0; i < asOutputs.size(); i++ )
+                {
+                    if( asOutputs[i].poLayer == NULL 
+                        && !CreateOutputLayer( asOutputs[i], poOutputSRS, papszLCO ) )
+                    {
+                        fprintf( stderr, "Can't create layer in %s\n", 
+                                 asOutputs[i].osFilename.c_str() );
+                        bWriteError = TRUE;
+                    }
+                }
+                bLayersReady = TRUE;
+            }
+
+            if( poBatch->poSRS != NULL && poOutputSRS != NULL
+                && poBatch->poSRS != poOutputSRS 
+                && !poBatch->poSRS->IsSame( poOutputSRS ) )
+            {
+                osFileError = "Projection differs from the output. "
+                              "Use -oo TARGET_SRS=... to reproject.";
+            }
+        }
+        if( osFileError.empty() )
+            osFileError = poBatch->osError;
+
+        // the features of the last batch of a file that failed are 
+        // dropped with the rest
+        if( osFileError.empty() && !bWriteError )
+        {
+            if( WriteBatch( asOutputs, poBatch, pszFilename, aanFIDs ) )
+                nFileFeatures += poBatch->apoFeatures.size();
+            else
+                bWriteError = TRUE;
+        }
+
+        if( poBatch->bLast )
+        {
+            if( !osFileError.empty() )
+            {
+                fprintf( stderr, "ERROR: %s: %s\n", pszFilename, osFileError.c_str() );
+                nFailed++;
+                if( nFileFeatures > 0 && !bWriteError 
+                    && !UndoFile( asOutputs, pszFilename, aanFIDs ) )
+                    bWriteError = TRUE;
+            }
+            else if( !bWriteError )
+            {
+                nFeatures += nFileFeatures;
+                nSinceCommit += nFileFeatures;
+                aosPending.push_back( pszFilename );
+                if( nSinceCommit >= nGroupTransactions )
+                {
+                    bWriteError = !CommitOutputs( asOutputs, fpJournal, aosPending, FALSE );
+                    nSinceCommit = 0;
+                }
+            }
+
+            // on to whichever worker has a file ready
+            iWorker = -1;
+            nDone++;
+        }
+        DeleteBatch( poBatch );
+
+        std::chrono::steady_clock::time_point oNow = std::chrono::steady_clock::now();
+        if( bProgress && oNow - oLastReport >= std::chrono::seconds( 1 ) )
+        {
+            double dfSeconds = std::chrono::duration<double>( oNow - oStart ).count();
+            printf( "%d/%d files, " CPL_FRMT_GIB " features, %.1f files/s\n", 
+                    nDone, nFiles, nFeatures, nDone / dfSeconds );
+            fflush( stdout );
+            oLastReport = oNow;
+        }
+    }
+
+    for( size_t i = 0; i < aoWorkers.size(); i++ )
+        aoWorkers[i].join();
+
+    if( !bWriteError )
+        bWriteError = !CommitOutputs( asOutputs, fpJournal, aosPending, TRUE );
+
+    double dfSeconds = std::chrono::duration<double>( 
+                std::chrono::steady_clock::now() - oStart ).count();
+    printf( "%d files (%d failed), " CPL_FRMT_GIB " features in %.1fs: "
+            "%.1f files/s, %.0f features/s\n", 
+            nFiles, nFailed, nFeatures, dfSeconds, 
+            dfSeconds > 0 ? nFiles / dfSeconds : 0.0, 
+            dfSeconds > 0 ? nFeatures / dfSeconds : 0.0 );
+
+    if( fpJournal != NULL )
+        VSIFCloseL( fpJournal );
+    for( size_t i = 0; i < asOutputs.size(); i++ )
+        GDALClose( asOutputs[i].poDS );
+    if( poOutputSRS != NULL )
+        poOutputSRS->Release();
+    CSLDestroy( papszOpenOptions );
+    CSLDestroy( papszDSCO );
+    CSLDestroy( papszLCO );
+    CSLDestroy( papszArgv );
+    GDALDestroyDriverManager();
+
+    if( bWriteError )
+        return 2;
+    return nFailed > 0 ? 1 : 0;
+}
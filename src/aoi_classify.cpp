@@ -0,0 +1,119 @@
+/* ******************************************************************************
+ * Copyright (c) 2015, Sam Gillingham <gillingham.sam@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+// Find which AOIs contain each of a list of points.
+// Reads "x,y" or "x y" lines and writes "n,FID FID ..." for the nth point.
+// Usage: see Usage() below.
+
+#include <gdal_priv.h>
+#include <cpl_string.h>
+#include "aoidatasource.h"
+#include "aoiclassify.h"
+#include "aoithreads.h"
+
+static void Usage( const char *pszError = NULL )
+{
+    printf( "Usage: aoi_classify [-threads n|ALL_CPUS] [-oo NAME=VALUE]*\n"
+            "                    src.aoi points.txt|-\n" );
+    if( pszError != NULL )
+        fprintf( stderr, "\nFAILURE: %s\n", pszError );
+    exit( 1 );
+}
+
+int main( int nArgc, char **papszArgv )
+{
+    GDALAllRegister();
+    nArgc = GDALGeneralCmdLineProcessor( nArgc, &papszArgv, 0 );
+    if( nArgc < 1 )
+        exit( -nArgc );
+
+    int nThreads = 1;
+    char **papszOpenOptions = NULL;
+    const char *pszSrc = NULL, *pszPoints = NULL;
+
+    for( int i = 1; i < nArgc; i++ )
+    {
+        if( EQUAL(papszArgv[i], "-threads") && i + 1 < nArgc )
+            nThreads = AOIGetThreadCount( papszArgv[++i] );
+        else if( EQUAL(papszArgv[i], "-oo") && i + 1 < nArgc )
+            papszOpenOptions = CSLAddString( papszOpenOptions, papszArgv[++i] );
+        else if( papszArgv[i][0] == '-' && papszArgv[i][1] != '\0' )
+            Usage( CPLSPrintf( "Unknown option name '%s'", papszArgv[i] ) );
+        else if( pszSrc == NULL )
+            pszSrc = papszArgv[i];
+        else if( pszPoints == NULL )
+            pszPoints = papszArgv[i];
+        else
+            Usage( "Too many command options" );
+    }
+    if( pszSrc == NULL || pszPoints == NULL )
+        Usage( "Missing AOI or points" );
+
+    OGRAOIDataSource *poSrcDS = AOIOpenDataSource( pszSrc, papszOpenOptions );
+    if( poSrcDS == NULL )
+    {
+        fprintf( stderr, "Unable to open %s\n", pszSrc );
+        exit( 1 );
+    }
+
+    FILE *fpPoints = EQUAL(pszPoints, "-") ? stdin : fopen( pszPoints, "rt" );
+    if( fpPoints == NULL )
+    {
+        fprintf( stderr, "Unable to open %s\n", pszPoints );
+        exit( 1 );
+    }
+    std::vector<double> adfX, adfY;
+    char szLine[1024];
+    while( fgets( szLine, sizeof(szLine), fpPoints ) != NULL )
+    {
+        double dfX, dfY;
+        if( sscanf( szLine, "%lf%*[ ,\t]%lf", &dfX, &dfY ) != 2 )
+            continue;
+        adfX.push_back( dfX );
+        adfY.push_back( dfY );
+    }
+    if( fpPoints != stdin )
+        fclose( fpPoints );
+
+    AOIPointClassifier oClassifier;
+    oClassifier.Build( (OGRAOILayer*)poSrcDS->GetLayer( 0 ) );
+
+    std::vector<size_t> anOffsets;
+    std::vector<GIntBig> anFIDs;
+    oClassifier.Classify( adfX.size(), adfX.empty() ? NULL : &adfX[0], 
+                          adfY.empty() ? NULL : &adfY[0], nThreads, anOffsets, anFIDs );
+
+    for( size_t i = 0; i < adfX.size(); i++ )
+    {
+        printf( "%d,", (int)i );
+        for( size_t j = anOffsets[i]; j < anOffsets[i+1]; j++ )
+            printf( j == anOffsets[i] ? CPL_FRMT_GIB : " " CPL_FRMT_GIB, anFIDs[j] );
+        printf( "\n" );
+    }
+
+    delete poSrcDS;
+    CSLDestroy( papszOpenOptions );
+    CSLDestroy( papszArgv );
+    GDALDestroyDriverManager();
+    return 0;
+}
@@ -0,0 +1,222 @@
+/* ******************************************************************************
+ * Copyright (c) 2015, Sam Gillingham <gillingham.sam@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+// Burn the shapes in an AOI file into a raster without going through
+// OGR geometries. 
+// Usage: see Usage() below.
+
+#include <gdal_priv.h>
+#include <cpl_string.h>
+#include "aoidatasource.h"
+#include "aoiraster.h"
+#include "aoithreads.h"
+
+static void Usage( const char *pszError = NULL )
+{
+    printf( "Usage: aoi_rasterize [-burn value] [-init value] [-threads n|ALL_CPUS]\n"
+            "                     [-of format] [-ot type] [-co NAME=VALUE]*\n"
+            "                     [-oo NAME=VALUE]* [-tr xres yres | -ts xsize ysize]\n"
+            "                     src.aoi dst_raster\n"
+            "\n"
+            "If dst_raster exists the shapes are burnt into its first band.\n"
+            "Otherwise it is created covering the AOI using -tr or -ts.\n" );
+    if( pszError != NULL )
+        fprintf( stderr, "\nFAILURE: %s\n", pszError );
+    exit( 1 );
+}
+
+#define CHECK_ARGS(n) if( i + (n) >= nArgc ) \
+    Usage( CPLSPrintf( "%s option requires %d argument(s)", papszArgv[i], n ) )
+
+int main( int nArgc, char **papszArgv )
+{
+    GDALAllRegister();
+    nArgc = GDALGeneralCmdLineProcessor( nArgc, &papszArgv, 0 );
+    if( nArgc < 1 )
+        exit( -nArgc );
+
+    double dfBurnValue = 1, dfInitValue = 0;
+    int bInit = FALSE;
+    int nThreads = 1;
+    const char *pszFormat = "GTiff";
+    GDALDataType eType = GDT_Byte;
+    char **papszCreateOptions = NULL, **papszOpenOptions = NULL;
+    double dfXRes = 0, dfYRes = 0;
+    int nXSize = 0, nYSize = 0;
+    const char *pszSrc = NULL, *pszDst = NULL;
+
+    for( int i = 1; i < nArgc; i++ )
+    {
+        if( EQUAL(papszArgv[i], "-burn") )
+        {
+            CHECK_ARGS(1);
+            dfBurnValue = CPLAtof( papszArgv[++i] );
+        }
+        else if( EQUAL(papszArgv[i], "-init") )
+        {
+            CHECK_ARGS(1);
+            dfInitValue = CPLAtof( papszArgv[++i] );
+            bInit = TRUE;
+        }
+        else if( EQUAL(papszArgv[i], "-threads") )
+        {
+            CHECK_ARGS(1);
+            nThreads = AOIGetThreadCount( papszArgv[++i] );
+        }
+        else if( EQUAL(papszArgv[i], "-of") )
+        {
+            CHECK_ARGS(1);
+            pszFormat = papszArgv[++i];
+        }
+        else if( EQUAL(papszArgv[i], "-ot") )
+        {
+            CHECK_ARGS(1);
+            eType = GDALGetDataTypeByName( papszArgv[++i] );
+            if( eType == GDT_Unknown )
+                Usage( CPLSPrintf( "Unknown output pixel type: %s", papszArgv[i] ) );
+        }
+        else if( EQUAL(papszArgv[i], "-co") )
+        {
+            CHECK_ARGS(1);
+            papszCreateOptions = CSLAddString( papszCreateOptions, papszArgv[++i] );
+        }
+        else if( EQUAL(papszArgv[i], "-oo") )
+        {
+            CHECK_ARGS(1);
+            papszOpenOptions = CSLAddString( papszOpenOptions, papszArgv[++i] );
+        }
+        else if( EQUAL(papszArgv[i], "-tr") )
+        {
+            CHECK_ARGS(2);
+            dfXRes = CPLAtof( papszArgv[++i] );
+            dfYRes = fabs( CPLAtof( papszArgv[++i] ) );
+            if( dfXRes <= 0 || dfYRes == 0 )
+                Usage( "Wrong value for -tr" );
+        }
+        else if( EQUAL(papszArgv[i], "-ts") )
+        {
+            CHECK_ARGS(2);
+            nXSize = atoi( papszArgv[++i] );
+            nYSize = atoi( papszArgv[++i] );
+            if( nXSize <= 0 || nYSize <= 0 )
+                Usage( "Wrong value for -ts" );
+        }
+        else if( papszArgv[i][0] == '-' )
+            Usage( CPLSPrintf( "Unknown option name '%s'", papszArgv[i] ) );
+        else if( pszSrc == NULL )
+            pszSrc = papszArgv[i];
+        else if( pszDst == NULL )
+            pszDst = papszArgv[i];
+        else
+            Usage( "Too many command options" );
+    }
+
+    if( pszSrc == NULL || pszDst == NULL )
+        Usage( "Missing source or destination" );
+
+    OGRAOIDataSource *poSrcDS = AOIOpenDataSource( pszSrc, papszOpenOptions );
+    if( poSrcDS == NULL )
+    {
+        fprintf( stderr, "Unable to open %s\n", pszSrc );
+        exit( 1 );
+    }
+    OGRAOILayer *poLayer = (OGRAOILayer*)poSrcDS->GetLayer( 0 );
+
+    // burn into an existing raster or create one over the AOI
+    VSIStatBufL sStat;
+    GDALDataset *poDstDS;
+    double adfGeoTransform[6];
+    if( VSIStatL( pszDst, &sStat ) == 0 )
+    {
+        poDstDS = (GDALDataset*)GDALOpenEx( pszDst, GDAL_OF_RASTER | GDAL_OF_UPDATE,
+                                            NULL, NULL, NULL );
+        if( poDstDS == NULL )
+            exit( 1 );
+        if( poDstDS->GetGeoTransform( adfGeoTransform ) != CE_None )
+        {
+            fprintf( stderr, "%s has no geotransform\n", pszDst );
+            exit( 1 );
+        }
+    }
+    else
+    {
+        if( dfXRes == 0 && nXSize == 0 )
+            Usage( "-tr or -ts is needed to create a new raster" );
+
+        OGREnvelope sExtent;
+        if( poLayer->GetExtent( &sExtent, TRUE ) != OGRERR_NONE )
+        {
+            fprintf( stderr, "Can't get the extent of %s\n", pszSrc );
+            exit( 1 );
+        }
+        if( dfXRes == 0 )
+        {
+            dfXRes = (sExtent.MaxX - sExtent.MinX) / nXSize;
+            dfYRes = (sExtent.MaxY - sExtent.MinY) / nYSize;
+        }
+        else
+        {
+            nXSize = MAX( 1, (int)ceil( (sExtent.MaxX - sExtent.MinX) / dfXRes ) );
+            nYSize = MAX( 1, (int)ceil( (sExtent.MaxY - sExtent.MinY) / dfYRes ) );
+        }
+
+        GDALDriver *poDriver = GetGDALDriverManager()->GetDriverByName( pszFormat );
+        if( poDriver == NULL )
+            Usage( CPLSPrintf( "Output driver `%s' not recognised.", pszFormat ) );
+        poDstDS = poDriver->Create( pszDst, nXSize, nYSize, 1, eType, papszCreateOptions );
+        if( poDstDS == NULL )
+            exit( 1 );
+
+        adfGeoTransform[0] = sExtent.MinX;
+        adfGeoTransform[1] = dfXRes;
+        adfGeoTransform[2] = 0;
+        adfGeoTransform[3] = sExtent.MaxY;
+        adfGeoTransform[4] = 0;
+        adfGeoTransform[5] = -dfYRes;
+        poDstDS->SetGeoTransform( adfGeoTransform );
+
+        OGRSpatialReference *poSRS = poLayer->GetSpatialRef();
+        if( poSRS != NULL )
+        {
+            char *pszWKT = NULL;
+            poSRS->exportToWkt( &pszWKT );
+            poDstDS->SetProjection( pszWKT );
+            CPLFree( pszWKT );
+        }
+    }
+
+    GDALRasterBand *poBand = poDstDS->GetRasterBand( 1 );
+    if( bInit )
+        poBand->Fill( dfInitValue );
+
+    CPLErr eErr = AOIRasterize( poLayer, poBand, adfGeoTransform, dfBurnValue, nThreads );
+
+    GDALClose( poDstDS );
+    delete poSrcDS;
+    CSLDestroy( papszCreateOptions );
+    CSLDestroy( papszOpenOptions );
+    CSLDestroy( papszArgv );
+    GDALDestroyDriverManager();
+
+    return eErr == CE_None ? 0 : 1;
+}
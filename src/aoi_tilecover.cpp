@@ -0,0 +1,192 @@
+/* ******************************************************************************
+ * Copyright (c) 2015, Sam Gillingham <gillingham.sam@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+// Work out which tiles of a raster grid each AOI covers.
+// Writes "TileX,TileY,FID" lines sorted by tile and then FID.
+// Usage: see Usage() below.
+
+#include <gdal_priv.h>
+#include <cpl_string.h>
+#include "aoidatasource.h"
+#include "aoicoverage.h"
+#include "aoithreads.h"
+
+static void Usage( const char *pszError = NULL )
+{
+    printf( "Usage: aoi_tilecover [-threads n|ALL_CPUS] [-oo NAME=VALUE]*\n"
+            "                     [-tilesize xsize ysize]\n"
+            "                     -like raster | -gt x0 xres xrot y0 yrot yres -ts xsize ysize\n"
+            "                     src.aoi [out.csv]\n"
+            "\n"
+            "The grid is taken from -like or given with -gt and -ts. Tiles are\n"
+            "-tilesize pixels, by default the block size of -like or 256 by 256.\n"
+            "Tiles are numbered from 0 at the top left.\n" );
+    if( pszError != NULL )
+        fprintf( stderr, "\nFAILURE: %s\n", pszError );
+    exit( 1 );
+}
+
+#define CHECK_ARGS(n) if( i + (n) >= nArgc ) \
+    Usage( CPLSPrintf( "%s option requires %d argument(s)", papszArgv[i], n ) )
+
+int main( int nArgc, char **papszArgv )
+{
+    GDALAllRegister();
+    nArgc = GDALGeneralCmdLineProcessor( nArgc, &papszArgv, 0 );
+    if( nArgc < 1 )
+        exit( -nArgc );
+
+    int nThreads = 1;
+    char **papszOpenOptions = NULL;
+    const char *pszLike = NULL;
+    double adfGeoTransform[6];
+    int bHaveGeoTransform = FALSE;
+    int nXSize = 0, nYSize = 0;
+    int nTileXSize = 0, nTileYSize = 0;
+    const char *pszSrc = NULL, *pszOut = NULL;
+
+    for( int i = 1; i < nArgc; i++ )
+    {
+        if( EQUAL(papszArgv[i], "-threads") )
+        {
+            CHECK_ARGS(1);
+            nThreads = AOIGetThreadCount( papszArgv[++i] );
+        }
+        else if( EQUAL(papszArgv[i], "-oo") )
+        {
+            CHECK_ARGS(1);
+            papszOpenOptions = CSLAddString( papszOpenOptions, papszArgv[++i] );
+        }
+        else if( EQUAL(papszArgv[i], "-tilesize") )
+        {
+            CHECK_ARGS(2);
+            nTileXSize = atoi( papszArgv[++i] );
+            nTileYSize = atoi( papszArgv[++i] );
+            if( nTileXSize <= 0 || nTileYSize <= 0 )
+                Usage( "Wrong value for -tilesize" );
+        }
+        else if( EQUAL(papszArgv[i], "-like") )
+        {
+            CHECK_ARGS(1);
+            pszLike = papszArgv[++i];
+        }
+        else if( EQUAL(papszArgv[i], "-gt") )
+        {
+            CHECK_ARGS(6);
+            for( int j = 0; j < 6; j++ )
+                adfGeoTransform[j] = CPLAtof( papszArgv[++i] );
+            bHaveGeoTransform = TRUE;
+        }
+        else if( EQUAL(papszArgv[i], "-ts") )
+        {
+            CHECK_ARGS(2);
+            nXSize = atoi( papszArgv[++i] );
+            nYSize = atoi( papszArgv[++i] );
+            if( nXSize <= 0 || nYSize <= 0 )
+                Usage( "Wrong value for -ts" );
+        }
+        else if( papszArgv[i][0] == '-' )
+            Usage( CPLSPrintf( "Unknown option name '%s'", papszArgv[i] ) );
+        else if( pszSrc == NULL )
+            pszSrc = papszArgv[i];
+        else if( pszOut == NULL )
+            pszOut = papszArgv[i];
+        else
+            Usage( "Too many command options" );
+    }
+
+    if( pszSrc == NULL )
+        Usage( "Missing AOI" );
+
+    // the grid
+    if( pszLike != NULL )
+    {
+        GDALDataset *poLikeDS = (GDALDataset*)GDALOpenEx( pszLike, 
+                            GDAL_OF_RASTER | GDAL_OF_VERBOSE_ERROR, NULL, NULL, NULL );
+        if( poLikeDS == NULL )
+            exit( 1 );
+        if( poLikeDS->GetGeoTransform( adfGeoTransform ) != CE_None )
+        {
+            fprintf( stderr, "%s has no geotransform\n", pszLike );
+            exit( 1 );
+        }
+        nXSize = poLikeDS->GetRasterXSize();
+        nYSize = poLikeDS->GetRasterYSize();
+        if( nTileXSize == 0 && poLikeDS->GetRasterCount() > 0 )
+            poLikeDS->GetRasterBand( 1 )->GetBlockSize( &nTileXSize, &nTileYSize );
+        GDALClose( poLikeDS );
+    }
+    else if( !bHaveGeoTransform || nXSize == 0 )
+    {
+        Usage( "-like or -gt and -ts are needed" );
+    }
+    if( nTileXSize == 0 )
+    {
+        nTileXSize = 256;
+        nTileYSize = 256;
+    }
+
+    OGRAOIDataSource *poSrcDS = AOIOpenDataSource( pszSrc, papszOpenOptions );
+    if( poSrcDS == NULL )
+    {
+        fprintf( stderr, "Unable to open %s\n", pszSrc );
+        exit( 1 );
+    }
+    OGRAOILayer *poLayer = (OGRAOILayer*)poSrcDS->GetLayer( 0 );
+
+    std::vector<AOITileFID> asCoverage;
+    CPLErr eErr = AOIComputeTileCoverage( poLayer, adfGeoTransform, nXSize, nYSize,
+                                          nTileXSize, nTileYSize, nThreads, asCoverage );
+
+    FILE *fpOut = stdout;
+    if( eErr == CE_None && pszOut != NULL )
+    {
+        fpOut = fopen( pszOut, "wt" );
+        if( fpOut == NULL )
+        {
+            fprintf( stderr, "Can't create %s\n", pszOut );
+            eErr = CE_Failure;
+        }
+    }
+
+    if( eErr == CE_None )
+    {
+        int nTilesPerRow = (nXSize + nTileXSize - 1) / nTileXSize;
+        fprintf( fpOut, "TileX,TileY,FID\n" );
+        for( size_t i = 0; i < asCoverage.size(); i++ )
+        {
+            fprintf( fpOut, "%d,%d," CPL_FRMT_GIB "\n", 
+                     (int)(asCoverage[i].nTile % nTilesPerRow),
+                     (int)(asCoverage[i].nTile / nTilesPerRow), asCoverage[i].nFID );
+        }
+        if( fpOut != stdout )
+            fclose( fpOut );
+    }
+
+    delete poSrcDS;
+    CSLDestroy( papszOpenOptions );
+    CSLDestroy( papszArgv );
+    GDALDestroyDriverManager();
+
+    return eErr == CE_None ? 0 : 1;
+}
@@ -0,0 +1,175 @@
+/* ******************************************************************************
+ * Copyright (c) 2015, Sam Gillingham <gillingham.sam@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+// Compute statistics of a raster under each AOI in an AOI file and
+// write them out as a CSV table with a row per object and band.
+// Usage: see Usage() below.
+
+#include <gdal_priv.h>
+#include <cpl_string.h>
+#include "aoidatasource.h"
+#include "aoizonal.h"
+#include "aoithreads.h"
+
+static void Usage( const char *pszError = NULL )
+{
+    printf( "Usage: aoi_zonalstats [-b band]* [-threads n|ALL_CPUS]\n"
+            "                      [-hist bins min max] [-oo NAME=VALUE]*\n"
+            "                      [-o out.csv] src.aoi raster\n"
+            "\n"
+            "Writes FID,Name,Band,Count,Sum,Mean,Min,Max and any histogram\n"
+            "counts for each object and band to out.csv or stdout.\n" );
+    if( pszError != NULL )
+        fprintf( stderr, "\nFAILURE: %s\n", pszError );
+    exit( 1 );
+}
+
+#define CHECK_ARGS(n) if( i + (n) >= nArgc ) \
+    Usage( CPLSPrintf( "%s option requires %d argument(s)", papszArgv[i], n ) )
+
+int main( int nArgc, char **papszArgv )
+{
+    GDALAllRegister();
+    nArgc = GDALGeneralCmdLineProcessor( nArgc, &papszArgv, 0 );
+    if( nArgc < 1 )
+        exit( -nArgc );
+
+    AOIZonalOptions sOptions;
+    char **papszOpenOptions = NULL;
+    const char *pszSrc = NULL, *pszRaster = NULL, *pszOut = NULL;
+
+    for( int i = 1; i < nArgc; i++ )
+    {
+        if( EQUAL(papszArgv[i], "-b") )
+        {
+            CHECK_ARGS(1);
+            sOptions.anBands.push_back( atoi( papszArgv[++i] ) );
+        }
+        else if( EQUAL(papszArgv[i], "-threads") )
+        {
+            CHECK_ARGS(1);
+            sOptions.nThreads = AOIGetThreadCount( papszArgv[++i] );
+        }
+        else if( EQUAL(papszArgv[i], "-hist") )
+        {
+            CHECK_ARGS(3);
+            sOptions.nHistogramBins = atoi( papszArgv[++i] );
+            sOptions.dfHistogramMin = CPLAtof( papszArgv[++i] );
+            sOptions.dfHistogramMax = CPLAtof( papszArgv[++i] );
+            if( sOptions.nHistogramBins <= 0 )
+                Usage( "Wrong number of bins for -hist" );
+        }
+        else if( EQUAL(papszArgv[i], "-oo") )
+        {
+            CHECK_ARGS(1);
+            papszOpenOptions = CSLAddString( papszOpenOptions, papszArgv[++i] );
+        }
+        else if( EQUAL(papszArgv[i], "-o") )
+        {
+            CHECK_ARGS(1);
+            pszOut = papszArgv[++i];
+        }
+        else if( papszArgv[i][0] == '-' )
+            Usage( CPLSPrintf( "Unknown option name '%s'", papszArgv[i] ) );
+        else if( pszSrc == NULL )
+            pszSrc = papszArgv[i];
+        else if( pszRaster == NULL )
+            pszRaster = papszArgv[i];
+        else
+            Usage( "Too many command options" );
+    }
+
+    if( pszSrc == NULL || pszRaster == NULL )
+        Usage( "Missing AOI or raster" );
+
+    OGRAOIDataSource *poSrcDS = AOIOpenDataSource( pszSrc, papszOpenOptions );
+    if( poSrcDS == NULL )
+    {
+        fprintf( stderr, "Unable to open %s\n", pszSrc );
+        exit( 1 );
+    }
+    OGRAOILayer *poLayer = (OGRAOILayer*)poSrcDS->GetLayer( 0 );
+
+    GDALDataset *poRasterDS = (GDALDataset*)GDALOpenEx( pszRaster, 
+                            GDAL_OF_RASTER | GDAL_OF_VERBOSE_ERROR, NULL, NULL, NULL );
+    if( poRasterDS == NULL )
+        exit( 1 );
+
+    std::vector<AOIZonalResult> aoResults;
+    CPLErr eErr = AOIComputeZonalStats( poLayer, poRasterDS, sOptions, aoResults );
+
+    FILE *fpOut = stdout;
+    if( eErr == CE_None && pszOut != NULL )
+    {
+        fpOut = fopen( pszOut, "wt" );
+        if( fpOut == NULL )
+        {
+            fprintf( stderr, "Can't create %s\n", pszOut );
+            eErr = CE_Failure;
+        }
+    }
+
+    if( eErr == CE_None )
+    {
+        fprintf( fpOut, "FID,Name,Band,Count,Sum,Mean,Min,Max" );
+        for( int i = 0; i < sOptions.nHistogramBins; i++ )
+            fprintf( fpOut, ",Hist%d", i );
+        fprintf( fpOut, "\n" );
+
+        for( size_t iResult = 0; iResult < aoResults.size(); iResult++ )
+        {
+            const AOIZonalResult &sResult = aoResults[iResult];
+            char *pszName = CPLEscapeString( sResult.osName.c_str(), -1, CPLES_CSV );
+            for( size_t iBand = 0; iBand < sResult.asBands.size(); iBand++ )
+            {
+                const AOIZonalStats &sStats = sResult.asBands[iBand];
+                int nBand = sOptions.anBands.empty() ? (int)iBand + 1 
+                                                     : sOptions.anBands[iBand];
+                fprintf( fpOut, CPL_FRMT_GIB ",%s,%d," CPL_FRMT_GIB ",%.17g", 
+                         sResult.nFID, pszName, nBand, sStats.nCount, sStats.dfSum );
+                if( sStats.nCount > 0 )
+                    fprintf( fpOut, ",%.17g,%.17g,%.17g", 
+                             sStats.GetMean(), sStats.dfMin, sStats.dfMax );
+                else
+                    fprintf( fpOut, ",,," );
+                for( int i = 0; i < sOptions.nHistogramBins; i++ )
+                {
+                    fprintf( fpOut, "," CPL_FRMT_GIB, 
+                             i < (int)sStats.anHistogram.size() ? sStats.anHistogram[i] : 0 );
+                }
+                fprintf( fpOut, "\n" );
+            }
+            CPLFree( pszName );
+        }
+        if( fpOut != stdout )
+            fclose( fpOut );
+    }
+
+    GDALClose( poRasterDS );
+    delete poSrcDS;
+    CSLDestroy( papszOpenOptions );
+    CSLDestroy( papszArgv );
+    GDALDestroyDriverManager();
+
+    return eErr == CE_None ? 0 : 1;
+}
@@ -0,0 +1,331 @@
+/* ******************************************************************************
+ * Copyright (c) 2015, Sam Gillingham <gillingham.sam@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "aoiclassify.h"
+#include "aoithreads.h"
+
+// Polygons get a band for about this many edges
+#define AOI_EDGES_PER_BAND 8
+#define AOI_MAX_BANDS 4096
+// Largest grid in each direction
+#define AOI_MAX_GRID_SIZE 1024
+// Points are classified in chunks of this many
+#define AOI_CLASSIFY_CHUNK 4096
+
+AOIPointClassifier::AOIPointClassifier()
+{
+    m_nGridXSize = 0;
+    m_nGridYSize = 0;
+    m_dfCellWidth = 0;
+    m_dfCellHeight = 0;
+}
+
+// Copy the closed outline of a polygon and bucket its edges into bands
+void AOIPointClassifier::AddPolygon( Shape &sShape, const double *padfX, 
+                                     const double *padfY, int nPoints )
+{
+    sShape.nFirstPoint = (int)m_adfX.size();
+    sShape.nPoints = nPoints;
+    m_adfX.insert( m_adfX.end(), padfX, padfX + nPoints );
+    m_adfY.insert( m_adfY.end(), padfY, padfY + nPoints );
+
+    int nEdges = nPoints - 1;
+    sShape.nBands = MIN( MAX( 1, nEdges / AOI_EDGES_PER_BAND ), AOI_MAX_BANDS );
+    double dfHeight = sShape.sEnvelope.MaxY - sShape.sEnvelope.MinY;
+    if( dfHeight <= 0 )
+        sShape.nBands = 1;
+    sShape.dfBandHeight = sShape.nBands > 1 ? dfHeight / sShape.nBands : 0;
+    sShape.nFirstBand = (int)m_anBandStart.size();
+
+    // count the edges in each band then fill them in
+    std::vector<int> anCounts( sShape.nBands, 0 );
+    for( int iPass = 0; iPass < 2; iPass++ )
+    {
+        if( iPass == 1 )
+        {
+            int nOffset = (int)m_anBandEdges.size();
+            for( int iBand = 0; iBand < sShape.nBands; iBand++ )
+            {
+                m_anBandStart.push_back( nOffset );
+                nOffset += anCounts[iBand];
+                anCounts[iBand] = m_anBandStart.back();
+            }
+            m_anBandStart.push_back( nOffset );
+            m_anBandEdges.resize( nOffset );
+        }
+
+        for( int i = 0; i < nEdges; i++ )
+        {
+            int iFirst = 0, iLast = 0;
+            if( sShape.nBands > 1 )
+            {
+                double dfMinY = MIN( padfY[i], padfY[i+1] ) - sShape.sEnvelope.MinY;
+                double dfMaxY = MAX( padfY[i], padfY[i+1] ) - sShape.sEnvelope.MinY;
+                iFirst = MIN( (int)(dfMinY / sShape.dfBandHeight), sShape.nBands - 1 );
+                iLast = MIN( (int)(dfMaxY / sShape.dfBandHeight), sShape.nBands - 1 );
+            }
+            for( int iBand = iFirst; iBand <= iLast; iBand++ )
+            {
+                if( iPass == 0 )
+                    anCounts[iBand]++;
+                else
+                    m_anBandEdges[anCounts[iBand]++] = sShape.nFirstPoint + i;
+            }
+        }
+    }
+}
+
+// Put the shapes into a grid over their extent with about one cell
+// per shape
+void AOIPointClassifier::BuildGrid()
+{
+    m_sExtent = OGREnvelope();
+    for( size_t i = 0; i < m_aoShapes.size(); i++ )
+        m_sExtent.Merge( m_aoShapes[i].sEnvelope );
+
+    int nSize = (int)ceil( sqrt( (double)m_aoShapes.size() ) );
+    m_nGridXSize = MIN( MAX( nSize, 1 ), AOI_MAX_GRID_SIZE );
+    m_nGridYSize = m_nGridXSize;
+    m_dfCellWidth = (m_sExtent.MaxX - m_sExtent.MinX) / m_nGridXSize;
+    m_dfCellHeight = (m_sExtent.MaxY - m_sExtent.MinY) / m_nGridYSize;
+    if( !(m_dfCellWidth > 0) || !(m_dfCellHeight > 0) )
+    {
+        m_nGridXSize = 1;
+        m_nGridYSize = 1;
+        m_dfCellWidth = 1;
+        m_dfCellHeight = 1;
+    }
+
+    // same count then fill as the bands
+    int nCells = m_nGridXSize * m_nGridYSize;
+    std::vector<int> anCounts( nCells, 0 );
+    m_anCellStart.clear();
+    m_anCellShapes.clear();
+    for( int iPass = 0; iPass < 2; iPass++ )
+    {
+        if( iPass == 1 )
+        {
+            int nOffset = 0;
+            for( int iCell = 0; iCell < nCells; iCell++ )
+            {
+                m_anCellStart.push_back( nOffset );
+                nOffset += anCounts[iCell];
+                anCounts[iCell] = m_anCellStart.back();
+            }
+            m_anCellStart.push_back( nOffset );
+            m_anCellShapes.resize( nOffset );
+        }
+
+        for( size_t iShape = 0; iShape < m_aoShapes.size(); iShape++ )
+        {
+            const OGREnvelope &sEnv = m_aoShapes[iShape].sEnvelope;
+            int nX1 = MIN( (int)((sEnv.MinX - m_sExtent.MinX) / m_dfCellWidth), m_nGridXSize - 1 );
+            int nX2 = MIN( (int)((sEnv.MaxX - m_sExtent.MinX) / m_dfCellWidth), m_nGridXSize - 1 );
+            int nY1 = MIN( (int)((sEnv.MinY - m_sExtent.MinY) / m_dfCellHeight), m_nGridYSize - 1 );
+            int nY2 = MIN( (int)((sEnv.MaxY - m_sExtent.MinY) / m_dfCellHeight), m_nGridYSize - 1 );
+            for( int iY = nY1; iY <= nY2; iY++ )
+            {
+                for( int iX = nX1; iX <= nX2; iX++ )
+                {
+                    int iCell = iY * m_nGridXSize + iX;
+                    if( iPass == 0 )
+                        anCounts[iCell]++;
+                    else
+                        m_anCellShapes[anCounts[iCell]++] = (int)iShape;
+                }
+            }
+        }
+    }
+}
+
+int AOIPointClassifier::Build( OGRAOILayer *poLayer )
+{
+    m_aoShapes.clear();
+    m_anFIDs.clear();
+    m_adfX.clear();
+    m_adfY.clear();
+    m_anBandStart.clear();
+    m_anBandEdges.clear();
+
+    AOIScratch oScratch;
+    GIntBig nFID;
+    const AOIObject *poObject;
+    poLayer->ResetReading();
+    while( (poObject = poLayer->GetNextDecodedObject( &nFID )) != NULL )
+    {
+        int iObject = (int)m_anFIDs.size();
+        m_anFIDs.push_back( nFID );
+
+        for( int iElement = 0; iElement < poObject->nElements; iElement++ )
+        {
+            const AOIElement &sElement = poObject->aoElements[iElement];
+            if( sElement.eKind == AOI_SHAPE_LINE || sElement.eKind == AOI_SHAPE_POINT )
+                continue;
+
+            Shape sShape;
+            sShape.iObject = iObject;
+            sShape.eKind = sElement.eKind;
+            sShape.bAnalytic = FALSE;
+            sShape.nFirstPoint = 0;
+            sShape.nPoints = 0;
+            sShape.nFirstBand = 0;
+            sShape.nBands = 0;
+            sShape.dfBandHeight = 0;
+
+            double adfAffine[6];
+            if( AOIElementIsAnalytic( sElement, poLayer->GetGeometryOptions() ) 
+                && AOIElementGetAffine( sElement, adfAffine )
+                && sElement.dfSize1 > 0 && sElement.dfSize2 > 0
+                && GDALInvGeoTransform( adfAffine, sShape.adfToLocal ) )
+            {
+                sShape.bAnalytic = TRUE;
+                sShape.dfCenterX = sElement.dfCenterX;
+                sShape.dfCenterY = sElement.dfCenterY;
+                sShape.dfSize1 = sElement.dfSize1;
+                sShape.dfSize2 = sElement.dfSize2;
+                AOIElementGetAffineEnvelope( sElement, adfAffine, &sShape.sEnvelope );
+                m_aoShapes.push_back( sShape );
+                continue;
+            }
+
+            int nPoints = AOIElementGetOutline( sElement, poLayer->GetGeometryOptions(), 
+                                                oScratch );
+            if( nPoints < 4 )
+                continue;
+            for( int i = 0; i < nPoints; i++ )
+                sShape.sEnvelope.Merge( oScratch.adfX[i], oScratch.adfY[i] );
+            AddPolygon( sShape, &oScratch.adfX[0], &oScratch.adfY[0], nPoints );
+            m_aoShapes.push_back( sShape );
+        }
+    }
+
+    BuildGrid();
+    return (int)m_anFIDs.size();
+}
+
+// Even-odd crossing test using just the edges in the point's band
+int AOIPointClassifier::PolygonContains( const Shape &sShape, 
+                                         double dfX, double dfY ) const
+{
+    int iBand = 0;
+    if( sShape.nBands > 1 )
+        iBand = MIN( (int)((dfY - sShape.sEnvelope.MinY) / sShape.dfBandHeight), 
+                     sShape.nBands - 1 );
+
+    const int *panBand = &m_anBandStart[sShape.nFirstBand];
+    int bInside = FALSE;
+    for( int i = panBand[iBand]; i < panBand[iBand + 1]; i++ )
+    {
+        int iPoint = m_anBandEdges[i];
+        double dfX1 = m_adfX[iPoint], dfY1 = m_adfY[iPoint];
+        double dfX2 = m_adfX[iPoint + 1], dfY2 = m_adfY[iPoint + 1];
+        if( (dfY1 > dfY) != (dfY2 > dfY)
+            && dfX < dfX1 + (dfY - dfY1) * (dfX2 - dfX1) / (dfY2 - dfY1) )
+        {
+            bInside = !bInside;
+        }
+    }
+    return bInside;
+}
+
+int AOIPointClassifier::ShapeContains( const Shape &sShape, 
+                                       double dfX, double dfY ) const
+{
+    if( dfX < sShape.sEnvelope.MinX || dfX > sShape.sEnvelope.MaxX
+        || dfY < sShape.sEnvelope.MinY || dfY > sShape.sEnvelope.MaxY )
+        return FALSE;
+
+    if( sShape.bAnalytic )
+    {
+        const double *padfM = sShape.adfToLocal;
+        return AOIShapeContainsLocal( sShape.eKind, sShape.dfCenterX, sShape.dfCenterY,
+                            sShape.dfSize1, sShape.dfSize2,
+                            padfM[0] + padfM[1] * dfX + padfM[2] * dfY,
+                            padfM[3] + padfM[4] * dfX + padfM[5] * dfY );
+    }
+    return PolygonContains( sShape, dfX, dfY );
+}
+
+void AOIPointClassifier::Classify( size_t nPoints, const double *padfX, 
+                                   const double *padfY, int nThreads,
+                                   std::vector<size_t> &anOffsets,
+                                   std::vector<GIntBig> &anFIDs ) const
+{
+    // each chunk collects its own results which are joined in order
+    // so the output doesn't depend on the number of threads
+    int nChunks = (int)((nPoints + AOI_CLASSIFY_CHUNK - 1) / AOI_CLASSIFY_CHUNK);
+    std::vector<std::vector<int> > aanCounts( nChunks );
+    std::vector<std::vector<GIntBig> > aanChunkFIDs( nChunks );
+
+    AOIParallelFor( nChunks, nThreads, [&]( int /*iThread*/, int iChunk )
+    {
+        size_t iStart = (size_t)iChunk * AOI_CLASSIFY_CHUNK;
+        size_t iEnd = MIN( iStart + AOI_CLASSIFY_CHUNK, nPoints );
+        std::vector<int> &anCounts = aanCounts[iChunk];
+        std::vector<GIntBig> &anChunkFIDs = aanChunkFIDs[iChunk];
+        anCounts.assign( iEnd - iStart, 0 );
+
+        for( size_t i = iStart; i < iEnd; i++ )
+        {
+            double dfX = padfX[i], dfY = padfY[i];
+            if( m_aoShapes.empty() || dfX < m_sExtent.MinX || dfX > m_sExtent.MaxX
+                || dfY < m_sExtent.MinY || dfY > m_sExtent.MaxY )
+                continue;
+
+            int iX = MIN( (int)((dfX - m_sExtent.MinX) / m_dfCellWidth), m_nGridXSize - 1 );
+            int iY = MIN( (int)((dfY - m_sExtent.MinY) / m_dfCellHeight), m_nGridYSize - 1 );
+            int iCell = iY * m_nGridXSize + iX;
+
+            // shapes are in object order so an object's shapes are
+            // together - skip the rest once one contains the point
+            int iLastObject = -1;
+            for( int j = m_anCellStart[iCell]; j < m_anCellStart[iCell + 1]; j++ )
+            {
+                const Shape &sShape = m_aoShapes[m_anCellShapes[j]];
+                if( sShape.iObject == iLastObject )
+                    continue;
+                if( ShapeContains( sShape, dfX, dfY ) )
+                {
+                    iLastObject = sShape.iObject;
+                    anChunkFIDs.push_back( m_anFIDs[sShape.iObject] );
+                    anCounts[i - iStart]++;
+                }
+            }
+        }
+    } );
+
+    anOffsets.resize( nPoints + 1 );
+    anFIDs.clear();
+    size_t nOffset = 0;
+    for( int iChunk = 0; iChunk < nChunks; iChunk++ )
+    {
+        size_t iStart = (size_t)iChunk * AOI_CLASSIFY_CHUNK;
+        for( size_t i = 0; i < aanCounts[iChunk].size(); i++ )
+        {
+            anOffsets[iStart + i] = nOffset;
+            nOffset += aanCounts[iChunk][i];
+        }
+        anFIDs.insert( anFIDs.end(), aanChunkFIDs[iChunk].begin(), aanChunkFIDs[iChunk].end() );
+    }
+    anOffsets[nPoints] = nOffset;
+}
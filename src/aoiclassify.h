@@ -0,0 +1,101 @@
+/* ******************************************************************************
+ * Copyright (c) 2015, Sam Gillingham <gillingham.sam@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef AOICLASSIFY_H
+#define AOICLASSIFY_H
+
+#include "aoilayer.h"
+#include <vector>
+
+// Finds which objects contain each of a batch of points.
+// The objects are decoded once into a grid index over their shape 
+// envelopes. Rectangles and ellipses with an affine polynomial are 
+// tested exactly by taking the point back into the element's own 
+// coordinates. Polygons keep their edges bucketed into horizontal 
+// bands so a crossing test only looks at the edges near the point.
+// Lines and points don't contain anything.
+// Once built it is only read so Classify() can be called from many
+// threads.
+class AOIPointClassifier
+{
+    struct Shape
+    {
+        int             iObject;
+        AOIShapeKind    eKind;
+        int             bAnalytic;
+        OGREnvelope     sEnvelope;
+
+        // analytic shapes - layer to element coordinates
+        double          adfToLocal[6];
+        double          dfCenterX;
+        double          dfCenterY;
+        double          dfSize1;
+        double          dfSize2;
+
+        // polygons - closed outline in m_adfX/m_adfY and the edges
+        // in each band in m_anBandStart/m_anBandEdges
+        int             nFirstPoint;
+        int             nPoints;
+        int             nFirstBand;
+        int             nBands;
+        double          dfBandHeight;
+    };
+
+    std::vector<Shape>      m_aoShapes;
+    std::vector<GIntBig>    m_anFIDs;       // for each object
+    std::vector<double>     m_adfX;
+    std::vector<double>     m_adfY;
+    std::vector<int>        m_anBandStart;  // nBands + 1 for each polygon
+    std::vector<int>        m_anBandEdges;  // first point of each edge
+
+    OGREnvelope             m_sExtent;
+    int                     m_nGridXSize;
+    int                     m_nGridYSize;
+    double                  m_dfCellWidth;
+    double                  m_dfCellHeight;
+    std::vector<int>        m_anCellStart;  // offsets into m_anCellShapes
+    std::vector<int>        m_anCellShapes;
+
+    void                AddPolygon( Shape &sShape, const double *padfX, 
+                                    const double *padfY, int nPoints );
+    void                BuildGrid();
+    int                 PolygonContains( const Shape &sShape, double dfX, double dfY ) const;
+    int                 ShapeContains( const Shape &sShape, double dfX, double dfY ) const;
+
+  public:
+                        AOIPointClassifier();
+
+    // Decode every object in poLayer and index them. Returns the 
+    // number of objects.
+    int                 Build( OGRAOILayer *poLayer );
+
+    // Find the objects that contain each point. The FIDs containing 
+    // point i are in anFIDs from anOffsets[i] up to anOffsets[i+1], in
+    // FID order. The points are split between nThreads threads.
+    void                Classify( size_t nPoints, const double *padfX, 
+                                  const double *padfY, int nThreads,
+                                  std::vector<size_t> &anOffsets,
+                                  std::vector<GIntBig> &anFIDs ) const;
+};
+
+#endif // AOICLASSIFY_H
@@ -0,0 +1,164 @@
+/* ******************************************************************************
+ * Copyright (c) 2015, Sam Gillingham <gillingham.sam@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "aoicoverage.h"
+#include "aoiraster.h"
+#include "aoithreads.h"
+#include <algorithm>
+
+// Per thread state for AOIComputeTileCoverage()
+struct AOICoverageState
+{
+    std::vector<GByte>  abyMask;
+    AOIFillScratch      oScratch;
+};
+
+CPLErr AOIComputeTileCoverage( OGRAOILayer *poLayer, const double *padfGeoTransform,
+                               int nXSize, int nYSize, int nTileXSize, int nTileYSize,
+                               int nThreads, std::vector<AOITileFID> &asCoverage )
+{
+    asCoverage.clear();
+    if( nTileXSize <= 0 || nTileYSize <= 0 )
+    {
+        CPLError( CE_Failure, CPLE_IllegalArg, "Invalid tile size %d x %d",
+                  nTileXSize, nTileYSize );
+        return CE_Failure;
+    }
+
+    AOIPixelShapes oShapes;
+    if( !oShapes.Initialize( padfGeoTransform, nXSize, nYSize ) )
+    {
+        CPLError( CE_Failure, CPLE_AppDefined, "Can't invert geotransform" );
+        return CE_Failure;
+    }
+
+    // decode everything first, as for AOIRasterize()
+    AOIScratch oScratch;
+    GIntBig nFID;
+    const AOIObject *poObject;
+    poLayer->ResetReading();
+    while( (poObject = poLayer->GetNextDecodedObject( &nFID )) != NULL )
+        oShapes.AddObject( *poObject, (int)nFID, poLayer->GetGeometryOptions(), oScratch );
+
+    // candidate shapes for each tile from their bounding boxes
+    int nTilesPerRow = (nXSize + nTileXSize - 1) / nTileXSize;
+    std::map<GIntBig, std::vector<int> > oTileShapes;
+    oShapes.GetBlockShapes( nTileXSize, nTileYSize, oTileShapes );
+    std::vector<std::pair<GIntBig, std::vector<int>*> > aoTiles;
+    for( std::map<GIntBig, std::vector<int> >::iterator oIter = oTileShapes.begin();
+         oIter != oTileShapes.end(); ++oIter )
+    {
+        aoTiles.push_back( std::make_pair( oIter->first, &oIter->second ) );
+    }
+
+    // Scan convert each candidate in each tile until one of its pixels
+    // is set. The shapes of an object are together and in FID order
+    // so once an object is found its other shapes are skipped and each
+    // tile's list comes out sorted.
+    std::vector<std::vector<GIntBig> > aanTileFIDs( aoTiles.size() );
+    std::vector<AOICoverageState> asState( MAX( nThreads, 1 ) );
+    AOIParallelFor( (int)aoTiles.size(), nThreads, 
+        [&]( int iThread, int iTile )
+    {
+        AOICoverageState &sState = asState[iThread];
+        int nTileXOff = (int)(aoTiles[iTile].first % nTilesPerRow) * nTileXSize;
+        int nTileYOff = (int)(aoTiles[iTile].first / nTilesPerRow) * nTileYSize;
+        int nTileXEnd = MIN( nTileXOff + nTileXSize, nXSize );
+        int nTileYEnd = MIN( nTileYOff + nTileYSize, nYSize );
+
+        const std::vector<int> &anShapes = *aoTiles[iTile].second;
+        int nFoundObject = -1;
+        for( size_t i = 0; i < anShapes.size(); i++ )
+        {
+            const AOIPixelShapes::Shape &sShape = oShapes.aoShapes[anShapes[i]];
+            if( sShape.nObject == nFoundObject )
+                continue;
+
+            // only the part of the tile the shape can touch
+            int nXOff = MAX( nTileXOff, sShape.nXOff );
+            int nYOff = MAX( nTileYOff, sShape.nYOff );
+            int nWinXSize = MIN( nTileXEnd, sShape.nXEnd ) - nXOff;
+            int nWinYSize = MIN( nTileYEnd, sShape.nYEnd ) - nYOff;
+            if( nWinXSize <= 0 || nWinYSize <= 0 )
+                continue;
+
+            sState.abyMask.assign( (size_t)nWinXSize * nWinYSize, 0 );
+            oShapes.Fill( anShapes[i], nXOff, nYOff, nWinXSize, nWinYSize,
+                          &sState.abyMask[0], sState.oScratch );
+            if( std::find( sState.abyMask.begin(), sState.abyMask.end(), 1 ) 
+                    != sState.abyMask.end() )
+            {
+                aanTileFIDs[iTile].push_back( sShape.nObject );
+                nFoundObject = sShape.nObject;
+            }
+        }
+    } );
+
+    int nMaxObject = -1;
+    for( size_t i = 0; i < oShapes.aoShapes.size(); i++ )
+        nMaxObject = MAX( nMaxObject, oShapes.aoShapes[i].nObject );
+    std::vector<char> abyCovered( nMaxObject + 1, FALSE );
+    for( size_t iTile = 0; iTile < aoTiles.size(); iTile++ )
+    {
+        for( size_t i = 0; i < aanTileFIDs[iTile].size(); i++ )
+        {
+            AOITileFID sEntry;
+            sEntry.nTile = aoTiles[iTile].first;
+            sEntry.nFID = aanTileFIDs[iTile][i];
+            asCoverage.push_back( sEntry );
+            abyCovered[sEntry.nFID] = TRUE;
+        }
+    }
+
+    // objects that missed every pixel centre get the tiles under 
+    // their shapes' bounds
+    int bAddedBounds = FALSE;
+    for( size_t iShape = 0; iShape < oShapes.aoShapes.size(); iShape++ )
+    {
+        const AOIPixelShapes::Shape &sShape = oShapes.aoShapes[iShape];
+        if( abyCovered[sShape.nObject] || sShape.nXEnd <= sShape.nXOff 
+            || sShape.nYEnd <= sShape.nYOff )
+            continue;
+        for( int iTileY = sShape.nYOff / nTileYSize; 
+             iTileY <= (sShape.nYEnd - 1) / nTileYSize; iTileY++ )
+        {
+            for( int iTileX = sShape.nXOff / nTileXSize;
+                 iTileX <= (sShape.nXEnd - 1) / nTileXSize; iTileX++ )
+            {
+                AOITileFID sEntry;
+                sEntry.nTile = (GIntBig)iTileY * nTilesPerRow + iTileX;
+                sEntry.nFID = sShape.nObject;
+                asCoverage.push_back( sEntry );
+                bAddedBounds = TRUE;
+            }
+        }
+    }
+    if( bAddedBounds )
+    {
+        std::sort( asCoverage.begin(), asCoverage.end() );
+        asCoverage.erase( std::unique( asCoverage.begin(), asCoverage.end() ), 
+                          asCoverage.end() );
+    }
+
+    return CE_None;
+}
@@ -0,0 +1,61 @@
+/* ******************************************************************************
+ * Copyright (c) 2015, Sam Gillingham <gillingham.sam@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef AOICOVERAGE_H
+#define AOICOVERAGE_H
+
+#include "aoilayer.h"
+#include <vector>
+
+// One tile an object covers. Tiles are numbered 
+// iTileY * nTilesPerRow + iTileX.
+struct AOITileFID
+{
+    GIntBig             nTile;
+    GIntBig             nFID;
+
+    bool                operator<( const AOITileFID &sOther ) const
+                        {
+                            return nTile < sOther.nTile 
+                                || (nTile == sOther.nTile && nFID < sOther.nFID);
+                        }
+    bool                operator==( const AOITileFID &sOther ) const
+                        {
+                            return nTile == sOther.nTile && nFID == sOther.nFID;
+                        }
+};
+
+// Work out which tiles of a grid (nXSize by nYSize pixels with 
+// padfGeoTransform, cut into nTileXSize by nTileYSize tiles) each 
+// object in poLayer covers. An object covers a tile when it would burn
+// at least one of its pixels with AOIRasterize(), found by scan 
+// converting the shapes rather than from their bounding boxes. 
+// Objects too small to cover any pixel centre are given the tiles 
+// their bounds touch so none are lost. asCoverage is sorted by tile 
+// and then FID with no duplicates. Tiles are worked on by nThreads 
+// threads. FIDs are those of whole objects whatever GRANULARITY is.
+CPLErr AOIComputeTileCoverage( OGRAOILayer *poLayer, const double *padfGeoTransform,
+                               int nXSize, int nYSize, int nTileXSize, int nTileYSize,
+                               int nThreads, std::vector<AOITileFID> &asCoverage );
+
+#endif // AOICOVERAGE_H
@@ -21,34 +21,51 @@
  */
 #include "aoidatasource.h"
 #include "aoilayer.h"
-
+#include "aoireadcache.h"
+#include "aoisql.h"
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <unordered_map>
 
 /* from hfaopen.cpp - unfortunately declared static so we can't get access*/
 /* had to copy and paste into here */
 /* I found if this isn't called we get a crash reading fields */
+/* Changed to read in blocks rather than a byte at a time */
 /************************************************************************/
 /*                          HFAGetDictionary()                          */
 /************************************************************************/
 
+#define DICTIONARY_READ_SIZE 4096
+
 static char * HFAGetDictionary( HFAHandle hHFA )
 
 {
-    int		nDictMax = 100;
+    int		nDictMax = DICTIONARY_READ_SIZE + 1;
     char	*pszDictionary = (char *) CPLMalloc(nDictMax);
     int		nDictSize = 0;
+    int     nDictRead = 0;  /* bytes read into pszDictionary so far */
 
     VSIFSeekL( hHFA->fp, hHFA->nDictionaryPos, SEEK_SET );
 
     while( TRUE )
     {
-        if( nDictSize >= nDictMax-1 )
+        if( nDictSize >= nDictRead )
         {
-            nDictMax = nDictSize * 2 + 100;
-            pszDictionary = (char *) CPLRealloc(pszDictionary, nDictMax );
+            if( nDictRead + DICTIONARY_READ_SIZE >= nDictMax )
+            {
+                nDictMax = nDictMax * 2 + DICTIONARY_READ_SIZE;
+                pszDictionary = (char *) CPLRealloc(pszDictionary, nDictMax );
+            }
+
+            int nRead = (int)VSIFReadL( pszDictionary + nDictRead, 1, 
+                                        DICTIONARY_READ_SIZE, hHFA->fp );
+            if( nRead == 0 )
+                break;
+            nDictRead += nRead;
         }
 
-        if( VSIFReadL( pszDictionary + nDictSize, 1, 1, hHFA->fp ) < 1
-            || pszDictionary[nDictSize] == '\0'
+        if( pszDictionary[nDictSize] == '\0'
             || (nDictSize > 2 && pszDictionary[nDictSize-2] == ','
                 && pszDictionary[nDictSize-1] == '.') )
             break;
@@ -62,6 +79,148 @@ static char * HFAGetDictionary( HFAHandle hHFA )
     return( pszDictionary );
 }
 
+/************************************************************************/
+/*                          Dictionary cache                            */
+/************************************************************************/
+
+// Parsing the dictionary is a good part of the cost of opening a file
+// and files written by the same version of Imagine have identical ones,
+// so parsed dictionaries are shared between datasources. Keyed on the 
+// dictionary text. Ones no longer used are kept for later opens up to
+// OGR_AOI_DICTIONARY_CACHE_SIZE.
+struct AOIDictionaryCacheEntry
+{
+    HFADictionary  *poDictionary;
+    int             nRefCount;
+    GUIntBig        nLastUse;
+};
+
+static std::mutex oDictionaryCacheMutex;
+static std::unordered_map<std::string, AOIDictionaryCacheEntry> oDictionaryCache;
+static GUIntBig nDictionaryCacheCounter = 0;
+
+// HFADictionary::FindType() adds a type from GDAL's built in list
+// (aszDefaultDefn in frmts/hfa/hfadictionary.cpp) to the dictionary the
+// first time it is asked for if the file doesn't define it. 
+// HFAEntry::LoadData() calls FindType() for whatever type the entry has,
+// so any of them can be asked for, not just the ones this driver reads.
+// Ask for all of them before sharing so that FindType() never changes a
+// dictionary another thread is using. Types that are in neither list,
+// like the Eaoi_ ones, are only looked up. This is a copy of 
+// aszDefaultDefn as of GDAL 3.12 (the same 14 types as 3.9) plus names
+// older versions have had; names that GDAL doesn't know are harmless as 
+// FindType() just returns NULL. Check it when GDAL adds to the list - 
+// the dictionary_threads test fails if the dictionary grows once shared.
+static const char * const apszAOIDictionaryTypes[] = {
+    "Edsc_Table", "Edsc_Column", "Edsc_BinFunction", "Edsc_BinFunction840",
+    "Eprj_Size", "Eprj_Coordinate", "Eprj_MapInfo", "Eprj_MapProjection842",
+    "Eprj_Datum", "Eprj_Spheroid", "Eprj_ProParameters",
+    "Eimg_StatisticsParameters830", "Esta_Statistics",
+    "Eimg_NonInitializedValue", "Eimg_RRDNamesList", "Eimg_DependentFile",
+    "Eimg_DependentLayerName", "Eimg_Layer", "Eimg_Layer_SubSample",
+    "Eimg_ExternalRaster", "ImgExternalRaster", "Ehfa_Layer",
+    "Emif_MIFObject", "Emif_String",
+    "Edms_VirtualBlockInfo", "Edms_FreeIDList", "Edms_State",
+    NULL };
+
+static int GetDictionaryCacheSize()
+{
+    return atoi( CPLGetConfigOption( "OGR_AOI_DICTIONARY_CACHE_SIZE", "8" ) );
+}
+
+// Remove unused dictionaries until there are no more than nCacheSize
+// of them. Must hold oDictionaryCacheMutex.
+static void TrimDictionaryCache( int nCacheSize )
+{
+    while( TRUE )
+    {
+        int nUnused = 0;
+        std::unordered_map<std::string, AOIDictionaryCacheEntry>::iterator oOldest 
+                = oDictionaryCache.end();
+        for( std::unordered_map<std::string, AOIDictionaryCacheEntry>::iterator oIter 
+                = oDictionaryCache.begin(); oIter != oDictionaryCache.end(); ++oIter )
+        {
+            if( oIter->second.nRefCount > 0 )
+                continue;
+            nUnused++;
+            if( oOldest == oDictionaryCache.end() 
+                || oIter->second.nLastUse < oOldest->second.nLastUse )
+                oOldest = oIter;
+        }
+        if( nUnused <= nCacheSize )
+            return;
+        delete oOldest->second.poDictionary;
+        oDictionaryCache.erase( oOldest );
+    }
+}
+
+// Get a parsed dictionary for the text, shared if we have seen it 
+// before. Call AOIReleaseDictionary() when done.
+static HFADictionary *AOIAcquireDictionary( const char *pszDictionary )
+{
+    if( GetDictionaryCacheSize() <= 0 )
+        return new HFADictionary( pszDictionary );
+
+    std::string osKey( pszDictionary );
+    {
+        std::lock_guard<std::mutex> oLock( oDictionaryCacheMutex );
+        std::unordered_map<std::string, AOIDictionaryCacheEntry>::iterator oIter =
+            oDictionaryCache.find( osKey );
+        if( oIter != oDictionaryCache.end() )
+        {
+            oIter->second.nRefCount++;
+            oIter->second.nLastUse = ++nDictionaryCacheCounter;
+            return oIter->second.poDictionary;
+        }
+    }
+
+    // parse outside the lock so other opens aren't held up. Once it is
+    // in the cache the dictionary is only read.
+    HFADictionary *poDictionary = new HFADictionary( pszDictionary );
+    for( int i = 0; apszAOIDictionaryTypes[i] != NULL; i++ )
+        poDictionary->FindType( apszAOIDictionaryTypes[i] );
+
+    std::lock_guard<std::mutex> oLock( oDictionaryCacheMutex );
+    std::unordered_map<std::string, AOIDictionaryCacheEntry>::iterator oIter =
+        oDictionaryCache.find( osKey );
+    if( oIter != oDictionaryCache.end() )
+    {
+        // another thread got there first
+        delete poDictionary;
+        oIter->second.nRefCount++;
+        oIter->second.nLastUse = ++nDictionaryCacheCounter;
+        return oIter->second.poDictionary;
+    }
+
+    AOIDictionaryCacheEntry sEntry;
+    sEntry.poDictionary = poDictionary;
+    sEntry.nRefCount = 1;
+    sEntry.nLastUse = ++nDictionaryCacheCounter;
+    oDictionaryCache[osKey] = sEntry;
+    return poDictionary;
+}
+
+static void AOIReleaseDictionary( HFADictionary *poDictionary )
+{
+    if( poDictionary == NULL )
+        return;
+
+    std::lock_guard<std::mutex> oLock( oDictionaryCacheMutex );
+    for( std::unordered_map<std::string, AOIDictionaryCacheEntry>::iterator oIter 
+            = oDictionaryCache.begin(); oIter != oDictionaryCache.end(); ++oIter )
+    {
+        if( oIter->second.poDictionary == poDictionary )
+        {
+            oIter->second.nRefCount--;
+            TrimDictionaryCache( GetDictionaryCacheSize() );
+            return;
+        }
+    }
+
+    // wasn't cached
+    delete poDictionary;
+}
+
 // Constructor - no layers etc until Open() called
 OGRAOIDataSource::OGRAOIDataSource()
 {
@@ -70,15 +229,27 @@ OGRAOIDataSource::OGRAOIDataSource()
 
     m_pszName = NULL;
     m_psInfo = NULL;
+    m_poCache = NULL;
+
+    m_bRefresh = FALSE;
+    m_nRefreshInterval = 0;
+    m_nLastCheck = 0;
+    memset( &m_sStamp, 0, sizeof(m_sStamp) );
+    m_papszOpenOptions = NULL;
 }
 
 // Destructor - free memory
 OGRAOIDataSource::~OGRAOIDataSource()
 {
     if( m_poLayer != NULL )
+    {
+        // write any changes while the file is still open
+        m_poLayer->SyncToDisk();
         delete m_poLayer;
+    }
 
     CPLFree( m_pszName );
+    CSLDestroy( m_papszOpenOptions );
 
     if( m_psInfo != NULL )
     {
@@ -87,17 +258,67 @@ OGRAOIDataSource::~OGRAOIDataSource()
         CPLFree( m_psInfo->pszPath );
         delete m_psInfo->poRoot;
         CPLFree( m_psInfo->pszDictionary );
-        delete m_psInfo->poDictionary;
+        AOIReleaseDictionary( m_psInfo->poDictionary );
         CPLFree( m_psInfo );
     }
 }
 
+// Size of the Ehfa_File structure pointed to by the header
+#define HFA_FILE_HEADER_SIZE 18
+
+// The size and modification time of the file and where its header 
+// says the tree and dictionary are. Reads a few bytes of the header 
+// so rewrites that keep the size and time are usually noticed too.
+static int AOIGetFileStamp( const char *pszFilename, AOIFileStamp *psStamp )
+{
+    VSIStatBufL sStat;
+    if( VSIStatL( pszFilename, &sStat ) != 0 )
+        return FALSE;
+    memset( psStamp, 0, sizeof(AOIFileStamp) );
+    psStamp->nSize = (GIntBig)sStat.st_size;
+    psStamp->nMTime = (GIntBig)sStat.st_mtime;
+
+    VSILFILE *fp = VSIFOpenL( pszFilename, "rb" );
+    if( fp == NULL )
+        return FALSE;
+    GByte abyTag[20], abyFileHeader[HFA_FILE_HEADER_SIZE];
+    GUInt32 nHeaderPos;
+    int bOK = VSIFReadL( abyTag, sizeof(abyTag), 1, fp ) == 1;
+    if( bOK )
+    {
+        memcpy( &nHeaderPos, abyTag + 16, sizeof(GUInt32) );
+        HFAStandard( 4, &nHeaderPos );
+        bOK = VSIFSeekL( fp, nHeaderPos, SEEK_SET ) == 0
+            && VSIFReadL( abyFileHeader, HFA_FILE_HEADER_SIZE, 1, fp ) == 1;
+    }
+    VSIFCloseL( fp );
+    if( !bOK )
+        return FALSE;
+
+    memcpy( &psStamp->nRootPos, abyFileHeader + 8, sizeof(GUInt32) );
+    HFAStandard( 4, &psStamp->nRootPos );
+    memcpy( &psStamp->nDictionaryPos, abyFileHeader + 14, sizeof(GUInt32) );
+    HFAStandard( 4, &psStamp->nDictionaryPos );
+    return TRUE;
+}
+
+static int AOIStampsEqual( const AOIFileStamp &sFirst, const AOIFileStamp &sSecond )
+{
+    return sFirst.nSize == sSecond.nSize && sFirst.nMTime == sSecond.nMTime
+        && sFirst.nRootPos == sSecond.nRootPos 
+        && sFirst.nDictionaryPos == sSecond.nDictionaryPos;
+}
+
 // Return TRUE if it is an aoi file and we will be able to open it
 // Adapted from HFAOpen()
-int OGRAOIDataSource::Open( const char *pszFilename, int bUpdate )
+// Takes ownership of the file handle in poOpenInfo and uses the
+// header bytes already read by GDAL where possible so that we
+// don't reopen the file or do lots of small reads
+int OGRAOIDataSource::Open( GDALOpenInfo *poOpenInfo )
 {
+    const char *pszFilename = poOpenInfo->pszFilename;
     VSILFILE *fp;
-    char	szHeader[16];
+    GByte	abyFileHeader[HFA_FILE_HEADER_SIZE];
     GUInt32	nHeaderPos;
 // -------------------------------------------------------------------- 
 //      Does this appear to be an .aoi file?                           
@@ -105,17 +326,44 @@ int OGRAOIDataSource::Open( const char *pszFilename, int bUpdate )
     if( !EQUAL( CPLGetExtension(pszFilename), "aoi" ) )
         return FALSE;
 
-    if( bUpdate )
+    // Update only changes the entries that need it (see aoiupdate.h)
+    int bUpdate = poOpenInfo->eAccess == GA_Update;
+
+/* -------------------------------------------------------------------- */
+/*      Read and verify the header. The tag and the position of the     */
+/*      Ehfa_File structure are in the first 20 bytes.                  */
+/* -------------------------------------------------------------------- */
+    if( poOpenInfo->nHeaderBytes < 20 )
     {
-        CPLError( CE_Failure, CPLE_OpenFailed, 
-                  "Update access not supported by the AOI driver." );
+        CPLError( CE_Failure, CPLE_AppDefined,
+                  "Attempt to read 16 byte header failed for\n%s.",
+                  pszFilename );
+
+        return FALSE;
+    }
+
+    if( !EQUALN((const char*)poOpenInfo->pabyHeader,"EHFA_HEADER_TAG",15) )
+    {
+        CPLError( CE_Failure, CPLE_AppDefined,
+                  "File %s is not an Imagine HFA file ... header wrong.",
+                  pszFilename );
+
         return FALSE;
     }
 
 /* -------------------------------------------------------------------- */
-/*      Open the file.                                                  */
+/*	Where is the header?						*/
 /* -------------------------------------------------------------------- */
-    fp = VSIFOpenL( pszFilename, "rb" );
+    memcpy( &nHeaderPos, poOpenInfo->pabyHeader + 16, sizeof(GUInt32) );
+    HFAStandard( 4, &nHeaderPos );
+
+/* -------------------------------------------------------------------- */
+/*      Take over the file handle opened by GDAL.                       */
+/* -------------------------------------------------------------------- */
+    fp = poOpenInfo->fpL;
+    poOpenInfo->fpL = NULL;
+    if( fp == NULL )
+        fp = VSIFOpenL( pszFilename, bUpdate ? "r+b" : "rb" );
 
     /* should this be changed to use some sort of CPLFOpen() which will
        set the error? */
@@ -129,23 +377,31 @@ int OGRAOIDataSource::Open( const char *pszFilename, int bUpdate )
     }
 
 /* -------------------------------------------------------------------- */
-/*      Read and verify the header.                                     */
+/*      On network file systems put a cache in front of the handle      */
+/*      so the many small reads done by HFAEntry are coalesced.         */
 /* -------------------------------------------------------------------- */
-    if( VSIFReadL( szHeader, 16, 1, fp ) < 1 )
-    {
-        CPLError( CE_Failure, CPLE_AppDefined,
-                  "Attempt to read 16 byte header failed for\n%s.",
-                  pszFilename );
+    if( !bUpdate )
+        m_poCache = AOICreateCachedHandle( fp, pszFilename );
+    if( m_poCache != NULL )
+        fp = reinterpret_cast<VSILFILE*>( m_poCache );
 
-        return FALSE;
+/* -------------------------------------------------------------------- */
+/*      Read the header. Normally this isn't in the bytes GDAL has      */
+/*      already read so get it in one go.                               */
+/* -------------------------------------------------------------------- */
+    if( (vsi_l_offset)nHeaderPos + HFA_FILE_HEADER_SIZE
+            <= (vsi_l_offset)poOpenInfo->nHeaderBytes )
+    {
+        memcpy( abyFileHeader, poOpenInfo->pabyHeader + nHeaderPos,
+                HFA_FILE_HEADER_SIZE );
     }
-
-    if( !EQUALN(szHeader,"EHFA_HEADER_TAG",15) )
+    else if( VSIFSeekL( fp, nHeaderPos, SEEK_SET ) != 0 
+            || VSIFReadL( abyFileHeader, HFA_FILE_HEADER_SIZE, 1, fp ) < 1 )
     {
-        CPLError( CE_Failure, CPLE_AppDefined,
-                  "File %s is not an Imagine HFA file ... header wrong.",
+        CPLError( CE_Failure, CPLE_FileIO,
+                  "Unable to read header of %s.",
                   pszFilename );
-
+        VSIFCloseL( fp );
         return FALSE;
     }
 
@@ -157,32 +413,25 @@ int OGRAOIDataSource::Open( const char *pszFilename, int bUpdate )
     m_psInfo->pszFilename = CPLStrdup(CPLGetFilename(pszFilename));
     m_psInfo->pszPath = CPLStrdup(CPLGetPath(pszFilename));
     m_psInfo->fp = fp;
-	m_psInfo->eAccess = HFA_ReadOnly;
+	m_psInfo->eAccess = bUpdate ? HFA_Update : HFA_ReadOnly;
     m_psInfo->bTreeDirty = FALSE;
 
 /* -------------------------------------------------------------------- */
-/*	Where is the header?						*/
-/* -------------------------------------------------------------------- */
-    VSIFReadL( &nHeaderPos, sizeof(GInt32), 1, fp );
-    HFAStandard( 4, &nHeaderPos );
-
+/*      Unpack the header (Ehfa_File).                                  */
 /* -------------------------------------------------------------------- */
-/*      Read the header.                                                */
-/* -------------------------------------------------------------------- */
-    VSIFSeekL( fp, nHeaderPos, SEEK_SET );
-
-    VSIFReadL( &(m_psInfo->nVersion), sizeof(GInt32), 1, fp );
+    memcpy( &(m_psInfo->nVersion), abyFileHeader, sizeof(GInt32) );
     HFAStandard( 4, &(m_psInfo->nVersion) );
 
-    VSIFReadL( szHeader, 4, 1, fp ); /* skip freeList */
+    /* skip freeList at abyFileHeader + 4 */
 
-    VSIFReadL( &(m_psInfo->nRootPos), sizeof(GInt32), 1, fp );
+    memcpy( &(m_psInfo->nRootPos), abyFileHeader + 8, sizeof(GInt32) );
     HFAStandard( 4, &(m_psInfo->nRootPos) );
 
-    VSIFReadL( &(m_psInfo->nEntryHeaderLength), sizeof(GInt16), 1, fp );
+    memcpy( &(m_psInfo->nEntryHeaderLength), abyFileHeader + 12, 
+            sizeof(GInt16) );
     HFAStandard( 2, &(m_psInfo->nEntryHeaderLength) );
 
-    VSIFReadL( &(m_psInfo->nDictionaryPos), sizeof(GInt32), 1, fp );
+    memcpy( &(m_psInfo->nDictionaryPos), abyFileHeader + 14, sizeof(GInt32) );
     HFAStandard( 4, &(m_psInfo->nDictionaryPos) );
 
 /* -------------------------------------------------------------------- */
@@ -197,10 +446,21 @@ int OGRAOIDataSource::Open( const char *pszFilename, int bUpdate )
     m_psInfo->poRoot = HFAEntry::New( m_psInfo, m_psInfo->nRootPos, NULL, NULL );
 
 /* -------------------------------------------------------------------- */
-/*      Read the dictionary                                             */
+/*      Read the dictionary. The parsed version is shared with other    */
+/*      files that have the same one so the text isn't needed after.    */
+/*      Not when updating as types may be added to it.                  */
 /* -------------------------------------------------------------------- */
     m_psInfo->pszDictionary = HFAGetDictionary( m_psInfo );
-    m_psInfo->poDictionary = new HFADictionary( m_psInfo->pszDictionary );
+    if( bUpdate )
+    {
+        m_psInfo->poDictionary = new HFADictionary( m_psInfo->pszDictionary );
+    }
+    else
+    {
+        m_psInfo->poDictionary = AOIAcquireDictionary( m_psInfo->pszDictionary );
+        CPLFree( m_psInfo->pszDictionary );
+        m_psInfo->pszDictionary = NULL;
+    }
 
 
 /* -------------------------------------------------------------------- */
@@ -215,16 +475,49 @@ int OGRAOIDataSource::Open( const char *pszFilename, int bUpdate )
         return FALSE;
     }
 
+/* -------------------------------------------------------------------- */
+/*      Pull the whole AOI tree into the cache in a few large sorted    */
+/*      reads rather than letting HFAEntry seek all over the file.      */
+/* -------------------------------------------------------------------- */
+    if( m_poCache != NULL )
+    {
+        size_t nMaxBytes = (size_t)CPLAtoGIntBig(
+                CPLGetConfigOption("OGR_AOI_PREFETCH_SIZE", "8388608") );
+        AOIPrefetchTree( m_poCache, pAOInode->GetFilePos(), nMaxBytes );
+    }
+
 /* -------------------------------------------------------------------- */
 /*      Create layers for each geometry type                            */
 /*  AOI Files contain multiple types, so we put them in seperate layers */
 /*  AFAIK OGR only supports one geometry type per layer                 */
 /* -------------------------------------------------------------------- */
     m_nLayers = 1;
-    m_poLayer = new OGRAOILayer( pAOInode, CPLGetBasename( pszFilename ) );
+    m_poLayer = new OGRAOILayer( m_psInfo, pAOInode, CPLGetBasename( pszFilename ),
+                                 poOpenInfo->papszOpenOptions, this );
 
     m_pszName = CPLStrdup( pszFilename );
 
+/* -------------------------------------------------------------------- */
+/*      Watch for the file being saved again. The layer keeps the old   */
+/*      file in memory with the lean reader so it is never part read.   */
+/* -------------------------------------------------------------------- */
+    m_bRefresh = CPLTestBool( AOIGetOption(poOpenInfo->papszOpenOptions, "REFRESH", "NO") );
+    m_nRefreshInterval = atoi( 
+            AOIGetOption(poOpenInfo->papszOpenOptions, "REFRESH_INTERVAL", "0") );
+    if( m_bRefresh && (bUpdate || !m_poLayer->CanReload()) )
+    {
+        CPLError( CE_Warning, CPLE_NotSupported, 
+                  "REFRESH needs READER=LEAN and can't be used when updating or streaming. Ignoring it." );
+        m_bRefresh = FALSE;
+    }
+    if( m_bRefresh )
+    {
+        m_papszOpenOptions = CSLDuplicate( poOpenInfo->papszOpenOptions );
+        m_nLastCheck = time( NULL );
+        if( !AOIGetFileStamp( pszFilename, &m_sStamp ) )
+            m_bRefresh = FALSE;
+    }
+
     return TRUE;
 }
 
@@ -236,3 +529,75 @@ OGRLayer *OGRAOIDataSource::GetLayer( int iLayer )
     else
         return m_poLayer;
 }
+
+OGRLayer *OGRAOIDataSource::ExecuteSQL( const char *pszStatement,
+                                        OGRGeometry *poSpatialFilter,
+                                        const char *pszDialect )
+{
+    if( m_poLayer != NULL && poSpatialFilter == NULL 
+        && (pszDialect == NULL || pszDialect[0] == '\0' || EQUAL(pszDialect, "OGRSQL")) )
+    {
+        OGRLayer *poResult = AOIExecuteSummarySQL( m_poLayer, pszStatement );
+        if( poResult != NULL )
+        {
+            CPLDebug( "AOI", "Answered '%s' from the object table", pszStatement );
+            return poResult;
+        }
+    }
+    return OGRDataSource::ExecuteSQL( pszStatement, poSpatialFilter, pszDialect );
+}
+
+int OGRAOIDataSource::RefreshIfChanged()
+{
+    if( !m_bRefresh )
+        return FALSE;
+    time_t nNow = time( NULL );
+    if( m_nRefreshInterval > 0 && nNow - m_nLastCheck < m_nRefreshInterval )
+        return FALSE;
+    m_nLastCheck = nNow;
+
+    AOIFileStamp sStamp;
+    if( !AOIGetFileStamp( m_pszName, &sStamp ) || AOIStampsEqual( sStamp, m_sStamp ) )
+        return FALSE;
+
+    // Read the new file completely with another datasource first so 
+    // the layer only changes if it all worked. If the file changed
+    // again while it was being read try again next time.
+    CPLDebug( "AOI", "%s has changed. Reloading it.", m_pszName );
+    OGRAOIDataSource *poNew = AOIOpenDataSource( m_pszName, m_papszOpenOptions );
+    AOIFileStamp sAfter;
+    if( poNew == NULL || !AOIGetFileStamp( m_pszName, &sAfter ) 
+        || !AOIStampsEqual( sStamp, sAfter ) )
+    {
+        CPLDebug( "AOI", "Couldn't read the new %s. Keeping the old one.", m_pszName );
+        delete poNew;
+        return FALSE;
+    }
+
+    int bReloaded = m_poLayer->Reload( poNew->m_poLayer );
+    if( bReloaded )
+    {
+        // poNew closes the old file
+        std::swap( m_psInfo, poNew->m_psInfo );
+        std::swap( m_poCache, poNew->m_poCache );
+    }
+    // don't keep trying a file that can't be reloaded
+    m_sStamp = sStamp;
+    delete poNew;
+    return bReloaded;
+}
+
+OGRAOIDataSource *AOIOpenDataSource( const char *pszFilename, 
+                                     char **papszOpenOptions )
+{
+    GDALOpenInfo oOpenInfo( pszFilename, GA_ReadOnly );
+    oOpenInfo.papszOpenOptions = papszOpenOptions;
+
+    OGRAOIDataSource *poDS = new OGRAOIDataSource();
+    if( !poDS->Open( &oOpenInfo ) )
+    {
+        delete poDS;
+        return NULL;
+    }
+    return poDS;
+}
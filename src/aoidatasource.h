@@ -25,6 +25,17 @@
 
 #include <ogrsf_frmts.h>
 #include "aoilayer.h"
+#include "aoireadcache.h"
+#include <time.h>
+
+// What is checked to see if the file has changed since it was opened
+struct AOIFileStamp
+{
+    GIntBig              nSize;
+    GIntBig              nMTime;
+    GUInt32              nRootPos;
+    GUInt32              nDictionaryPos;
+};
 
 // Data source class for AOI files
 class OGRAOIDataSource : public OGRDataSource
@@ -34,20 +45,48 @@ class OGRAOIDataSource : public OGRDataSource
     
     OGRAOILayer         *m_poLayer;
     HFAInfo_t	        *m_psInfo;
+    AOICachedHandle     *m_poCache; // m_psInfo->fp if we are caching reads
+
+    // REFRESH=YES - the file is checked for changes at most every
+    // m_nRefreshInterval seconds when the layer is reset
+    int                  m_bRefresh;
+    int                  m_nRefreshInterval;
+    time_t               m_nLastCheck;
+    AOIFileStamp         m_sStamp;
+    char               **m_papszOpenOptions;
 
   public:
                         OGRAOIDataSource();
                         ~OGRAOIDataSource();
 
-    int                 Open( const char * pszFilename, int bUpdate );
+    int                 Open( GDALOpenInfo *poOpenInfo );
     
     const char          *GetName() { return m_pszName; }
 
+    // Reload the file into the layer if it has been changed since it
+    // was read. Objects that are the same keep what the layer knows 
+    // about them. If the new file can't be read (eg it is still being
+    // written) the old one is used until the next check. Returns TRUE
+    // if the file was reloaded.
+    int                 RefreshIfChanged();
+
     int                 GetLayerCount() { return m_nLayers; }
     OGRLayer            *GetLayer( int );
 
     int                 TestCapability( const char * ) { return FALSE; }
 
+    // Counts and attribute listings are answered from the object table
+    // (see aoisql.h), anything else goes to the generic SQL engine
+    OGRLayer            *ExecuteSQL( const char *pszStatement,
+                                     OGRGeometry *poSpatialFilter,
+                                     const char *pszDialect );
+
 };
 
+// Open an AOI file directly rather than through the driver manager.
+// Used by the command line tools so they get an OGRAOILayer even if a
+// different copy of the driver is registered. Returns NULL on failure.
+OGRAOIDataSource *AOIOpenDataSource( const char *pszFilename, 
+                                     char **papszOpenOptions );
+
 #endif // AOIDATASOURCE_H
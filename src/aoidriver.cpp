@@ -53,8 +53,7 @@ static GDALDataset* OGRAOIDriverOpen(GDALOpenInfo* poOpenInfo)
 
     OGRAOIDataSource *poDS = new OGRAOIDataSource();
 
-    if( !poDS->Open( poOpenInfo->pszFilename, 
-                poOpenInfo->eAccess == GA_Update ) )
+    if( !poDS->Open( poOpenInfo ) )
     {
         delete poDS;
         return NULL;
@@ -78,6 +77,33 @@ void RegisterOGRAOI()
         poDriver->SetMetadataItem( GDAL_DMD_LONGNAME,
                                    "ERDAS Imagine AOI" );
         poDriver->SetMetadataItem( GDAL_DMD_EXTENSION, "aoi" );
+        poDriver->SetMetadataItem( GDAL_DMD_OPENOPTIONLIST,
+"<OpenOptionList>"
+"  <Option name='ELLIPSIS_STEPS' type='int' description='Number of points used for ellipses' default='36'/>"
+"  <Option name='SIMPLIFY_TOLERANCE' type='float' description='Simplify shapes to within this distance (in layer units) as they are read. 0 to not simplify' default='0'/>"
+"  <Option name='STREAMING' type='boolean' description='Free objects once STREAMING_MEMORY is used instead of keeping everything read in memory' default='NO'/>"
+"  <Option name='STREAMING_MEMORY' type='int' description='Bytes of objects kept in memory when streaming' default='16777216'/>"
+"  <Option name='MAX_FILE_IN_MEMORY' type='int' description='Files bigger than this many bytes are streamed even without STREAMING' default='268435456'/>"
+"  <Option name='FEATURE_CACHE_SIZE' type='int' description='Bytes of memory used to keep built features between passes. 0 to not cache' default='0'/>"
+"  <Option name='TARGET_SRS' type='string' description='Reproject shapes to this SRS as they are read'/>"
+"  <Option name='NUM_THREADS' type='string' description='Threads used when reading the whole layer for GetExtent() and GetFeatureCount(). A number or ALL_CPUS' default='ALL_CPUS'/>"
+"  <Option name='MAX_VERTICES' type='int' description='Objects with more points than this are ignored' default='10000000'/>"
+"  <Option name='MAX_NODES' type='int' description='Stop reading the file after this many entries' default='10000000'/>"
+"  <Option name='MAX_DEPTH' type='int' description='Objects nested deeper than this are ignored' default='64'/>"
+"  <Option name='GRANULARITY' type='string-select' description='A feature for each object or for each shape in the objects' default='OBJECT'>"
+"    <Value>OBJECT</Value>"
+"    <Value>ELEMENT</Value>"
+"  </Option>"
+"  <Option name='COMPUTED_FIELDS' type='boolean' description='Add area, perimeter, minx, miny, maxx, maxy, vertex_count and shape_kind fields worked out from the shapes' default='NO'/>"
+"  <Option name='CLIP_TO_FILTER' type='boolean' description='Clip features to the spatial filter rectangle as they are read' default='NO'/>"
+"  <Option name='CLIP_BUFFER' type='float' description='Distance (in layer units) to grow the rectangle by when clipping' default='0'/>"
+"  <Option name='READER' type='string-select' description='How objects are read when not updating. LEAN parses only the AOI types straight from the file, HFA goes through the GDAL HFA entries' default='LEAN'>"
+"    <Value>LEAN</Value>"
+"    <Value>HFA</Value>"
+"  </Option>"
+"  <Option name='REFRESH' type='boolean' description='Reload the file when ResetReading() finds it has been changed, keeping what is known about unchanged objects' default='NO'/>"
+"  <Option name='REFRESH_INTERVAL' type='int' description='Seconds between checks for changes with REFRESH. 0 checks on every ResetReading()' default='0'/>"
+"</OpenOptionList>" );
 
         poDriver->pfnIdentify = OGRAOIDriverIdentify;
         poDriver->pfnOpen = OGRAOIDriverOpen;
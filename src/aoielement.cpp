@@ -0,0 +1,970 @@
+/* ******************************************************************************
+ * Copyright (c) 2015, Sam Gillingham <gillingham.sam@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "aoielement.h"
+#include "hfa_p.h"
+#include "aoiproj.h"
+#include "math.h"
+#include <utility>
+#include <algorithm>
+
+// Fewest points an ellipse is simplified to
+#define AOI_MIN_ELLIPSE_STEPS 8
+
+// When reprojecting, rectangle and ellipse edges are halved at most
+// this many times. Without a simplify tolerance edges are densified
+// until they are within this fraction of the shape's size.
+#define AOI_MAX_DENSIFY_LEVELS 6
+#define AOI_DENSIFY_FRACTION 0.001
+
+// Simplified shapes that still cross themselves after putting back
+// vertices this many times are left as they were
+#define AOI_MAX_SIMPLIFY_ROUNDS 32
+
+AOIElement &AOIObject::AddElement()
+{
+    if( nElements == (int)aoElements.size() )
+        aoElements.resize( nElements + 1 );
+    return aoElements[nElements++];
+}
+
+void AOIObject::Swap( AOIObject &oOther )
+{
+    osName.swap( oOther.osName );
+    osDescription.swap( oOther.osDescription );
+    std::swap( nElements, oOther.nElements );
+    aoElements.swap( oOther.aoElements );
+}
+
+// Make sure the vectors have room for at least nPoints
+static void GrowTo( std::vector<double> &adfX, std::vector<double> &adfY,
+                    int nPoints )
+{
+    if( (int)adfX.size() < nPoints )
+    {
+        adfX.resize( nPoints );
+        adfY.resize( nPoints );
+    }
+}
+
+// Number of ellipse steps needed to keep within the simplify tolerance.
+// The largest error for a chord across angle t of a circle radius r
+// is r(1 - cos(t/2)). Uses the larger transformed axis as the radius.
+static int GetEllipseSteps( const AOIElement &sElement, 
+                            const AOIGeometryOptions &sOptions )
+{
+    if( sOptions.dfSimplifyTolerance <= 0 )
+        return sOptions.nEllipseSteps;
+
+    double adfX[3], adfY[3];
+    adfX[0] = sElement.dfCenterX;
+    adfY[0] = sElement.dfCenterY;
+    adfX[1] = sElement.dfCenterX + sElement.dfSize1;
+    adfY[1] = sElement.dfCenterY;
+    adfX[2] = sElement.dfCenterX;
+    adfY[2] = sElement.dfCenterY + sElement.dfSize2;
+    for( int i = 0; i < 3; i++ )
+        ApplyXformPolynomial( &sElement.sPoly, &adfX[i], &adfY[i] );
+    // the tolerance is in the target units
+    if( sOptions.poCT != NULL && !sOptions.poCT->Transform( 3, adfX, adfY ) )
+        return sOptions.nEllipseSteps;
+
+    double dfRadius = MAX( sqrt( (adfX[1] - adfX[0]) * (adfX[1] - adfX[0]) +
+                                 (adfY[1] - adfY[0]) * (adfY[1] - adfY[0]) ),
+                           sqrt( (adfX[2] - adfX[0]) * (adfX[2] - adfX[0]) +
+                                 (adfY[2] - adfY[0]) * (adfY[2] - adfY[0]) ) );
+
+    int nSteps = AOI_MIN_ELLIPSE_STEPS;
+    if( dfRadius > sOptions.dfSimplifyTolerance )
+    {
+        double dfAngle = 2 * acos( 1 - sOptions.dfSimplifyTolerance / dfRadius );
+        nSteps = MAX( nSteps, (int)ceil( 2 * M_PI / dfAngle ) );
+    }
+    return MIN( nSteps, sOptions.nEllipseSteps );
+}
+
+// Distance squared from point i to the segment a-b
+static double SegmentDistance2( const double *padfX, const double *padfY,
+                                int i, int a, int b )
+{
+    double dfDX = padfX[b] - padfX[a];
+    double dfDY = padfY[b] - padfY[a];
+    double dfPX = padfX[i] - padfX[a];
+    double dfPY = padfY[i] - padfY[a];
+    double dfLen2 = dfDX * dfDX + dfDY * dfDY;
+    if( dfLen2 > 0 )
+    {
+        double dfT = (dfPX * dfDX + dfPY * dfDY) / dfLen2;
+        if( dfT > 1 )
+            dfT = 1;
+        else if( dfT < 0 )
+            dfT = 0;
+        dfPX -= dfT * dfDX;
+        dfPY -= dfT * dfDY;
+    }
+    return dfPX * dfPX + dfPY * dfPY;
+}
+
+// Douglas-Peucker between vertices a and b, marking the ones to keep.
+// Uses an explicit stack in oScratch rather than recursion.
+static void MarkDouglasPeucker( const double *padfX, const double *padfY, 
+                                int a, int b, double dfTolerance2,
+                                AOIScratch &oScratch )
+{
+    std::vector<int> &anStack = oScratch.anStack;
+    anStack.clear();
+    anStack.push_back( a );
+    anStack.push_back( b );
+    while( !anStack.empty() )
+    {
+        int nLast = anStack.back();
+        anStack.pop_back();
+        int nFirst = anStack.back();
+        anStack.pop_back();
+
+        double dfMax = 0;
+        int nMax = -1;
+        for( int i = nFirst + 1; i < nLast; i++ )
+        {
+            double dfDist = SegmentDistance2( padfX, padfY, i, nFirst, nLast );
+            if( dfDist > dfMax )
+            {
+                dfMax = dfDist;
+                nMax = i;
+            }
+        }
+
+        if( nMax >= 0 && dfMax > dfTolerance2 )
+        {
+            oScratch.abyKeep[nMax] = 1;
+            anStack.push_back( nFirst );
+            anStack.push_back( nMax );
+            anStack.push_back( nMax );
+            anStack.push_back( nLast );
+        }
+    }
+}
+
+// Which side of a-b point c is on: > 0 left, < 0 right, 0 on the line
+static double Orientation( const double *padfX, const double *padfY,
+                           int a, int b, int c )
+{
+    return (padfX[b] - padfX[a]) * (padfY[c] - padfY[a]) 
+         - (padfY[b] - padfY[a]) * (padfX[c] - padfX[a]);
+}
+
+// Is point c, which is on the line through a and b, between them?
+static int IsOnSegment( const double *padfX, const double *padfY,
+                        int a, int b, int c )
+{
+    return padfX[c] >= MIN(padfX[a], padfX[b]) && padfX[c] <= MAX(padfX[a], padfX[b])
+        && padfY[c] >= MIN(padfY[a], padfY[b]) && padfY[c] <= MAX(padfY[a], padfY[b]);
+}
+
+// Do segments a1-a2 and b1-b2 cross or touch?
+static int SegmentsIntersect( const double *padfX, const double *padfY,
+                              int a1, int a2, int b1, int b2 )
+{
+    double d1 = Orientation( padfX, padfY, a1, a2, b1 );
+    double d2 = Orientation( padfX, padfY, a1, a2, b2 );
+    double d3 = Orientation( padfX, padfY, b1, b2, a1 );
+    double d4 = Orientation( padfX, padfY, b1, b2, a2 );
+    if( ((d1 > 0 && d2 < 0) || (d1 < 0 && d2 > 0)) 
+        && ((d3 > 0 && d4 < 0) || (d3 < 0 && d4 > 0)) )
+        return TRUE;
+    return (d1 == 0 && IsOnSegment( padfX, padfY, a1, a2, b1 ))
+        || (d2 == 0 && IsOnSegment( padfX, padfY, a1, a2, b2 ))
+        || (d3 == 0 && IsOnSegment( padfX, padfY, b1, b2, a1 ))
+        || (d4 == 0 && IsOnSegment( padfX, padfY, b1, b2, a2 ));
+}
+
+// Orders the segments of the simplified outline by their smallest x
+struct AOISegmentMinXLess
+{
+    const double *padfX;
+    const int    *panKept;
+
+    bool operator()( int i, int j ) const
+    {
+        return MIN(padfX[panKept[i]], padfX[panKept[i + 1]]) 
+             < MIN(padfX[panKept[j]], padfX[panKept[j + 1]]);
+    }
+};
+
+// Put back the removed vertex furthest from segment iSegment of the
+// simplified outline. Returns 1 if one was put back.
+static int RestoreFurthest( const double *padfX, const double *padfY,
+                            int iSegment, AOIScratch &oScratch )
+{
+    int a = oScratch.anKept[iSegment];
+    int b = oScratch.anKept[iSegment + 1];
+    double dfMax = -1;
+    int nMax = -1;
+    for( int i = a + 1; i < b; i++ )
+    {
+        double dfDist = SegmentDistance2( padfX, padfY, i, a, b );
+        if( dfDist > dfMax )
+        {
+            dfMax = dfDist;
+            nMax = i;
+        }
+    }
+    // already put back for another crossing this round
+    if( nMax < 0 || oScratch.abyKeep[nMax] )
+        return 0;
+    oScratch.abyKeep[nMax] = 1;
+    return 1;
+}
+
+// Find where the outline made of the vertices marked in oScratch.abyKeep
+// crosses or touches itself, and put back the removed vertex furthest 
+// from each segment involved. Crossings between two segments of the 
+// original outline are left alone. Segments are swept in order of x
+// so only ones that overlap in x are compared. Returns the number of
+// vertices put back.
+static int RestoreCrossings( const double *padfX, const double *padfY,
+                             int nPoints, int bRing, AOIScratch &oScratch )
+{
+    std::vector<int> &anKept = oScratch.anKept;
+    anKept.clear();
+    for( int i = 0; i < nPoints; i++ )
+    {
+        if( oScratch.abyKeep[i] )
+            anKept.push_back( i );
+    }
+
+    int nSegments = (int)anKept.size() - 1;
+    std::vector<int> &anOrder = oScratch.anOrder;
+    anOrder.resize( nSegments );
+    for( int i = 0; i < nSegments; i++ )
+        anOrder[i] = i;
+    AOISegmentMinXLess oLess;
+    oLess.padfX = padfX;
+    oLess.panKept = &anKept[0];
+    std::sort( anOrder.begin(), anOrder.end(), oLess );
+
+    int nRestored = 0;
+    for( int i = 0; i < nSegments; i++ )
+    {
+        int s = anOrder[i];
+        double dfMaxX = MAX(padfX[anKept[s]], padfX[anKept[s + 1]]);
+        for( int j = i + 1; j < nSegments; j++ )
+        {
+            int t = anOrder[j];
+            if( MIN(padfX[anKept[t]], padfX[anKept[t + 1]]) > dfMaxX )
+                break;
+
+            // neighbours share a vertex, as do the ends of a ring
+            int nLow = MIN(s, t);
+            int nHigh = MAX(s, t);
+            if( nHigh - nLow == 1 || (bRing && nLow == 0 && nHigh == nSegments - 1) )
+                continue;
+
+            if( SegmentsIntersect( padfX, padfY, anKept[s], anKept[s + 1], 
+                                   anKept[t], anKept[t + 1] ) )
+            {
+                nRestored += RestoreFurthest( padfX, padfY, s, oScratch );
+                nRestored += RestoreFurthest( padfX, padfY, t, oScratch );
+            }
+        }
+    }
+    return nRestored;
+}
+
+// Simplify the points in oScratch.adfX/adfY in place and return the
+// new count. Rings are split at the vertex furthest from the start so
+// both halves have a proper chord. A ring is left alone if simplifying
+// it would leave less than 4 points, and lines always keep their end
+// points, so shapes never collapse. Simplifying doesn't make a shape
+// cross itself: where the simplified outline crosses or touches itself 
+// the vertices removed from the segments involved are put back until 
+// it doesn't, and if that takes too long the shape is left alone.
+static int Simplify( int nPoints, int bRing, double dfTolerance, 
+                     AOIScratch &oScratch )
+{
+    int nMin = bRing ? 4 : 2;
+    if( nPoints <= nMin )
+        return nPoints;
+
+    double *padfX = &oScratch.adfX[0];
+    double *padfY = &oScratch.adfY[0];
+    double dfTolerance2 = dfTolerance * dfTolerance;
+
+    oScratch.abyKeep.assign( nPoints, 0 );
+    oScratch.abyKeep[0] = 1;
+    oScratch.abyKeep[nPoints - 1] = 1;
+
+    if( bRing )
+    {
+        int nFar = 1;
+        double dfMax = -1;
+        for( int i = 1; i < nPoints - 1; i++ )
+        {
+            double dfDX = padfX[i] - padfX[0];
+            double dfDY = padfY[i] - padfY[0];
+            if( dfDX * dfDX + dfDY * dfDY > dfMax )
+            {
+                dfMax = dfDX * dfDX + dfDY * dfDY;
+                nFar = i;
+            }
+        }
+        oScratch.abyKeep[nFar] = 1;
+        MarkDouglasPeucker( padfX, padfY, 0, nFar, dfTolerance2, oScratch );
+        MarkDouglasPeucker( padfX, padfY, nFar, nPoints - 1, dfTolerance2, oScratch );
+    }
+    else
+    {
+        MarkDouglasPeucker( padfX, padfY, 0, nPoints - 1, dfTolerance2, oScratch );
+    }
+
+    int nKept = 0;
+    for( int i = 0; i < nPoints; i++ )
+        nKept += oScratch.abyKeep[i];
+    if( nKept < nMin )
+        return nPoints;
+
+    int nRounds = 0;
+    while( RestoreCrossings( padfX, padfY, nPoints, bRing, oScratch ) > 0 )
+    {
+        if( ++nRounds == AOI_MAX_SIMPLIFY_ROUNDS )
+            return nPoints;
+    }
+
+    int nOut = 0;
+    for( int i = 0; i < nPoints; i++ )
+    {
+        if( oScratch.abyKeep[i] )
+        {
+            padfX[nOut] = padfX[i];
+            padfY[nOut] = padfY[i];
+            nOut++;
+        }
+    }
+    return nOut;
+}
+
+// Point on the outline of a rectangle or ellipse in the element's own
+// coordinates. For rectangles dfParam goes from 0 to 4 around the
+// corners (TL, TR, BR, BL), for ellipses it is the angle.
+static void GetLocalPoint( const AOIElement &sElement, double dfParam,
+                           double *pdfX, double *pdfY )
+{
+    if( sElement.eKind == AOI_SHAPE_ELLIPSE )
+    {
+        *pdfX = sElement.dfCenterX + (sElement.dfSize1 * cos(dfParam));
+        *pdfY = sElement.dfCenterY + (sElement.dfSize2 * sin(dfParam));
+        return;
+    }
+
+    static const double adfCornerX[5] = { -0.5, 0.5, 0.5, -0.5, -0.5 };
+    static const double adfCornerY[5] = { 0.5, 0.5, -0.5, -0.5, 0.5 };
+    int nCorner = MIN( (int)dfParam, 3 );
+    double dfFrac = dfParam - nCorner;
+    *pdfX = sElement.dfCenterX + sElement.dfSize1 * 
+            (adfCornerX[nCorner] + dfFrac * (adfCornerX[nCorner + 1] - adfCornerX[nCorner]));
+    *pdfY = sElement.dfCenterY + sElement.dfSize2 * 
+            (adfCornerY[nCorner] + dfFrac * (adfCornerY[nCorner + 1] - adfCornerY[nCorner]));
+}
+
+// Add points to a reprojected rectangle or ellipse outline where the 
+// middle of an edge is further than the tolerance from the chord 
+// between its ends. oScratch.adfParam has the parameter of each point.
+// All the new points for one level go through a single Transform().
+static int Densify( const AOIElement &sElement, 
+                    const AOIGeometryOptions &sOptions,
+                    int nPoints, AOIScratch &oScratch )
+{
+    double dfTolerance = sOptions.dfSimplifyTolerance;
+    if( dfTolerance <= 0 )
+    {
+        OGREnvelope sEnvelope;
+        for( int i = 0; i < nPoints; i++ )
+            sEnvelope.Merge( oScratch.adfX[i], oScratch.adfY[i] );
+        dfTolerance = AOI_DENSIFY_FRACTION * MAX( sEnvelope.MaxX - sEnvelope.MinX,
+                                                  sEnvelope.MaxY - sEnvelope.MinY );
+        if( dfTolerance <= 0 )
+            return nPoints;
+    }
+    double dfTolerance2 = dfTolerance * dfTolerance;
+
+    for( int nLevel = 0; nLevel < AOI_MAX_DENSIFY_LEVELS; nLevel++ )
+    {
+        int nSegments = nPoints - 1;
+        oScratch.adfMidX.resize( nSegments );
+        oScratch.adfMidY.resize( nSegments );
+        oScratch.anSuccess.resize( nSegments );
+        for( int i = 0; i < nSegments; i++ )
+        {
+            GetLocalPoint( sElement, 
+                           (oScratch.adfParam[i] + oScratch.adfParam[i + 1]) / 2,
+                           &oScratch.adfMidX[i], &oScratch.adfMidY[i] );
+            ApplyXformPolynomial( &sElement.sPoly, &oScratch.adfMidX[i], 
+                                  &oScratch.adfMidY[i] );
+        }
+        sOptions.poCT->Transform( nSegments, &oScratch.adfMidX[0], 
+                                  &oScratch.adfMidY[0], NULL, 
+                                  &oScratch.anSuccess[0] );
+
+        oScratch.abyKeep.assign( nSegments, 0 );
+        int nAdd = 0;
+        for( int i = 0; i < nSegments; i++ )
+        {
+            if( !oScratch.anSuccess[i] )
+                continue;
+            double dfDX = oScratch.adfMidX[i] - (oScratch.adfX[i] + oScratch.adfX[i + 1]) / 2;
+            double dfDY = oScratch.adfMidY[i] - (oScratch.adfY[i] + oScratch.adfY[i + 1]) / 2;
+            if( dfDX * dfDX + dfDY * dfDY > dfTolerance2 )
+            {
+                oScratch.abyKeep[i] = 1;
+                nAdd++;
+            }
+        }
+        if( nAdd == 0 )
+            break;
+
+        // spread the points out from the end, putting the new
+        // ones in between
+        GrowTo( oScratch.adfX, oScratch.adfY, nPoints + nAdd );
+        oScratch.adfParam.resize( nPoints + nAdd );
+        int iOut = nPoints + nAdd - 1;
+        for( int i = nPoints - 1; i >= 0; i-- )
+        {
+            oScratch.adfX[iOut] = oScratch.adfX[i];
+            oScratch.adfY[iOut] = oScratch.adfY[i];
+            oScratch.adfParam[iOut] = oScratch.adfParam[i];
+            iOut--;
+            if( i > 0 && oScratch.abyKeep[i - 1] )
+            {
+                oScratch.adfX[iOut] = oScratch.adfMidX[i - 1];
+                oScratch.adfY[iOut] = oScratch.adfMidY[i - 1];
+                oScratch.adfParam[iOut] = (oScratch.adfParam[i - 1] + oScratch.adfParam[i]) / 2;
+                iOut--;
+            }
+        }
+        nPoints += nAdd;
+    }
+
+    return nPoints;
+}
+
+int AOIElementGetOutline( const AOIElement &sElement, 
+                          const AOIGeometryOptions &sOptions,
+                          AOIScratch &oScratch )
+{
+    std::vector<double> &adfX = oScratch.adfX;
+    std::vector<double> &adfY = oScratch.adfY;
+    int nOut = 0;
+    switch( sElement.eKind )
+    {
+        case AOI_SHAPE_POLYGON:
+        {
+            // all the vertices then back to the first
+            GrowTo( adfX, adfY, sElement.nPoints + 1 );
+            for( int i = 0; i < sElement.nPoints; i++ )
+            {
+                adfX[i] = sElement.adfX[i];
+                adfY[i] = sElement.adfY[i];
+            }
+            adfX[sElement.nPoints] = sElement.adfX[0];
+            adfY[sElement.nPoints] = sElement.adfY[0];
+            nOut = sElement.nPoints + 1;
+            break;
+        }
+
+        case AOI_SHAPE_LINE:
+        case AOI_SHAPE_POINT:
+        {
+            GrowTo( adfX, adfY, sElement.nPoints );
+            for( int i = 0; i < sElement.nPoints; i++ )
+            {
+                adfX[i] = sElement.adfX[i];
+                adfY[i] = sElement.adfY[i];
+            }
+            nOut = sElement.nPoints;
+            break;
+        }
+
+        case AOI_SHAPE_RECTANGLE:
+        {
+            // TL, TR, BR, BL and back to TL
+            // orientation always seems to be 0 - handled by the polynomial
+            double dfHalfWidth = sElement.dfSize1 / 2;
+            double dfHalfHeight = sElement.dfSize2 / 2;
+            GrowTo( adfX, adfY, 5 );
+            adfX[0] = sElement.dfCenterX - dfHalfWidth;
+            adfY[0] = sElement.dfCenterY + dfHalfHeight;
+            adfX[1] = sElement.dfCenterX + dfHalfWidth;
+            adfY[1] = adfY[0];
+            adfX[2] = adfX[1];
+            adfY[2] = sElement.dfCenterY - dfHalfHeight;
+            adfX[3] = adfX[0];
+            adfY[3] = adfY[2];
+            adfX[4] = adfX[0];
+            adfY[4] = adfY[0];
+            nOut = 5;
+            if( sOptions.poCT != NULL )
+            {
+                oScratch.adfParam.resize( nOut );
+                for( int i = 0; i < nOut; i++ )
+                    oScratch.adfParam[i] = i;
+            }
+            break;
+        }
+
+        case AOI_SHAPE_ELLIPSE:
+        {
+            // orientation always seems to be 0 - handled by the polynomial
+            int nEllipseSteps = GetEllipseSteps( sElement, sOptions );
+            GrowTo( adfX, adfY, nEllipseSteps + 1 );
+            for( int i = 0; i < nEllipseSteps; i++ )
+            {
+                double dfAlpha = (2 * M_PI * i) / nEllipseSteps;
+                adfX[i] = sElement.dfCenterX + (sElement.dfSize1 * cos(dfAlpha));
+                adfY[i] = sElement.dfCenterY + (sElement.dfSize2 * sin(dfAlpha));
+            }
+            // close poly
+            adfX[nEllipseSteps] = sElement.dfCenterX + sElement.dfSize1;
+            adfY[nEllipseSteps] = sElement.dfCenterY;
+            nOut = nEllipseSteps + 1;
+            if( sOptions.poCT != NULL )
+            {
+                oScratch.adfParam.resize( nOut );
+                for( int i = 0; i < nOut; i++ )
+                    oScratch.adfParam[i] = (2 * M_PI * i) / nEllipseSteps;
+            }
+            break;
+        }
+    }
+
+    // apply the transform - this handles rotation etc
+    for( int i = 0; i < nOut; i++ )
+        ApplyXformPolynomial( &sElement.sPoly, &adfX[i], &adfY[i] );
+
+    // then reproject the whole outline in one go
+    if( sOptions.poCT != NULL && nOut > 0 )
+    {
+        if( !sOptions.poCT->Transform( nOut, &adfX[0], &adfY[0] ) )
+        {
+            CPLError( CE_Warning, CPLE_AppDefined, 
+                      "Failed to reproject AOI shape. Ignoring it." );
+            return 0;
+        }
+        if( sElement.eKind == AOI_SHAPE_RECTANGLE || sElement.eKind == AOI_SHAPE_ELLIPSE )
+            nOut = Densify( sElement, sOptions, nOut, oScratch );
+    }
+
+    // simplify after the transform so the tolerance is in layer units
+    // (target units if reprojecting)
+    if( sOptions.dfSimplifyTolerance > 0 && sElement.eKind != AOI_SHAPE_POINT )
+        nOut = Simplify( nOut, sElement.eKind != AOI_SHAPE_LINE, 
+                         sOptions.dfSimplifyTolerance, oScratch );
+
+    return nOut;
+}
+
+// Clip the closed ring in oScratch.adfX/adfY against one side of the 
+// clip rectangle (iSide 0 to 3 for MinX, MaxX, MinY, MaxY). The result
+// is left in adfX/adfY, closed. adfMidX/adfMidY are used as the
+// other buffer.
+static int ClipRingSide( int nPoints, int iSide, const OGREnvelope &sClip,
+                         AOIScratch &oScratch )
+{
+    double dfEdge = iSide == 0 ? sClip.MinX : iSide == 1 ? sClip.MaxX 
+                  : iSide == 2 ? sClip.MinY : sClip.MaxY;
+    int bY = iSide >= 2;
+    int bMax = iSide == 1 || iSide == 3;
+    std::vector<double> &adfInX = oScratch.adfX;
+    std::vector<double> &adfInY = oScratch.adfY;
+    std::vector<double> &adfOutX = oScratch.adfMidX;
+    std::vector<double> &adfOutY = oScratch.adfMidY;
+    // at most one extra point per edge
+    GrowTo( adfOutX, adfOutY, 2 * nPoints + 1 );
+
+    int nOut = 0;
+    for( int i = 0; i < nPoints - 1; i++ )
+    {
+        double dfX0 = adfInX[i], dfY0 = adfInY[i];
+        double dfX1 = adfInX[i + 1], dfY1 = adfInY[i + 1];
+        double dfV0 = bY ? dfY0 : dfX0;
+        double dfV1 = bY ? dfY1 : dfX1;
+        int bIn0 = bMax ? dfV0 <= dfEdge : dfV0 >= dfEdge;
+        int bIn1 = bMax ? dfV1 <= dfEdge : dfV1 >= dfEdge;
+
+        if( bIn0 )
+        {
+            adfOutX[nOut] = dfX0;
+            adfOutY[nOut] = dfY0;
+            nOut++;
+        }
+        if( bIn0 != bIn1 )
+        {
+            double dfT = (dfEdge - dfV0) / (dfV1 - dfV0);
+            adfOutX[nOut] = bY ? dfX0 + dfT * (dfX1 - dfX0) : dfEdge;
+            adfOutY[nOut] = bY ? dfEdge : dfY0 + dfT * (dfY1 - dfY0);
+            nOut++;
+        }
+    }
+    if( nOut > 0 )
+    {
+        adfOutX[nOut] = adfOutX[0];
+        adfOutY[nOut] = adfOutY[0];
+        nOut++;
+    }
+
+    adfInX.swap( adfOutX );
+    adfInY.swap( adfOutY );
+    return nOut;
+}
+
+// Clip the outline of an element in oScratch to the clip rectangle
+static OGRGeometry *ClipOutline( AOIShapeKind eKind, int nPoints, 
+                                 const OGREnvelope &sClip, AOIScratch &oScratch )
+{
+    std::vector<double> &adfX = oScratch.adfX;
+    std::vector<double> &adfY = oScratch.adfY;
+
+    // points are either inside or outside so don't get here
+    if( eKind == AOI_SHAPE_POINT )
+        return new OGRPoint( adfX[0], adfY[0] );
+
+    if( eKind != AOI_SHAPE_LINE )
+    {
+        for( int iSide = 0; iSide < 4 && nPoints > 0; iSide++ )
+            nPoints = ClipRingSide( nPoints, iSide, sClip, oScratch );
+        // a triangle and the closing point
+        if( nPoints < 4 )
+            return NULL;
+
+        OGRLinearRing *poRing = new OGRLinearRing();
+        poRing->setPoints( nPoints, &adfX[0], &adfY[0] );
+        OGRPolygon *poPolygon = new OGRPolygon();
+        poPolygon->addRingDirectly( poRing );
+        return poPolygon;
+    }
+
+    // Liang-Barsky on each segment, starting a new part each time the
+    // line leaves the rectangle
+    OGRMultiLineString *poMulti = new OGRMultiLineString();
+    OGRLineString *poPart = NULL;
+    for( int i = 0; i < nPoints - 1; i++ )
+    {
+        double dfX0 = adfX[i], dfY0 = adfY[i];
+        double dfDX = adfX[i + 1] - dfX0, dfDY = adfY[i + 1] - dfY0;
+        double adfP[4] = { -dfDX, dfDX, -dfDY, dfDY };
+        double adfQ[4] = { dfX0 - sClip.MinX, sClip.MaxX - dfX0, 
+                           dfY0 - sClip.MinY, sClip.MaxY - dfY0 };
+        double dfT0 = 0, dfT1 = 1;
+        int bVisible = TRUE;
+        for( int j = 0; j < 4 && bVisible; j++ )
+        {
+            if( adfP[j] == 0 )
+            {
+                bVisible = adfQ[j] >= 0;
+                continue;
+            }
+            double dfT = adfQ[j] / adfP[j];
+            if( adfP[j] < 0 )
+                dfT0 = MAX( dfT0, dfT );
+            else
+                dfT1 = MIN( dfT1, dfT );
+            bVisible = dfT0 <= dfT1;
+        }
+        if( !bVisible )
+        {
+            poPart = NULL;
+            continue;
+        }
+
+        if( poPart == NULL || dfT0 > 0 )
+        {
+            poPart = new OGRLineString();
+            poMulti->addGeometryDirectly( poPart );
+            poPart->addPoint( dfX0 + dfT0 * dfDX, dfY0 + dfT0 * dfDY );
+        }
+        poPart->addPoint( dfX0 + dfT1 * dfDX, dfY0 + dfT1 * dfDY );
+        if( dfT1 < 1 )
+            poPart = NULL;
+    }
+
+    if( poMulti->getNumGeometries() == 0 )
+    {
+        delete poMulti;
+        return NULL;
+    }
+    if( poMulti->getNumGeometries() == 1 )
+    {
+        OGRGeometry *poLine = poMulti->getGeometryRef( 0 );
+        poMulti->removeGeometry( 0, FALSE );
+        delete poMulti;
+        return poLine;
+    }
+    return poMulti;
+}
+
+OGRGeometry *AOIElementToGeometry( const AOIElement &sElement, 
+                                   const AOIGeometryOptions &sOptions,
+                                   AOIScratch &oScratch )
+{
+    std::vector<double> &adfX = oScratch.adfX;
+    std::vector<double> &adfY = oScratch.adfY;
+    int nPoints = AOIElementGetOutline( sElement, sOptions, oScratch );
+    if( nPoints == 0 )
+        return NULL;
+
+    if( sOptions.bClip )
+    {
+        OGREnvelope sEnvelope;
+        for( int i = 0; i < nPoints; i++ )
+            sEnvelope.Merge( adfX[i], adfY[i] );
+        if( !sOptions.sClipEnvelope.Intersects( sEnvelope ) )
+            return NULL;
+        // nothing to do if it is all inside
+        if( !sOptions.sClipEnvelope.Contains( sEnvelope ) )
+            return ClipOutline( sElement.eKind, nPoints, sOptions.sClipEnvelope, oScratch );
+    }
+
+    switch( sElement.eKind )
+    {
+        case AOI_SHAPE_POLYGON:
+        case AOI_SHAPE_RECTANGLE:
+        case AOI_SHAPE_ELLIPSE:
+        {
+            OGRLinearRing *poRing = new OGRLinearRing();
+            poRing->setPoints( nPoints, &adfX[0], &adfY[0] );
+            OGRPolygon *poPolygon = new OGRPolygon();
+            poPolygon->addRingDirectly( poRing );
+            return poPolygon;
+        }
+
+        case AOI_SHAPE_LINE:
+        {
+            OGRLineString *poLine = new OGRLineString();
+            poLine->setPoints( nPoints, &adfX[0], &adfY[0] );
+            return poLine;
+        }
+
+        case AOI_SHAPE_POINT:
+            return new OGRPoint( adfX[0], adfY[0] );
+    }
+
+    return NULL;
+}
+
+int AOIElementGetAffine( const AOIElement &sElement, double *padfAffine )
+{
+    const Efga_Polynomial *pPoly = &sElement.sPoly;
+    if( pPoly->order == 0 )
+    {
+        padfAffine[0] = 0;
+        padfAffine[1] = 1;
+        padfAffine[2] = 0;
+        padfAffine[3] = 0;
+        padfAffine[4] = 0;
+        padfAffine[5] = 1;
+        return TRUE;
+    }
+    else if( pPoly->order == 1 )
+    {
+        // same terms as ApplyXformPolynomial()
+        padfAffine[0] = pPoly->polycoefvector[0];
+        padfAffine[1] = pPoly->polycoefmtx[0];
+        padfAffine[2] = pPoly->polycoefmtx[2];
+        padfAffine[3] = pPoly->polycoefvector[1];
+        padfAffine[4] = pPoly->polycoefmtx[1];
+        padfAffine[5] = pPoly->polycoefmtx[3];
+        return TRUE;
+    }
+    return FALSE;
+}
+
+void AOIComposeAffine( const double *padfFirst, const double *padfSecond,
+                       double *padfOut )
+{
+    double adfOut[6];
+    adfOut[0] = padfSecond[0] + padfSecond[1] * padfFirst[0] + padfSecond[2] * padfFirst[3];
+    adfOut[1] = padfSecond[1] * padfFirst[1] + padfSecond[2] * padfFirst[4];
+    adfOut[2] = padfSecond[1] * padfFirst[2] + padfSecond[2] * padfFirst[5];
+    adfOut[3] = padfSecond[3] + padfSecond[4] * padfFirst[0] + padfSecond[5] * padfFirst[3];
+    adfOut[4] = padfSecond[4] * padfFirst[1] + padfSecond[5] * padfFirst[4];
+    adfOut[5] = padfSecond[4] * padfFirst[2] + padfSecond[5] * padfFirst[5];
+    // allow padfOut to be one of the inputs
+    for( int i = 0; i < 6; i++ )
+        padfOut[i] = adfOut[i];
+}
+
+int AOIElementIsAnalytic( const AOIElement &sElement, 
+                          const AOIGeometryOptions &sOptions )
+{
+    return sOptions.poCT == NULL 
+            && (sElement.eKind == AOI_SHAPE_RECTANGLE || sElement.eKind == AOI_SHAPE_ELLIPSE)
+            && sElement.sPoly.order <= 1;
+}
+
+void AOIElementGetAffineEnvelope( const AOIElement &sElement, 
+                                  const double *padfAffine,
+                                  OGREnvelope *psEnvelope )
+{
+    double dfCenterX = padfAffine[0] + padfAffine[1] * sElement.dfCenterX 
+                        + padfAffine[2] * sElement.dfCenterY;
+    double dfCenterY = padfAffine[3] + padfAffine[4] * sElement.dfCenterX 
+                        + padfAffine[5] * sElement.dfCenterY;
+    double dfHalfX, dfHalfY;
+    if( sElement.eKind == AOI_SHAPE_RECTANGLE )
+    {
+        // furthest corner in each direction
+        dfHalfX = (fabs(padfAffine[1]) * sElement.dfSize1 
+                    + fabs(padfAffine[2]) * sElement.dfSize2) / 2;
+        dfHalfY = (fabs(padfAffine[4]) * sElement.dfSize1 
+                    + fabs(padfAffine[5]) * sElement.dfSize2) / 2;
+    }
+    else
+    {
+        // maximum of a cos(t) + b sin(t) is sqrt(a^2 + b^2)
+        dfHalfX = sqrt( padfAffine[1] * sElement.dfSize1 * padfAffine[1] * sElement.dfSize1
+                      + padfAffine[2] * sElement.dfSize2 * padfAffine[2] * sElement.dfSize2 );
+        dfHalfY = sqrt( padfAffine[4] * sElement.dfSize1 * padfAffine[4] * sElement.dfSize1
+                      + padfAffine[5] * sElement.dfSize2 * padfAffine[5] * sElement.dfSize2 );
+    }
+    psEnvelope->MinX = dfCenterX - dfHalfX;
+    psEnvelope->MaxX = dfCenterX + dfHalfX;
+    psEnvelope->MinY = dfCenterY - dfHalfY;
+    psEnvelope->MaxY = dfCenterY + dfHalfY;
+}
+
+void AOIElementGetEnvelope( const AOIElement &sElement, 
+                            const AOIGeometryOptions &sOptions,
+                            AOIScratch &oScratch, OGREnvelope *psEnvelope )
+{
+    double adfAffine[6];
+    if( AOIElementIsAnalytic( sElement, sOptions ) && AOIElementGetAffine( sElement, adfAffine ) )
+    {
+        AOIElementGetAffineEnvelope( sElement, adfAffine, psEnvelope );
+        return;
+    }
+
+    int nPoints = AOIElementGetOutline( sElement, sOptions, oScratch );
+    *psEnvelope = OGREnvelope();
+    for( int i = 0; i < nPoints; i++ )
+        psEnvelope->Merge( oScratch.adfX[i], oScratch.adfY[i] );
+}
+
+void AOIElementGetMeasures( const AOIElement &sElement, 
+                            const AOIGeometryOptions &sOptions,
+                            AOIScratch &oScratch, double *pdfArea, 
+                            double *pdfPerimeter )
+{
+    *pdfArea = 0;
+    *pdfPerimeter = 0;
+    if( sElement.eKind == AOI_SHAPE_POINT )
+        return;
+
+    double adfAffine[6];
+    if( sOptions.poCT == NULL && AOIElementGetAffine( sElement, adfAffine ) )
+    {
+        // areas scale by the determinant
+        double dfDet = fabs( adfAffine[1] * adfAffine[5] - adfAffine[2] * adfAffine[4] );
+        if( sElement.eKind == AOI_SHAPE_RECTANGLE )
+        {
+            // a parallelogram with sides the images of (width, 0) and (0, height)
+            *pdfArea = sElement.dfSize1 * sElement.dfSize2 * dfDet;
+            *pdfPerimeter = 2 * (sElement.dfSize1 * hypot( adfAffine[1], adfAffine[4] )
+                                 + sElement.dfSize2 * hypot( adfAffine[2], adfAffine[5] ));
+        }
+        else if( sElement.eKind == AOI_SHAPE_ELLIPSE )
+        {
+            *pdfArea = M_PI * sElement.dfSize1 * sElement.dfSize2 * dfDet;
+
+            // The semi axes of the result are the singular values of the
+            // affine times diag(a, b). Their squares sum to the sum of the
+            // squared terms and their product is the determinant.
+            double dfM00 = adfAffine[1] * sElement.dfSize1;
+            double dfM01 = adfAffine[2] * sElement.dfSize2;
+            double dfM10 = adfAffine[4] * sElement.dfSize1;
+            double dfM11 = adfAffine[5] * sElement.dfSize2;
+            double dfSumSquares = dfM00 * dfM00 + dfM01 * dfM01 + dfM10 * dfM10 + dfM11 * dfM11;
+            double dfProduct = fabs( dfM00 * dfM11 - dfM01 * dfM10 );
+            double dfSum = sqrt( dfSumSquares + 2 * dfProduct );
+            double dfDiff = sqrt( MAX( 0.0, dfSumSquares - 2 * dfProduct ) );
+            double dfA = (dfSum + dfDiff) / 2;
+            double dfB = (dfSum - dfDiff) / 2;
+            *pdfPerimeter = M_PI * (3 * (dfA + dfB) - sqrt( (3 * dfA + dfB) * (dfA + 3 * dfB) ));
+        }
+        else
+        {
+            // shoelace over the file coordinates, lengths with the
+            // polynomial applied a point at a time
+            const double *padfX = sElement.adfX.data();
+            const double *padfY = sElement.adfY.data();
+            int nPoints = sElement.nPoints;
+            int bRing = sElement.eKind == AOI_SHAPE_POLYGON;
+            double dfArea2 = 0;
+            double dfLastX = 0, dfLastY = 0;
+            for( int i = 0; i < nPoints; i++ )
+            {
+                int iNext = (i + 1) % nPoints;
+                dfArea2 += padfX[i] * padfY[iNext] - padfX[iNext] * padfY[i];
+
+                double dfX = adfAffine[0] + adfAffine[1] * padfX[i] + adfAffine[2] * padfY[i];
+                double dfY = adfAffine[3] + adfAffine[4] * padfX[i] + adfAffine[5] * padfY[i];
+                if( i > 0 )
+                    *pdfPerimeter += hypot( dfX - dfLastX, dfY - dfLastY );
+                dfLastX = dfX;
+                dfLastY = dfY;
+            }
+            if( bRing && nPoints > 1 )
+            {
+                // back to the start - nothing if already closed
+                double dfX = adfAffine[0] + adfAffine[1] * padfX[0] + adfAffine[2] * padfY[0];
+                double dfY = adfAffine[3] + adfAffine[4] * padfX[0] + adfAffine[5] * padfY[0];
+                *pdfPerimeter += hypot( dfX - dfLastX, dfY - dfLastY );
+                *pdfArea = fabs( dfArea2 ) / 2 * dfDet;
+            }
+        }
+        return;
+    }
+
+    // measure the outline - closed for everything but lines
+    int nPoints = AOIElementGetOutline( sElement, sOptions, oScratch );
+    double dfArea2 = 0;
+    for( int i = 1; i < nPoints; i++ )
+    {
+        double dfX0 = oScratch.adfX[i - 1], dfY0 = oScratch.adfY[i - 1];
+        double dfX1 = oScratch.adfX[i], dfY1 = oScratch.adfY[i];
+        *pdfPerimeter += hypot( dfX1 - dfX0, dfY1 - dfY0 );
+        dfArea2 += dfX0 * dfY1 - dfX1 * dfY0;
+    }
+    if( sElement.eKind != AOI_SHAPE_LINE )
+        *pdfArea = fabs( dfArea2 ) / 2;
+}
+
+const char *AOIShapeKindName( AOIShapeKind eKind )
+{
+    switch( eKind )
+    {
+        case AOI_SHAPE_POLYGON:     return "polygon";
+        case AOI_SHAPE_RECTANGLE:   return "rectangle";
+        case AOI_SHAPE_ELLIPSE:     return "ellipse";
+        case AOI_SHAPE_LINE:        return "line";
+        case AOI_SHAPE_POINT:       return "point";
+    }
+    return "unknown";
+}
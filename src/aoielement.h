@@ -0,0 +1,212 @@
+/* ******************************************************************************
+ * Copyright (c) 2015, Sam Gillingham <gillingham.sam@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef AOIELEMENT_H
+#define AOIELEMENT_H
+
+#include <ogr_geometry.h>
+#include <ogr_spatialref.h>
+#include <cpl_string.h>
+#include <vector>
+#include <math.h>
+#include "hfa.h"
+
+// The kinds of shape that can appear in an AOI
+enum AOIShapeKind
+{
+    AOI_SHAPE_POLYGON,
+    AOI_SHAPE_RECTANGLE,
+    AOI_SHAPE_ELLIPSE,
+    AOI_SHAPE_LINE,
+    AOI_SHAPE_POINT
+};
+
+// One shape as read from the file, before the polynomial has been applied.
+// Polygons, lines and points use the vertex arrays. Rectangles and
+// ellipses use the centre and sizes (width and height for rectangles,
+// semi major and semi minor axes for ellipses).
+struct AOIElement
+{
+    AOIShapeKind        eKind;
+    Efga_Polynomial     sPoly;
+
+    int                 nPoints;
+    std::vector<double> adfX;   // capacity is kept between features
+    std::vector<double> adfY;
+
+    double              dfCenterX;
+    double              dfCenterY;
+    double              dfSize1;
+    double              dfSize2;
+
+    // Which Element_2_Eant in the group the shape came from, eg "0/1".
+    // Only filled in when the layer has a feature per element.
+    CPLString           osGroupPath;
+};
+
+// All the shapes for one Eaoi_AoiObjectType.
+// The layer keeps one of these and reuses it for each feature so
+// once it has grown to the size of the largest object decoding
+// doesn't allocate.
+class AOIObject
+{
+  public:
+    CPLString               osName;
+    CPLString               osDescription;
+    int                     nElements;
+    std::vector<AOIElement> aoElements;
+
+                        AOIObject() { nElements = 0; }
+
+    void                Clear() { nElements = 0; }
+    AOIElement         &AddElement();
+    // swaps contents, capacity included
+    void                Swap( AOIObject &oOther );
+};
+
+// Scratch space used when turning elements into geometries. Kept by
+// the caller and reused so building geometries doesn't allocate once
+// it has grown.
+struct AOIScratch
+{
+    std::vector<double> adfX;
+    std::vector<double> adfY;
+    std::vector<int>    anStack;
+    std::vector<char>   abyKeep;
+    // for checking simplified outlines don't cross themselves
+    std::vector<int>    anKept;
+    std::vector<int>    anOrder;
+
+    // for densifying rectangles and ellipses after reprojection
+    std::vector<double> adfParam;
+    std::vector<double> adfMidX;
+    std::vector<double> adfMidY;
+    std::vector<int>    anSuccess;
+};
+
+// Settings for turning elements into geometries
+struct AOIGeometryOptions
+{
+    int                 nEllipseSteps;
+    // Douglas-Peucker tolerance applied after the polynomial, 0 for none.
+    // Also reduces the number of ellipse steps to match.
+    double              dfSimplifyTolerance;
+    // Applied straight after the polynomial when not NULL. Rectangles
+    // and ellipses are then densified in the target coordinates so
+    // their curved edges stay within the simplify tolerance (or a
+    // small fraction of their size if not simplifying).
+    OGRCoordinateTransformation *poCT;
+    // AOIElementToGeometry() clips to sClipEnvelope if set. Outlines
+    // and envelopes are never clipped.
+    int                 bClip;
+    OGREnvelope         sClipEnvelope;
+
+                        AOIGeometryOptions() 
+                        { 
+                            nEllipseSteps = 36; 
+                            dfSimplifyTolerance = 0; 
+                            poCT = NULL;
+                            bClip = FALSE;
+                        }
+};
+
+// Fill oScratch.adfX/adfY with the outline of the element with the 
+// polynomial applied and simplified if requested. Polygons, rectangles
+// and ellipses are closed. Returns the number of points, 0 if the
+// points could not be reprojected.
+int AOIElementGetOutline( const AOIElement &sElement, 
+                          const AOIGeometryOptions &sOptions,
+                          AOIScratch &oScratch );
+
+// Build an OGRGeometry for the element using oScratch.
+// The point arrays of the returned geometry are exactly sized.
+// When clipping, rings are clipped with Sutherland-Hodgman (so a
+// concave ring cut into pieces stays one ring joined along the clip 
+// edges) and lines with Liang-Barsky, which can give a multi line. 
+// Returns NULL if nothing is left.
+OGRGeometry *AOIElementToGeometry( const AOIElement &sElement, 
+                                   const AOIGeometryOptions &sOptions,
+                                   AOIScratch &oScratch );
+
+// The polynomial of the element as an affine transform laid out like
+// a GDAL geotransform (x' = a[0] + a[1]x + a[2]y, y' = a[3] + a[4]x + a[5]y).
+// Returns FALSE if the polynomial is higher order than 1.
+int AOIElementGetAffine( const AOIElement &sElement, double *padfAffine );
+
+// padfOut = padfSecond applied after padfFirst
+void AOIComposeAffine( const double *padfFirst, const double *padfSecond,
+                       double *padfOut );
+
+// Rectangles and ellipses with an affine polynomial can be dealt with
+// exactly without tessellating them. Never the case when reprojecting.
+int AOIElementIsAnalytic( const AOIElement &sElement, 
+                          const AOIGeometryOptions &sOptions );
+
+// Whether a point in the element's own coordinates (ie before the
+// polynomial is applied) is inside a rectangle or ellipse
+inline int AOIShapeContainsLocal( AOIShapeKind eKind, double dfCenterX, 
+                                  double dfCenterY, double dfSize1, 
+                                  double dfSize2, double dfX, double dfY )
+{
+    double dfU = dfX - dfCenterX;
+    double dfV = dfY - dfCenterY;
+    if( eKind == AOI_SHAPE_RECTANGLE )
+        return fabs(dfU) * 2 <= dfSize1 && fabs(dfV) * 2 <= dfSize2;
+    dfU /= dfSize1;
+    dfV /= dfSize2;
+    return dfU * dfU + dfV * dfV <= 1;
+}
+
+inline int AOIElementContainsLocal( const AOIElement &sElement, 
+                                    double dfX, double dfY )
+{
+    return AOIShapeContainsLocal( sElement.eKind, sElement.dfCenterX, 
+                                  sElement.dfCenterY, sElement.dfSize1,
+                                  sElement.dfSize2, dfX, dfY );
+}
+
+// Exact bounds of a rectangle or ellipse once padfAffine has been
+// applied to its own coordinates
+void AOIElementGetAffineEnvelope( const AOIElement &sElement, 
+                                  const double *padfAffine,
+                                  OGREnvelope *psEnvelope );
+
+// Bounds of the element in layer coordinates. Exact for analytic
+// elements, otherwise the bounds of the outline.
+void AOIElementGetEnvelope( const AOIElement &sElement, 
+                            const AOIGeometryOptions &sOptions,
+                            AOIScratch &oScratch, OGREnvelope *psEnvelope );
+
+// Area and perimeter (length for lines) of the element in layer units 
+// worked out from the shape parameters. Exact for polygons, lines and
+// rectangles with an affine polynomial. Ellipses have an exact area and
+// Ramanujan's approximation for the perimeter. Otherwise (higher order
+// polynomials or reprojecting) they are measured on the outline.
+void AOIElementGetMeasures( const AOIElement &sElement, 
+                            const AOIGeometryOptions &sOptions,
+                            AOIScratch &oScratch, double *pdfArea, 
+                            double *pdfPerimeter );
+
+// "polygon", "rectangle", "ellipse", "line" or "point"
+const char *AOIShapeKindName( AOIShapeKind eKind );
+
+#endif // AOIELEMENT_H
@@ -0,0 +1,267 @@
+/* ******************************************************************************
+ * Copyright (c) 2015, Sam Gillingham <gillingham.sam@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "aoifeaturecache.h"
+
+// Part types in Entry::abyParts
+#define AOI_PART_POLYGON    0
+#define AOI_PART_LINE       1
+#define AOI_PART_POINT      2
+
+// Rough fixed cost of an entry on top of its arrays
+#define AOI_CACHE_ENTRY_OVERHEAD 256
+
+AOIFeatureCache::AOIFeatureCache( size_t nMaxSize )
+{
+    m_nSize = 0;
+    m_nMaxSize = nMaxSize;
+    m_nHits = 0;
+    m_nMisses = 0;
+}
+
+OGRFeature *AOIFeatureCache::Get( GIntBig nFID, OGRFeatureDefn *poDefn,
+                                  OGRSpatialReference *poSRS )
+{
+    std::map<GIntBig, EntryList::iterator>::iterator oIter = m_oIndex.find( nFID );
+    if( oIter == m_oIndex.end() )
+    {
+        m_nMisses++;
+        return NULL;
+    }
+    m_nHits++;
+    m_oEntries.splice( m_oEntries.begin(), m_oEntries, oIter->second );
+    const Entry &sEntry = *oIter->second;
+
+    OGRFeature *poFeature = new OGRFeature( poDefn );
+    poFeature->SetFID( nFID );
+    size_t iString = 0, iNumber = 0;
+    for( int iField = 0; iField < poDefn->GetFieldCount(); iField++ )
+    {
+        OGRFieldType eType = poDefn->GetFieldDefn( iField )->GetType();
+        if( eType == OFTString )
+        {
+            if( sEntry.abFieldSet[iField] )
+                poFeature->SetField( iField, sEntry.aosStrings[iString].c_str() );
+            iString++;
+        }
+        else
+        {
+            if( sEntry.abFieldSet[iField] )
+            {
+                if( eType == OFTReal )
+                    poFeature->SetField( iField, sEntry.adfNumbers[iNumber] );
+                else
+                    poFeature->SetField( iField, (GIntBig)sEntry.adfNumbers[iNumber] );
+            }
+            iNumber++;
+        }
+    }
+
+    OGRGeometryCollection *poCollection = new OGRGeometryCollection();
+    OGRGeometry *poSingle = NULL;
+    const double *padfXY = sEntry.adfXY.empty() ? NULL : &sEntry.adfXY[0];
+    std::vector<double> adfX, adfY;
+    for( size_t iPart = 0; iPart < sEntry.abyParts.size(); iPart++ )
+    {
+        int nPoints = sEntry.anPartPoints[iPart];
+        OGRGeometry *poPart;
+        if( sEntry.abyParts[iPart] == AOI_PART_POINT )
+        {
+            poPart = new OGRPoint( padfXY[0], padfXY[1] );
+        }
+        else
+        {
+            adfX.resize( nPoints );
+            adfY.resize( nPoints );
+            for( int i = 0; i < nPoints; i++ )
+            {
+                adfX[i] = padfXY[i * 2];
+                adfY[i] = padfXY[i * 2 + 1];
+            }
+            if( sEntry.abyParts[iPart] == AOI_PART_POLYGON )
+            {
+                OGRLinearRing *poRing = new OGRLinearRing();
+                if( nPoints > 0 )
+                    poRing->setPoints( nPoints, &adfX[0], &adfY[0] );
+                OGRPolygon *poPolygon = new OGRPolygon();
+                poPolygon->addRingDirectly( poRing );
+                poPart = poPolygon;
+            }
+            else
+            {
+                OGRLineString *poLine = new OGRLineString();
+                if( nPoints > 0 )
+                    poLine->setPoints( nPoints, &adfX[0], &adfY[0] );
+                poPart = poLine;
+            }
+        }
+        if( sEntry.bCollection )
+            poCollection->addGeometryDirectly( poPart );
+        else
+            poSingle = poPart;
+        padfXY += nPoints * 2;
+    }
+
+    if( sEntry.bCollection )
+    {
+        poCollection->assignSpatialReference( poSRS );
+        poFeature->SetGeometryDirectly( poCollection );
+    }
+    else
+    {
+        delete poCollection;
+        if( poSingle != NULL )
+        {
+            poSingle->assignSpatialReference( poSRS );
+            poFeature->SetGeometryDirectly( poSingle );
+        }
+    }
+    return poFeature;
+}
+
+void AOIFeatureCache::Add( OGRFeature *poFeature )
+{
+    if( m_nMaxSize == 0 )
+        return;
+
+    Entry sEntry;
+    sEntry.nFID = poFeature->GetFID();
+
+    OGRFeatureDefn *poDefn = poFeature->GetDefnRef();
+    for( int iField = 0; iField < poDefn->GetFieldCount(); iField++ )
+    {
+        int bSet = poFeature->IsFieldSet( iField );
+        sEntry.abFieldSet.push_back( (char)bSet );
+        if( poDefn->GetFieldDefn( iField )->GetType() == OFTString )
+            sEntry.aosStrings.push_back( bSet ? poFeature->GetFieldAsString( iField ) : "" );
+        else
+            sEntry.adfNumbers.push_back( bSet ? poFeature->GetFieldAsDouble( iField ) : 0 );
+    }
+
+    // an object's collection, or a single shape with GRANULARITY=ELEMENT
+    OGRGeometry *poGeom = poFeature->GetGeometryRef();
+    OGRGeometryCollection *poCollection = 
+        dynamic_cast<OGRGeometryCollection*>( poGeom );
+    sEntry.bCollection = poCollection != NULL;
+    int nParts = 0;
+    if( poCollection != NULL )
+        nParts = poCollection->getNumGeometries();
+    else if( poGeom != NULL )
+        nParts = 1;
+
+    for( int iPart = 0; iPart < nParts; iPart++ )
+    {
+        OGRGeometry *poPart = poCollection != NULL 
+            ? poCollection->getGeometryRef( iPart ) : poGeom;
+        OGRSimpleCurve *poCurve = NULL;
+        switch( wkbFlatten( poPart->getGeometryType() ) )
+        {
+            case wkbPoint:
+            {
+                OGRPoint *poPoint = (OGRPoint*)poPart;
+                sEntry.abyParts.push_back( AOI_PART_POINT );
+                sEntry.anPartPoints.push_back( 1 );
+                sEntry.adfXY.push_back( poPoint->getX() );
+                sEntry.adfXY.push_back( poPoint->getY() );
+                continue;
+            }
+            case wkbLineString:
+                sEntry.abyParts.push_back( AOI_PART_LINE );
+                poCurve = (OGRLineString*)poPart;
+                break;
+            case wkbPolygon:
+                // the shapes never have holes
+                if( ((OGRPolygon*)poPart)->getNumInteriorRings() > 0 )
+                    return;
+                sEntry.abyParts.push_back( AOI_PART_POLYGON );
+                poCurve = ((OGRPolygon*)poPart)->getExteriorRing();
+                break;
+            default:
+                // couldn't give it back as it was
+                return;
+        }
+        int nPoints = poCurve != NULL ? poCurve->getNumPoints() : 0;
+        sEntry.anPartPoints.push_back( nPoints );
+        for( int i = 0; i < nPoints; i++ )
+        {
+            sEntry.adfXY.push_back( poCurve->getX( i ) );
+            sEntry.adfXY.push_back( poCurve->getY( i ) );
+        }
+    }
+
+    sEntry.nSize = AOI_CACHE_ENTRY_OVERHEAD + sEntry.abFieldSet.size()
+                    + sEntry.adfNumbers.size() * sizeof(double)
+                    + sEntry.abyParts.size() * (1 + sizeof(int))
+                    + sEntry.adfXY.size() * sizeof(double);
+    for( size_t i = 0; i < sEntry.aosStrings.size(); i++ )
+        sEntry.nSize += sizeof(CPLString) + sEntry.aosStrings[i].size();
+
+    // never going to fit
+    if( sEntry.nSize > m_nMaxSize )
+        return;
+
+    std::map<GIntBig, EntryList::iterator>::iterator oIter = m_oIndex.find( sEntry.nFID );
+    if( oIter != m_oIndex.end() )
+    {
+        m_nSize -= oIter->second->nSize;
+        m_oEntries.erase( oIter->second );
+        m_oIndex.erase( oIter );
+    }
+
+    while( m_nSize + sEntry.nSize > m_nMaxSize && !m_oEntries.empty() )
+    {
+        m_nSize -= m_oEntries.back().nSize;
+        m_oIndex.erase( m_oEntries.back().nFID );
+        m_oEntries.pop_back();
+    }
+
+    m_nSize += sEntry.nSize;
+    m_oEntries.push_front( sEntry );
+    m_oIndex[sEntry.nFID] = m_oEntries.begin();
+}
+
+void AOIFeatureCache::Clear()
+{
+    m_oEntries.clear();
+    m_oIndex.clear();
+    m_nSize = 0;
+}
+
+void AOIFeatureCache::Remap( const std::vector<GIntBig> &anNewFIDs )
+{
+    m_oIndex.clear();
+    EntryList::iterator oIter = m_oEntries.begin();
+    while( oIter != m_oEntries.end() )
+    {
+        GIntBig nFID = oIter->nFID;
+        if( nFID < 0 || nFID >= (GIntBig)anNewFIDs.size() || anNewFIDs[nFID] < 0 )
+        {
+            m_nSize -= oIter->nSize;
+            oIter = m_oEntries.erase( oIter );
+            continue;
+        }
+        oIter->nFID = anNewFIDs[nFID];
+        m_oIndex[oIter->nFID] = oIter;
+        ++oIter;
+    }
+}
@@ -0,0 +1,82 @@
+/* ******************************************************************************
+ * Copyright (c) 2015, Sam Gillingham <gillingham.sam@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef AOIFEATURECACHE_H
+#define AOIFEATURECACHE_H
+
+#include <ogrsf_frmts.h>
+#include <list>
+#include <map>
+#include <vector>
+
+// Features that have already been built, kept so later passes over the
+// layer (eg after ResetReading() when a map is panned) don't decode 
+// the HFA tree again. Stored as flat arrays of coordinates and field 
+// values rather than OGRFeatures to keep them small. The least recently
+// used are dropped to stay within a budget in bytes.
+// Geometries are given back the way they were added: a collection of
+// polygons, lines and points for an object, or a single one of them 
+// for a GRANULARITY=ELEMENT feature. Anything else isn't cached.
+class AOIFeatureCache
+{
+    struct Entry
+    {
+        GIntBig                 nFID;
+        std::vector<char>       abFieldSet;
+        std::vector<CPLString>  aosStrings;     // string fields in order
+        std::vector<double>     adfNumbers;     // numeric fields in order
+        int                     bCollection;    // else a single part as it is
+        std::vector<GByte>      abyParts;       // geometry type of each part
+        std::vector<int>        anPartPoints;
+        std::vector<double>     adfXY;          // x, y of each point
+        size_t                  nSize;
+    };
+    typedef std::list<Entry> EntryList;
+
+    EntryList               m_oEntries;     // most recently used at the front
+    std::map<GIntBig, EntryList::iterator> m_oIndex;
+    size_t                  m_nSize;
+    size_t                  m_nMaxSize;
+    GIntBig                 m_nHits;
+    GIntBig                 m_nMisses;
+
+  public:
+                        AOIFeatureCache( size_t nMaxSize );
+
+    // Rebuild feature nFID or return NULL if it isn't cached
+    OGRFeature         *Get( GIntBig nFID, OGRFeatureDefn *poDefn,
+                             OGRSpatialReference *poSRS );
+    // Keep a copy of poFeature, replacing any with the same FID
+    void                Add( OGRFeature *poFeature );
+    void                Clear();
+    // Renumber the features after the file has been reloaded. 
+    // anNewFIDs is indexed by the old FID, -1 drops the feature.
+    void                Remap( const std::vector<GIntBig> &anNewFIDs );
+
+    GIntBig             GetHits() const { return m_nHits; }
+    GIntBig             GetMisses() const { return m_nMisses; }
+    size_t              GetSize() const { return m_nSize; }
+    int                 GetCount() const { return (int)m_oEntries.size(); }
+};
+
+#endif // AOIFEATURECACHE_H
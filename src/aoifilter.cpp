@@ -0,0 +1,328 @@
+/* ******************************************************************************
+ * Copyright (c) 2015, Sam Gillingham <gillingham.sam@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "aoifilter.h"
+#include <ogr_geometry.h>
+#include <math.h>
+
+// Rows of edges - more means fewer edges to look at for each test
+#define AOI_MAX_FILTER_BUCKETS 4096
+
+void AOIPreparedFilter::AddRing( const OGRSimpleCurve *poRing )
+{
+    int nPoints = poRing->getNumPoints();
+    if( nPoints < 2 )
+        return;
+
+    m_adfRingX.push_back( poRing->getX( 0 ) );
+    m_adfRingY.push_back( poRing->getY( 0 ) );
+    for( int i = 0; i < nPoints; i++ )
+    {
+        // closes the ring if it isn't already
+        int iNext = (i + 1) % nPoints;
+        Edge sEdge;
+        sEdge.dfX0 = poRing->getX( i );
+        sEdge.dfY0 = poRing->getY( i );
+        sEdge.dfX1 = poRing->getX( iNext );
+        sEdge.dfY1 = poRing->getY( iNext );
+        m_sEnvelope.Merge( sEdge.dfX0, sEdge.dfY0 );
+        if( sEdge.dfX0 != sEdge.dfX1 || sEdge.dfY0 != sEdge.dfY1 )
+            m_asEdges.push_back( sEdge );
+    }
+}
+
+int AOIPreparedFilter::Prepare( const OGRGeometry *poGeom )
+{
+    m_asEdges.clear();
+    m_aanBuckets.clear();
+    m_adfRingX.clear();
+    m_adfRingY.clear();
+    m_sEnvelope = OGREnvelope();
+
+    std::vector<const OGRGeometry*> apoStack( 1, poGeom );
+    while( !apoStack.empty() )
+    {
+        const OGRGeometry *poPart = apoStack.back();
+        apoStack.pop_back();
+        OGRwkbGeometryType eType = wkbFlatten( poPart->getGeometryType() );
+        if( eType == wkbPolygon )
+        {
+            const OGRPolygon *poPolygon = (const OGRPolygon*)poPart;
+            if( poPolygon->getExteriorRing() == NULL )
+                continue;
+            AddRing( poPolygon->getExteriorRing() );
+            for( int i = 0; i < poPolygon->getNumInteriorRings(); i++ )
+                AddRing( poPolygon->getInteriorRing( i ) );
+        }
+        else if( eType == wkbMultiPolygon || eType == wkbGeometryCollection )
+        {
+            const OGRGeometryCollection *poCollection = (const OGRGeometryCollection*)poPart;
+            for( int i = 0; i < poCollection->getNumGeometries(); i++ )
+                apoStack.push_back( poCollection->getGeometryRef( i ) );
+        }
+        else
+        {
+            // lines, points and curves are left to GEOS
+            return FALSE;
+        }
+    }
+    if( m_asEdges.empty() )
+        return FALSE;
+
+    int nBuckets = (int)sqrt( (double)m_asEdges.size() );
+    nBuckets = MAX( 1, MIN( nBuckets, AOI_MAX_FILTER_BUCKETS ) );
+    m_dfBucketHeight = (m_sEnvelope.MaxY - m_sEnvelope.MinY) / nBuckets;
+    if( m_dfBucketHeight <= 0 )
+    {
+        nBuckets = 1;
+        m_dfBucketHeight = 1;
+    }
+    m_aanBuckets.resize( nBuckets );
+    for( size_t i = 0; i < m_asEdges.size(); i++ )
+    {
+        const Edge &sEdge = m_asEdges[i];
+        int iLast = GetBucket( MAX( sEdge.dfY0, sEdge.dfY1 ) );
+        for( int iBucket = GetBucket( MIN( sEdge.dfY0, sEdge.dfY1 ) ); iBucket <= iLast; iBucket++ )
+            m_aanBuckets[iBucket].push_back( (int)i );
+    }
+    return TRUE;
+}
+
+int AOIPreparedFilter::GetBucket( double dfY ) const
+{
+    int iBucket = (int)floor( (dfY - m_sEnvelope.MinY) / m_dfBucketHeight );
+    return MAX( 0, MIN( iBucket, (int)m_aanBuckets.size() - 1 ) );
+}
+
+int AOIPreparedFilter::ContainsPoint( double dfX, double dfY ) const
+{
+    if( dfX < m_sEnvelope.MinX || dfX > m_sEnvelope.MaxX 
+        || dfY < m_sEnvelope.MinY || dfY > m_sEnvelope.MaxY )
+        return FALSE;
+
+    // each edge is only in a bucket once so crossings aren't counted twice
+    int bInside = FALSE;
+    const std::vector<int> &anEdges = m_aanBuckets[GetBucket( dfY )];
+    for( size_t i = 0; i < anEdges.size(); i++ )
+    {
+        const Edge &sEdge = m_asEdges[anEdges[i]];
+        if( (sEdge.dfY0 > dfY) != (sEdge.dfY1 > dfY) )
+        {
+            double dfCrossX = sEdge.dfX0 + (dfY - sEdge.dfY0) * (sEdge.dfX1 - sEdge.dfX0) 
+                                                            / (sEdge.dfY1 - sEdge.dfY0);
+            if( dfX < dfCrossX )
+                bInside = !bInside;
+        }
+    }
+    return bInside;
+}
+
+// Which side of a-b c is on
+static double Orient( double dfAX, double dfAY, double dfBX, double dfBY, 
+                      double dfCX, double dfCY )
+{
+    return (dfBX - dfAX) * (dfCY - dfAY) - (dfBY - dfAY) * (dfCX - dfAX);
+}
+
+// Whether the segment a-b touches or crosses any edge of the filter
+int AOIPreparedFilter::SegmentCrossesEdges( double dfX0, double dfY0, 
+                                            double dfX1, double dfY1 ) const
+{
+    double dfMinX = MIN( dfX0, dfX1 ), dfMaxX = MAX( dfX0, dfX1 );
+    double dfMinY = MIN( dfY0, dfY1 ), dfMaxY = MAX( dfY0, dfY1 );
+    if( dfMaxX < m_sEnvelope.MinX || dfMinX > m_sEnvelope.MaxX 
+        || dfMaxY < m_sEnvelope.MinY || dfMinY > m_sEnvelope.MaxY )
+        return FALSE;
+
+    int iLast = GetBucket( dfMaxY );
+    for( int iBucket = GetBucket( dfMinY ); iBucket <= iLast; iBucket++ )
+    {
+        const std::vector<int> &anEdges = m_aanBuckets[iBucket];
+        for( size_t i = 0; i < anEdges.size(); i++ )
+        {
+            const Edge &sEdge = m_asEdges[anEdges[i]];
+            if( MAX( sEdge.dfX0, sEdge.dfX1 ) < dfMinX || MIN( sEdge.dfX0, sEdge.dfX1 ) > dfMaxX
+                || MAX( sEdge.dfY0, sEdge.dfY1 ) < dfMinY || MIN( sEdge.dfY0, sEdge.dfY1 ) > dfMaxY )
+                continue;
+
+            double dfD1 = Orient( sEdge.dfX0, sEdge.dfY0, sEdge.dfX1, sEdge.dfY1, dfX0, dfY0 );
+            double dfD2 = Orient( sEdge.dfX0, sEdge.dfY0, sEdge.dfX1, sEdge.dfY1, dfX1, dfY1 );
+            double dfD3 = Orient( dfX0, dfY0, dfX1, dfY1, sEdge.dfX0, sEdge.dfY0 );
+            double dfD4 = Orient( dfX0, dfY0, dfX1, dfY1, sEdge.dfX1, sEdge.dfY1 );
+            // the bounding boxes overlap so an end on the other line touches
+            if( ((dfD1 <= 0 && dfD2 >= 0) || (dfD1 >= 0 && dfD2 <= 0))
+                && ((dfD3 <= 0 && dfD4 >= 0) || (dfD3 >= 0 && dfD4 <= 0)) )
+                return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+// A rectangle or ellipse intersects if its centre is inside the filter
+// or an edge of the filter touches it. The edges near it are taken into
+// its own coordinates, scaled so it is a square or circle of radius 1.
+int AOIPreparedFilter::IntersectsAnalytic( const AOIElement &sElement, 
+                                           const double *padfAffine ) const
+{
+    OGREnvelope sEnvelope;
+    AOIElementGetAffineEnvelope( sElement, padfAffine, &sEnvelope );
+    if( !sEnvelope.Intersects( m_sEnvelope ) )
+        return FALSE;
+
+    if( ContainsPoint( padfAffine[0] + padfAffine[1] * sElement.dfCenterX 
+                                     + padfAffine[2] * sElement.dfCenterY,
+                       padfAffine[3] + padfAffine[4] * sElement.dfCenterX 
+                                     + padfAffine[5] * sElement.dfCenterY ) )
+        return TRUE;
+
+    double dfDet = padfAffine[1] * padfAffine[5] - padfAffine[2] * padfAffine[4];
+    int bRectangle = sElement.eKind == AOI_SHAPE_RECTANGLE;
+    double dfScaleX = bRectangle ? sElement.dfSize1 / 2 : sElement.dfSize1;
+    double dfScaleY = bRectangle ? sElement.dfSize2 / 2 : sElement.dfSize2;
+    if( dfDet == 0 || dfScaleX <= 0 || dfScaleY <= 0 )
+        return FALSE;
+
+    int iLast = GetBucket( sEnvelope.MaxY );
+    for( int iBucket = GetBucket( sEnvelope.MinY ); iBucket <= iLast; iBucket++ )
+    {
+        const std::vector<int> &anEdges = m_aanBuckets[iBucket];
+        for( size_t i = 0; i < anEdges.size(); i++ )
+        {
+            const Edge &sEdge = m_asEdges[anEdges[i]];
+            if( MAX( sEdge.dfX0, sEdge.dfX1 ) < sEnvelope.MinX 
+                || MIN( sEdge.dfX0, sEdge.dfX1 ) > sEnvelope.MaxX
+                || MAX( sEdge.dfY0, sEdge.dfY1 ) < sEnvelope.MinY 
+                || MIN( sEdge.dfY0, sEdge.dfY1 ) > sEnvelope.MaxY )
+                continue;
+
+            // inverse of the affine then scaled about the centre
+            double adfU[2], adfV[2];
+            for( int j = 0; j < 2; j++ )
+            {
+                double dfX = (j == 0 ? sEdge.dfX0 : sEdge.dfX1) - padfAffine[0];
+                double dfY = (j == 0 ? sEdge.dfY0 : sEdge.dfY1) - padfAffine[3];
+                double dfLocalX = (padfAffine[5] * dfX - padfAffine[2] * dfY) / dfDet;
+                double dfLocalY = (padfAffine[1] * dfY - padfAffine[4] * dfX) / dfDet;
+                adfU[j] = (dfLocalX - sElement.dfCenterX) / dfScaleX;
+                adfV[j] = (dfLocalY - sElement.dfCenterY) / dfScaleY;
+            }
+            double dfDU = adfU[1] - adfU[0], dfDV = adfV[1] - adfV[0];
+
+            if( bRectangle )
+            {
+                // Liang-Barsky against the square
+                double adfP[4] = { -dfDU, dfDU, -dfDV, dfDV };
+                double adfQ[4] = { adfU[0] + 1, 1 - adfU[0], adfV[0] + 1, 1 - adfV[0] };
+                double dfT0 = 0, dfT1 = 1;
+                int bVisible = TRUE;
+                for( int j = 0; j < 4 && bVisible; j++ )
+                {
+                    if( adfP[j] == 0 )
+                        bVisible = adfQ[j] >= 0;
+                    else if( adfP[j] < 0 )
+                        dfT0 = MAX( dfT0, adfQ[j] / adfP[j] );
+                    else
+                        dfT1 = MIN( dfT1, adfQ[j] / adfP[j] );
+                    bVisible = bVisible && dfT0 <= dfT1;
+                }
+                if( bVisible )
+                    return TRUE;
+            }
+            else
+            {
+                // closest point on the segment to the centre
+                double dfLength2 = dfDU * dfDU + dfDV * dfDV;
+                double dfT = dfLength2 > 0 ? -(adfU[0] * dfDU + adfV[0] * dfDV) / dfLength2 : 0;
+                dfT = MAX( 0.0, MIN( 1.0, dfT ) );
+                double dfU = adfU[0] + dfT * dfDU, dfV = adfV[0] + dfT * dfDV;
+                if( dfU * dfU + dfV * dfV <= 1 )
+                    return TRUE;
+            }
+        }
+    }
+    return FALSE;
+}
+
+int AOIPreparedFilter::IntersectsElement( const AOIElement &sElement,
+                                          const AOIGeometryOptions &sOptions,
+                                          AOIScratch &oScratch ) const
+{
+    double adfAffine[6];
+    if( AOIElementIsAnalytic( sElement, sOptions ) && AOIElementGetAffine( sElement, adfAffine ) )
+        return IntersectsAnalytic( sElement, adfAffine );
+
+    int nPoints = AOIElementGetOutline( sElement, sOptions, oScratch );
+    if( nPoints == 0 )
+        return FALSE;
+    const double *padfX = &oScratch.adfX[0];
+    const double *padfY = &oScratch.adfY[0];
+
+    OGREnvelope sEnvelope;
+    for( int i = 0; i < nPoints; i++ )
+        sEnvelope.Merge( padfX[i], padfY[i] );
+    if( !sEnvelope.Intersects( m_sEnvelope ) )
+        return FALSE;
+
+    // starts inside or crosses the boundary
+    if( ContainsPoint( padfX[0], padfY[0] ) )
+        return TRUE;
+    for( int i = 0; i < nPoints - 1; i++ )
+    {
+        if( SegmentCrossesEdges( padfX[i], padfY[i], padfX[i + 1], padfY[i + 1] ) )
+            return TRUE;
+    }
+
+    // or the filter is inside it
+    if( sElement.eKind == AOI_SHAPE_LINE || sElement.eKind == AOI_SHAPE_POINT )
+        return FALSE;
+    for( size_t iRing = 0; iRing < m_adfRingX.size(); iRing++ )
+    {
+        double dfX = m_adfRingX[iRing], dfY = m_adfRingY[iRing];
+        if( dfX < sEnvelope.MinX || dfX > sEnvelope.MaxX 
+            || dfY < sEnvelope.MinY || dfY > sEnvelope.MaxY )
+            continue;
+        int bInside = FALSE;
+        for( int i = 0; i < nPoints - 1; i++ )
+        {
+            if( (padfY[i] > dfY) != (padfY[i + 1] > dfY) 
+                && dfX < padfX[i] + (dfY - padfY[i]) * (padfX[i + 1] - padfX[i]) 
+                                                    / (padfY[i + 1] - padfY[i]) )
+                bInside = !bInside;
+        }
+        if( bInside )
+            return TRUE;
+    }
+    return FALSE;
+}
+
+int AOIPreparedFilter::IntersectsObject( const AOIObject &oObject,
+                                         const AOIGeometryOptions &sOptions,
+                                         AOIScratch &oScratch ) const
+{
+    for( int i = 0; i < oObject.nElements; i++ )
+    {
+        if( IntersectsElement( oObject.aoElements[i], sOptions, oScratch ) )
+            return TRUE;
+    }
+    return FALSE;
+}
@@ -0,0 +1,76 @@
+/* ******************************************************************************
+ * Copyright (c) 2015, Sam Gillingham <gillingham.sam@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef AOIFILTER_H
+#define AOIFILTER_H
+
+#include "aoielement.h"
+#include <vector>
+
+// A polygonal spatial filter indexed so decoded shapes can be tested 
+// against it without building OGR geometries. The edges of the filter 
+// are bucketed by row so each test only looks at nearby edges. 
+// Rectangles and ellipses with an affine polynomial are tested exactly
+// by taking the filter edges into the shape's own coordinates.
+// Once prepared it is only read so can be used on many threads.
+class AOIPreparedFilter
+{
+    struct Edge
+    {
+        double          dfX0;
+        double          dfY0;
+        double          dfX1;
+        double          dfY1;
+    };
+
+    std::vector<Edge>   m_asEdges;
+    std::vector<std::vector<int> > m_aanBuckets;   // edges crossing each row
+    std::vector<double> m_adfRingX;     // a vertex of each ring
+    std::vector<double> m_adfRingY;
+    OGREnvelope         m_sEnvelope;
+    double              m_dfBucketHeight;
+
+    void                AddRing( const OGRSimpleCurve *poRing );
+    int                 GetBucket( double dfY ) const;
+    int                 SegmentCrossesEdges( double dfX0, double dfY0, 
+                                             double dfX1, double dfY1 ) const;
+    int                 IntersectsAnalytic( const AOIElement &sElement, 
+                                            const double *padfAffine ) const;
+
+  public:
+    // Returns FALSE if poGeom isn't polygons (or collections of them)
+    int                 Prepare( const OGRGeometry *poGeom );
+
+    // Inside by the even-odd rule so holes are outside
+    int                 ContainsPoint( double dfX, double dfY ) const;
+
+    int                 IntersectsElement( const AOIElement &sElement,
+                                           const AOIGeometryOptions &sOptions,
+                                           AOIScratch &oScratch ) const;
+    // Stops at the first element that intersects
+    int                 IntersectsObject( const AOIObject &oObject,
+                                          const AOIGeometryOptions &sOptions,
+                                          AOIScratch &oScratch ) const;
+};
+
+#endif // AOIFILTER_H
@@ -0,0 +1,1547 @@
+/* ******************************************************************************
+ * Copyright (c) 2015, Sam Gillingham <gillingham.sam@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "aoihfareader.h"
+#include "aoireadcache.h"
+#include <limits.h>
+#include <algorithm>
+#include <set>
+
+// The fields the decoders use, looked up in every type when opening
+enum
+{
+    AOI_PATH_NAME,
+    AOI_PATH_DESCRIPTION,
+    AOI_PATH_ORDER,
+    AOI_PATH_TERMCOUNT,
+    AOI_PATH_POLYCOEFMTX,
+    AOI_PATH_POLYCOEFVECTOR,
+    AOI_PATH_COORDS,
+    AOI_PATH_COORD,
+    AOI_PATH_CENTER_X,
+    AOI_PATH_CENTER_Y,
+    AOI_PATH_WIDTH,
+    AOI_PATH_HEIGHT,
+    AOI_PATH_SEMIMAJOR,
+    AOI_PATH_SEMIMINOR,
+    AOI_PATH_COUNT
+};
+
+static const char * const apszAOIPaths[AOI_PATH_COUNT] = 
+{
+    "name", "description", "xformMatrix.order", "xformMatrix.termcount",
+    "xformMatrix.polycoefmtx", "xformMatrix.polycoefvector", "coords.coords",
+    "coord.coords", "center.x", "center.y", "width", "height",
+    "semiMajorAxis", "semiMinorAxis"
+};
+
+// types containing types more deeply than this are taken to be corrupt
+#define AOI_MAX_TYPE_DEPTH 32
+
+// rows, columns, item type and object type at the start of a BASEDATA
+#define AOI_BASEDATA_HEADER_SIZE 12
+
+/* -------------------------------------------------------------------- */
+/*      Little endian values from the buffer.                           */
+/* -------------------------------------------------------------------- */
+static GUInt32 AOIGetUInt32( const GByte *pabyData )
+{
+    GUInt32 nValue;
+    memcpy( &nValue, pabyData, 4 );
+    CPL_LSBPTR32( &nValue );
+    return nValue;
+}
+
+static GUInt16 AOIGetUInt16( const GByte *pabyData )
+{
+    GUInt16 nValue;
+    memcpy( &nValue, pabyData, 2 );
+    CPL_LSBPTR16( &nValue );
+    return nValue;
+}
+
+static double AOIGetFloat64( const GByte *pabyData )
+{
+    double dfValue;
+    memcpy( &dfValue, pabyData, 8 );
+    CPL_LSBPTR64( &dfValue );
+    return dfValue;
+}
+
+// Size of the simple item types as HFADictionary::GetItemSize().
+// -1 for basedata and objects which vary.
+static int AOIGetItemSize( char chType )
+{
+    switch( chType )
+    {
+      case '1': case '2': case '4': case 'c': case 'C':
+        return 1;
+      case 'e': case 's': case 'S':
+        return 2;
+      case 't': case 'l': case 'L': case 'f':
+        return 4;
+      case 'd': case 'm':
+        return 8;
+      case 'M':
+        return 16;
+      default:
+        return -1;
+    }
+}
+
+// Bits per item for the EPT_ basedata types, 0 if unknown
+static int AOIGetBaseTypeBits( int nBaseType )
+{
+    static const int anBits[] = { 1, 2, 4, 8, 8, 16, 16, 32, 32, 32, 64, 64, 128 };
+    if( nBaseType < 0 || nBaseType >= (int)(sizeof(anBits) / sizeof(anBits[0])) )
+        return 0;
+    return anBits[nBaseType];
+}
+
+// A simple item as a double. Bit fields and complex types aren't read.
+static int AOIGetItemValue( char chType, const GByte *pabyData, double *pdfValue )
+{
+    switch( chType )
+    {
+      case 'c':
+        *pdfValue = pabyData[0];
+        return TRUE;
+      case 'C':
+        *pdfValue = (signed char)pabyData[0];
+        return TRUE;
+      case 'e': case 's':
+        *pdfValue = AOIGetUInt16( pabyData );
+        return TRUE;
+      case 'S':
+        *pdfValue = (GInt16)AOIGetUInt16( pabyData );
+        return TRUE;
+      case 't': case 'l':
+        *pdfValue = AOIGetUInt32( pabyData );
+        return TRUE;
+      case 'L':
+        *pdfValue = (GInt32)AOIGetUInt32( pabyData );
+        return TRUE;
+      case 'f':
+      {
+        GUInt32 nBits = AOIGetUInt32( pabyData );
+        float fValue;
+        memcpy( &fValue, &nBits, 4 );
+        *pdfValue = fValue;
+        return TRUE;
+      }
+      case 'd':
+        *pdfValue = AOIGetFloat64( pabyData );
+        return TRUE;
+      default:
+        return FALSE;
+    }
+}
+
+// An item of basedata as a double, for the EPT_ types of at least a byte
+static int AOIGetBaseValue( int nBaseType, const GByte *pabyData, double *pdfValue )
+{
+    switch( nBaseType )
+    {
+      case 3: // EPT_u8
+        *pdfValue = pabyData[0];
+        return TRUE;
+      case 4: // EPT_s8
+        *pdfValue = (signed char)pabyData[0];
+        return TRUE;
+      case 5: // EPT_u16
+        *pdfValue = AOIGetUInt16( pabyData );
+        return TRUE;
+      case 6: // EPT_s16
+        *pdfValue = (GInt16)AOIGetUInt16( pabyData );
+        return TRUE;
+      case 7: // EPT_u32
+        *pdfValue = AOIGetUInt32( pabyData );
+        return TRUE;
+      case 8: // EPT_s32
+        *pdfValue = (GInt32)AOIGetUInt32( pabyData );
+        return TRUE;
+      case 9: // EPT_f32
+        return AOIGetItemValue( 'f', pabyData, pdfValue );
+      case 10: // EPT_f64
+        *pdfValue = AOIGetFloat64( pabyData );
+        return TRUE;
+      default:
+        return FALSE;
+    }
+}
+
+int AOIReadBaseDataCoords( int nBaseType, const GByte *pabyValues, int nPoints,
+                           AOIElement &sElement )
+{
+    int nBits = AOIGetBaseTypeBits( nBaseType );
+    if( nBits < 8 || nPoints <= 0 )
+        return FALSE;
+
+    if( (int)sElement.adfX.size() < nPoints )
+    {
+        sElement.adfX.resize( nPoints );
+        sElement.adfY.resize( nPoints );
+    }
+
+    if( nBaseType == 10 ) // EPT_f64
+    {
+        for( int i = 0; i < nPoints; i++ )
+        {
+            sElement.adfX[i] = AOIGetFloat64( pabyValues + (size_t)i * 16 );
+            sElement.adfY[i] = AOIGetFloat64( pabyValues + (size_t)i * 16 + 8 );
+        }
+    }
+    else
+    {
+        int nItemBytes = nBits / 8;
+        for( int i = 0; i < nPoints; i++ )
+        {
+            if( !AOIGetBaseValue( nBaseType, pabyValues + (size_t)i * 2 * nItemBytes,
+                                  &sElement.adfX[i] )
+                || !AOIGetBaseValue( nBaseType, 
+                                     pabyValues + ((size_t)i * 2 + 1) * nItemBytes,
+                                     &sElement.adfY[i] ) )
+            {
+                return FALSE;
+            }
+        }
+    }
+    sElement.nPoints = nPoints;
+    return TRUE;
+}
+
+// A string of at most nMax characters that may not be terminated
+static CPLString AOIGetFixedString( const GByte *pabyData, size_t nMax )
+{
+    size_t nLength = 0;
+    while( nLength < nMax && pabyData[nLength] != '\0' )
+        nLength++;
+    return CPLString( (const char*)pabyData, nLength );
+}
+
+AOIHFAReader::AOIHFAReader()
+{
+    m_fp = NULL;
+    m_nFileSize = 0;
+    m_nMaxNodes = 0;
+    m_bStreaming = FALSE;
+    m_nMemoryBudget = 0;
+    m_nStreamedSize = 0;
+}
+
+/* -------------------------------------------------------------------- */
+/*      Dictionary.                                                     */
+/*      Follows HFAType::Initialize() and HFAField::Initialize() so     */
+/*      files are read the same way.                                    */
+/* -------------------------------------------------------------------- */
+static const char *AOIParseField( const char *pszInput, CPLString &osOut )
+{
+    size_t i = 0;
+    while( pszInput[i] != '\0' && pszInput[i] != ',' )
+        i++;
+    if( pszInput[i] == '\0' )
+        return NULL;
+    osOut.assign( pszInput, i );
+    return pszInput + i + 1;
+}
+
+int AOIHFAReader::ParseDictionary( const char *pszDictionary )
+{
+    const char *pszInput = pszDictionary;
+    while( pszInput != NULL && *pszInput != '.' && *pszInput != '\0' )
+    {
+        while( *pszInput != '{' && *pszInput != '\0' )
+            pszInput++;
+        if( *pszInput == '\0' )
+            break;
+        pszInput++;
+
+        Type oType;
+        while( pszInput != NULL && *pszInput != '}' )
+        {
+            Field oField;
+            oField.nItemCount = atoi( pszInput );
+            oField.chPointer = '\0';
+            oField.iObjectType = -1;
+            if( oField.nItemCount < 0 )
+            {
+                pszInput = NULL;
+                break;
+            }
+            while( *pszInput != '\0' && *pszInput != ':' )
+                pszInput++;
+            if( *pszInput == '\0' )
+            {
+                pszInput = NULL;
+                break;
+            }
+            pszInput++;
+
+            if( *pszInput == 'p' || *pszInput == '*' )
+                oField.chPointer = *(pszInput++);
+            oField.chItemType = *pszInput;
+            if( oField.chItemType == '\0' 
+                || strchr( "124cCesSlLfdmMbox", oField.chItemType ) == NULL )
+            {
+                pszInput = NULL;
+                break;
+            }
+            pszInput++;
+
+            if( oField.chItemType == 'o' )
+            {
+                pszInput = AOIParseField( pszInput, oField.osObjectType );
+            }
+            else if( oField.chItemType == 'x' && *pszInput == '{' )
+            {
+                // inline definitions are skipped as HFAField does,
+                // the type has to be defined elsewhere too
+                int nBraceDepth = 1;
+                pszInput++;
+                while( nBraceDepth > 0 && *pszInput != '\0' )
+                {
+                    if( *pszInput == '{' )
+                        nBraceDepth++;
+                    else if( *pszInput == '}' )
+                        nBraceDepth--;
+                    pszInput++;
+                }
+                oField.chItemType = 'o';
+                pszInput = AOIParseField( pszInput, oField.osObjectType );
+            }
+            else if( oField.chItemType == 'e' )
+            {
+                // the names of the values aren't needed
+                int nEnumCount = atoi( pszInput );
+                pszInput = strchr( pszInput, ':' );
+                if( nEnumCount < 0 || nEnumCount > 100000 || pszInput == NULL )
+                {
+                    pszInput = NULL;
+                    break;
+                }
+                pszInput++;
+                CPLString osEnum;
+                for( int iEnum = 0; iEnum < nEnumCount && pszInput != NULL; iEnum++ )
+                    pszInput = AOIParseField( pszInput, osEnum );
+            }
+
+            if( pszInput != NULL )
+                pszInput = AOIParseField( pszInput, oField.osName );
+            if( pszInput != NULL )
+                oType.aoFields.push_back( oField );
+        }
+        if( pszInput == NULL )
+            break;
+
+        pszInput = AOIParseField( pszInput + 1, oType.osName );
+        if( pszInput != NULL )
+        {
+            m_oTypeIndex[oType.osName] = (int)m_aoTypes.size();
+            m_aoTypes.push_back( oType );
+        }
+    }
+
+    for( size_t iType = 0; iType < m_aoTypes.size(); iType++ )
+    {
+        std::vector<Field> &aoFields = m_aoTypes[iType].aoFields;
+        for( size_t iField = 0; iField < aoFields.size(); iField++ )
+        {
+            if( aoFields[iField].chItemType != 'o' )
+                continue;
+            std::map<CPLString, int>::const_iterator oIter = 
+                m_oTypeIndex.find( aoFields[iField].osObjectType );
+            if( oIter != m_oTypeIndex.end() )
+                aoFields[iField].iObjectType = oIter->second;
+        }
+        m_aoTypes[iType].nFixedSize = -2; // not worked out yet
+    }
+
+    for( size_t iType = 0; iType < m_aoTypes.size(); iType++ )
+        GetFixedSize( (int)iType, 0 );
+
+    return !m_aoTypes.empty();
+}
+
+// Fill in the fixed offsets of a type's fields and return its size,
+// -1 if it varies. Types containing themselves count as varying.
+int AOIHFAReader::GetFixedSize( int iType, int nDepth )
+{
+    Type &oType = m_aoTypes[iType];
+    if( oType.nFixedSize == -3 || nDepth > AOI_MAX_TYPE_DEPTH )
+        return -1;
+    if( oType.nFixedSize != -2 )
+        return oType.nFixedSize;
+    oType.nFixedSize = -3; // being worked out
+
+    int nOffset = 0;
+    oType.anFixedOffset.resize( oType.aoFields.size() );
+    for( size_t iField = 0; iField < oType.aoFields.size(); iField++ )
+    {
+        oType.anFixedOffset[iField] = nOffset;
+        if( nOffset < 0 )
+            continue;
+
+        const Field &oField = oType.aoFields[iField];
+        int nItemSize = -1;
+        if( oField.chPointer != '\0' || oField.chItemType == 'b' )
+            nItemSize = -1;
+        else if( oField.chItemType != 'o' )
+            nItemSize = AOIGetItemSize( oField.chItemType );
+        else if( oField.iObjectType >= 0 )
+            nItemSize = GetFixedSize( oField.iObjectType, nDepth + 1 );
+
+        // GetFieldBytes() stops at the first empty object
+        if( nItemSize <= 0 
+            || (GIntBig)nOffset + (GIntBig)nItemSize * oField.nItemCount > INT_MAX )
+            nOffset = -1;
+        else
+            nOffset += nItemSize * oField.nItemCount;
+    }
+    oType.nFixedSize = nOffset;
+    return nOffset;
+}
+
+// Look up a field like "center.x" in a type. Every level but the last
+// has to be an object.
+int AOIHFAReader::ResolvePath( int iType, const char *pszPath, FieldPath &sPath ) const
+{
+    sPath.nSteps = 0;
+    while( iType >= 0 )
+    {
+        const char *pszDot = strchr( pszPath, '.' );
+        size_t nLength = pszDot != NULL ? (size_t)(pszDot - pszPath) : strlen( pszPath );
+        const std::vector<Field> &aoFields = m_aoTypes[iType].aoFields;
+        int iField = 0;
+        while( iField < (int)aoFields.size()
+               && !(aoFields[iField].osName.size() == nLength
+                    && EQUALN(aoFields[iField].osName, pszPath, nLength)) )
+        {
+            iField++;
+        }
+        if( iField == (int)aoFields.size() || sPath.nSteps == 2 )
+            break;
+        sPath.anOffset[sPath.nSteps] = m_aoTypes[iType].anFixedOffset[iField];
+        sPath.anField[sPath.nSteps++] = iField;
+
+        if( pszDot == NULL )
+            return TRUE;
+        iType = aoFields[iField].iObjectType;
+        pszPath = pszDot + 1;
+    }
+    sPath.nSteps = 0;
+    return FALSE;
+}
+
+/* -------------------------------------------------------------------- */
+/*      Tree.                                                           */
+/* -------------------------------------------------------------------- */
+
+// Set the type, and the kind of shape if it is one, of a node from
+// its header
+void AOIHFAReader::InitNode( Node &sNode, const AOIEntryHeader &sHeader ) const
+{
+    std::map<CPLString, int>::const_iterator oIter = m_oTypeIndex.find( sHeader.szType );
+    sNode.iType = oIter != m_oTypeIndex.end() ? oIter->second : -1;
+    sNode.iChild = -1;
+    sNode.iNext = -1;
+
+    // as the HFAEntry version, only the start of the type is checked
+    const char *pszType = sHeader.szType;
+    if( EQUALN(pszType, "Polygon", 7) )
+        sNode.nShapeKind = AOI_SHAPE_POLYGON;
+    else if( EQUALN(pszType, "Rectangle", 9) )
+        sNode.nShapeKind = AOI_SHAPE_RECTANGLE;
+    else if( EQUALN(pszType, "Ellipse", 7) )
+        sNode.nShapeKind = AOI_SHAPE_ELLIPSE;
+    else if( EQUALN(pszType, "Polyline", 8) )
+        sNode.nShapeKind = AOI_SHAPE_LINE;
+    else if( EQUALN(pszType, "Point", 5) )
+        sNode.nShapeKind = AOI_SHAPE_POINT;
+    else
+        sNode.nShapeKind = -1;
+    sNode.bElement = EQUALN(pszType, "Element", 7);
+}
+
+// Add the entry at nFilePos to the nodes of the whole file tree, whose
+// buffer is the file. Returns -1 if its header isn't in the file.
+int AOIHFAReader::AddNode( Tree &oTree, GUInt32 nFilePos )
+{
+    if( (vsi_l_offset)nFilePos + HFA_ENTRY_HEADER_SIZE > oTree.abyData.size() )
+        return -1;
+
+    AOIEntryHeader sHeader;
+    Node sNode;
+    AOIParseEntryHeader( &oTree.abyData[nFilePos], &sHeader );
+    sNode.nPos = nFilePos;
+    sNode.nDataPos = sHeader.nDataPos;
+    sNode.nDataSize = sHeader.nDataSize;
+    if( (vsi_l_offset)sNode.nDataPos + sNode.nDataSize > oTree.abyData.size() )
+    {
+        sNode.nDataPos = 0;
+        sNode.nDataSize = 0;
+    }
+    InitNode( sNode, sHeader );
+
+    oTree.asNodes.push_back( sNode );
+    return (int)oTree.asNodes.size() - 1;
+}
+
+// Walk the tree under the entry at nRootPos into oTree, linking each
+// node to its first child and next sibling. An entry that is reached 
+// twice means the file has a loop and can't be read this way. If
+// bFindObjects the objects directly under the root are listed.
+int AOIHFAReader::BuildTree( Tree &oTree, GUInt32 nRootPos, int bFindObjects )
+{
+    if( m_bStreaming )
+        return StreamTree( oTree, nRootPos );
+
+    std::set<GUInt32> oSeen;
+    std::vector<int> anPending;
+
+    if( AddNode( oTree, nRootPos ) < 0 )
+        return FALSE;
+    oSeen.insert( nRootPos );
+    anPending.push_back( 0 );
+
+    while( !anPending.empty() )
+    {
+        int iParent = anPending.back();
+        anPending.pop_back();
+
+        AOIEntryHeader sHeader;
+        AOIParseEntryHeader( &oTree.abyData[oTree.asNodes[iParent].nPos], &sHeader );
+        GUInt32 nPos = sHeader.nChildPos;
+        int iPrevious = -1;
+        while( nPos != 0 )
+        {
+            if( !oSeen.insert( nPos ).second )
+            {
+                CPLDebug( "AOI", "Entry at %u is linked to more than once.", nPos );
+                return FALSE;
+            }
+            if( (GIntBig)oTree.asNodes.size() >= m_nMaxNodes )
+            {
+                CPLDebug( "AOI", "More than " CPL_FRMT_GIB " entries under the entry at %u.",
+                          m_nMaxNodes, nRootPos );
+                return FALSE;
+            }
+
+            int iNode = AddNode( oTree, nPos );
+            if( iNode < 0 )
+                break;
+            if( iPrevious < 0 )
+                oTree.asNodes[iParent].iChild = iNode;
+            else
+                oTree.asNodes[iPrevious].iNext = iNode;
+            anPending.push_back( iNode );
+            iPrevious = iNode;
+
+            // objects are only looked for directly under the AOI node
+            AOIParseEntryHeader( &oTree.abyData[oTree.asNodes[iNode].nPos], &sHeader );
+            if( bFindObjects && iParent == 0 
+                && EQUAL(sHeader.szType, "Eaoi_AoiObjectType") )
+            {
+                m_anObjectPos.push_back( nPos );
+                m_anObjectNodes.push_back( iNode );
+            }
+            nPos = sHeader.nNextPos;
+        }
+    }
+    return TRUE;
+}
+
+// A read of part of the file into a tree's buffer when streaming
+struct AOITreeRead
+{
+    vsi_l_offset    nOffset;
+    size_t          nSize;
+    size_t          nBufferPos;     // in the tree's buffer
+    int             bHeader;        // else the data of a node
+    int             iItem;          // the pending entry or the node
+    int             bOK;
+};
+
+static bool CompareTreeReads( const AOITreeRead &a, const AOITreeRead &b )
+{
+    return a.nOffset < b.nOffset;
+}
+
+// Read a set of ranges into a tree's buffer, which must already be 
+// big enough, with one VSIFReadMultiRangeL() call in file order. If 
+// that fails they are read one at a time to find which can't be read.
+static void ReadTreeRanges( VSILFILE *fp, std::vector<GByte> &abyData,
+                            std::vector<AOITreeRead> &asReads )
+{
+    if( asReads.empty() )
+        return;
+    std::sort( asReads.begin(), asReads.end(), CompareTreeReads );
+
+    std::vector<void*> apData( asReads.size() );
+    std::vector<vsi_l_offset> anOffsets( asReads.size() );
+    std::vector<size_t> anSizes( asReads.size() );
+    for( size_t i = 0; i < asReads.size(); i++ )
+    {
+        apData[i] = &abyData[asReads[i].nBufferPos];
+        anOffsets[i] = asReads[i].nOffset;
+        anSizes[i] = asReads[i].nSize;
+        asReads[i].bOK = TRUE;
+    }
+    if( VSIFReadMultiRangeL( (int)asReads.size(), &apData[0], &anOffsets[0], 
+                             &anSizes[0], fp ) == 0 )
+        return;
+
+    for( size_t i = 0; i < asReads.size(); i++ )
+    {
+        asReads[i].bOK = VSIFSeekL( fp, anOffsets[i], SEEK_SET ) == 0
+            && VSIFReadL( apData[i], anSizes[i], 1, fp ) == 1;
+    }
+}
+
+// The streaming version of BuildTree(). Entries can only be found by
+// reading their parent or previous sibling, so rather than reading 
+// each header and its data as it is reached the tree is read a level
+// at a time: each pass reads the headers of the entries found on the
+// previous pass, and the data of the entries read on it, in one multi
+// range read sorted by offset. On /vsicurl/ etc that is a request or 
+// so per level rather than two per entry.
+int AOIHFAReader::StreamTree( Tree &oTree, GUInt32 nRootPos )
+{
+    // an entry to read and where it goes in the tree
+    struct PendingEntry
+    {
+        GUInt32     nFilePos;
+        int         iParent;        // -1 for the root
+        int         iPrevious;      // -1 if the first child
+    };
+
+    std::set<GUInt32> oSeen;
+    std::vector<PendingEntry> asEntries, asNextEntries;
+    std::vector<int> anData, anNextData;   // nodes whose data is to be read
+    std::vector<AOITreeRead> asReads;
+
+    PendingEntry sRoot;
+    sRoot.nFilePos = nRootPos;
+    sRoot.iParent = -1;
+    sRoot.iPrevious = -1;
+    asEntries.push_back( sRoot );
+    oSeen.insert( nRootPos );
+
+    while( !asEntries.empty() || !anData.empty() )
+    {
+        // make room at the end of the buffer for everything read in 
+        // this pass. Anything that can't be read leaves a gap.
+        asReads.clear();
+        size_t nBufferPos = oTree.abyData.size();
+        for( size_t i = 0; i < asEntries.size(); i++ )
+        {
+            AOITreeRead sRead;
+            sRead.nOffset = asEntries[i].nFilePos;
+            sRead.nSize = HFA_ENTRY_HEADER_SIZE;
+            sRead.nBufferPos = nBufferPos;
+            sRead.bHeader = TRUE;
+            sRead.iItem = (int)i;
+            sRead.bOK = FALSE;
+            // a header past the end ends its list of siblings
+            if( sRead.nOffset + sRead.nSize > m_nFileSize 
+                || (GUIntBig)nBufferPos + sRead.nSize >= 0xFFFFFFFFU )
+                continue;
+            nBufferPos += sRead.nSize;
+            asReads.push_back( sRead );
+        }
+        for( size_t i = 0; i < anData.size(); i++ )
+        {
+            AOIEntryHeader sHeader;
+            AOIParseEntryHeader( &oTree.abyData[oTree.asNodes[anData[i]].nPos], &sHeader );
+            AOITreeRead sRead;
+            sRead.nOffset = sHeader.nDataPos;
+            sRead.nSize = sHeader.nDataSize;
+            sRead.nBufferPos = nBufferPos;
+            sRead.bHeader = FALSE;
+            sRead.iItem = anData[i];
+            sRead.bOK = FALSE;
+            if( (GUIntBig)nBufferPos + sRead.nSize >= 0xFFFFFFFFU )
+                continue;
+            nBufferPos += sRead.nSize;
+            asReads.push_back( sRead );
+        }
+        oTree.abyData.resize( nBufferPos );
+        ReadTreeRanges( m_fp, oTree.abyData, asReads );
+
+        // the headers are taken in the order the entries were found
+        // so a list of siblings that can't be read is cut at the same
+        // place whatever the offsets
+        std::vector<int> anHeaderRead( asEntries.size(), -1 );
+        for( size_t i = 0; i < asReads.size(); i++ )
+        {
+            const AOITreeRead &sRead = asReads[i];
+            if( !sRead.bOK )
+                continue;
+            if( sRead.bHeader )
+            {
+                anHeaderRead[sRead.iItem] = (int)i;
+            }
+            else
+            {
+                Node &sNode = oTree.asNodes[sRead.iItem];
+                sNode.nDataPos = (GUInt32)sRead.nBufferPos;
+                sNode.nDataSize = (GUInt32)sRead.nSize;
+            }
+        }
+
+        asNextEntries.clear();
+        anNextData.clear();
+        for( size_t i = 0; i < asEntries.size(); i++ )
+        {
+            const PendingEntry &sEntry = asEntries[i];
+            if( anHeaderRead[i] < 0 )
+            {
+                if( sEntry.iParent < 0 )
+                    return FALSE;
+                continue;
+            }
+            if( (GIntBig)oTree.asNodes.size() >= m_nMaxNodes && sEntry.iParent >= 0 )
+            {
+                CPLDebug( "AOI", "More than " CPL_FRMT_GIB " entries under the entry at %u.",
+                          m_nMaxNodes, nRootPos );
+                return FALSE;
+            }
+
+            AOIEntryHeader sHeader;
+            Node sNode;
+            sNode.nPos = (GUInt32)asReads[anHeaderRead[i]].nBufferPos;
+            AOIParseEntryHeader( &oTree.abyData[sNode.nPos], &sHeader );
+            sNode.nDataPos = 0;
+            sNode.nDataSize = 0;
+            InitNode( sNode, sHeader );
+            int iNode = (int)oTree.asNodes.size();
+            oTree.asNodes.push_back( sNode );
+            if( sEntry.iPrevious >= 0 )
+                oTree.asNodes[sEntry.iPrevious].iNext = iNode;
+            else if( sEntry.iParent >= 0 )
+                oTree.asNodes[sEntry.iParent].iChild = iNode;
+
+            if( sHeader.nDataSize > 0 
+                && (vsi_l_offset)sHeader.nDataPos + sHeader.nDataSize <= m_nFileSize )
+                anNextData.push_back( iNode );
+
+            // the first child, and the next sibling except of the root
+            PendingEntry sNext;
+            sNext.nFilePos = sHeader.nChildPos;
+            sNext.iParent = iNode;
+            sNext.iPrevious = -1;
+            for( int iLink = 0; iLink < 2; iLink++ )
+            {
+                if( iLink == 1 )
+                {
+                    if( sEntry.iParent < 0 )
+                        break;
+                    sNext.nFilePos = sHeader.nNextPos;
+                    sNext.iParent = sEntry.iParent;
+                    sNext.iPrevious = iNode;
+                }
+                if( sNext.nFilePos == 0 )
+                    continue;
+                if( !oSeen.insert( sNext.nFilePos ).second )
+                {
+                    CPLDebug( "AOI", "Entry at %u is linked to more than once.", 
+                              sNext.nFilePos );
+                    return FALSE;
+                }
+                asNextEntries.push_back( sNext );
+            }
+        }
+        asEntries.swap( asNextEntries );
+        anData.swap( anNextData );
+    }
+    return TRUE;
+}
+
+// When streaming, find the objects under the AOI node by following
+// the sibling list through the entry headers
+int AOIHFAReader::ListObjects( GUInt32 nAOIPos )
+{
+    AOIEntryHeader sHeader;
+    if( !AOIReadEntryHeader( m_fp, nAOIPos, &sHeader ) )
+        return FALSE;
+
+    std::set<GUInt32> oSeen;
+    GUInt32 nPos = sHeader.nChildPos;
+    while( nPos != 0 )
+    {
+        if( !oSeen.insert( nPos ).second )
+        {
+            CPLDebug( "AOI", "Entry at %u is linked to more than once.", nPos );
+            return FALSE;
+        }
+        if( (GIntBig)oSeen.size() > m_nMaxNodes )
+        {
+            CPLDebug( "AOI", "More than " CPL_FRMT_GIB " entries under the AOI node.",
+                      m_nMaxNodes );
+            return FALSE;
+        }
+        if( !AOIReadEntryHeader( m_fp, nPos, &sHeader ) )
+            break;
+        if( EQUAL(sHeader.szType, "Eaoi_AoiObjectType") )
+            m_anObjectPos.push_back( nPos );
+        nPos = sHeader.nNextPos;
+    }
+    return TRUE;
+}
+
+// The tree holding an object's entries and the object's node in it.
+// When streaming the object is read if it isn't in memory and then 
+// other objects are freed if over the budget, so the tree is only 
+// valid until the next call. NULL if it can't be read.
+const AOIHFAReader::Tree *AOIHFAReader::GetTree( int iObject, int *piRoot )
+{
+    if( !m_bStreaming )
+    {
+        *piRoot = m_anObjectNodes[iObject];
+        return &m_oFile;
+    }
+
+    *piRoot = 0;
+    std::map<int, StreamedList::iterator>::iterator oIter = 
+        m_oStreamedIndex.find( iObject );
+    if( oIter != m_oStreamedIndex.end() )
+    {
+        m_oStreamed.splice( m_oStreamed.begin(), m_oStreamed, oIter->second );
+        return &oIter->second->oTree;
+    }
+
+    m_oStreamed.push_front( StreamedTree() );
+    StreamedTree &sStreamed = m_oStreamed.front();
+    sStreamed.iObject = iObject;
+    int bOK;
+    try
+    {
+        bOK = BuildTree( sStreamed.oTree, m_anObjectPos[iObject], FALSE );
+    }
+    catch( const std::bad_alloc& )
+    {
+        bOK = FALSE;
+    }
+    if( !bOK )
+    {
+        CPLError( CE_Failure, CPLE_AppDefined, 
+                  "Can't read the AOI object at %u.", m_anObjectPos[iObject] );
+        m_oStreamed.pop_front();
+        return NULL;
+    }
+    sStreamed.nSize = sizeof(StreamedTree) + sStreamed.oTree.abyData.capacity()
+                    + sStreamed.oTree.asNodes.capacity() * sizeof(Node);
+    m_oStreamedIndex[iObject] = m_oStreamed.begin();
+    m_nStreamedSize += sStreamed.nSize;
+
+    // the one just read is at the front so is always kept
+    while( m_nStreamedSize > m_nMemoryBudget && m_oStreamed.size() > 1 )
+    {
+        m_nStreamedSize -= m_oStreamed.back().nSize;
+        m_oStreamedIndex.erase( m_oStreamed.back().iObject );
+        m_oStreamed.pop_back();
+    }
+    return &m_oStreamed.front().oTree;
+}
+
+int AOIHFAReader::Open( VSILFILE *fp, GUInt32 nDictionaryPos, GUInt32 nAOIPos,
+                        GIntBig nMaxNodes, size_t nStreamingMemory )
+{
+    m_fp = fp;
+    m_nMaxNodes = nMaxNodes;
+    m_bStreaming = nStreamingMemory > 0;
+    m_nMemoryBudget = nStreamingMemory;
+
+    if( VSIFSeekL( fp, 0, SEEK_END ) != 0 )
+        return FALSE;
+    m_nFileSize = VSIFTellL( fp );
+    if( m_nFileSize == 0 || nDictionaryPos >= m_nFileSize )
+        return FALSE;
+
+    CPLString osDictionary;
+    if( !m_bStreaming )
+    {
+        std::vector<GByte> &abyFile = m_oFile.abyData;
+        if( m_nFileSize != (vsi_l_offset)(size_t)m_nFileSize )
+            return FALSE;
+        try
+        {
+            abyFile.resize( (size_t)m_nFileSize );
+        }
+        catch( const std::bad_alloc& )
+        {
+            CPLDebug( "AOI", "Not enough memory to read the file." );
+            return FALSE;
+        }
+        if( VSIFSeekL( fp, 0, SEEK_SET ) != 0
+            || VSIFReadL( &abyFile[0], abyFile.size(), 1, fp ) < 1 )
+        {
+            return FALSE;
+        }
+
+        // the dictionary runs to a nul or the end of the file
+        osDictionary = AOIGetFixedString( &abyFile[nDictionaryPos],
+                                          abyFile.size() - nDictionaryPos );
+    }
+    else
+    {
+        // read the dictionary a piece at a time until the nul
+        GByte abyChunk[4096];
+        if( VSIFSeekL( fp, nDictionaryPos, SEEK_SET ) != 0 )
+            return FALSE;
+        while( TRUE )
+        {
+            size_t nRead = VSIFReadL( abyChunk, 1, sizeof(abyChunk), fp );
+            CPLString osChunk = AOIGetFixedString( abyChunk, nRead );
+            osDictionary += osChunk;
+            if( osChunk.size() < sizeof(abyChunk) )
+                break;
+        }
+    }
+    if( !ParseDictionary( osDictionary ) )
+        return FALSE;
+
+    m_asPaths.resize( m_aoTypes.size() * AOI_PATH_COUNT );
+    for( size_t iType = 0; iType < m_aoTypes.size(); iType++ )
+    {
+        for( int iPath = 0; iPath < AOI_PATH_COUNT; iPath++ )
+            ResolvePath( (int)iType, apszAOIPaths[iPath], 
+                         m_asPaths[iType * AOI_PATH_COUNT + iPath] );
+    }
+
+    if( m_bStreaming )
+        return ListObjects( nAOIPos );
+    try
+    {
+        return BuildTree( m_oFile, nAOIPos, TRUE );
+    }
+    catch( const std::bad_alloc& )
+    {
+        CPLDebug( "AOI", "Not enough memory to read the file." );
+        return FALSE;
+    }
+}
+
+// Whether a node is called pszName, ignoring case as HFAEntry does
+int AOIHFAReader::NameIs( const Tree &oTree, const Node &sNode, 
+                          const char *pszName ) const
+{
+    const char *pszNodeName = (const char*)&oTree.abyData[sNode.nPos + 24];
+    size_t nLength = strlen( pszName );
+    return nLength <= 64 && EQUALN(pszNodeName, pszName, nLength)
+        && (nLength == 64 || pszNodeName[nLength] == '\0');
+}
+
+int AOIHFAReader::GetNamedChild( const Tree &oTree, int iNode, 
+                                 const char *pszName ) const
+{
+    if( iNode < 0 )
+        return -1;
+    int iChild = oTree.asNodes[iNode].iChild;
+    while( iChild >= 0 && !NameIs( oTree, oTree.asNodes[iChild], pszName ) )
+        iChild = oTree.asNodes[iChild].iNext;
+    return iChild;
+}
+
+/* -------------------------------------------------------------------- */
+/*      Field access.                                                   */
+/* -------------------------------------------------------------------- */
+
+// Bytes used by a field in an instance, as HFAField::GetInstBytes() 
+// but -1 if it runs past nSize
+GIntBig AOIHFAReader::GetFieldBytes( const Field &oField, const GByte *pabyData,
+                                     size_t nSize, int nDepth ) const
+{
+    GIntBig nBytes = 0;
+    GUInt32 nCount = oField.nItemCount;
+    if( oField.chPointer != '\0' )
+    {
+        if( nSize < 8 )
+            return -1;
+        nCount = AOIGetUInt32( pabyData );
+        pabyData += 8;
+        nSize -= 8;
+        nBytes = 8;
+    }
+
+    if( oField.chItemType == 'b' )
+    {
+        if( nCount == 0 )
+            return nBytes;
+        if( nSize < AOI_BASEDATA_HEADER_SIZE )
+            return -1;
+        GInt32 nRows = (GInt32)AOIGetUInt32( pabyData );
+        GInt32 nColumns = (GInt32)AOIGetUInt32( pabyData + 4 );
+        int nBits = AOIGetBaseTypeBits( (GInt16)AOIGetUInt16( pabyData + 8 ) );
+        if( nRows < 0 || nColumns < 0 || nBits == 0 )
+            return -1;
+        GIntBig nDataBytes = (GIntBig)((nBits + 7) / 8) * nRows * nColumns;
+        if( nDataBytes > (GIntBig)(nSize - AOI_BASEDATA_HEADER_SIZE) )
+            return -1;
+        return nBytes + AOI_BASEDATA_HEADER_SIZE + nDataBytes;
+    }
+
+    if( oField.iObjectType < 0 )
+    {
+        int nItemSize = AOIGetItemSize( oField.chItemType );
+        if( nItemSize < 0 || (GIntBig)nCount * nItemSize > (GIntBig)nSize )
+            return -1;
+        return nBytes + (GIntBig)nCount * nItemSize;
+    }
+
+    for( GUInt32 i = 0; i < nCount; i++ )
+    {
+        GIntBig nThisBytes = GetTypeBytes( oField.iObjectType, pabyData, nSize, 
+                                           nDepth + 1 );
+        if( nThisBytes < 0 )
+            return -1;
+        // the rest will be empty too
+        if( nThisBytes == 0 )
+            break;
+        pabyData += nThisBytes;
+        nSize -= (size_t)nThisBytes;
+        nBytes += nThisBytes;
+    }
+    return nBytes;
+}
+
+GIntBig AOIHFAReader::GetTypeBytes( int iType, const GByte *pabyData, 
+                                    size_t nSize, int nDepth ) const
+{
+    if( nDepth > AOI_MAX_TYPE_DEPTH )
+        return -1;
+
+    const std::vector<Field> &aoFields = m_aoTypes[iType].aoFields;
+    GIntBig nBytes = 0;
+    for( size_t iField = 0; iField < aoFields.size(); iField++ )
+    {
+        GIntBig nThisBytes = GetFieldBytes( aoFields[iField], pabyData, nSize, nDepth );
+        if( nThisBytes < 0 )
+            return -1;
+        pabyData += nThisBytes;
+        nSize -= (size_t)nThisBytes;
+        nBytes += nThisBytes;
+    }
+    return nBytes;
+}
+
+// Find one of the AOI_PATH_ fields in the data of a node. Objects on
+// the way are followed into their first item. Returns NULL if the
+// node doesn't have it.
+const GByte *AOIHFAReader::FindField( const Tree &oTree, int iNode, int iPath, 
+                                      size_t *pnSize, const Field **ppoField ) const
+{
+    const Node &sNode = oTree.asNodes[iNode];
+    int iType = sNode.iType;
+    if( iType < 0 || sNode.nDataSize == 0 )
+        return NULL;
+    const FieldPath &sPath = m_asPaths[iType * AOI_PATH_COUNT + iPath];
+    const GByte *pabyData = &oTree.abyData[sNode.nDataPos];
+    size_t nSize = sNode.nDataSize;
+
+    for( int iStep = 0; iStep < sPath.nSteps; iStep++ )
+    {
+        const std::vector<Field> &aoFields = m_aoTypes[iType].aoFields;
+        int iField = sPath.anField[iStep];
+        int nOffset = sPath.anOffset[iStep];
+        if( nOffset >= 0 )
+        {
+            if( (size_t)nOffset > nSize )
+                return NULL;
+            pabyData += nOffset;
+            nSize -= nOffset;
+        }
+        else
+        {
+            // after a field whose size varies, skip the fields before
+            for( int i = 0; i < iField; i++ )
+            {
+                GIntBig nThisBytes = GetFieldBytes( aoFields[i], pabyData, nSize, 0 );
+                if( nThisBytes < 0 )
+                    return NULL;
+                pabyData += nThisBytes;
+                nSize -= (size_t)nThisBytes;
+            }
+        }
+
+        const Field &oField = aoFields[iField];
+        if( iStep == sPath.nSteps - 1 )
+        {
+            *pnSize = nSize;
+            *ppoField = &oField;
+            return pabyData;
+        }
+
+        // into the first item of the object
+        if( oField.chPointer != '\0' )
+        {
+            if( nSize < 8 || AOIGetUInt32( pabyData ) == 0 )
+                return NULL;
+            pabyData += 8;
+            nSize -= 8;
+        }
+        else if( oField.nItemCount == 0 )
+        {
+            return NULL;
+        }
+        iType = oField.iObjectType;
+    }
+    return NULL;
+}
+
+// Item nIndex of a field as a double. For basedata -1, -2 and -3 are
+// the rows, columns and type as with HFAEntry::GetDoubleField().
+int AOIHFAReader::ReadValue( const Field &oField, const GByte *pabyData, 
+                             size_t nSize, int nIndex, double *pdfValue ) const
+{
+    GUInt32 nCount = oField.nItemCount;
+    if( oField.chPointer != '\0' )
+    {
+        if( nSize < 8 )
+            return FALSE;
+        nCount = AOIGetUInt32( pabyData );
+        pabyData += 8;
+        nSize -= 8;
+    }
+
+    if( oField.chItemType == 'b' )
+    {
+        if( nCount == 0 || nSize < AOI_BASEDATA_HEADER_SIZE )
+            return FALSE;
+        GInt32 nRows = (GInt32)AOIGetUInt32( pabyData );
+        GInt32 nColumns = (GInt32)AOIGetUInt32( pabyData + 4 );
+        int nBaseType = (GInt16)AOIGetUInt16( pabyData + 8 );
+        if( nIndex == -1 )
+            *pdfValue = nRows;
+        else if( nIndex == -2 )
+            *pdfValue = nColumns;
+        else if( nIndex == -3 )
+            *pdfValue = nBaseType;
+        if( nIndex < 0 )
+            return nIndex >= -3;
+
+        int nItemBytes = AOIGetBaseTypeBits( nBaseType ) / 8;
+        if( nItemBytes == 0 || nIndex >= (GIntBig)nRows * nColumns
+            || (GIntBig)(nIndex + 1) * nItemBytes 
+                    > (GIntBig)(nSize - AOI_BASEDATA_HEADER_SIZE) )
+        {
+            return FALSE;
+        }
+        return AOIGetBaseValue( nBaseType, 
+                    pabyData + AOI_BASEDATA_HEADER_SIZE + (size_t)nIndex * nItemBytes,
+                    pdfValue );
+    }
+
+    int nItemSize = AOIGetItemSize( oField.chItemType );
+    if( nIndex < 0 || (GUInt32)nIndex >= nCount || nItemSize <= 0
+        || (GIntBig)(nIndex + 1) * nItemSize > (GIntBig)nSize )
+    {
+        return FALSE;
+    }
+    return AOIGetItemValue( oField.chItemType, pabyData + (size_t)nIndex * nItemSize,
+                            pdfValue );
+}
+
+int AOIHFAReader::ReadDouble( const Tree &oTree, int iNode, int iPath, 
+                              int nIndex, double *pdfValue ) const
+{
+    size_t nSize = 0;
+    const Field *poField = NULL;
+    const GByte *pabyData = FindField( oTree, iNode, iPath, &nSize, &poField );
+    return pabyData != NULL && ReadValue( *poField, pabyData, nSize, nIndex, pdfValue );
+}
+
+// A char field as a string, up to the first nul
+int AOIHFAReader::ReadString( const Tree &oTree, int iNode, int iPath, 
+                              CPLString &osValue ) const
+{
+    size_t nSize = 0;
+    const Field *poField = NULL;
+    const GByte *pabyData = FindField( oTree, iNode, iPath, &nSize, &poField );
+    if( pabyData == NULL || (poField->chItemType != 'c' && poField->chItemType != 'C') )
+        return FALSE;
+
+    size_t nCount = poField->nItemCount;
+    if( poField->chPointer != '\0' )
+    {
+        if( nSize < 8 )
+            return FALSE;
+        nCount = AOIGetUInt32( pabyData );
+        pabyData += 8;
+        nSize -= 8;
+    }
+    if( nCount == 0 )
+        return FALSE;
+    osValue = AOIGetFixedString( pabyData, MIN(nCount, nSize) );
+    return TRUE;
+}
+
+/* -------------------------------------------------------------------- */
+/*      AOI decoders. These do what ReadXformPolynomial() and the       */
+/*      OGRAOILayer::Handle*() methods do with HFAEntry.                */
+/* -------------------------------------------------------------------- */
+void AOIHFAReader::ReadPolynomial( const Tree &oTree, int iNode, 
+                                   Efga_Polynomial *psPoly ) const
+{
+    memset( psPoly, 0, sizeof(Efga_Polynomial) );
+
+    // an order of 0 means there isn't a valid polynomial
+    double dfOrder = 0, dfTermCount = 0;
+    ReadDouble( oTree, iNode, AOI_PATH_ORDER, 0, &dfOrder );
+    ReadDouble( oTree, iNode, AOI_PATH_TERMCOUNT, 0, &dfTermCount );
+    psPoly->order = (int)dfOrder;
+    int nTermCount = (int)dfTermCount;
+    if( ( psPoly->order == 1 && nTermCount != 3) 
+        || (psPoly->order == 2 && nTermCount != 6) 
+        || (psPoly->order == 3 && nTermCount != 10) )
+    {
+        psPoly->order = 0;
+        return;
+    }
+
+    for( int i = 0; i < nTermCount * 2 - 2 && i < 18; i++ )
+    {
+        if( !ReadDouble( oTree, iNode, AOI_PATH_POLYCOEFMTX, i, &psPoly->polycoefmtx[i] ) )
+            psPoly->polycoefmtx[i] = 0;
+    }
+    for( int i = 0; i < 2; i++ )
+    {
+        if( !ReadDouble( oTree, iNode, AOI_PATH_POLYCOEFVECTOR, i, &psPoly->polycoefvector[i] ) )
+            psPoly->polycoefvector[i] = 0;
+    }
+}
+
+// The vertices of a polygon, line or point. f64 coordinates are 
+// copied straight out of the buffer.
+int AOIHFAReader::ReadVertices( const Tree &oTree, int iNode, int iPath, 
+                                AOIElement &sElement, AOIDecodeLimits &sLimits ) const
+{
+    size_t nSize = 0;
+    const Field *poField = NULL;
+    const GByte *pabyData = FindField( oTree, iNode, iPath, &nSize, &poField );
+    double dfRows = 0, dfColumns = 0, dfBaseType = 0;
+    if( pabyData == NULL || poField->chItemType != 'b'
+        || !ReadValue( *poField, pabyData, nSize, -1, &dfRows )
+        || !ReadValue( *poField, pabyData, nSize, -2, &dfColumns )
+        || !ReadValue( *poField, pabyData, nSize, -3, &dfBaseType ) )
+    {
+        return FALSE;
+    }
+    int nColumns = (int)dfColumns;
+    int nBaseType = (int)dfBaseType;
+    if( nColumns <= 0 || dfRows != 2 )
+        return FALSE;
+    int nBits = AOIGetBaseTypeBits( nBaseType );
+    if( nBits <= 0 )
+        return FALSE;
+
+    // make sure the entry really has that many before we loop over them
+    if( poField->chPointer != '\0' )
+    {
+        pabyData += 8;
+        nSize -= 8;
+    }
+    GUIntBig nNeeded = AOI_BASEDATA_HEADER_SIZE + 
+                        ((GUIntBig)nColumns * 2 * nBits + 7) / 8;
+    if( nNeeded > nSize )
+    {
+        const Node &sNode = oTree.asNodes[iNode];
+        CPLError( CE_Failure, CPLE_AppDefined, 
+                  "%s in %s claims %d points but the entry only has %u bytes", 
+                  apszAOIPaths[iPath], 
+                  AOIGetFixedString( &oTree.abyData[sNode.nPos + 24], 64 ).c_str(),
+                  nColumns, sNode.nDataSize );
+        return FALSE;
+    }
+
+    sLimits.nObjectVertices += nColumns;
+    if( sLimits.nObjectVertices > sLimits.nMaxVertices )
+    {
+        CPLError( CE_Failure, CPLE_AppDefined, 
+                  "AOI object has more than " CPL_FRMT_GIB " points (MAX_VERTICES). Ignoring it.",
+                  sLimits.nMaxVertices );
+        sLimits.bObjectBudgetExceeded = TRUE;
+        return FALSE;
+    }
+    if( sLimits.bCheckOnly )
+    {
+        sElement.nPoints = nColumns;
+        return TRUE;
+    }
+
+    return AOIReadBaseDataCoords( nBaseType, pabyData + AOI_BASEDATA_HEADER_SIZE, 
+                                  nColumns, sElement );
+}
+
+int AOIHFAReader::ReadShape( const Tree &oTree, int iNode, AOIElement &sElement, 
+                             AOIDecodeLimits &sLimits ) const
+{
+    sElement.eKind = (AOIShapeKind)oTree.asNodes[iNode].nShapeKind;
+    switch( sElement.eKind )
+    {
+      case AOI_SHAPE_POLYGON:
+      case AOI_SHAPE_LINE:
+        return ReadVertices( oTree, iNode, AOI_PATH_COORDS, sElement, sLimits );
+
+      case AOI_SHAPE_POINT:
+        return ReadVertices( oTree, iNode, AOI_PATH_COORD, sElement, sLimits )
+                && sElement.nPoints == 1;
+
+      case AOI_SHAPE_RECTANGLE:
+        sElement.nPoints = 0;
+        // orientation always seems to be 0 - handled by the polynomial
+        return ReadDouble( oTree, iNode, AOI_PATH_CENTER_X, 0, &sElement.dfCenterX )
+            && ReadDouble( oTree, iNode, AOI_PATH_CENTER_Y, 0, &sElement.dfCenterY )
+            && ReadDouble( oTree, iNode, AOI_PATH_WIDTH, 0, &sElement.dfSize1 )
+            && ReadDouble( oTree, iNode, AOI_PATH_HEIGHT, 0, &sElement.dfSize2 );
+
+      case AOI_SHAPE_ELLIPSE:
+        sElement.nPoints = 0;
+        return ReadDouble( oTree, iNode, AOI_PATH_CENTER_X, 0, &sElement.dfCenterX )
+            && ReadDouble( oTree, iNode, AOI_PATH_CENTER_Y, 0, &sElement.dfCenterY )
+            && ReadDouble( oTree, iNode, AOI_PATH_SEMIMAJOR, 0, &sElement.dfSize1 )
+            && ReadDouble( oTree, iNode, AOI_PATH_SEMIMINOR, 0, &sElement.dfSize2 );
+    }
+    return FALSE;
+}
+
+// Same walk as OGRAOILayer::HandleChildFeatures()
+int AOIHFAReader::DecodeNode( const Tree &oTree, int iNode, int iParent, 
+                              AOIObject &oObject, AOIDecodeLimits &sLimits, 
+                              int bGroupPaths, int nDepth ) const
+{
+    if( nDepth > sLimits.nMaxDepth )
+    {
+        CPLError( CE_Failure, CPLE_AppDefined, 
+                  "AOI object is nested more than %d deep (MAX_DEPTH). Ignoring it.",
+                  sLimits.nMaxDepth );
+        return FALSE;
+    }
+    if( ++sLimits.nNodesRead > sLimits.nMaxNodes )
+    {
+        CPLError( CE_Failure, CPLE_AppDefined, 
+                  "AOI file has more than " CPL_FRMT_GIB " entries (MAX_NODES). "
+                  "Not reading any more.", sLimits.nMaxNodes );
+        sLimits.bBudgetExceeded = TRUE;
+        return FALSE;
+    }
+
+    if( oTree.asNodes[iNode].nShapeKind >= 0 )
+    {
+        AOIElement &sElement = oObject.AddElement();
+        if( bGroupPaths )
+            sElement.osGroupPath = sLimits.osGroupPath;
+        if( !sLimits.bCheckOnly )
+            ReadPolynomial( oTree, iParent, &sElement.sPoly );
+
+        // couldn't read it - forget about it
+        if( !ReadShape( oTree, iNode, sElement, sLimits ) )
+            oObject.nElements--;
+        if( sLimits.bObjectBudgetExceeded )
+            return FALSE;
+    }
+
+    int iGroup = 0;
+    for( int iChild = oTree.asNodes[iNode].iChild; iChild >= 0; 
+         iChild = oTree.asNodes[iChild].iNext )
+    {
+        size_t nPathLength = sLimits.osGroupPath.size();
+        if( bGroupPaths && oTree.asNodes[iChild].bElement )
+            sLimits.osGroupPath += CPLSPrintf( "/%d", iGroup++ );
+
+        int bOK = DecodeNode( oTree, iChild, iNode, oObject, sLimits, bGroupPaths, 
+                              nDepth + 1 );
+        sLimits.osGroupPath.resize( nPathLength );
+        if( !bOK )
+            return FALSE;
+    }
+    return TRUE;
+}
+
+// The head Element_2_Eant of an object and its name and description,
+// -1 if it hasn't got one
+int AOIHFAReader::GetHeadElement( const Tree &oTree, int iRoot, CPLString &osName,
+                                  CPLString &osDescription ) const
+{
+    int iNode = GetNamedChild( oTree, iRoot, "AOIantObject" );
+    iNode = GetNamedChild( oTree, iNode, "antInfo" );
+    iNode = GetNamedChild( oTree, iNode, "ElementList" );
+    if( iNode < 0 || oTree.asNodes[iNode].iChild < 0 )
+        return -1;
+    iNode = oTree.asNodes[iNode].iChild;
+
+    if( !ReadString( oTree, iNode, AOI_PATH_NAME, osName ) )
+        osName = "";
+    if( !ReadString( oTree, iNode, AOI_PATH_DESCRIPTION, osDescription ) )
+        osDescription = "";
+    return iNode;
+}
+
+int AOIHFAReader::GetObjectStrings( int iObject, CPLString &osName,
+                                    CPLString &osDescription )
+{
+    int iRoot;
+    const Tree *poTree = GetTree( iObject, &iRoot );
+    return poTree != NULL && GetHeadElement( *poTree, iRoot, osName, osDescription ) >= 0;
+}
+
+// FNV-1a
+static GUIntBig AOIHashBytes( GUIntBig nHash, const GByte *pabyData, size_t nSize )
+{
+    for( size_t i = 0; i < nSize; i++ )
+    {
+        nHash ^= pabyData[i];
+        nHash *= 1099511628211ULL;
+    }
+    return nHash;
+}
+
+// Add a field to the hash as GetFieldBytes() walks it, but with only
+// the count of a pointer and not the offset after it, which changes
+// when the entry is moved. Returns the bytes used, -1 if it doesn't fit.
+GIntBig AOIHFAReader::HashField( const Field &oField, const GByte *pabyData,
+                                 size_t nSize, int nDepth, GUIntBig &nHash ) const
+{
+    GIntBig nTotal = GetFieldBytes( oField, pabyData, nSize, nDepth );
+    if( nTotal < 0 )
+        return -1;
+
+    GIntBig nBytes = 0;
+    GUInt32 nCount = oField.nItemCount;
+    if( oField.chPointer != '\0' )
+    {
+        nCount = AOIGetUInt32( pabyData );
+        nHash = AOIHashBytes( nHash, pabyData, 4 );
+        nBytes = 8;
+    }
+
+    // no pointers in simple items or basedata
+    if( oField.chItemType == 'b' || oField.iObjectType < 0 )
+    {
+        nHash = AOIHashBytes( nHash, pabyData + nBytes, (size_t)(nTotal - nBytes) );
+        return nTotal;
+    }
+
+    for( GUInt32 i = 0; i < nCount && nBytes < nTotal; i++ )
+    {
+        GIntBig nThisBytes = HashType( oField.iObjectType, pabyData + nBytes, 
+                                       (size_t)(nTotal - nBytes), nDepth + 1, nHash );
+        if( nThisBytes <= 0 )
+            break;
+        nBytes += nThisBytes;
+    }
+    return nTotal;
+}
+
+GIntBig AOIHFAReader::HashType( int iType, const GByte *pabyData, 
+                                size_t nSize, int nDepth, GUIntBig &nHash ) const
+{
+    if( nDepth > AOI_MAX_TYPE_DEPTH )
+        return -1;
+
+    const std::vector<Field> &aoFields = m_aoTypes[iType].aoFields;
+    GIntBig nBytes = 0;
+    for( size_t iField = 0; iField < aoFields.size(); iField++ )
+    {
+        GIntBig nThisBytes = HashField( aoFields[iField], pabyData + nBytes, 
+                                        nSize - (size_t)nBytes, nDepth, nHash );
+        if( nThisBytes < 0 )
+            return -1;
+        nBytes += nThisBytes;
+    }
+    return nBytes;
+}
+
+GUIntBig AOIHFAReader::GetObjectHash( int iObject )
+{
+    GUIntBig nHash = 14695981039346656037ULL;
+    int iRoot;
+    const Tree *poTree = GetTree( iObject, &iRoot );
+    if( poTree == NULL )
+        return nHash;
+    const Tree &oTree = *poTree;
+
+    std::vector<int> anStack( 1, iRoot );
+    while( !anStack.empty() )
+    {
+        int iNode = anStack.back();
+        anStack.pop_back();
+        if( iNode < 0 )
+        {
+            // end of a node's children so the shape of the tree counts
+            nHash = AOIHashBytes( nHash, (const GByte*)"}", 1 );
+            continue;
+        }
+
+        // the name and type but not the links to other entries
+        const Node &sNode = oTree.asNodes[iNode];
+        nHash = AOIHashBytes( nHash, &oTree.abyData[sNode.nPos + 24], 96 );
+        if( sNode.nDataSize > 0 )
+        {
+            const GByte *pabyData = &oTree.abyData[sNode.nDataPos];
+            GUIntBig nDataHash = nHash;
+            GIntBig nUsed = sNode.iType >= 0 
+                ? HashType( sNode.iType, pabyData, sNode.nDataSize, 0, nDataHash ) : -1;
+            if( nUsed < 0 )
+            {
+                // can't tell where the pointers are so take it all
+                nHash = AOIHashBytes( nHash, pabyData, sNode.nDataSize );
+            }
+            else
+            {
+                nHash = AOIHashBytes( nDataHash, pabyData + nUsed, 
+                                      sNode.nDataSize - (size_t)nUsed );
+            }
+        }
+
+        // children are visited in reverse which is as good
+        anStack.push_back( -1 );
+        for( int iChild = sNode.iChild; iChild >= 0; iChild = oTree.asNodes[iChild].iNext )
+            anStack.push_back( iChild );
+    }
+    return nHash;
+}
+
+int AOIHFAReader::DecodeObject( int iObject, AOIObject &oObject, 
+                                AOIDecodeLimits &sLimits, int bGroupPaths )
+{
+    oObject.Clear();
+
+    int iRoot;
+    const Tree *poTree = GetTree( iObject, &iRoot );
+    if( poTree == NULL )
+        return FALSE;
+    int iInfo = GetHeadElement( *poTree, iRoot, oObject.osName, oObject.osDescription );
+    if( iInfo < 0 )
+        return FALSE;
+
+    sLimits.osGroupPath = "0";
+    sLimits.nObjectVertices = 0;
+    sLimits.bObjectBudgetExceeded = FALSE;
+    if( !DecodeNode( *poTree, iInfo, iInfo, oObject, sLimits, bGroupPaths, 0 ) )
+    {
+        // over one of the limits - leave the object out
+        oObject.Clear();
+        return FALSE;
+    }
+    return oObject.nElements > 0;
+}
@@ -0,0 +1,241 @@
+/* ******************************************************************************
+ * Copyright (c) 2015, Sam Gillingham <gillingham.sam@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef AOIHFAREADER_H
+#define AOIHFAREADER_H
+
+#include <cpl_vsi.h>
+#include <cpl_string.h>
+#include <list>
+#include <map>
+#include <vector>
+#include "aoielement.h"
+
+struct AOIEntryHeader;
+
+// Limits applied while decoding (MAX_VERTICES etc). nNodesRead 
+// carries on from object to object for a whole pass. Also holds what
+// DecodeObject() keeps track of within an object, so threads decoding
+// at the same time each need their own.
+struct AOIDecodeLimits
+{
+    GIntBig             nMaxVertices;       // per object
+    GIntBig             nMaxNodes;          // per pass
+    int                 nMaxDepth;
+    GIntBig             nNodesRead;
+    int                 bBudgetExceeded;    // stops reading the file
+    // only check the shapes can be read and count their vertices,
+    // leaving the coordinates and polynomials out of the object
+    int                 bCheckOnly;
+
+    // set by DecodeObject()
+    GIntBig             nObjectVertices;
+    int                 bObjectBudgetExceeded;
+    CPLString           osGroupPath;
+};
+
+// Copy the nPoints x,y pairs of a BASEDATA of EPT_ type nBaseType
+// into the element, from its values after the header. Both readers
+// use this. The caller checks the data is long enough.
+int AOIReadBaseDataCoords( int nBaseType, const GByte *pabyValues, int nPoints,
+                           AOIElement &sElement );
+
+// A read only parser for the parts of an HFA file an AOI layer needs,
+// used to decode objects when the file isn't being updated because it
+// is much faster than going through HFAEntry.
+// Normally the file is read into memory in one go. Only the dictionary
+// types are parsed, then the tree under the AOI node is walked once into
+// a flat array of nodes that refer to each other by index. Shapes are
+// decoded straight from the buffer by typed readers. The fields they
+// need are looked up in each dictionary type when opening, along with
+// their offsets where the fields before them have a fixed size (all of
+// the shape types), so no field names are formatted or parsed while 
+// reading and nothing is allocated once the AOIObject has grown.
+// When streaming only the list of objects is kept. Each object's 
+// entries are read when it is first needed into a tree of its own,
+// and the least recently used ones are freed once they take more than
+// the memory budget.
+// The projection and anything written to the file still go through
+// HFAEntry.
+class AOIHFAReader
+{
+    struct Field
+    {
+        CPLString           osName;
+        int                 nItemCount;
+        char                chPointer;      // '\0' if not a pointer
+        char                chItemType;
+        CPLString           osObjectType;
+        int                 iObjectType;    // -1 if not an object
+    };
+
+    struct Type
+    {
+        CPLString           osName;
+        std::vector<Field>  aoFields;
+        // Worked out once when opening. Where each field starts if all 
+        // the ones before it have a fixed size, -1 after a pointer, 
+        // basedata or anything else that varies. Then the size of the
+        // whole type, or -1 if it varies.
+        std::vector<int>    anFixedOffset;
+        int                 nFixedSize;
+    };
+
+    // Where a field such as "center.x" is, as field indexes at each level
+    // and the fixed offsets of those fields (-1 if they have to be found
+    // by skipping the fields before them)
+    struct FieldPath
+    {
+        int                 nSteps;         // 0 if the type doesn't have it
+        int                 anField[2];
+        int                 anOffset[2];
+    };
+
+    struct Node
+    {
+        GUInt32             nPos;           // of the header in the tree's buffer
+        GUInt32             nDataPos;       // in the tree's buffer
+        GUInt32             nDataSize;      // 0 if not in the file
+        int                 iType;          // -1 if not in the dictionary
+        int                 iChild;         // -1 for none
+        int                 iNext;
+        int                 nShapeKind;     // AOIShapeKind, -1 if not a shape
+        int                 bElement;       // Element_2_Eant etc
+    };
+
+    // Some entries and the bytes they refer to. Without streaming there 
+    // is one for the whole file and the buffer is the file. When 
+    // streaming each object read has its own holding copies of its 
+    // entries' headers and data, with the object the first node.
+    struct Tree
+    {
+        std::vector<GByte>  abyData;
+        std::vector<Node>   asNodes;
+    };
+
+    struct StreamedTree
+    {
+        int                 iObject;
+        Tree                oTree;
+        size_t              nSize;          // estimate of memory used
+    };
+    typedef std::list<StreamedTree> StreamedList;
+
+    VSILFILE               *m_fp;
+    vsi_l_offset            m_nFileSize;
+    GIntBig                 m_nMaxNodes;
+    std::vector<Type>       m_aoTypes;
+    std::map<CPLString, int> m_oTypeIndex;
+    std::vector<FieldPath>  m_asPaths;      // for each type, for each AOI field
+    std::vector<GUInt32>    m_anObjectPos;  // Eaoi_AoiObjectType entries
+
+    // whole file
+    Tree                    m_oFile;        // the AOI node is the first
+    std::vector<int>        m_anObjectNodes;
+
+    // streaming
+    int                     m_bStreaming;
+    size_t                  m_nMemoryBudget;
+    StreamedList            m_oStreamed;    // most recently used at the front
+    std::map<int, StreamedList::iterator> m_oStreamedIndex;
+    size_t                  m_nStreamedSize;
+
+    int                 ParseDictionary( const char *pszDictionary );
+    int                 GetFixedSize( int iType, int nDepth );
+    int                 ResolvePath( int iType, const char *pszPath, FieldPath &sPath ) const;
+    void                InitNode( Node &sNode, const AOIEntryHeader &sHeader ) const;
+    int                 AddNode( Tree &oTree, GUInt32 nFilePos );
+    int                 BuildTree( Tree &oTree, GUInt32 nRootPos, int bFindObjects );
+    int                 StreamTree( Tree &oTree, GUInt32 nRootPos );
+    int                 ListObjects( GUInt32 nAOIPos );
+    const Tree         *GetTree( int iObject, int *piRoot );
+    int                 NameIs( const Tree &oTree, const Node &sNode, 
+                                const char *pszName ) const;
+    int                 GetNamedChild( const Tree &oTree, int iNode, 
+                                       const char *pszName ) const;
+
+    GIntBig             GetFieldBytes( const Field &oField, const GByte *pabyData,
+                                       size_t nSize, int nDepth ) const;
+    GIntBig             GetTypeBytes( int iType, const GByte *pabyData, 
+                                      size_t nSize, int nDepth ) const;
+    GIntBig             HashField( const Field &oField, const GByte *pabyData,
+                                   size_t nSize, int nDepth, GUIntBig &nHash ) const;
+    GIntBig             HashType( int iType, const GByte *pabyData, 
+                                  size_t nSize, int nDepth, GUIntBig &nHash ) const;
+    const GByte        *FindField( const Tree &oTree, int iNode, int iPath, 
+                                   size_t *pnSize, const Field **ppoField ) const;
+    int                 ReadValue( const Field &oField, const GByte *pabyData, 
+                                   size_t nSize, int nIndex, double *pdfValue ) const;
+    int                 ReadDouble( const Tree &oTree, int iNode, int iPath, 
+                                    int nIndex, double *pdfValue ) const;
+    int                 ReadString( const Tree &oTree, int iNode, int iPath, 
+                                    CPLString &osValue ) const;
+
+    void                ReadPolynomial( const Tree &oTree, int iNode, 
+                                        Efga_Polynomial *psPoly ) const;
+    int                 ReadVertices( const Tree &oTree, int iNode, int iPath, 
+                                      AOIElement &sElement, AOIDecodeLimits &sLimits ) const;
+    int                 ReadShape( const Tree &oTree, int iNode, AOIElement &sElement,
+                                   AOIDecodeLimits &sLimits ) const;
+    int                 DecodeNode( const Tree &oTree, int iNode, int iParent, 
+                                    AOIObject &oObject, AOIDecodeLimits &sLimits, 
+                                    int bGroupPaths, int nDepth ) const;
+    int                 GetHeadElement( const Tree &oTree, int iRoot, CPLString &osName,
+                                        CPLString &osDescription ) const;
+
+  public:
+                        AOIHFAReader();
+
+    // Parse the dictionary and the tree under the node at nAOIPos. 
+    // The whole file is read into memory unless nStreamingMemory isn't
+    // 0, in which case objects are read as needed and no more than
+    // about that many bytes of them are kept. Returns FALSE if there
+    // are more than nMaxNodes entries under the AOI node (or in one 
+    // object when streaming), there isn't enough memory or the file
+    // can't be parsed. fp must stay open while the reader is used.
+    int                 Open( VSILFILE *fp, GUInt32 nDictionaryPos, GUInt32 nAOIPos,
+                              GIntBig nMaxNodes, size_t nStreamingMemory );
+    int                 IsStreaming() const { return m_bStreaming; }
+
+    // The Eaoi_AoiObjectType entries in file order
+    int                 GetObjectCount() const { return (int)m_anObjectPos.size(); }
+    GUInt32             GetObjectPos( int iObject ) const 
+                            { return m_anObjectPos[iObject]; }
+    int                 GetObjectStrings( int iObject, CPLString &osName,
+                                          CPLString &osDescription );
+    // Hash of the names, types and data of all the entries making up
+    // an object, but not where they are, so an object that has been
+    // moved in the file is the same. The file offsets that pointer 
+    // fields hold are left out for the same reason.
+    GUIntBig            GetObjectHash( int iObject );
+
+    // Read all the shapes of an object into oObject the same way the 
+    // layer does with HFAEntry. Returns FALSE if there weren't any or
+    // the object is over one of the limits. Fills in the GroupPath of
+    // each element if bGroupPaths. Without streaming, threads can
+    // decode at the same time with their own sLimits.
+    int                 DecodeObject( int iObject, AOIObject &oObject, 
+                                      AOIDecodeLimits &sLimits, int bGroupPaths );
+};
+
+#endif // AOIHFAREADER_H
@@ -21,8 +21,25 @@
  */
 
 #include "aoilayer.h"
+#include "aoidatasource.h"
 #include "aoiproj.h"
+#include "aoithreads.h"
+#include "aoiupdate.h"
 #include "math.h"
+#include <algorithm>
+#include <limits.h>
+
+// Most points allowed in an ellipse
+#define AOI_MAX_ELLIPSE_STEPS 100000
+
+// Size of the header at the start of a BASEDATA (rows, columns, 
+// item type and object type)
+#define AOI_BASEDATA_HEADER_SIZE 12
+
+// Objects decoded before handing them to the threads in ScanObjects()
+// and the fewest worth starting threads for
+#define AOI_SCAN_BATCH_SIZE 1024
+#define AOI_MIN_PARALLEL_BATCH 64
 
 // This is my diagram of what an AOI file looks like (types with name in brackets):
 // Eaoi_AreaOfInterest (AOInode)
@@ -49,21 +66,50 @@
 //                              Polgon2 (Polygon Info)
 //                              ...
 
+const char *AOIGetOption( char **papszOpenOptions, const char *pszName, 
+                          const char *pszDefault )
+{
+    const char *pszValue = CSLFetchNameValue( papszOpenOptions, pszName );
+    if( pszValue == NULL )
+        pszValue = CPLGetConfigOption( CPLSPrintf( "OGR_AOI_%s", pszName ), pszDefault );
+    return pszValue;
+}
+
 // Constructor
-OGRAOILayer::OGRAOILayer( HFAEntry *pAOInode, const char *pszBasename )
+OGRAOILayer::OGRAOILayer( HFAInfo_t *psInfo, HFAEntry *pAOInode, 
+                          const char *pszBasename, char **papszOpenOptions,
+                          OGRAOIDataSource *poDS )
 {
+    m_poDS = poDS;
+    m_psInfo = psInfo;
     m_nNextFID = 0;
     m_pAOInode = pAOInode;
     m_pAOIObject = NULL;
     m_poSpatialRef = NULL;
+    m_bSpatialRefFetched = FALSE;
     m_bEnd = FALSE;
 
+    // A feature for each object or for each shape in the objects
+    const char *pszGranularity = AOIGetOption(papszOpenOptions, "GRANULARITY", "OBJECT");
+    m_bElementFeatures = EQUAL(pszGranularity, "ELEMENT");
+    if( !m_bElementFeatures && !EQUAL(pszGranularity, "OBJECT") )
+        CPLError(CE_Failure, CPLE_IllegalArg, "OGR_AOI_GRANULARITY should be OBJECT or ELEMENT. Using OBJECT");
+    if( m_bElementFeatures && psInfo->eAccess == HFA_Update )
+    {
+        // SetFeature() etc work on whole objects
+        CPLError(CE_Warning, CPLE_NotSupported, "GRANULARITY=ELEMENT can't be used when updating. Using OBJECT");
+        m_bElementFeatures = FALSE;
+    }
+    m_nElementObjectFID = -1;
+    m_iNextElement = 0;
+    m_nElementFIDEnd = 0;
+
     // Create the Feature Definition - GeometryCollection
     // and two text fields
     // Create layername from name of file and type
     m_poFeatureDefn = new OGRFeatureDefn( pszBasename );
     m_poFeatureDefn->Reference();
-    m_poFeatureDefn->SetGeomType( wkbGeometryCollection );
+    m_poFeatureDefn->SetGeomType( m_bElementFeatures ? wkbUnknown : wkbGeometryCollection );
    
     OGRFieldDefn oFieldName( "Name", OFTString );
     m_poFeatureDefn->AddFieldDefn( &oFieldName );
@@ -71,14 +117,152 @@ OGRAOILayer::OGRAOILayer( HFAEntry *pAOInode, const char *pszBasename )
     OGRFieldDefn oFieldDescription( "Description", OFTString );
     m_poFeatureDefn->AddFieldDefn( &oFieldDescription );
 
+    // which object the shape is from and where in its group
+    if( m_bElementFeatures )
+    {
+        OGRFieldDefn oFieldParent( "ParentFID", OFTInteger64 );
+        m_poFeatureDefn->AddFieldDefn( &oFieldParent );
+
+        OGRFieldDefn oFieldGroupPath( "GroupPath", OFTString );
+        m_poFeatureDefn->AddFieldDefn( &oFieldGroupPath );
+    }
+
+    // measures worked out while decoding without building the geometry
+    m_bComputedFields = CPLTestBool( AOIGetOption(papszOpenOptions, "COMPUTED_FIELDS", "NO") );
+    m_iFirstComputedField = m_poFeatureDefn->GetFieldCount();
+    if( m_bComputedFields )
+    {
+        const char *apszRealFields[] = { "area", "perimeter", "minx", "miny", "maxx", "maxy" };
+        for( size_t i = 0; i < sizeof(apszRealFields) / sizeof(apszRealFields[0]); i++ )
+        {
+            OGRFieldDefn oField( apszRealFields[i], OFTReal );
+            m_poFeatureDefn->AddFieldDefn( &oField );
+        }
+        OGRFieldDefn oFieldVertexCount( "vertex_count", OFTInteger64 );
+        m_poFeatureDefn->AddFieldDefn( &oFieldVertexCount );
+        OGRFieldDefn oFieldShapeKind( "shape_kind", OFTString );
+        m_poFeatureDefn->AddFieldDefn( &oFieldShapeKind );
+    }
+    m_poFilterFeature = NULL;
+    m_poPreparedFilter = NULL;
+
+    // clip to the spatial filter as features are built
+    m_bClipToFilter = CPLTestBool( AOIGetOption(papszOpenOptions, "CLIP_TO_FILTER", "NO") );
+    m_dfClipBuffer = CPLAtof( AOIGetOption(papszOpenOptions, "CLIP_BUFFER", "0") );
+    if( m_dfClipBuffer < 0 )
+    {
+        CPLError(CE_Failure, CPLE_IllegalArg, "OGR_AOI_CLIP_BUFFER < zero. Using 0");
+        m_dfClipBuffer = 0;
+    }
+
     // get the number of steps for creating an ellipsis from the config
-    const char *pszNSteps = CPLGetConfigOption("OGR_AOI_ELLIPSIS_STEPS", "36");
-    m_nEllipsisSteps = atol(pszNSteps);
-    if( m_nEllipsisSteps <= 0 )
+    const char *pszNSteps = AOIGetOption(papszOpenOptions, "ELLIPSIS_STEPS", "36");
+    m_sGeomOptions.nEllipseSteps = atol(pszNSteps);
+    if( m_sGeomOptions.nEllipseSteps <= 0 )
     {
         CPLError(CE_Failure, CPLE_IllegalArg, "OGR_AOI_ELLIPSIS_STEPS <= zero or invalid. Using 36");
-        m_nEllipsisSteps = 36;
+        m_sGeomOptions.nEllipseSteps = 36;
+    }
+    else if( m_sGeomOptions.nEllipseSteps > AOI_MAX_ELLIPSE_STEPS )
+    {
+        CPLError(CE_Failure, CPLE_IllegalArg, "OGR_AOI_ELLIPSIS_STEPS > %d. Using %d",
+                 AOI_MAX_ELLIPSE_STEPS, AOI_MAX_ELLIPSE_STEPS);
+        m_sGeomOptions.nEllipseSteps = AOI_MAX_ELLIPSE_STEPS;
+    }
+
+    // Limits so a corrupt file can't take forever or use all the memory
+    m_nMaxVertices = CPLAtoGIntBig( 
+            AOIGetOption(papszOpenOptions, "MAX_VERTICES", "10000000") );
+    m_nMaxNodes = CPLAtoGIntBig( 
+            AOIGetOption(papszOpenOptions, "MAX_NODES", "10000000") );
+    m_nMaxDepth = atoi( AOIGetOption(papszOpenOptions, "MAX_DEPTH", "64") );
+    m_nObjectVertices = 0;
+    m_nNodesRead = 0;
+    m_bObjectBudgetExceeded = FALSE;
+    m_bBudgetExceeded = FALSE;
+    m_bCheckOnly = FALSE;
+
+    // simplify shapes as they are decoded - tolerance is in layer units
+    m_sGeomOptions.dfSimplifyTolerance = CPLAtof( 
+            AOIGetOption(papszOpenOptions, "SIMPLIFY_TOLERANCE", "0") );
+    if( m_sGeomOptions.dfSimplifyTolerance < 0 )
+    {
+        CPLError(CE_Failure, CPLE_IllegalArg, "OGR_AOI_SIMPLIFY_TOLERANCE < zero. Not simplifying");
+        m_sGeomOptions.dfSimplifyTolerance = 0;
+    }
+
+    // Objects are decoded by the lean reader unless asked not to. 
+    // Changed entries have to stay in the HFAEntry tree until they 
+    // are written so it isn't used when updating.
+    m_bUpdate = psInfo->eAccess == HFA_Update;
+    m_poLeanReader = NULL;
+    m_iNextLeanObject = 0;
+    int bHFAReader = EQUAL( AOIGetOption(papszOpenOptions, "READER", "LEAN"), "HFA" );
+    // Streaming mode - only keep the entries for recently read
+    // objects in memory rather than the whole file
+    int bStreaming = CPLTestBool( AOIGetOption(papszOpenOptions, "STREAMING", "NO") );
+    if( bStreaming && (m_bUpdate || bHFAReader) )
+    {
+        CPLError(CE_Warning, CPLE_NotSupported, "STREAMING can't be used when updating or with READER=HFA. Ignoring it");
+        bStreaming = FALSE;
     }
+    if( !m_bUpdate && !bHFAReader )
+    {
+        // Without streaming the whole file is read into memory, so 
+        // bigger files than MAX_FILE_IN_MEMORY are streamed anyway
+        if( !bStreaming )
+        {
+            GUIntBig nMaxInMemory = (GUIntBig)CPLAtoGIntBig(
+                    AOIGetOption(papszOpenOptions, "MAX_FILE_IN_MEMORY", "268435456") );
+            vsi_l_offset nFileSize = 0;
+            if( VSIFSeekL( psInfo->fp, 0, SEEK_END ) == 0 )
+                nFileSize = VSIFTellL( psInfo->fp );
+            if( (GUIntBig)nFileSize > nMaxInMemory )
+            {
+                CPLDebug( "AOI", "File is over MAX_FILE_IN_MEMORY (" CPL_FRMT_GUIB 
+                          " bytes). Streaming it.", nMaxInMemory );
+                bStreaming = TRUE;
+            }
+        }
+        size_t nStreamingMemory = 0;
+        if( bStreaming )
+        {
+            nStreamingMemory = (size_t)CPLAtoGIntBig(
+                    AOIGetOption(papszOpenOptions, "STREAMING_MEMORY", "16777216") );
+            // 0 keeps only the object being read
+            if( nStreamingMemory == 0 )
+                nStreamingMemory = 1;
+        }
+        m_poLeanReader = new AOIHFAReader();
+        if( !m_poLeanReader->Open( psInfo->fp, psInfo->nDictionaryPos, 
+                                   pAOInode->GetFilePos(), m_nMaxNodes,
+                                   nStreamingMemory ) )
+        {
+            CPLError(CE_Warning, CPLE_AppDefined, "Can't read the AOI entries directly. Reading them through HFAEntry instead");
+            delete m_poLeanReader;
+            m_poLeanReader = NULL;
+        }
+    }
+
+    m_bObjectTableComplete = FALSE;
+
+    // Threads for whole layer passes (GetExtent etc)
+    m_nThreads = AOIGetThreadCount( 
+            AOIGetOption(papszOpenOptions, "NUM_THREADS", "ALL_CPUS") );
+    m_bEnvelopeIndexBuilt = FALSE;
+
+    // Reproject as shapes are decoded rather than afterwards
+    m_poTargetSRS = NULL;
+    const char *pszTargetSRS = AOIGetOption(papszOpenOptions, "TARGET_SRS", NULL);
+    if( pszTargetSRS != NULL )
+        SetTargetSRS( pszTargetSRS );
+
+    // Keep built features between passes - budget in bytes
+    size_t nFeatureCacheSize = (size_t)CPLAtoGIntBig( 
+            AOIGetOption(papszOpenOptions, "FEATURE_CACHE_SIZE", "0") );
+    m_poFeatureCache = NULL;
+    if( nFeatureCacheSize > 0 )
+        m_poFeatureCache = new AOIFeatureCache( nFeatureCacheSize );
 }
 
 // Destructor - release attached feature defn and spatial ref
@@ -86,20 +270,161 @@ OGRAOILayer::~OGRAOILayer()
 {
     if( m_poFeatureDefn != NULL )
         m_poFeatureDefn->Release();
+
+    if( m_poSpatialRef != NULL )
+        m_poSpatialRef->Release();
+
+    if( m_sGeomOptions.poCT != NULL )
+        OGRCoordinateTransformation::DestroyCT( m_sGeomOptions.poCT );
+    if( m_poTargetSRS != NULL )
+        m_poTargetSRS->Release();
+
+    delete m_poLeanReader;
+
+    delete m_poFilterFeature;
+    delete m_poPreparedFilter;
+
+    if( m_poFeatureCache != NULL )
+    {
+        CPLDebug( "AOI", "Feature cache: " CPL_FRMT_GIB " hits, " CPL_FRMT_GIB " misses",
+                  m_poFeatureCache->GetHits(), m_poFeatureCache->GetMisses() );
+        delete m_poFeatureCache;
+    }
+}
+
+int OGRAOILayer::TestCapability( const char *pszCap )
+{
+    if( EQUAL(pszCap, OLCRandomRead) )
+        return TRUE;
+    if( EQUAL(pszCap, OLCSequentialWrite) || EQUAL(pszCap, OLCRandomWrite) )
+        return m_bUpdate;
+    if( EQUAL(pszCap, OLCFastFeatureCount) )
+        return m_poFilterGeom == NULL && m_poAttrQuery == NULL && m_bEnvelopeIndexBuilt
+            && !m_bElementFeatures;
+    if( EQUAL(pszCap, OLCFastGetExtent) )
+        return m_poFilterGeom == NULL && m_poAttrQuery == NULL && m_bEnvelopeIndexBuilt;
+    return FALSE;
 }
 
-// Return the spatial reference for this layer
+// Index polygon filters so shapes can be tested without building 
+// their geometry. Rectangles only need the envelope test.
+void OGRAOILayer::SetSpatialFilter( OGRGeometry *poGeom )
+{
+    OGRLayer::SetSpatialFilter( poGeom );
+
+    delete m_poPreparedFilter;
+    m_poPreparedFilter = NULL;
+    if( m_poFilterGeom != NULL && !m_bFilterIsEnvelope )
+    {
+        m_poPreparedFilter = new AOIPreparedFilter();
+        if( !m_poPreparedFilter->Prepare( m_poFilterGeom ) )
+        {
+            delete m_poPreparedFilter;
+            m_poPreparedFilter = NULL;
+        }
+    }
+}
+
+const char *OGRAOILayer::GetMetadataItem( const char *pszName, const char *pszDomain )
+{
+    if( pszDomain != NULL && EQUAL(pszDomain, "AOI") && EQUAL(pszName, "DICTIONARY_SIZE") )
+    {
+        m_osMetadataItem.Printf( "%d", 
+                (int)m_psInfo->poDictionary->osDictionaryText.size() );
+        return m_osMetadataItem.c_str();
+    }
+    if( pszDomain != NULL && EQUAL(pszDomain, "AOI") && m_poFeatureCache != NULL )
+    {
+        if( EQUAL(pszName, "FEATURE_CACHE_HITS") )
+            m_osMetadataItem.Printf( CPL_FRMT_GIB, m_poFeatureCache->GetHits() );
+        else if( EQUAL(pszName, "FEATURE_CACHE_MISSES") )
+            m_osMetadataItem.Printf( CPL_FRMT_GIB, m_poFeatureCache->GetMisses() );
+        else if( EQUAL(pszName, "FEATURE_CACHE_SIZE") )
+            m_osMetadataItem.Printf( CPL_FRMT_GUIB, (GUIntBig)m_poFeatureCache->GetSize() );
+        else if( EQUAL(pszName, "FEATURE_CACHE_COUNT") )
+            m_osMetadataItem.Printf( "%d", m_poFeatureCache->GetCount() );
+        else
+            return NULL;
+        return m_osMetadataItem.c_str();
+    }
+    return OGRLayer::GetMetadataItem( pszName, pszDomain );
+}
+
+// Set up the transformation to pszTargetSRS (anything
+// OGRSpatialReference::SetFromUserInput() understands). 
+// Leaves the layer in its own SRS if this fails.
+void OGRAOILayer::SetTargetSRS( const char *pszTargetSRS )
+{
+    OGRSpatialReference *poSourceSRS = GetSourceSpatialRef();
+    if( poSourceSRS == NULL )
+    {
+        CPLError( CE_Failure, CPLE_AppDefined, 
+                  "AOI file has no projection. Cannot reproject to TARGET_SRS." );
+        return;
+    }
+
+    OGRSpatialReference *poTargetSRS = new OGRSpatialReference();
+    if( poTargetSRS->SetFromUserInput( pszTargetSRS ) != OGRERR_NONE )
+    {
+        CPLError( CE_Failure, CPLE_IllegalArg, "Invalid TARGET_SRS: %s", pszTargetSRS );
+        poTargetSRS->Release();
+        return;
+    }
+
+    // The layer's SRS is handed out through GetSpatialRef() so work
+    // on a copy rather than changing its axis mapping underneath callers
+    poSourceSRS = poSourceSRS->Clone();
+#if GDAL_VERSION_NUM >= 3000000
+    poTargetSRS->SetAxisMappingStrategy( OAMS_TRADITIONAL_GIS_ORDER );
+    poSourceSRS->SetAxisMappingStrategy( OAMS_TRADITIONAL_GIS_ORDER );
+#endif
+
+    if( poTargetSRS->IsSame( poSourceSRS ) )
+    {
+        // nothing to do
+        poSourceSRS->Release();
+        poTargetSRS->Release();
+        return;
+    }
+
+    OGRCoordinateTransformation *poCT = 
+                OGRCreateCoordinateTransformation( poSourceSRS, poTargetSRS );
+    poSourceSRS->Release();
+    if( poCT == NULL )
+    {
+        // error already reported
+        poTargetSRS->Release();
+        return;
+    }
+
+    m_poTargetSRS = poTargetSRS;
+    m_sGeomOptions.poCT = poCT;
+}
+
+// Return the spatial reference of the file
 // Construct it if this is the first time we have
 // been asked, or return cached copy
-OGRSpatialReference* OGRAOILayer::GetSpatialRef()
+// Note the SRS may be shared with other layers through
+// the SRS cache (see aoiproj.cpp)
+OGRSpatialReference* OGRAOILayer::GetSourceSpatialRef()
 {
-    if( m_poSpatialRef.get() == NULL )
+    if( !m_bSpatialRefFetched )
     {
-        // note: already assigned refcount of 1 on creation
+        // note: already assigned a reference for us on creation
         m_poSpatialRef = CreateSpatialReference( m_pAOInode );
+        m_bSpatialRefFetched = TRUE;
     }
 
-    return m_poSpatialRef.get();
+    return m_poSpatialRef;
+}
+
+// Return the spatial reference for this layer. 
+// This is TARGET_SRS if reprojecting.
+OGRSpatialReference* OGRAOILayer::GetSpatialRef()
+{
+    if( m_poTargetSRS != NULL )
+        return m_poTargetSRS;
+    return GetSourceSpatialRef();
 }
 
 /* Returns the next Eaoi_AoiObjectType to use */
@@ -169,391 +494,1499 @@ HFAEntry* OGRAOILayer::GetInfoFromAOIObject( HFAEntry *pAOIObject,
     return pInfo;
 }
 
-// Allow reading to begin at the start again
+// Allow reading to begin at the start again. Long lived datasources
+// (REFRESH=YES) reload the file here if it has changed so a pass never
+// sees a mix of the old and new file.
 void OGRAOILayer::ResetReading()
+{
+    if( m_poDS != NULL )
+        m_poDS->RefreshIfChanged();
+    Rewind();
+}
+
+void OGRAOILayer::Rewind()
 {
     m_nNextFID = 0;
     m_pAOIObject = NULL;
+    m_iNextLeanObject = 0;
     m_bEnd = FALSE;
+    m_nNodesRead = 0;
+    m_bBudgetExceeded = FALSE;
+    m_oElementObject.Clear();
+    m_iNextElement = 0;
 }
 
-// Given an HFAEntry that is a Polygon2, create a OGRGeometry for it
-OGRGeometry * OGRAOILayer::HandlePolygon( HFAEntry *pInfo, Efga_Polynomial *pPoly )
+// Read the vertices of a polygon, line or point from the named
+// BASEDATA field into the element. The field is found once and the
+// values are read straight from the entry data, as the lean reader 
+// does. The vertex arrays in the element keep their capacity between
+// features so this doesn't allocate in the steady state.
+int OGRAOILayer::HandleVertices( HFAEntry *pInfo, const char *pszField,
+                                 AOIElement &sElement )
 {
-    int nRows=0, nColumns;
-    CPLErr err;
-    // this is how you extract the dimensions of a basedata
-    nColumns = pInfo->GetIntField("coords.coords[-2]", &err);
-    if( err == CE_None )
-        nRows = pInfo->GetIntField("coords.coords[-1]", &err);
+    int nSize = 0;
+    const GByte *pabyData = AOIGetEntryField( pInfo, pszField, &nSize );
+    if( pabyData == NULL || nSize < AOI_BASEDATA_HEADER_SIZE )
+        return FALSE;
+
+    // rows, columns, then the EPT_ type of the values
+    GUInt32 nRows, nColumns;
+    GUInt16 nBaseType;
+    memcpy( &nRows, pabyData, 4 );
+    memcpy( &nColumns, pabyData + 4, 4 );
+    memcpy( &nBaseType, pabyData + 8, 2 );
+    HFAStandard( 4, &nRows );
+    HFAStandard( 4, &nColumns );
+    HFAStandard( 2, &nBaseType );
+    if( nColumns == 0 || nColumns > INT_MAX || nRows != 2 )
+        return FALSE;
 
-    CPLString wkt("POLYGON((");
-    if( ( err == CE_None ) && (nColumns > 0 ) && (nRows == 2 ) )
+    // make sure the entry really has that many before we loop over them
+    int nBits = HFAGetDataTypeBits( (EPTType)nBaseType );
+    if( nBits <= 0 )
+        return FALSE;
+    GUIntBig nNeeded = AOI_BASEDATA_HEADER_SIZE + 
+                        ((GUIntBig)nColumns * nRows * nBits + 7) / 8;
+    if( nNeeded > (GUIntBig)nSize )
     {
-        // Read in each coord and put it into the wkt
-        double x = 0, y = 0;
-        CPLString osBuffer;
-        for( int nIndex = 0; ( err == CE_None ) && nIndex < (nColumns * nRows); nIndex+=2 )
-        {
-            osBuffer.Printf("coords.coords[%d]", nIndex );
-            x = pInfo->GetDoubleField( osBuffer, &err );
+        CPLError( CE_Failure, CPLE_AppDefined, 
+                  "%s in %s claims %d points but the entry only has %u bytes", 
+                  pszField, pInfo->GetName(), (int)nColumns, pInfo->GetDataSize() );
+        return FALSE;
+    }
 
-            if( err == CE_None )
-            {
-                osBuffer.Printf("coords.coords[%d]", nIndex+1 );
-                y = pInfo->GetDoubleField( osBuffer, &err );
-            }
-            if( err == CE_None )
-            {
-                // apply the transform - this handles rotation etc
-                ApplyXformPolynomial( pPoly, &x, &y );
-                osBuffer.Printf("%f %f,", x, y );
-                wkt = wkt + osBuffer;
-            }
-        }
-        // at end - close polygon
-        if( err == CE_None )
-        {
-            x = pInfo->GetDoubleField( "coords.coords[0]", &err );
-            if( err == CE_None )
-                y = pInfo->GetDoubleField( "coords.coords[1]", &err );
-            if( err == CE_None )
-            {
-                ApplyXformPolynomial( pPoly, &x, &y );
-                osBuffer.Printf("%f %f))", x, y );
-                wkt = wkt + osBuffer;
-            }
-        }
+    m_nObjectVertices += nColumns;
+    if( m_nObjectVertices > m_nMaxVertices )
+    {
+        CPLError( CE_Failure, CPLE_AppDefined, 
+                  "AOI object has more than " CPL_FRMT_GIB " points (MAX_VERTICES). Ignoring it.",
+                  m_nMaxVertices );
+        m_bObjectBudgetExceeded = TRUE;
+        return FALSE;
     }
+    if( m_bCheckOnly )
+    {
+        sElement.nPoints = (int)nColumns;
+        return TRUE;
+    }
+
+    return AOIReadBaseDataCoords( nBaseType, pabyData + AOI_BASEDATA_HEADER_SIZE,
+                                  (int)nColumns, sElement );
+}
 
+// Given an HFAEntry that is a Polygon2, read it into the element
+int OGRAOILayer::HandlePolygon( HFAEntry *pInfo, AOIElement &sElement )
+{
+    sElement.eKind = AOI_SHAPE_POLYGON;
+    return HandleVertices( pInfo, "coords.coords", sElement );
+}
+
+// Given an HFAEntry that is a Rectangle2, read it into the element
+int OGRAOILayer::HandleRectangle( HFAEntry *pInfo, AOIElement &sElement )
+{
+    CPLErr err;
+
+    sElement.eKind = AOI_SHAPE_RECTANGLE;
+    sElement.nPoints = 0;
+    sElement.dfCenterX = pInfo->GetDoubleField("center.x", &err);
     if( err == CE_None )
     {
-        // Create OGRGeometry object
-        const char *pszData = wkt.c_str();
-        OGRGeometry *pGeom;
-        if( OGRGeometryFactory::createFromWkt( &pszData, GetSpatialRef(), &pGeom ) == OGRERR_NONE )
-        {
-            return pGeom;
-        }
+        sElement.dfCenterY = pInfo->GetDoubleField("center.y", &err);
     }
-    return NULL;
+    if( err == CE_None )
+    {
+        sElement.dfSize1 = pInfo->GetDoubleField("width", &err);
+    }
+    if( err == CE_None )
+    {
+        sElement.dfSize2 = pInfo->GetDoubleField("height", &err);
+    }
+    // orientation always seems to be 0 - handled by the pPoly
+
+    return err == CE_None;
 }
 
-// Given an HFAEntry that is a Rectangle2, create a OGRGeometry for it
-OGRGeometry *OGRAOILayer::HandleRectangle( HFAEntry *pInfo, Efga_Polynomial *pPoly )
+// Given an HFAEntry that is a Ellipse2, read it into the element
+// Note that since an ellipse type doesn't exist in OGR, it gets
+// turned into a polygon with m_sGeomOptions.nEllipseSteps points 
+// (or fewer if simplifying) when the geometry is built
+int OGRAOILayer::HandleEllipse( HFAEntry *pInfo, AOIElement &sElement )
 {
-    double dX, dY, dWidth, dHeight;
-    double dTLX, dTLY, dBRX, dBRY, dTRX, dTRY, dBLX, dBLY;
     CPLErr err;
 
-    dX = pInfo->GetDoubleField("center.x", &err);
+    sElement.eKind = AOI_SHAPE_ELLIPSE;
+    sElement.nPoints = 0;
+    sElement.dfCenterX = pInfo->GetDoubleField("center.x", &err);
     if( err == CE_None )
     {
-        dY = pInfo->GetDoubleField("center.y", &err);
+        sElement.dfCenterY = pInfo->GetDoubleField("center.y", &err);
     }
     if( err == CE_None )
     {
-        dWidth = pInfo->GetDoubleField("width", &err);
+        sElement.dfSize1 = pInfo->GetDoubleField("semiMajorAxis", &err);
     }
     if( err == CE_None )
     {
-        dHeight = pInfo->GetDoubleField("height", &err);
+        sElement.dfSize2 = pInfo->GetDoubleField("semiMinorAxis", &err);
     }
     // orientation always seems to be 0 - handled by the pPoly
 
-    if( err == CE_None )
+    return err == CE_None;
+}
+
+// Given an HFAEntry that is a Polyline2, read it into the element
+int OGRAOILayer::HandleLine( HFAEntry *pInfo, AOIElement &sElement )
+{
+    sElement.eKind = AOI_SHAPE_LINE;
+    return HandleVertices( pInfo, "coords.coords", sElement );
+}
+
+// Given an HFAEntry that is a Point2, read it into the element
+int OGRAOILayer::HandlePoint( HFAEntry *pInfo, AOIElement &sElement )
+{
+    sElement.eKind = AOI_SHAPE_POINT;
+    return HandleVertices( pInfo, "coord.coords", sElement )
+            && sElement.nPoints == 1;
+}
+
+// This function is called recursively to add elements to the
+// AOIObject.
+// Is initially called with the head Element_2_Eant for the feature
+int OGRAOILayer::HandleChildFeatures( HFAEntry *pNode, HFAEntry *pParent, 
+                                      AOIObject &oObject, int nDepth )
+{
+    if( nDepth > m_nMaxDepth )
+    {
+        CPLError( CE_Failure, CPLE_AppDefined, 
+                  "AOI object is nested more than %d deep (MAX_DEPTH). Ignoring it.",
+                  m_nMaxDepth );
+        return FALSE;
+    }
+    if( ++m_nNodesRead > m_nMaxNodes )
     {
-        // work out corners
-        dTLX = dX - (dWidth / 2);
-        dTLY = dY + (dHeight / 2);
+        CPLError( CE_Failure, CPLE_AppDefined, 
+                  "AOI file has more than " CPL_FRMT_GIB " entries (MAX_NODES). "
+                  "Not reading any more.", m_nMaxNodes );
+        m_bBudgetExceeded = TRUE;
+        return FALSE;
+    }
 
-        dTRX = dX + (dWidth / 2);
-        dTRY = dTLY;
+    // Note we just check the first part of the type string
+    // (without the version). Hopefully later versions (if they exist)
+    // have the same base fields.
+    // Call the appropriate function for the shape
+    const char *pszType = pNode->GetType();
+    int bShape = EQUALN(pszType,"Polygon",7) || EQUALN(pszType,"Rectangle",9)
+        || EQUALN(pszType,"Ellipse",7) || EQUALN(pszType,"Polyline",8)
+        || EQUALN(pszType,"Point",5);
 
-        dBRX = dX + (dWidth / 2);
-        dBRY = dY - (dHeight / 2);
+    if( bShape )
+    {
+        AOIElement &sElement = oObject.AddElement();
+        if( m_bElementFeatures )
+            sElement.osGroupPath = m_osGroupPath;
 
-        dBLX = dTLX;
-        dBLY = dBRY;
+        // read the polynomial - will fail gracefully 
+        // this this node doesn't have one
+        if( !m_bCheckOnly )
+            ReadXformPolynomial( pParent, &sElement.sPoly );
 
-        // apply polynomial to each - handles rotation etc
-        ApplyXformPolynomial( pPoly, &dTLX, &dTLY );
-        ApplyXformPolynomial( pPoly, &dTRX, &dTRY );
-        ApplyXformPolynomial( pPoly, &dBRX, &dBRY );
-        ApplyXformPolynomial( pPoly, &dBLX, &dBLY );
+        int bOK = FALSE;
+        if( EQUALN(pszType,"Polygon",7) )
+            bOK = HandlePolygon( pNode, sElement );
+        else if( EQUALN(pszType,"Rectangle",9) )
+            bOK = HandleRectangle( pNode, sElement );
+        else if( EQUALN(pszType,"Ellipse",7) )
+            bOK = HandleEllipse( pNode, sElement );
+        else if( EQUALN(pszType,"Polyline",8) )
+            bOK = HandleLine( pNode, sElement );
+        else
+            bOK = HandlePoint( pNode, sElement );
 
-        // create WKT
-        CPLString sWKT;
-        sWKT.Printf("POLYGON((%f %f,%f %f,%f %f,%f %f,%f %f))",
-                    dTLX, dTLY, dTRX, dTRY, dBRX, dBRY, dBLX, dBLY, dTLX, dTLY );
+        // couldn't read it - forget about it
+        if( !bOK )
+            oObject.nElements--;
+        if( m_bObjectBudgetExceeded )
+            return FALSE;
+    }
 
-        // Create OGRGeometry object
-        const char *pszData = sWKT.c_str();
-        OGRGeometry *pGeom;
-        if( OGRGeometryFactory::createFromWkt( &pszData, GetSpatialRef(), &pGeom ) == OGRERR_NONE )
-        {
-            return pGeom;
-        }
+    // Now process any child entries recursively
+    HFAEntry *pChild = pNode->GetChild();
+    int iGroup = 0;
+    while( pChild != NULL )
+    {
+        // the path to each grouped Element_2_Eant is its position
+        // among the others under the same parent
+        size_t nPathLength = m_osGroupPath.size();
+        if( m_bElementFeatures && EQUALN(pChild->GetType(), "Element", 7) )
+            m_osGroupPath += CPLSPrintf( "/%d", iGroup++ );
+
+        int bOK = HandleChildFeatures( pChild, pNode, oObject, nDepth + 1 );
+        m_osGroupPath.resize( nPathLength );
+        if( !bOK )
+            return FALSE;
+        pChild = pChild->GetNext();
     }
+    return TRUE;
+}
 
-    return NULL;
+// Read all the shapes for an Eaoi_AoiObjectType into oObject.
+// Returns FALSE if there weren't any.
+int OGRAOILayer::DecodeAOIObject( HFAEntry *pAOIObject, AOIObject &oObject )
+{
+    const char *pszName = NULL, *pszDescription = NULL;
+
+    oObject.Clear();
+
+    // Get the head node for the feature
+    HFAEntry *pInfo = GetInfoFromAOIObject( pAOIObject, &pszName, &pszDescription );
+    if( pInfo == NULL )
+        return FALSE;
+
+    oObject.osName = pszName ? pszName : "";
+    oObject.osDescription = pszDescription ? pszDescription : "";
+
+    // put all the child shapes into the object
+    m_osGroupPath = "0";
+    m_nObjectVertices = 0;
+    m_bObjectBudgetExceeded = FALSE;
+    if( !HandleChildFeatures( pInfo, pInfo, oObject, 0 ) )
+    {
+        // over one of the limits - leave the object out
+        oObject.Clear();
+        if( m_bBudgetExceeded )
+            m_bEnd = TRUE;
+        return FALSE;
+    }
+
+    return oObject.nElements > 0;
 }
 
-// Given an HFAEntry that is a Ellipse2, create a OGRGeometry for it
-// Note that since an ellipse type doesn't exist in OGR, we must turn
-// it into a polygon with ELLIPSESTEPS points
-OGRGeometry *OGRAOILayer::HandleEllipse( HFAEntry *pInfo, Efga_Polynomial *pPoly )
+// Read all the shapes of one of the lean reader's objects into oObject
+int OGRAOILayer::DecodeLeanObject( int iObject, AOIObject &oObject )
 {
-    double dCenterX, dCenterY, dSemiMajor, dSemiMinor, dAlpha, dX, dY;
-    CPLErr err;
+    AOIDecodeLimits sLimits;
+    sLimits.nMaxVertices = m_nMaxVertices;
+    sLimits.nMaxNodes = m_nMaxNodes;
+    sLimits.nMaxDepth = m_nMaxDepth;
+    sLimits.nNodesRead = m_nNodesRead;
+    sLimits.bBudgetExceeded = FALSE;
+    sLimits.bCheckOnly = m_bCheckOnly;
 
-    dCenterX = pInfo->GetDoubleField("center.x", &err);
-    if( err == CE_None )
+    int bHaveShapes = m_poLeanReader->DecodeObject( iObject, oObject, sLimits, 
+                                                    m_bElementFeatures );
+    m_nNodesRead = sLimits.nNodesRead;
+    if( sLimits.bBudgetExceeded )
     {
-        dCenterY = pInfo->GetDoubleField("center.y", &err);
+        m_bBudgetExceeded = TRUE;
+        m_bEnd = TRUE;
     }
-    if( err == CE_None )
+    return bHaveShapes;
+}
+
+// The options for building features, with the clip rectangle set
+// from the current spatial filter if bClip
+const AOIGeometryOptions &OGRAOILayer::GetBuildOptions( int bClip )
+{
+    if( !bClip )
+        return m_sGeomOptions;
+
+    m_sClipOptions = m_sGeomOptions;
+    m_sClipOptions.bClip = TRUE;
+    m_sClipOptions.sClipEnvelope = m_sFilterEnvelope;
+    m_sClipOptions.sClipEnvelope.MinX -= m_dfClipBuffer;
+    m_sClipOptions.sClipEnvelope.MinY -= m_dfClipBuffer;
+    m_sClipOptions.sClipEnvelope.MaxX += m_dfClipBuffer;
+    m_sClipOptions.sClipEnvelope.MaxY += m_dfClipBuffer;
+    return m_sClipOptions;
+}
+
+// Create the geometry collection for a decoded object
+OGRGeometry *OGRAOILayer::BuildGeometry( const AOIObject &oObject, int bClip )
+{
+    const AOIGeometryOptions &sOptions = GetBuildOptions( bClip );
+    OGRGeometryCollection *pCollection = new OGRGeometryCollection();
+    for( int i = 0; i < oObject.nElements; i++ )
     {
-        dSemiMajor = pInfo->GetDoubleField("semiMajorAxis", &err);
+        OGRGeometry *pGeom = AOIElementToGeometry( oObject.aoElements[i], 
+                                                   sOptions, m_oScratch );
+        if( pGeom != NULL )
+            pCollection->addGeometryDirectly( pGeom );
     }
-    if( err == CE_None )
+    pCollection->assignSpatialReference( GetSpatialRef() );
+    return pCollection;
+}
+
+// Decode the object for a FID that is already in the object table
+int OGRAOILayer::DecodeObjectByFID( GIntBig nFID )
+{
+    if( m_poLeanReader != NULL )
+        return DecodeLeanObject( m_anLeanObjects[nFID], m_oObject );
+
+    HFAEntry *pAOIObject = m_apoObjects[nFID];
+    if( pAOIObject == NULL )
+        return FALSE;
+
+    return DecodeAOIObject( pAOIObject, m_oObject );
+}
+
+// Decode the next object that has shapes without building a geometry.
+// The returned object belongs to the layer and is only valid until 
+// the next call. Returns NULL at the end.
+const AOIObject *OGRAOILayer::GetNextDecodedObject( GIntBig *pnFID )
+{
+    // once we know where everything is skip following the tree
+    if( m_bObjectTableComplete )
     {
-        dSemiMinor = pInfo->GetDoubleField("semiMinorAxis", &err);
+        while( m_nNextFID < (int)m_anObjectPos.size() && !m_bBudgetExceeded )
+        {
+            GIntBig nFID = m_nNextFID++;
+            if( DecodeObjectByFID( nFID ) )
+            {
+                if( pnFID != NULL )
+                    *pnFID = nFID;
+                return &m_oObject;
+            }
+        }
+        return NULL;
     }
-    // orientation always seems to be 0 - handled by the pPoly
 
-    if( err == CE_None )
+    while( TRUE )
     {
-        // Do maths to get points and add to wkt
-        CPLString sWKT("POLYGON((");
-        CPLString osBuffer;
-        for( dAlpha = 0; dAlpha < 360; dAlpha += (360.0/m_nEllipsisSteps) )
+        HFAEntry *pAOIObject = NULL;
+        int iLeanObject = -1;
+        if( m_poLeanReader == NULL )
+            pAOIObject = GetNextAOIObject();
+        else if( !m_bEnd && m_iNextLeanObject < m_poLeanReader->GetObjectCount() )
+            iLeanObject = m_iNextLeanObject++;
+        else
+            m_bEnd = TRUE;
+
+        if( pAOIObject == NULL && iLeanObject < 0 ) // at end of file
         {
-            dX = dCenterX + (dSemiMajor * cos(dAlpha / 180.0 * M_PI));
-            dY = dCenterY + (dSemiMinor * sin(dAlpha / 180.0 * M_PI));
+            // every object has been seen in order if the table is
+            // as long as the pass
+            if( m_nNextFID == (int)m_anObjectPos.size() && !m_bBudgetExceeded )
+                m_bObjectTableComplete = TRUE;
+            return NULL;
+        }
+
+        int bHaveShapes;
+        if( m_poLeanReader != NULL )
+            bHaveShapes = DecodeLeanObject( iLeanObject, m_oObject );
+        else
+            bHaveShapes = DecodeAOIObject( pAOIObject, m_oObject );
 
-            // Handles rotation etc
-            ApplyXformPolynomial( pPoly, &dX, &dY );
-            osBuffer.Printf("%f %f,", dX, dY );
-            sWKT = sWKT + osBuffer;
+        // no shapes - don't add feature
+        // is this the right thing to do?
+        if( !bHaveShapes )
+            continue;
+
+        if( m_nNextFID == (int)m_anObjectPos.size() && m_poLeanReader != NULL )
+        {
+            m_anObjectPos.push_back( m_poLeanReader->GetObjectPos( iLeanObject ) );
+            m_anLeanObjects.push_back( iLeanObject );
         }
-        // close poly
-        dX = dCenterX + dSemiMajor;
-        dY = dCenterY;
-
-        ApplyXformPolynomial( pPoly, &dX, &dY );
-        osBuffer.Printf("%f %f))", dX, dY );
-        sWKT = sWKT + osBuffer;
-
-        // Create OGRGeometry object
-        const char *pszData = sWKT.c_str();
-        OGRGeometry *pGeom;
-        if( OGRGeometryFactory::createFromWkt( &pszData, GetSpatialRef(), &pGeom ) == OGRERR_NONE )
+        else if( m_nNextFID == (int)m_anObjectPos.size() )
         {
-            return pGeom;
+            m_anObjectPos.push_back( pAOIObject->GetFilePos() );
+            m_apoObjects.push_back( pAOIObject );
         }
+
+        if( pnFID != NULL )
+            *pnFID = m_nNextFID;
+        m_nNextFID++;
+        return &m_oObject;
     }
+}
 
-    return NULL;
+// Set the attributes of a feature for a whole object (iElement -1)
+// or one of its shapes
+void OGRAOILayer::SetFields( OGRFeature *poFeature, const AOIObject &oObject,
+                             GIntBig nObjectFID, int iElement )
+{
+    poFeature->SetField( 0, oObject.osName.c_str() );
+    poFeature->SetField( 1, oObject.osDescription.c_str() );
+    if( iElement < 0 )
+    {
+        if( m_bComputedFields )
+            SetComputedFields( poFeature, oObject, 0, oObject.nElements );
+        return;
+    }
+
+    poFeature->SetField( 2, nObjectFID );
+    poFeature->SetField( 3, oObject.aoElements[iElement].osGroupPath.c_str() );
+    if( m_bComputedFields )
+        SetComputedFields( poFeature, oObject, iElement, iElement + 1 );
 }
 
-// Given an HFAEntry that is a Rectangle2, create a OGRGeometry for it
-OGRGeometry *OGRAOILayer::HandleLine( HFAEntry *pInfo, Efga_Polynomial *pPoly )
+// Totals for the shapes iFirst to iLast - 1. Rectangles and ellipses 
+// have no vertices in the file. The kind is "mixed" if there are
+// different kinds of shapes.
+void OGRAOILayer::SetComputedFields( OGRFeature *poFeature, const AOIObject &oObject,
+                                     int iFirst, int iLast )
 {
-    int nRows=0, nColumns;
-    CPLErr err;
-    // this is how you extract the dimensions of a basedata
-    nColumns = pInfo->GetIntField("coords.coords[-2]", &err);
-    if( err == CE_None )
-        nRows = pInfo->GetIntField("coords.coords[-1]", &err);
+    double dfArea = 0, dfPerimeter = 0;
+    GIntBig nVertices = 0;
+    OGREnvelope sEnvelope;
+    const char *pszKind = NULL;
+    for( int i = iFirst; i < iLast; i++ )
+    {
+        const AOIElement &sElement = oObject.aoElements[i];
+        double dfElementArea, dfElementPerimeter;
+        AOIElementGetMeasures( sElement, m_sGeomOptions, m_oScratch, 
+                               &dfElementArea, &dfElementPerimeter );
+        dfArea += dfElementArea;
+        dfPerimeter += dfElementPerimeter;
+
+        OGREnvelope sElementEnvelope;
+        AOIElementGetEnvelope( sElement, m_sGeomOptions, m_oScratch, &sElementEnvelope );
+        sEnvelope.Merge( sElementEnvelope );
+
+        if( sElement.eKind != AOI_SHAPE_RECTANGLE && sElement.eKind != AOI_SHAPE_ELLIPSE )
+            nVertices += sElement.nPoints;
+
+        const char *pszElementKind = AOIShapeKindName( sElement.eKind );
+        if( pszKind == NULL )
+            pszKind = pszElementKind;
+        else if( pszKind != pszElementKind )
+            pszKind = "mixed";
+    }
 
-    CPLString wkt("LINESTRING(");
-    // read in the points and add to wkt
-    if( ( err == CE_None ) && (nColumns > 0 ) && (nRows == 2 ) )
+    int iField = m_iFirstComputedField;
+    poFeature->SetField( iField++, dfArea );
+    poFeature->SetField( iField++, dfPerimeter );
+    if( sEnvelope.IsInit() )
+    {
+        poFeature->SetField( iField++, sEnvelope.MinX );
+        poFeature->SetField( iField++, sEnvelope.MinY );
+        poFeature->SetField( iField++, sEnvelope.MaxX );
+        poFeature->SetField( iField++, sEnvelope.MaxY );
+    }
+    else
     {
-        double x = 0, y = 0;
-        CPLString osBuffer;
-        for( int nIndex = 0; ( err == CE_None ) && nIndex < (nColumns * nRows); nIndex+=2 )
+        iField += 4;
+    }
+    poFeature->SetField( iField++, nVertices );
+    if( pszKind != NULL )
+        poFeature->SetField( iField, pszKind );
+}
+
+// Test the attribute filter on a decoded object (or one of its shapes)
+// before its geometry is built
+int OGRAOILayer::PassesAttributeFilter( const AOIObject &oObject, GIntBig nFID,
+                                        GIntBig nObjectFID, int iElement )
+{
+    if( m_poFilterFeature == NULL )
+        m_poFilterFeature = new OGRFeature( m_poFeatureDefn );
+    SetFields( m_poFilterFeature, oObject, nObjectFID, iElement );
+    m_poFilterFeature->SetFID( nFID );
+    return m_poAttrQuery->Evaluate( m_poFilterFeature );
+}
+
+// Create a feature from a decoded object and remember it if caching
+OGRFeature *OGRAOILayer::BuildFeature( const AOIObject &oObject, GIntBig nFID,
+                                       int bClip )
+{
+    OGRFeature *poFeature = new OGRFeature( m_poFeatureDefn );
+    poFeature->SetGeometryDirectly( BuildGeometry( oObject, bClip ) );
+    SetFields( poFeature, oObject, nFID, -1 );
+    poFeature->SetFID( nFID );
+
+    if( m_poFeatureCache != NULL && !bClip )
+        m_poFeatureCache->Add( poFeature );
+
+    return poFeature;
+}
+
+// Return the next feature in the file. 
+// Keeps looping until a node of the right type is found
+OGRFeature *OGRAOILayer::GetNextFeature()
+{
+    if( m_bElementFeatures )
+        return GetNextElementFeature();
+
+    int bClip = IsClipping();
+    while( TRUE )
+    {
+        OGRFeature *poFeature = NULL;
+        int bAttrTested = FALSE;
+        int bSpatialTested = FALSE;
+
+        // after the first pass features may be in the cache
+        if( m_poFeatureCache != NULL && !bClip && m_bObjectTableComplete 
+            && m_nNextFID < (int)m_anObjectPos.size() )
         {
-            osBuffer.Printf("coords.coords[%d]", nIndex );
-            x = pInfo->GetDoubleField( osBuffer, &err );
+            poFeature = m_poFeatureCache->Get( m_nNextFID, m_poFeatureDefn, 
+                                               GetSpatialRef() );
+            if( poFeature != NULL )
+                m_nNextFID++;
+        }
 
-            if( err == CE_None )
+        if( poFeature == NULL )
+        {
+            GIntBig nFID;
+            const AOIObject *poObject = GetNextDecodedObject( &nFID );
+            if( poObject == NULL ) // at end of file
+                return NULL;
+
+            // the attributes don't need the geometry
+            if( m_poAttrQuery != NULL )
             {
-                osBuffer.Printf("coords.coords[%d]", nIndex+1 );
-                y = pInfo->GetDoubleField( osBuffer, &err );
+                if( !PassesAttributeFilter( *poObject, nFID, nFID, -1 ) )
+                    continue;
+                bAttrTested = TRUE;
             }
-            if( err == CE_None )
+            // and nor does a polygon filter
+            if( m_poPreparedFilter != NULL )
             {
-                // handles rotation etc
-                ApplyXformPolynomial( pPoly, &x, &y );
-                osBuffer.Printf("%f %f,", x, y );
-                wkt = wkt + osBuffer;
+                if( !m_poPreparedFilter->IntersectsObject( *poObject, m_sGeomOptions, 
+                                                           m_oScratch ) )
+                    continue;
+                bSpatialTested = TRUE;
+            }
+            poFeature = BuildFeature( *poObject, nFID, bClip );
+
+            // clipped away altogether
+            if( bClip && poFeature->GetGeometryRef()->IsEmpty() )
+            {
+                delete poFeature;
+                continue;
             }
         }
-        // get rid of trailing ','
-        // and close
-        wkt.erase(wkt.size() - 1);
-        wkt = wkt + ")";
+
+        // do spatial and attribute test
+        if( (m_poFilterGeom == NULL || bSpatialTested
+             || FilterGeometry( poFeature->GetGeometryRef() ) )
+            && (m_poAttrQuery == NULL || bAttrTested
+                || m_poAttrQuery->Evaluate( poFeature )) )
+            return poFeature;
+        else
+            delete poFeature;
     }
 
-    if( err == CE_None )
+    return NULL;
+}
+
+// Random access using the object table. FIDs past the end of the
+// table are found by reading through with the base class which also
+// fills in the table.
+OGRFeature *OGRAOILayer::GetFeature( GIntBig nFID )
+{
+    if( nFID < 0 )
+        return NULL;
+
+    if( m_poFeatureCache != NULL )
+    {
+        OGRFeature *poFeature = m_poFeatureCache->Get( nFID, m_poFeatureDefn, 
+                                                       GetSpatialRef() );
+        if( poFeature != NULL )
+            return poFeature;
+    }
+
+    if( m_bElementFeatures )
+        return GetElementFeature( nFID );
+
+    if( nFID < (GIntBig)m_anObjectPos.size() )
+    {
+        if( !DecodeObjectByFID( nFID ) )
+            return NULL;
+        return BuildFeature( m_oObject, nFID );
+    }
+
+    if( m_bObjectTableComplete )
+        return NULL;
+
+    return OGRLayer::GetFeature( nFID );
+}
+
+// Create a feature for one shape of a decoded object
+OGRFeature *OGRAOILayer::BuildElementFeature( const AOIObject &oObject, int iElement,
+                                              GIntBig nObjectFID, int bClip )
+{
+    const AOIElement &sElement = oObject.aoElements[iElement];
+    OGRGeometry *pGeom = AOIElementToGeometry( sElement, GetBuildOptions( bClip ), 
+                                               m_oScratch );
+    if( pGeom == NULL )
+        return NULL;
+    pGeom->assignSpatialReference( GetSpatialRef() );
+
+    OGRFeature *poFeature = new OGRFeature( m_poFeatureDefn );
+    poFeature->SetGeometryDirectly( pGeom );
+    SetFields( poFeature, oObject, nObjectFID, iElement );
+    poFeature->SetFID( m_anElementStart[nObjectFID] + iElement );
+
+    if( m_poFeatureCache != NULL && !bClip )
+        m_poFeatureCache->Add( poFeature );
+
+    return poFeature;
+}
+
+// GetNextFeature() for GRANULARITY=ELEMENT. Each object is decoded
+// once and then its shapes are handed out one at a time. Shapes whose
+// bounds are outside the spatial filter are skipped before their 
+// geometry is built.
+OGRFeature *OGRAOILayer::GetNextElementFeature()
+{
+    while( TRUE )
     {
-        // create OGRGeometry object
-        const char *pszData = wkt.c_str();
-        OGRGeometry *pGeom;
-        if( OGRGeometryFactory::createFromWkt(&pszData, GetSpatialRef(), &pGeom ) == OGRERR_NONE )
+        if( m_iNextElement >= m_oElementObject.nElements )
         {
-            return pGeom;
+            GIntBig nFID;
+            if( GetNextDecodedObject( &nFID ) == NULL ) // at end of file
+                return NULL;
+
+            // keep it out of the way of GetFeature()
+            m_oElementObject.Swap( m_oObject );
+            m_nElementObjectFID = nFID;
+            m_iNextElement = 0;
+
+            // objects that couldn't be decoded this time have no shapes
+            while( (GIntBig)m_anElementStart.size() < nFID )
+                m_anElementStart.push_back( m_nElementFIDEnd );
+            if( nFID == (GIntBig)m_anElementStart.size() )
+            {
+                m_anElementStart.push_back( m_nElementFIDEnd );
+                m_nElementFIDEnd += m_oElementObject.nElements;
+            }
+        }
+
+        int iElement = m_iNextElement++;
+        if( m_poFilterGeom != NULL )
+        {
+            OGREnvelope sEnvelope;
+            AOIElementGetEnvelope( m_oElementObject.aoElements[iElement], 
+                                   m_sGeomOptions, m_oScratch, &sEnvelope );
+            if( !m_sFilterEnvelope.Intersects( sEnvelope ) )
+                continue;
+            if( m_poPreparedFilter != NULL 
+                && !m_poPreparedFilter->IntersectsElement( 
+                        m_oElementObject.aoElements[iElement], m_sGeomOptions, m_oScratch ) )
+                continue;
         }
+        if( m_poAttrQuery != NULL 
+            && !PassesAttributeFilter( m_oElementObject, 
+                    m_anElementStart[m_nElementObjectFID] + iElement,
+                    m_nElementObjectFID, iElement ) )
+            continue;
+
+        OGRFeature *poFeature = BuildElementFeature( m_oElementObject, iElement,
+                                                     m_nElementObjectFID, IsClipping() );
+        if( poFeature == NULL )
+            continue;
+
+        if( m_poFilterGeom == NULL || m_poPreparedFilter != NULL 
+            || FilterGeometry( poFeature->GetGeometryRef() ) )
+            return poFeature;
+        else
+            delete poFeature;
+    }
+}
+
+// GetFeature() for GRANULARITY=ELEMENT. Finds the object from the
+// first element FID of each object and decodes just that object.
+OGRFeature *OGRAOILayer::GetElementFeature( GIntBig nFID )
+{
+    if( nFID >= m_nElementFIDEnd )
+    {
+        if( m_bObjectTableComplete 
+            && m_anElementStart.size() == m_anObjectPos.size() )
+            return NULL;
+        // not got that far yet
+        return OGRLayer::GetFeature( nFID );
     }
 
-    return NULL;
+    std::vector<GIntBig>::const_iterator oIter = 
+        std::upper_bound( m_anElementStart.begin(), m_anElementStart.end(), nFID );
+    GIntBig nObjectFID = (oIter - m_anElementStart.begin()) - 1;
+    int iElement = (int)(nFID - m_anElementStart[nObjectFID]);
+
+    if( !DecodeObjectByFID( nObjectFID ) || iElement >= m_oObject.nElements )
+        return NULL;
+    return BuildElementFeature( m_oObject, iElement, nObjectFID );
 }
 
-// Given an HFAEntry that is a Point2, create a OGRGeometry for it
-OGRGeometry *OGRAOILayer::HandlePoint( HFAEntry *pInfo, Efga_Polynomial *pPoly )
+// Geometry test for ScanObjects(). Like FilterGeometry() but safe to
+// call from several threads as it doesn't use the layer's prepared 
+// geometry. m_poPreparedFilter is only read so can be shared.
+int OGRAOILayer::ObjectPassesSpatialFilter( const AOIObject &oObject, 
+                                            const OGREnvelope &sEnvelope,
+                                            AOIScratch &oScratch )
 {
-    int nRows=0, nColumns;
-    CPLErr err;
-    // this is how you extract the dimensions of a basedata
-    nColumns = pInfo->GetIntField("coord.coords[-2]", &err);
-    if( err == CE_None )
-        nRows = pInfo->GetIntField("coord.coords[-1]", &err);
+    if( !m_sFilterEnvelope.Intersects( sEnvelope ) )
+        return FALSE;
+    if( m_bFilterIsEnvelope && m_sFilterEnvelope.Contains( sEnvelope ) )
+        return TRUE;
+    if( m_poPreparedFilter != NULL )
+        return m_poPreparedFilter->IntersectsObject( oObject, m_sGeomOptions, oScratch );
+
+    OGRGeometryCollection oCollection;
+    for( int i = 0; i < oObject.nElements; i++ )
+    {
+        OGRGeometry *pGeom = AOIElementToGeometry( oObject.aoElements[i], 
+                                                   m_sGeomOptions, oScratch );
+        if( pGeom != NULL )
+            oCollection.addGeometryDirectly( pGeom );
+    }
+    return oCollection.Intersects( m_poFilterGeom );
+}
 
-    CPLString sWKT;
-    if( ( err == CE_None ) && (nColumns == 1 ) && (nRows == 2 ) )
+// Work out the envelope of every object, and optionally whether it 
+// passes the filters, spreading the work over m_nThreads. The HFA
+// entries share one file handle so objects are read and decoded here
+// a batch at a time and then the geometry work for the batch is done
+// in parallel on copies. anFIDs and asEnvelopes are filled in FID order
+// with the objects that pass so the results don't depend on the 
+// number of threads.
+void OGRAOILayer::ScanObjects( int bApplyFilters, std::vector<GIntBig> &anFIDs,
+                               std::vector<OGREnvelope> &asEnvelopes )
+{
+    if( m_poLeanReader != NULL && !m_poLeanReader->IsStreaming() )
     {
-        double x = 0, y = 0;
-        x = pInfo->GetDoubleField( "coord.coords[0]", &err );
+        ScanLeanObjects( bApplyFilters, anFIDs, asEnvelopes );
+        return;
+    }
 
-        if( err == CE_None )
+    anFIDs.clear();
+    asEnvelopes.clear();
+
+    int bSpatialFilter = bApplyFilters && m_poFilterGeom != NULL;
+    int bAttrFilter = bApplyFilters && m_poAttrQuery != NULL;
+
+    // the coordinate transformation can't be shared between threads
+    int nThreads = m_sGeomOptions.poCT != NULL ? 1 : m_nThreads;
+    std::vector<AOIScratch> aoScratch( nThreads );
+
+    std::vector<AOIObject> aoBatch( AOI_SCAN_BATCH_SIZE );
+    std::vector<GIntBig> anBatchFIDs( AOI_SCAN_BATCH_SIZE );
+    std::vector<OGREnvelope> asBatchEnvelopes( AOI_SCAN_BATCH_SIZE );
+    std::vector<char> abyBatchPass( AOI_SCAN_BATCH_SIZE );
+
+    Rewind();
+    int bEnd = FALSE;
+    while( !bEnd )
+    {
+        int nBatch = 0;
+        while( nBatch < AOI_SCAN_BATCH_SIZE )
         {
-            y = pInfo->GetDoubleField( "coord.coords[1]", &err );
+            GIntBig nFID;
+            const AOIObject *poObject = GetNextDecodedObject( &nFID );
+            if( poObject == NULL )
+            {
+                bEnd = TRUE;
+                break;
+            }
+
+            if( bAttrFilter && !PassesAttributeFilter( *poObject, nFID, nFID, -1 ) )
+                continue;
+
+            aoBatch[nBatch] = *poObject;
+            anBatchFIDs[nBatch] = nFID;
+            nBatch++;
         }
-        if( err == CE_None )
+
+        AOIParallelFor( nBatch, nBatch < AOI_MIN_PARALLEL_BATCH ? 1 : nThreads,
+            [&]( int iThread, int i )
+            {
+                const AOIObject &oObject = aoBatch[i];
+                OGREnvelope &sEnvelope = asBatchEnvelopes[i];
+                sEnvelope = OGREnvelope();
+                for( int j = 0; j < oObject.nElements; j++ )
+                {
+                    OGREnvelope sElementEnvelope;
+                    AOIElementGetEnvelope( oObject.aoElements[j], m_sGeomOptions,
+                                           aoScratch[iThread], &sElementEnvelope );
+                    sEnvelope.Merge( sElementEnvelope );
+                }
+                abyBatchPass[i] = !bSpatialFilter 
+                    || ObjectPassesSpatialFilter( oObject, sEnvelope, aoScratch[iThread] );
+            } );
+
+        for( int i = 0; i < nBatch; i++ )
         {
-            // handle any movement etc
-            ApplyXformPolynomial( pPoly, &x, &y );
-            sWKT.Printf("POINT(%f %f)", x, y );
+            if( abyBatchPass[i] )
+            {
+                anFIDs.push_back( anBatchFIDs[i] );
+                asEnvelopes.push_back( asBatchEnvelopes[i] );
+            }
         }
     }
+    Rewind();
+}
 
-    if( err == CE_None )
+// ScanObjects() with the lean reader holding the whole file. Its tree
+// is only read while decoding, so the threads decode the objects too.
+// FIDs are handed out and the attribute filter applied afterwards in 
+// object order, as GetNextDecodedObject() would. Each thread has its
+// own limits - MAX_NODES can't be reached in one pass as the tree 
+// wasn't allowed to be any bigger than that when it was opened.
+void OGRAOILayer::ScanLeanObjects( int bApplyFilters, std::vector<GIntBig> &anFIDs,
+                                   std::vector<OGREnvelope> &asEnvelopes )
+{
+    anFIDs.clear();
+    asEnvelopes.clear();
+
+    int bSpatialFilter = bApplyFilters && m_poFilterGeom != NULL;
+    int bAttrFilter = bApplyFilters && m_poAttrQuery != NULL;
+
+    // the coordinate transformation can't be shared between threads
+    int nThreads = m_sGeomOptions.poCT != NULL ? 1 : m_nThreads;
+    std::vector<AOIScratch> aoScratch( nThreads );
+    std::vector<AOIDecodeLimits> asLimits( nThreads );
+    for( int iThread = 0; iThread < nThreads; iThread++ )
     {
-        // Create OGRGeometry class
-        const char *pszData = sWKT.c_str();
-        OGRGeometry *pGeom;
-        if( OGRGeometryFactory::createFromWkt( &pszData, GetSpatialRef(), &pGeom ) == OGRERR_NONE )
+        asLimits[iThread].nMaxVertices = m_nMaxVertices;
+        asLimits[iThread].nMaxNodes = m_nMaxNodes;
+        asLimits[iThread].nMaxDepth = m_nMaxDepth;
+        asLimits[iThread].nNodesRead = 0;
+        asLimits[iThread].bBudgetExceeded = FALSE;
+        asLimits[iThread].bCheckOnly = FALSE;
+    }
+
+    std::vector<AOIObject> aoBatch( AOI_SCAN_BATCH_SIZE );
+    std::vector<OGREnvelope> asBatchEnvelopes( AOI_SCAN_BATCH_SIZE );
+    std::vector<char> abyBatchShapes( AOI_SCAN_BATCH_SIZE );
+    std::vector<char> abyBatchPass( AOI_SCAN_BATCH_SIZE );
+
+    Rewind();
+    int nObjects = m_poLeanReader->GetObjectCount();
+    GIntBig nFID = 0;
+    for( int iFirst = 0; iFirst < nObjects; iFirst += AOI_SCAN_BATCH_SIZE )
+    {
+        int nBatch = std::min( AOI_SCAN_BATCH_SIZE, nObjects - iFirst );
+        AOIParallelFor( nBatch, nBatch < AOI_MIN_PARALLEL_BATCH ? 1 : nThreads,
+            [&]( int iThread, int i )
+            {
+                AOIObject &oObject = aoBatch[i];
+                abyBatchShapes[i] = m_poLeanReader->DecodeObject( iFirst + i, oObject,
+                                                asLimits[iThread], m_bElementFeatures );
+                if( !abyBatchShapes[i] )
+                    return;
+
+                OGREnvelope &sEnvelope = asBatchEnvelopes[i];
+                sEnvelope = OGREnvelope();
+                for( int j = 0; j < oObject.nElements; j++ )
+                {
+                    OGREnvelope sElementEnvelope;
+                    AOIElementGetEnvelope( oObject.aoElements[j], m_sGeomOptions,
+                                           aoScratch[iThread], &sElementEnvelope );
+                    sEnvelope.Merge( sElementEnvelope );
+                }
+                abyBatchPass[i] = !bSpatialFilter 
+                    || ObjectPassesSpatialFilter( oObject, sEnvelope, aoScratch[iThread] );
+            } );
+
+        for( int i = 0; i < nBatch; i++ )
         {
-            return pGeom;
+            // no shapes - not a feature
+            if( !abyBatchShapes[i] )
+                continue;
+
+            if( nFID == (GIntBig)m_anObjectPos.size() )
+            {
+                m_anObjectPos.push_back( m_poLeanReader->GetObjectPos( iFirst + i ) );
+                m_anLeanObjects.push_back( iFirst + i );
+            }
+            if( abyBatchPass[i] 
+                && (!bAttrFilter || PassesAttributeFilter( aoBatch[i], nFID, nFID, -1 )) )
+            {
+                anFIDs.push_back( nFID );
+                asEnvelopes.push_back( asBatchEnvelopes[i] );
+            }
+            nFID++;
         }
     }
+    // every object has been seen in order
+    m_bObjectTableComplete = TRUE;
+    Rewind();
+}
 
-    return NULL;
+// Envelope of every feature indexed by FID. Built with ScanObjects() the
+// first time it is needed.
+const std::vector<OGREnvelope> &OGRAOILayer::GetEnvelopeIndex()
+{
+    if( !m_bEnvelopeIndexBuilt )
+    {
+        std::vector<GIntBig> anFIDs;
+        ScanObjects( FALSE, anFIDs, m_asEnvelopes );
+        // without filters the FIDs are 0..n-1 so don't need keeping
+        m_bEnvelopeIndexBuilt = TRUE;
+    }
+    return m_asEnvelopes;
 }
 
-// This function is called recursively to add geometries to the
-// OGRGeometryCollecion. 
-// Is initially called with the head Element_2_Eant for the feature
-void OGRAOILayer::HandleChildFeatures(HFAEntry *pNode, HFAEntry *pParent, OGRGeometryCollection *pCollection)
+GIntBig OGRAOILayer::GetFeatureCount( int bForce )
 {
-    // read the polynomial - will fail gracefully 
-    // this this node doesn't have one
-    Efga_Polynomial xformPoly;
-    ReadXformPolynomial( pParent, &xformPoly );
+    if( m_bElementFeatures )
+    {
+        if( m_poFilterGeom != NULL || m_poAttrQuery != NULL )
+            return OGRLayer::GetFeatureCount( bForce );
 
-    OGRGeometry *pGeom = NULL;
-    // Note we just check the first part of the type string
-    // (without the version). Hopefully later versions (if they exist)
-    // have the same base fields.
-    // Call the appropriate function for the shape
-    if( EQUALN(pNode->GetType(),"Polygon",7) )
+        // the number of shapes - no geometry needed
+        GIntBig nCount = 0;
+        Rewind();
+        const AOIObject *poObject;
+        while( (poObject = GetNextDecodedObject( NULL )) != NULL )
+            nCount += poObject->nElements;
+        Rewind();
+        return nCount;
+    }
+
+    if( m_poFilterGeom == NULL && m_poAttrQuery == NULL )
     {
-        pGeom = HandlePolygon( pNode, &xformPoly );
+        if( m_bEnvelopeIndexBuilt )
+            return (GIntBig)m_asEnvelopes.size();
+
+        // just count - no geometry needed
+        Rewind();
+        while( GetNextDecodedObject( NULL ) != NULL )
+            ;
+        GIntBig nCount = m_nNextFID;
+        Rewind();
+        return nCount;
     }
-    else if( EQUALN(pNode->GetType(),"Rectangle",9) )
+
+    std::vector<GIntBig> anFIDs;
+    std::vector<OGREnvelope> asEnvelopes;
+    ScanObjects( TRUE, anFIDs, asEnvelopes );
+    return (GIntBig)anFIDs.size();
+}
+
+OGRErr OGRAOILayer::GetExtent( OGREnvelope *psExtent, int bForce )
+{
+    const std::vector<OGREnvelope> *pasEnvelopes;
+    std::vector<OGREnvelope> asFiltered;
+    if( m_poFilterGeom == NULL && m_poAttrQuery == NULL )
     {
-        pGeom = HandleRectangle( pNode, &xformPoly );
+        // the same whether features are objects or shapes
+        pasEnvelopes = &GetEnvelopeIndex();
     }
-    else if( EQUALN(pNode->GetType(),"Ellipse",7) )
+    else if( m_bElementFeatures )
     {
-        pGeom = HandleEllipse( pNode, &xformPoly );
+        return OGRLayer::GetExtent( psExtent, bForce );
     }
-    else if( EQUALN(pNode->GetType(),"Polyline",8) )
+    else
     {
-        pGeom = HandleLine( pNode, &xformPoly );
+        std::vector<GIntBig> anFIDs;
+        ScanObjects( TRUE, anFIDs, asFiltered );
+        pasEnvelopes = &asFiltered;
     }
-    else if( EQUALN(pNode->GetType(),"Point",5) )
+
+    if( pasEnvelopes->empty() )
+        return OGRERR_FAILURE;
+
+    *psExtent = OGREnvelope();
+    for( size_t i = 0; i < pasEnvelopes->size(); i++ )
+        psExtent->Merge( (*pasEnvelopes)[i] );
+    return OGRERR_NONE;
+}
+
+// Read through the file so we know where every FID is. Objects are
+// only checked the way decoding them would, so the same ones get FIDs,
+// without copying their coordinates.
+int OGRAOILayer::CompleteObjectTable()
+{
+    if( !m_bObjectTableComplete )
     {
-        pGeom = HandlePoint( pNode, &xformPoly );
+        Rewind();
+        m_bCheckOnly = TRUE;
+        while( GetNextDecodedObject( NULL ) != NULL )
+            ;
+        m_bCheckOnly = FALSE;
+        Rewind();
     }
+    return m_bObjectTableComplete;
+}
 
-    if( pGeom != NULL )
+// The Eaoi_AoiObjectType for a FID, NULL if there isn't one
+HFAEntry *OGRAOILayer::GetObjectEntry( GIntBig nFID )
+{
+    if( nFID < 0 )
+        return NULL;
+    if( nFID >= (GIntBig)m_anObjectPos.size() )
+        CompleteObjectTable();
+    if( nFID >= (GIntBig)m_apoObjects.size() )
+        return NULL;
+    return m_apoObjects[nFID];
+}
+
+// Change the name and description of an existing object. 
+// The geometry can't be changed.
+OGRErr OGRAOILayer::ISetFeature( OGRFeature *poFeature )
+{
+    if( !m_bUpdate )
     {
-        pCollection->addGeometryDirectly( pGeom );
+        CPLError( CE_Failure, CPLE_NotSupported, "AOI file not opened for update." );
+        return OGRERR_UNSUPPORTED_OPERATION;
     }
 
-    // Now process any child entries recursively
-    HFAEntry *pChild = pNode->GetChild();
-    while( pChild != NULL )
+    HFAEntry *pAOIObject = GetObjectEntry( poFeature->GetFID() );
+    if( pAOIObject == NULL )
+        return OGRERR_NON_EXISTING_FEATURE;
+
+    if( poFeature->GetGeometryRef() != NULL )
     {
-        HandleChildFeatures( pChild, pNode, pCollection );
-        pChild = pChild->GetNext();
+        if( !DecodeAOIObject( pAOIObject, m_oObject ) )
+            return OGRERR_FAILURE;
+        OGRGeometry *poCurrent = BuildGeometry( m_oObject );
+        int bSame = poCurrent->Equals( poFeature->GetGeometryRef() );
+        delete poCurrent;
+        if( !bSame )
+        {
+            CPLError( CE_Failure, CPLE_NotSupported, 
+                      "Changing the shapes of an AOI is not supported." );
+            return OGRERR_UNSUPPORTED_OPERATION;
+        }
+    }
+
+    const char *pszName = NULL, *pszDescription = NULL;
+    HFAEntry *pElement = GetInfoFromAOIObject( pAOIObject, &pszName, &pszDescription );
+    if( pElement == NULL )
+        return OGRERR_FAILURE;
+
+    CPLString osName = poFeature->IsFieldSet( 0 ) ? poFeature->GetFieldAsString( 0 ) : "";
+    CPLString osDescription = poFeature->IsFieldSet( 1 ) ? poFeature->GetFieldAsString( 1 ) : "";
+    int bChanged = FALSE;
+    if( osName != (pszName ? pszName : "") )
+    {
+        if( !AOISetEntryString( pElement, "name", osName ) )
+            return OGRERR_FAILURE;
+        bChanged = TRUE;
     }
+    // GetStringField() results don't survive the change above
+    GetInfoFromAOIObject( pAOIObject, &pszName, &pszDescription );
+    if( osDescription != (pszDescription ? pszDescription : "") )
+    {
+        if( !AOISetEntryString( pElement, "description", osDescription ) )
+            return OGRERR_FAILURE;
+        bChanged = TRUE;
+    }
+
+    if( bChanged )
+    {
+        m_apoChanged.push_back( pElement );
+        if( m_poFeatureCache != NULL )
+            m_poFeatureCache->Clear();
+    }
+    return OGRERR_NONE;
 }
 
-// Return the next feature in the file. 
-// Keeps looping until a node of the right type is found
-OGRFeature *OGRAOILayer::GetNextFeature()
+// The shapes of a geometry that can be written
+struct AOINewShape
 {
-    while( TRUE )
+    AOIShapeKind        eKind;
+    std::vector<double> adfX;
+    std::vector<double> adfY;
+};
+
+static int CollectShapes( const OGRGeometry *poGeom, std::vector<AOINewShape> &aoShapes )
+{
+    switch( wkbFlatten( poGeom->getGeometryType() ) )
     {
-        HFAEntry *pAOIObject = GetNextAOIObject();
-        if( pAOIObject == NULL ) // at end of file
+        case wkbPoint:
+        {
+            const OGRPoint *poPoint = (const OGRPoint*)poGeom;
+            AOINewShape sShape;
+            sShape.eKind = AOI_SHAPE_POINT;
+            sShape.adfX.push_back( poPoint->getX() );
+            sShape.adfY.push_back( poPoint->getY() );
+            aoShapes.push_back( sShape );
+            return TRUE;
+        }
+
+        case wkbLineString:
+        case wkbPolygon:
+        {
+            const OGRSimpleCurve *poCurve;
+            AOINewShape sShape;
+            if( wkbFlatten( poGeom->getGeometryType() ) == wkbPolygon )
+            {
+                const OGRPolygon *poPolygon = (const OGRPolygon*)poGeom;
+                if( poPolygon->getNumInteriorRings() > 0 )
+                {
+                    CPLError( CE_Failure, CPLE_NotSupported, 
+                              "AOI polygons can't have holes." );
+                    return FALSE;
+                }
+                poCurve = poPolygon->getExteriorRing();
+                sShape.eKind = AOI_SHAPE_POLYGON;
+            }
+            else
+            {
+                poCurve = (const OGRSimpleCurve*)poGeom;
+                sShape.eKind = AOI_SHAPE_LINE;
+            }
+            if( poCurve == NULL )
+                return TRUE;
+
+            int nPoints = poCurve->getNumPoints();
+            // AOI polygons aren't closed
+            if( sShape.eKind == AOI_SHAPE_POLYGON && nPoints > 1
+                && poCurve->getX( 0 ) == poCurve->getX( nPoints - 1 )
+                && poCurve->getY( 0 ) == poCurve->getY( nPoints - 1 ) )
+                nPoints--;
+            for( int i = 0; i < nPoints; i++ )
+            {
+                sShape.adfX.push_back( poCurve->getX( i ) );
+                sShape.adfY.push_back( poCurve->getY( i ) );
+            }
+            if( nPoints > 0 )
+                aoShapes.push_back( sShape );
+            return TRUE;
+        }
+
+        case wkbMultiPoint:
+        case wkbMultiLineString:
+        case wkbMultiPolygon:
+        case wkbGeometryCollection:
+        {
+            const OGRGeometryCollection *poColl = (const OGRGeometryCollection*)poGeom;
+            for( int i = 0; i < poColl->getNumGeometries(); i++ )
+            {
+                if( !CollectShapes( poColl->getGeometryRef( i ), aoShapes ) )
+                    return FALSE;
+            }
+            return TRUE;
+        }
+
+        default:
+            CPLError( CE_Failure, CPLE_NotSupported, 
+                      "Can't write %s geometries to an AOI.", poGeom->getGeometryName() );
+            return FALSE;
+    }
+}
+
+// Find an existing element with a shape of the given kind to copy.
+// The dictionary doesn't say what an element needs to contain so new
+// ones are made the same as ones Imagine wrote.
+int OGRAOILayer::FindTemplateElement( AOIShapeKind eKind, HFAEntry **ppoElement, 
+                                      HFAEntry **ppoShape )
+{
+    const char *pszPrefix = eKind == AOI_SHAPE_POLYGON ? "Polygon" 
+                          : eKind == AOI_SHAPE_LINE ? "Polyline" : "Point";
+    for( size_t i = 0; i < m_apoObjects.size(); i++ )
+    {
+        const char *pszName, *pszDescription;
+        HFAEntry *pElement = GetInfoFromAOIObject( m_apoObjects[i], &pszName, 
+                                                   &pszDescription );
+        // all the elements in the list
+        for( ; pElement != NULL; pElement = pElement->GetNext() )
+        {
+            for( HFAEntry *pShape = pElement->GetChild(); pShape != NULL; 
+                 pShape = pShape->GetNext() )
+            {
+                if( EQUALN( pShape->GetType(), pszPrefix, strlen(pszPrefix) ) )
+                {
+                    *ppoElement = pElement;
+                    *ppoShape = pShape;
+                    return TRUE;
+                }
+            }
+        }
+    }
+    return FALSE;
+}
+
+// Copy an object apart from the elements. Returns the new object and
+// sets *ppoElementList to its empty ElementList.
+static HFAEntry *CloneObjectSkeleton( HFAInfo_t *psInfo, HFAEntry *poTemplate, 
+                                      HFAEntry *poParent, const char *pszName,
+                                      HFAEntry **ppoElementList )
+{
+    HFAEntry *poEntry = AOICloneEntry( psInfo, poTemplate, poParent, pszName, FALSE );
+    if( poEntry == NULL )
+        return NULL;
+    if( EQUAL( poTemplate->GetName(), "ElementList" ) )
+    {
+        *ppoElementList = poEntry;
+        return poEntry;
+    }
+    for( HFAEntry *poChild = poTemplate->GetChild(); poChild != NULL; 
+         poChild = poChild->GetNext() )
+    {
+        if( CloneObjectSkeleton( psInfo, poChild, poEntry, poChild->GetName(), 
+                                 ppoElementList ) == NULL )
             return NULL;
+    }
+    return poEntry;
+}
 
-        const char *pszName = NULL, *pszDescription = NULL;
+// Append a new object at the end of the file. Only shapes of a kind
+// already in the file can be written as they are copied from it.
+OGRErr OGRAOILayer::ICreateFeature( OGRFeature *poFeature )
+{
+    if( !m_bUpdate )
+    {
+        CPLError( CE_Failure, CPLE_NotSupported, "AOI file not opened for update." );
+        return OGRERR_UNSUPPORTED_OPERATION;
+    }
+    if( m_sGeomOptions.poCT != NULL )
+    {
+        CPLError( CE_Failure, CPLE_NotSupported, 
+                  "Can't write to an AOI opened with TARGET_SRS." );
+        return OGRERR_UNSUPPORTED_OPERATION;
+    }
+
+    std::vector<AOINewShape> aoShapes;
+    if( poFeature->GetGeometryRef() == NULL )
+    {
+        CPLError( CE_Failure, CPLE_AppDefined, "AOI objects need a geometry." );
+        return OGRERR_FAILURE;
+    }
+    if( !CollectShapes( poFeature->GetGeometryRef(), aoShapes ) )
+        return OGRERR_FAILURE;
+    if( aoShapes.empty() )
+    {
+        CPLError( CE_Failure, CPLE_AppDefined, "AOI objects need a geometry." );
+        return OGRERR_FAILURE;
+    }
 
-        // Create the geometry collection
-        OGRGeometryCollection *pCollection = (OGRGeometryCollection*)
-                OGRGeometryFactory::createGeometry(wkbGeometryCollection);
+    if( !CompleteObjectTable() || m_apoObjects.empty() )
+    {
+        CPLError( CE_Failure, CPLE_AppDefined, 
+                  "AOI file has no objects to base new ones on." );
+        return OGRERR_FAILURE;
+    }
 
-        // Get the head node for the feature
-        HFAEntry *pInfo = GetInfoFromAOIObject( pAOIObject, &pszName, &pszDescription );
-        // put all the child geometries into the collection
-        if( pInfo != NULL )
+    HFAEntry *apoElements[AOI_SHAPE_POINT + 1], *apoShapes[AOI_SHAPE_POINT + 1];
+    for( size_t i = 0; i < aoShapes.size(); i++ )
+    {
+        AOIShapeKind eKind = aoShapes[i].eKind;
+        if( !FindTemplateElement( eKind, &apoElements[eKind], &apoShapes[eKind] ) )
         {
-            HandleChildFeatures( pInfo, pInfo, pCollection );
+            CPLError( CE_Failure, CPLE_NotSupported, 
+                      "AOI file has no %s shapes to base new ones on.",
+                      eKind == AOI_SHAPE_POLYGON ? "polygon" 
+                      : eKind == AOI_SHAPE_LINE ? "line" : "point" );
+            return OGRERR_FAILURE;
         }
+    }
+
+    GIntBig nFID = (GIntBig)m_apoObjects.size();
+    HFAEntry *pElementList = NULL;
+    HFAEntry *pAOIObject = CloneObjectSkeleton( m_psInfo, m_apoObjects[0], m_pAOInode, 
+                               CPLSPrintf( "AOIobject_" CPL_FRMT_GIB, nFID ), &pElementList );
+    if( pAOIObject == NULL || pElementList == NULL )
+        return OGRERR_FAILURE;
+
+    CPLString osName = poFeature->IsFieldSet( 0 ) ? poFeature->GetFieldAsString( 0 ) : "";
+    CPLString osDescription = poFeature->IsFieldSet( 1 ) ? poFeature->GetFieldAsString( 1 ) : "";
+    for( size_t i = 0; i < aoShapes.size(); i++ )
+    {
+        const AOINewShape &sShape = aoShapes[i];
+        HFAEntry *pElement = AOICloneEntry( m_psInfo, apoElements[sShape.eKind], 
+                                            pElementList, CPLSPrintf( "AntElement_%d", (int)i ), 
+                                            FALSE );
+        if( pElement == NULL 
+            || !AOISetEntryString( pElement, "name", osName )
+            || !AOISetEntryString( pElement, "description", osDescription )
+            || !AOISetIdentityPolynomial( pElement ) )
+            return OGRERR_FAILURE;
+
+        HFAEntry *pShape = AOICloneEntry( m_psInfo, apoShapes[sShape.eKind], pElement,
+                                          apoShapes[sShape.eKind]->GetName(), TRUE );
+        if( pShape == NULL
+            || !AOISetEntryCoords( pShape, 
+                                   sShape.eKind == AOI_SHAPE_POINT ? "coord.coords" : "coords.coords",
+                                   (int)sShape.adfX.size(), &sShape.adfX[0], &sShape.adfY[0] ) )
+            return OGRERR_FAILURE;
+    }
+
+    m_apoCreated.push_back( pAOIObject );
+    m_anObjectPos.push_back( 0 );
+    m_apoObjects.push_back( pAOIObject );
+    poFeature->SetFID( nFID );
+    m_bEnvelopeIndexBuilt = FALSE;
+    return OGRERR_NONE;
+}
+
+static void FixTreePointers( HFAEntry *poEntry )
+{
+    AOIFixPointers( poEntry );
+    for( HFAEntry *poChild = poEntry->GetChild(); poChild != NULL; 
+         poChild = poChild->GetNext() )
+        FixTreePointers( poChild );
+}
+
+// Write the changed entries. Only the changed and new entries and the
+// ones that point to moved entries are written.
+OGRErr OGRAOILayer::SyncToDisk()
+{
+    if( !m_bUpdate )
+        return OGRERR_NONE;
+
+    for( size_t i = 0; i < m_apoChanged.size(); i++ )
+        AOIFixPointers( m_apoChanged[i] );
+    for( size_t i = 0; i < m_apoCreated.size(); i++ )
+        FixTreePointers( m_apoCreated[i] );
+    m_apoChanged.clear();
+    m_apoCreated.clear();
+
+    return HFAFlush( m_psInfo ) == CE_None ? OGRERR_NONE : OGRERR_FAILURE;
+}
+
+GIntBig OGRAOILayer::GetObjectCount()
+{
+    if( !CompleteObjectTable() )
+        return -1;
+    return (GIntBig)m_anObjectPos.size();
+}
+
+int OGRAOILayer::GetObjectStrings( GIntBig nFID, CPLString &osName, 
+                                   CPLString &osDescription )
+{
+    if( nFID < 0 || nFID >= (GIntBig)m_anObjectPos.size() )
+        return FALSE;
+
+    if( m_poLeanReader != NULL )
+        return m_poLeanReader->GetObjectStrings( m_anLeanObjects[nFID], osName, 
+                                                 osDescription );
+
+    HFAEntry *pAOIObject = m_apoObjects[nFID];
+    if( pAOIObject == NULL )
+        return FALSE;
+
+    const char *pszName = NULL, *pszDescription = NULL;
+    int bOK = GetInfoFromAOIObject( pAOIObject, &pszName, &pszDescription ) != NULL;
+    osName = pszName ? pszName : "";
+    osDescription = pszDescription ? pszDescription : "";
+    return bOK;
+}
+
+// Objects in the new file whose entries hash the same as one in ours
+// keep their place in the object table, envelope, number of elements 
+// and cached feature under their new FID. Only the others are decoded.
+int OGRAOILayer::Reload( OGRAOILayer *poOther )
+{
+    if( m_poLeanReader == NULL || poOther->m_poLeanReader == NULL )
+        return FALSE;
+
+    // features already handed out would be in the wrong projection
+    OGRSpatialReference *poOldSRS = GetSourceSpatialRef();
+    OGRSpatialReference *poNewSRS = poOther->GetSourceSpatialRef();
+    if( (poOldSRS == NULL) != (poNewSRS == NULL)
+        || (poOldSRS != NULL && !poOldSRS->IsSame( poNewSRS )) )
+    {
+        CPLError( CE_Warning, CPLE_AppDefined, 
+                  "The projection of the AOI file has changed. Reopen it to see the changes." );
+        return FALSE;
+    }
+
+    // what we know about each of our objects: its FID, -1 for no 
+    // shapes or -2 if it hasn't been read yet
+    int nOldObjects = m_poLeanReader->GetObjectCount();
+    std::vector<GIntBig> anOldFIDs( nOldObjects, m_bObjectTableComplete ? -1 : -2 );
+    for( size_t i = 0; i < m_anLeanObjects.size(); i++ )
+        anOldFIDs[m_anLeanObjects[i]] = (GIntBig)i;
+    std::multimap<GUIntBig, int> oOldHashes;
+    for( int i = 0; i < nOldObjects; i++ )
+    {
+        if( anOldFIDs[i] != -2 )
+            oOldHashes.insert( std::make_pair( m_poLeanReader->GetObjectHash( i ), i ) );
+    }
+
+    AOIHFAReader *poReader = poOther->m_poLeanReader;
+    std::vector<GUInt32> anObjectPos;
+    std::vector<int> anLeanObjects;
+    std::vector<OGREnvelope> asEnvelopes;
+    std::vector<GIntBig> anElementStart;
+    GIntBig nElementFIDEnd = 0;
+    int bElementCountsKnown = m_bElementFeatures;
+    std::vector<GIntBig> anNewFIDs( m_anObjectPos.size(), -1 );    // by old FID
+    AOIDecodeLimits sLimits;
+    sLimits.nMaxVertices = m_nMaxVertices;
+    sLimits.nMaxNodes = m_nMaxNodes;
+    sLimits.nMaxDepth = m_nMaxDepth;
+    sLimits.nNodesRead = 0;
+    sLimits.bBudgetExceeded = FALSE;
+    sLimits.bCheckOnly = FALSE;
+    int nDecoded = 0;
+    AOIObject oObject;
 
-        if( pCollection->getNumGeometries() > 0 )
+    for( int iObject = 0; iObject < poReader->GetObjectCount(); iObject++ )
+    {
+        std::multimap<GUIntBig, int>::iterator oIter = 
+            oOldHashes.find( poReader->GetObjectHash( iObject ) );
+        GIntBig nOldFID = -1;
+        int nElements = 0;
+        OGREnvelope sEnvelope;
+        if( oIter != oOldHashes.end() )
         {
-            // Create the feature
-            OGRFeature *poFeature = new OGRFeature( m_poFeatureDefn );
-            poFeature->SetGeometryDirectly( pCollection );
-            poFeature->SetField( 0, pszName );
-            poFeature->SetField( 1, pszDescription );
-            poFeature->SetFID( m_nNextFID++ );
-            // do spatial and attribute test
-            if( (m_poFilterGeom == NULL
-                 || FilterGeometry( poFeature->GetGeometryRef() ) )
-                && (m_poAttrQuery == NULL
-                    || m_poAttrQuery->Evaluate( poFeature )) )
-                return poFeature;
+            nOldFID = anOldFIDs[oIter->second];
+            oOldHashes.erase( oIter );
+            if( nOldFID < 0 )
+                continue;   // no shapes before either
+
+            if( m_bEnvelopeIndexBuilt )
+                sEnvelope = m_asEnvelopes[nOldFID];
+            if( nOldFID + 1 < (GIntBig)m_anElementStart.size() )
+                nElements = (int)(m_anElementStart[nOldFID + 1] - m_anElementStart[nOldFID]);
+            else if( nOldFID + 1 == (GIntBig)m_anElementStart.size() )
+                nElements = (int)(m_nElementFIDEnd - m_anElementStart[nOldFID]);
             else
-                delete poFeature;
+                bElementCountsKnown = FALSE;
         }
         else
         {
-            // no geometries added - don't add feature
-            // is this the right thing to do?
-            OGRGeometryFactory::destroyGeometry( pCollection );
+            nDecoded++;
+            if( !poReader->DecodeObject( iObject, oObject, sLimits, FALSE ) )
+            {
+                if( sLimits.bBudgetExceeded )
+                    return FALSE;
+                continue;
+            }
+            nElements = oObject.nElements;
+            for( int i = 0; i < oObject.nElements && m_bEnvelopeIndexBuilt; i++ )
+            {
+                OGREnvelope sElementEnvelope;
+                AOIElementGetEnvelope( oObject.aoElements[i], m_sGeomOptions,
+                                       m_oScratch, &sElementEnvelope );
+                sEnvelope.Merge( sElementEnvelope );
+            }
         }
 
+        if( nOldFID >= 0 )
+            anNewFIDs[nOldFID] = (GIntBig)anObjectPos.size();
+        anObjectPos.push_back( poReader->GetObjectPos( iObject ) );
+        anLeanObjects.push_back( iObject );
+        if( m_bEnvelopeIndexBuilt )
+            asEnvelopes.push_back( sEnvelope );
+        if( bElementCountsKnown )
+        {
+            anElementStart.push_back( nElementFIDEnd );
+            nElementFIDEnd += nElements;
+        }
     }
+    CPLDebug( "AOI", "Reloaded %d objects, %d of them changed or new.",
+              poReader->GetObjectCount(), nDecoded );
 
-    return NULL;
-}
+    // nothing can fail from here on
+    std::swap( m_psInfo, poOther->m_psInfo );
+    std::swap( m_pAOInode, poOther->m_pAOInode );
+    std::swap( m_poLeanReader, poOther->m_poLeanReader );
+    m_anObjectPos.swap( anObjectPos );
+    m_anLeanObjects.swap( anLeanObjects );
+    m_bObjectTableComplete = TRUE;
+    m_asEnvelopes.swap( asEnvelopes );
+    if( !bElementCountsKnown )
+    {
+        // worked out again on the next pass
+        anElementStart.clear();
+        nElementFIDEnd = 0;
+    }
+    m_anElementStart.swap( anElementStart );
+    m_nElementFIDEnd = nElementFIDEnd;
+    m_nElementObjectFID = -1;
 
+    if( m_poFeatureCache != NULL )
+    {
+        // element FIDs would all need working out again
+        if( m_bElementFeatures )
+            m_poFeatureCache->Clear();
+        else
+            m_poFeatureCache->Remap( anNewFIDs );
+    }
 
+    Rewind();
+    return TRUE;
+}
@@ -25,17 +25,31 @@
 
 #include <ogrsf_frmts.h>
 #include "hfa_p.h"
+#include "aoielement.h"
+#include "aoifeaturecache.h"
+#include "aoifilter.h"
+#include "aoihfareader.h"
 
 // Classes for representing layers in an AOI file
 // We have 3 layers - one for Polygons, one for lines
 // and one for points. 
 // These are represented by different classes all
 // derived from OGRAOILayer which has common functionality
+
+class OGRAOIDataSource;
+
 class OGRAOILayer : public OGRLayer
 {
 protected:
+    OGRAOIDataSource       *m_poDS;     // asked to check for changes, may be NULL
+    HFAInfo_t              *m_psInfo;
     OGRFeatureDefn         *m_poFeatureDefn;
-    std::unique_ptr<OGRSpatialReference>    m_poSpatialRef;
+    OGRSpatialReference    *m_poSpatialRef;
+    int                     m_bSpatialRefFetched;
+    OGRSpatialReference    *m_poTargetSRS;  // NULL if not reprojecting
+
+    OGRSpatialReference *GetSourceSpatialRef();
+    void                SetTargetSRS( const char *pszTargetSRS );
 
     HFAEntry               *m_pAOInode;
     HFAEntry               *m_pAOIObject; // pointer to current Eaoi_AoiObjectType
@@ -47,26 +61,183 @@ protected:
     HFAEntry*           GetInfoFromAOIObject(HFAEntry *pAOIObject, 
                             const char **ppszName, const char **ppszDescription );
 
-    void HandleChildFeatures(HFAEntry *pNode, HFAEntry *pParent, OGRGeometryCollection *pCollection);
-    OGRGeometry *       HandlePolygon( HFAEntry *pInfo, Efga_Polynomial *pPoly );
-    OGRGeometry *       HandleRectangle( HFAEntry *pInfo, Efga_Polynomial *pPoly );
-    OGRGeometry *       HandleEllipse( HFAEntry *pInfo, Efga_Polynomial *pPoly );
-    OGRGeometry *       HandleLine( HFAEntry *pInfo, Efga_Polynomial *pPoly );
-    OGRGeometry *       HandlePoint( HFAEntry *pInfo, Efga_Polynomial *pPoly );
+    // decode state reused between features
+    AOIObject               m_oObject;
+    AOIScratch              m_oScratch;
+    AOIGeometryOptions      m_sGeomOptions;
+
+    // COMPUTED_FIELDS=YES - area, perimeter etc from the shape parameters
+    int                     m_bComputedFields;
+    int                     m_iFirstComputedField;
+    OGRFeature             *m_poFilterFeature;  // attributes only
+    void                SetFields( OGRFeature *poFeature, const AOIObject &oObject,
+                                   GIntBig nObjectFID, int iElement );
+    void                SetComputedFields( OGRFeature *poFeature, const AOIObject &oObject,
+                                           int iFirst, int iLast );
+    int                 PassesAttributeFilter( const AOIObject &oObject, GIntBig nFID,
+                                               GIntBig nObjectFID, int iElement );
+
+    int                 DecodeAOIObject( HFAEntry *pAOIObject, AOIObject &oObject );
+
+    // Objects are decoded by an AOIHFAReader rather than through 
+    // HFAEntry unless updating or READER=HFA. NULL if not in use.
+    AOIHFAReader           *m_poLeanReader;
+    int                     m_iNextLeanObject;
+    std::vector<int>        m_anLeanObjects;    // reader object by FID
+    int                 DecodeLeanObject( int iObject, AOIObject &oObject );
+
+    // ResetReading() without checking for changes to the file, for
+    // passes the layer makes itself
+    void                Rewind();
+    // CLIP_TO_FILTER - GetNextFeature() clips to the spatial filter's
+    // envelope grown by m_dfClipBuffer. Clipped features aren't cached.
+    int                     m_bClipToFilter;
+    double                  m_dfClipBuffer;
+    AOIGeometryOptions      m_sClipOptions;
+    int                 IsClipping() const { return m_bClipToFilter && m_poFilterGeom != NULL; }
+    const AOIGeometryOptions &GetBuildOptions( int bClip );
+
+    OGRGeometry *       BuildGeometry( const AOIObject &oObject, int bClip = FALSE );
+    OGRFeature *        BuildFeature( const AOIObject &oObject, GIntBig nFID,
+                                      int bClip = FALSE );
+
+    // Where each FID is, filled in as objects are first read. Once a
+    // pass has got to the end later passes and GetFeature() use this
+    // rather than following the tree.
+    std::vector<GUInt32>    m_anObjectPos;
+    std::vector<HFAEntry*>  m_apoObjects;   // not used with the lean reader
+    int                     m_bObjectTableComplete;
+    int                 DecodeObjectByFID( GIntBig nFID );
+
+    // whole layer passes
+    int                     m_nThreads;
+    std::vector<OGREnvelope> m_asEnvelopes;  // by FID
+    int                     m_bEnvelopeIndexBuilt;
+    void                ScanObjects( int bApplyFilters, std::vector<GIntBig> &anFIDs,
+                                     std::vector<OGREnvelope> &asEnvelopes );
+    void                ScanLeanObjects( int bApplyFilters, std::vector<GIntBig> &anFIDs,
+                                         std::vector<OGREnvelope> &asEnvelopes );
+    // polygon filters indexed for testing decoded shapes, NULL for
+    // rectangles and anything it can't handle
+    AOIPreparedFilter      *m_poPreparedFilter;
+    int                 ObjectPassesSpatialFilter( const AOIObject &oObject, 
+                                                   const OGREnvelope &sEnvelope,
+                                                   AOIScratch &oScratch );
+
+    // update mode - see aoiupdate.h
+    int                     m_bUpdate;
+    std::vector<HFAEntry*>  m_apoChanged;   // entries to fix up before flushing
+    std::vector<HFAEntry*>  m_apoCreated;   // new objects, including children
+    int                 CompleteObjectTable();
+    HFAEntry           *GetObjectEntry( GIntBig nFID );
+    int                 FindTemplateElement( AOIShapeKind eKind, HFAEntry **ppoElement,
+                                             HFAEntry **ppoShape );
 
-    int m_nEllipsisSteps;
+    AOIFeatureCache        *m_poFeatureCache; // NULL if not caching
+    CPLString               m_osMetadataItem;
+
+    // limits on what we will read (MAX_VERTICES etc)
+    GIntBig                 m_nMaxVertices;     // per object
+    GIntBig                 m_nMaxNodes;        // per pass through the file
+    int                     m_nMaxDepth;
+    GIntBig                 m_nObjectVertices;
+    GIntBig                 m_nNodesRead;
+    int                     m_bObjectBudgetExceeded;
+    int                     m_bBudgetExceeded;  // stops reading the file
+    int                     m_bCheckOnly;       // see AOIDecodeLimits
+
+    // GRANULARITY=ELEMENT - a feature per shape rather than per object.
+    // Element FIDs are numbered in file order, m_anElementStart holds 
+    // the first one for each object FID read so far.
+    int                     m_bElementFeatures;
+    AOIObject               m_oElementObject;   // object being split up
+    GIntBig                 m_nElementObjectFID;
+    int                     m_iNextElement;
+    std::vector<GIntBig>    m_anElementStart;
+    GIntBig                 m_nElementFIDEnd;
+    CPLString               m_osGroupPath;      // while decoding
+    OGRFeature *        GetNextElementFeature();
+    OGRFeature *        GetElementFeature( GIntBig nFID );
+    OGRFeature *        BuildElementFeature( const AOIObject &oObject, int iElement,
+                                             GIntBig nObjectFID, int bClip = FALSE );
+
+    int                 HandleChildFeatures( HFAEntry *pNode, HFAEntry *pParent, 
+                                             AOIObject &oObject, int nDepth );
+    int                 HandleVertices( HFAEntry *pInfo, const char *pszField,
+                                        AOIElement &sElement );
+    int                 HandlePolygon( HFAEntry *pInfo, AOIElement &sElement );
+    int                 HandleRectangle( HFAEntry *pInfo, AOIElement &sElement );
+    int                 HandleEllipse( HFAEntry *pInfo, AOIElement &sElement );
+    int                 HandleLine( HFAEntry *pInfo, AOIElement &sElement );
+    int                 HandlePoint( HFAEntry *pInfo, AOIElement &sElement );
 
   public:
-    OGRAOILayer( HFAEntry *pAOInode, const char *pszBasename );
+    OGRAOILayer( HFAInfo_t *psInfo, HFAEntry *pAOInode, const char *pszBasename,
+                 char **papszOpenOptions = NULL, OGRAOIDataSource *poDS = NULL );
    ~OGRAOILayer();
 
     void                ResetReading();
     OGRFeature *        GetNextFeature();
+    OGRFeature *        GetFeature( GIntBig nFID );
+
+    // Only the name and description can be changed. New features are
+    // appended to the file.
+    OGRErr              ISetFeature( OGRFeature *poFeature );
+    OGRErr              ICreateFeature( OGRFeature *poFeature );
+    OGRErr              SyncToDisk();
 
     OGRFeatureDefn *    GetLayerDefn() { return m_poFeatureDefn; }
     OGRSpatialReference * GetSpatialRef();
 
-    int                 TestCapability( const char * ) { return FALSE; }
+    int                 TestCapability( const char * );
+
+    void                SetSpatialFilter( OGRGeometry *poGeom );
+    void                SetSpatialFilter( int iGeomField, OGRGeometry *poGeom )
+                            { OGRLayer::SetSpatialFilter( iGeomField, poGeom ); }
+
+    // These read the whole layer using NUM_THREADS threads. With
+    // GRANULARITY=ELEMENT and a filter they read it like GetNextFeature().
+    GIntBig             GetFeatureCount( int bForce = TRUE );
+    OGRErr              GetExtent( OGREnvelope *psExtent, int bForce = TRUE );
+    OGRErr              GetExtent( int iGeomField, OGREnvelope *psExtent, int bForce = TRUE )
+                            { return OGRLayer::GetExtent( iGeomField, psExtent, bForce ); }
+    const std::vector<OGREnvelope> &GetEnvelopeIndex();    // by object FID
+
+    // FEATURE_CACHE_HITS, FEATURE_CACHE_MISSES, FEATURE_CACHE_SIZE and
+    // FEATURE_CACHE_COUNT in the "AOI" domain for tuning the cache, and
+    // DICTIONARY_SIZE, the length of the (possibly shared) dictionary
+    // text, which grows if a built in type is added to it
+    const char         *GetMetadataItem( const char *pszName, const char *pszDomain = "" );
+    const AOIFeatureCache *GetFeatureCache() const { return m_poFeatureCache; }
+
+    // Number of features and their attributes without decoding the 
+    // shapes. Used by the SQL fast path (see aoisql.h). GetObjectCount()
+    // returns -1 if the file can't be read through.
+    GIntBig             GetObjectCount();
+    int                 HasElementFeatures() const { return m_bElementFeatures; }
+    int                 GetObjectStrings( GIntBig nFID, CPLString &osName,
+                                          CPLString &osDescription );
+
+    // For tools that work on the decoded shapes directly 
+    // (eg AOIRasterize). Filters are not applied and objects are
+    // returned whole whatever GRANULARITY is.
+    const AOIObject    *GetNextDecodedObject( GIntBig *pnFID );
+    const AOIGeometryOptions &GetGeometryOptions() const { return m_sGeomOptions; }
+
+    // Take over the file poOther has read, a newer copy of ours, keeping 
+    // what is known about the objects that haven't changed (where they
+    // are, their envelopes and cached features) and decoding only the 
+    // ones that have. poOther gets our old file in exchange and should
+    // then be destroyed. Only possible with the lean reader. Returns 
+    // FALSE, leaving both layers as they were, if it can't be done.
+    int                 Reload( OGRAOILayer *poOther );
+    int                 CanReload() const 
+                            { return m_poLeanReader != NULL && !m_poLeanReader->IsStreaming(); }
 };
 
+// Get an option from the open options (eg SIMPLIFY_TOLERANCE) falling
+// back to the OGR_AOI_ prefixed config option (eg OGR_AOI_SIMPLIFY_TOLERANCE)
+const char *AOIGetOption( char **papszOpenOptions, const char *pszName, 
+                          const char *pszDefault );
+
 #endif // AOILAYER_H
@@ -22,34 +22,208 @@
 
 #include "hfa_p.h"
 #include "hfa.h"
+#include <cpl_string.h>
 #include <ogr_spatialref.h>
 #include <vector>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
 #include "aoiproj.h"
 
+/************************************************************************/
+/*                         AOIFindFirstChild()                          */
+/*  Like HFAEntry::FindChildren() but stops at the first match rather   */
+/*  than walking the whole tree.                                        */
+/************************************************************************/
+
+HFAEntry *AOIFindFirstChild( HFAEntry *poNode, const char *pszName,
+                             const char *pszType )
+{
+    for( HFAEntry *poChild = poNode->GetChild(); poChild != NULL;
+         poChild = poChild->GetNext() )
+    {
+        if( (pszName == NULL || EQUAL(poChild->GetName(), pszName))
+            && (pszType == NULL || EQUAL(poChild->GetType(), pszType)) )
+            return poChild;
+
+        HFAEntry *poMatch = AOIFindFirstChild( poChild, pszName, pszType );
+        if( poMatch != NULL )
+            return poMatch;
+    }
+    return NULL;
+}
+
+/************************************************************************/
+/*                          SRS cache                                   */
+/*                                                                      */
+/*  HFAPCSStructToOSR() does PROJ database lookups which are slow       */
+/*  compared to reading an AOI, and most AOIs in a batch share the      */
+/*  same projection. So we keep a small process wide LRU cache keyed    */
+/*  on a canonical string built from the projection structs. Each entry */
+/*  holds a prototype OGRSpatialReference that is never handed out or   */
+/*  modified once published; callers get their own Clone() which they   */
+/*  may change and must Release(). The number of entries is controlled  */
+/*  by OGR_AOI_SRS_CACHE_SIZE (0 disables the cache).                   */
+/************************************************************************/
+
+typedef std::list<std::string> AOISRSLRUList;
+
+struct AOISRSCacheEntry
+{
+    OGRSpatialReference        *poSRS; // may be NULL if the conversion failed
+    AOISRSLRUList::iterator     oLRUPos;
+};
+
+static std::mutex oSRSCacheMutex;
+static AOISRSLRUList oSRSCacheLRU;
+static std::map<std::string, AOISRSCacheEntry> oSRSCache;
+
+static void AppendKeyString( std::string &osKey, const char *pszValue )
+{
+    // length prefix so strings can't run into each other
+    if( pszValue == NULL )
+        pszValue = "";
+    osKey += CPLSPrintf( "%d:", (int)strlen(pszValue) );
+    osKey += pszValue;
+}
+
+static void AppendKeyDouble( std::string &osKey, double dfValue )
+{
+    osKey += CPLSPrintf( "%.17g,", dfValue );
+}
+
+static std::string BuildSRSCacheKey( const Eprj_Datum *psDatum,
+                                     const Eprj_ProParameters *psPro,
+                                     const Eprj_MapInfo *psMapInfo )
+{
+    std::string osKey;
+    int i;
+
+    osKey += CPLSPrintf( "P%d,%d,%d,", (int)psPro->proType, psPro->proNumber,
+                         psPro->proZone );
+    AppendKeyString( osKey, psPro->proExeName );
+    AppendKeyString( osKey, psPro->proName );
+    for( i = 0; i < 15; i++ )
+        AppendKeyDouble( osKey, psPro->proParams[i] );
+    AppendKeyString( osKey, psPro->proSpheroid.sphereName );
+    AppendKeyDouble( osKey, psPro->proSpheroid.a );
+    AppendKeyDouble( osKey, psPro->proSpheroid.b );
+    AppendKeyDouble( osKey, psPro->proSpheroid.eSquared );
+    AppendKeyDouble( osKey, psPro->proSpheroid.radius );
+
+    osKey += CPLSPrintf( "D%d,", (int)psDatum->type );
+    AppendKeyString( osKey, psDatum->datumname );
+    AppendKeyString( osKey, psDatum->gridname );
+    for( i = 0; i < 7; i++ )
+        AppendKeyDouble( osKey, psDatum->params[i] );
+
+    // Only the names and units of the map info are used for the SRS
+    // but include everything to be safe.
+    osKey += "M";
+    AppendKeyString( osKey, psMapInfo->proName );
+    AppendKeyString( osKey, psMapInfo->units );
+    AppendKeyDouble( osKey, psMapInfo->upperLeftCenter.x );
+    AppendKeyDouble( osKey, psMapInfo->upperLeftCenter.y );
+    AppendKeyDouble( osKey, psMapInfo->lowerRightCenter.x );
+    AppendKeyDouble( osKey, psMapInfo->lowerRightCenter.y );
+    AppendKeyDouble( osKey, psMapInfo->pixelSize.width );
+    AppendKeyDouble( osKey, psMapInfo->pixelSize.height );
+
+    return osKey;
+}
+
+static int GetSRSCacheSize()
+{
+    int nSize = atoi( CPLGetConfigOption("OGR_AOI_SRS_CACHE_SIZE", "32") );
+    if( nSize < 0 )
+        nSize = 0;
+    return nSize;
+}
+
+// Returns a new SRS for the given structs owned by the caller,
+// cloned from the cached prototype where possible
+static OGRSpatialReference *GetCachedSRS( const Eprj_Datum *psDatum,
+                                          const Eprj_ProParameters *psPro,
+                                          const Eprj_MapInfo *psMapInfo )
+{
+    const int nCacheSize = GetSRSCacheSize();
+    if( nCacheSize == 0 )
+        return HFAPCSStructToOSR( psDatum, psPro, psMapInfo, NULL ).release();
+
+    std::string osKey = BuildSRSCacheKey( psDatum, psPro, psMapInfo );
+
+    {
+        std::lock_guard<std::mutex> oLock( oSRSCacheMutex );
+        std::map<std::string, AOISRSCacheEntry>::iterator oIter =
+            oSRSCache.find( osKey );
+        if( oIter != oSRSCache.end() )
+        {
+            // move to front of LRU list
+            oSRSCacheLRU.splice( oSRSCacheLRU.begin(), oSRSCacheLRU,
+                                 oIter->second.oLRUPos );
+            const OGRSpatialReference *poSRS = oIter->second.poSRS;
+            return poSRS != NULL ? poSRS->Clone() : NULL;
+        }
+    }
+
+    // Not in the cache. Do the conversion without holding the lock
+    // so other threads aren't held up by PROJ.
+    OGRSpatialReference *poSRS =
+        HFAPCSStructToOSR( psDatum, psPro, psMapInfo, NULL ).release();
+
+    std::lock_guard<std::mutex> oLock( oSRSCacheMutex );
+    std::map<std::string, AOISRSCacheEntry>::iterator oIter =
+        oSRSCache.find( osKey );
+    if( oIter != oSRSCache.end() )
+    {
+        // another thread got there first - use theirs
+        if( poSRS != NULL )
+            poSRS->Release();
+        poSRS = oIter->second.poSRS;
+    }
+    else
+    {
+        while( (int)oSRSCache.size() >= nCacheSize )
+        {
+            std::map<std::string, AOISRSCacheEntry>::iterator oOldest =
+                oSRSCache.find( oSRSCacheLRU.back() );
+            if( oOldest->second.poSRS != NULL )
+                oOldest->second.poSRS->Release();
+            oSRSCache.erase( oOldest );
+            oSRSCacheLRU.pop_back();
+        }
+
+        oSRSCacheLRU.push_front( osKey );
+        AOISRSCacheEntry sEntry;
+        sEntry.poSRS = poSRS; // the cache owns the prototype
+        sEntry.oLRUPos = oSRSCacheLRU.begin();
+        oSRSCache[osKey] = sEntry;
+    }
+
+    return poSRS != NULL ? poSRS->Clone() : NULL;
+}
+
 /************************************************************************/
 /*                  CreateSpatialReference                              */
 /* Adapted from HFADataset::ReadProjection                              */
+/* Returns a new reference which the caller must Release()              */
 /************************************************************************/
 
-std::unique_ptr<OGRSpatialReference> CreateSpatialReference( HFAEntry* pAOInode )
+OGRSpatialReference *CreateSpatialReference( HFAEntry* pAOInode )
 {
     const Eprj_Datum	      *psDatum;
     const Eprj_ProParameters  *psPro;
     const Eprj_MapInfo        *psMapInfo;
-    std::unique_ptr<OGRSpatialReference> SRS;
+    OGRSpatialReference       *poSRS = NULL;
 
 // Each AOI has a projection (which are all the same). Just get the first 
 // one and use that
-// Possibly should use a search that just stops at the first rather
-// than finding all the matching entries.
-    std::vector<HFAEntry*> antInfoVector = 
-        pAOInode->FindChildren("antInfo", "AntHeader_Eant");
-
-    if( antInfoVector.empty() )
+    HFAEntry *poAntNode = AOIFindFirstChild( pAOInode, "antInfo", 
+                                             "AntHeader_Eant" );
+    if( poAntNode == NULL )
         return NULL;
 
-    HFAEntry *poAntNode = antInfoVector.front();
-
 /* -------------------------------------------------------------------- */
 /*      General case for Erdas style projections.                       */
 /*                                                                      */
@@ -75,10 +249,16 @@ std::unique_ptr<OGRSpatialReference> CreateSpatialReference( HFAEntry* pAOInode
     {
         /* do nothing */
     }
+    else if( psMapInfo == NULL )
+    {
+        // The MapInformation node is read directly by HFAPCSStructToOSR
+        // and isn't part of the cache key. This is rare so don't cache.
+        poSRS = HFAPCSStructToOSR( psDatum, psPro, psMapInfo, 
+                                   poMapInformation ).release();
+    }
     else
     {
-        SRS = HFAPCSStructToOSR( psDatum, psPro, psMapInfo, 
-                                       poMapInformation );
+        poSRS = GetCachedSRS( psDatum, psPro, psMapInfo );
     }
 
     if( psPro != NULL )
@@ -102,7 +282,7 @@ std::unique_ptr<OGRSpatialReference> CreateSpatialReference( HFAEntry* pAOInode
         CPLFree( psMapInfo->units );
         CPLFree( (void*)psMapInfo );
     }
-    return SRS;
+    return poSRS;
 }
 
 /************************************************************************/
@@ -277,7 +457,7 @@ const Eprj_MapInfo *AOIGetMapInfo( HFAEntry *poAntNode )
 // Adapted from HFAEvaluateXFormStack()
 // I've only ever seen order == 1, but handle 2 and 3 just in case
 // order = 0 is an empty polynomial (ie an error when readig etc)
-void ApplyXformPolynomial( Efga_Polynomial *pPoly, double *pdfX, double *pdfY )
+void ApplyXformPolynomial( const Efga_Polynomial *pPoly, double *pdfX, double *pdfY )
 {
     double dfXOut, dfYOut;
 
@@ -369,17 +549,19 @@ void ReadXformPolynomial( HFAEntry *pElement, Efga_Polynomial *pPoly )
     {
         // Get coefficients
         int i;
-        CPLString osFldName;
+        char szFldName[64];
         for( i = 0; i < termcount*2 - 2; i++ )
         {
-            osFldName.Printf( "xformMatrix.polycoefmtx[%d]", i );
-            pPoly->polycoefmtx[i] = pElement->GetDoubleField(osFldName);
+            snprintf( szFldName, sizeof(szFldName), 
+                      "xformMatrix.polycoefmtx[%d]", i );
+            pPoly->polycoefmtx[i] = pElement->GetDoubleField(szFldName);
         }
 
         for( i = 0; i < 2; i++ )
         {
-            osFldName.Printf( "xformMatrix.polycoefvector[%d]", i );
-            pPoly->polycoefvector[i] = pElement->GetDoubleField(osFldName);
+            snprintf( szFldName, sizeof(szFldName), 
+                      "xformMatrix.polycoefvector[%d]", i );
+            pPoly->polycoefvector[i] = pElement->GetDoubleField(szFldName);
         }
     }
 }
@@ -26,12 +26,14 @@
 // Routines for dealing with projections and
 // transform polynomials
 // Adapted from HFA driver
-std::unique_ptr<OGRSpatialReference> CreateSpatialReference( HFAEntry* pAOInode );
+OGRSpatialReference *CreateSpatialReference( HFAEntry* pAOInode );
+HFAEntry *AOIFindFirstChild( HFAEntry *poNode, const char *pszName,
+                             const char *pszType );
 const Eprj_ProParameters *AOIGetProParameters( HFAEntry *poAntNode );
 const Eprj_Datum *AOIGetDatum( HFAEntry *poAntNode );
 const Eprj_MapInfo *AOIGetMapInfo( HFAEntry *poAntNode );
 
-void ApplyXformPolynomial( Efga_Polynomial *pPoly, double *pdfX, double *pdfY );
+void ApplyXformPolynomial( const Efga_Polynomial *pPoly, double *pdfX, double *pdfY );
 void ReadXformPolynomial( HFAEntry *pElement, Efga_Polynomial *pPoly );
 
 #endif // AOIPROJ_H
@@ -0,0 +1,483 @@
+/* ******************************************************************************
+ * Copyright (c) 2015, Sam Gillingham <gillingham.sam@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "aoiraster.h"
+#include "aoithreads.h"
+#include <algorithm>
+#include <map>
+#include <mutex>
+
+// Sort edges by the row they start on
+static bool EdgeStartsBefore( const AOIPixelShapes::Edge &sA, 
+                              const AOIPixelShapes::Edge &sB )
+{
+    return sA.dfYMin < sB.dfYMin;
+}
+
+// Narrow [*pdfT0, *pdfT1] to where |dfA + dfB * t| <= dfHalf.
+// Returns FALSE if that leaves nothing.
+static int NarrowLinear( double dfA, double dfB, double dfHalf, 
+                         double *pdfT0, double *pdfT1 )
+{
+    if( dfB == 0 )
+        return fabs(dfA) <= dfHalf;
+
+    double dfTA = (-dfHalf - dfA) / dfB;
+    double dfTB = (dfHalf - dfA) / dfB;
+    if( dfTA > dfTB )
+        std::swap( dfTA, dfTB );
+    *pdfT0 = MAX( *pdfT0, dfTA );
+    *pdfT1 = MIN( *pdfT1, dfTB );
+    return *pdfT0 <= *pdfT1;
+}
+
+int AOIPixelShapes::Initialize( const double *padfGeoTransform, 
+                                int nXSize, int nYSize )
+{
+    m_nXSize = nXSize;
+    m_nYSize = nYSize;
+    aoShapes.clear();
+    aoEdges.clear();
+    adfX.clear();
+    adfY.clear();
+    return GDALInvGeoTransform( padfGeoTransform, m_adfInvGeoTransform );
+}
+
+// Work out the window of the grid that the shape touches and add it.
+// Returns FALSE if it is outside the grid.
+int AOIPixelShapes::AddShape( Shape &sShape, const OGREnvelope &sEnvelope )
+{
+    // clamp in double first - the envelope can be huge
+    double dfXOff = MAX( 0.0, floor(sEnvelope.MinX) );
+    double dfYOff = MAX( 0.0, floor(sEnvelope.MinY) );
+    double dfXEnd = MIN( (double)m_nXSize, floor(sEnvelope.MaxX) + 1 );
+    double dfYEnd = MIN( (double)m_nYSize, floor(sEnvelope.MaxY) + 1 );
+    if( !(dfXOff < dfXEnd) || !(dfYOff < dfYEnd) )
+        return FALSE;
+
+    sShape.nXOff = (int)dfXOff;
+    sShape.nYOff = (int)dfYOff;
+    sShape.nXEnd = (int)dfXEnd;
+    sShape.nYEnd = (int)dfYEnd;
+    aoShapes.push_back( sShape );
+    return TRUE;
+}
+
+int AOIPixelShapes::AddObject( const AOIObject &oObject, int nObject,
+                               const AOIGeometryOptions &sOptions,
+                               AOIScratch &oScratch )
+{
+    const double *padfInv = m_adfInvGeoTransform;
+    int nAdded = 0;
+    for( int iElement = 0; iElement < oObject.nElements; iElement++ )
+    {
+        const AOIElement &sElement = oObject.aoElements[iElement];
+        Shape sShape;
+        sShape.eKind = sElement.eKind;
+        sShape.bAnalytic = FALSE;
+        sShape.nObject = nObject;
+        sShape.nFirst = 0;
+        sShape.nCount = 0;
+        OGREnvelope sEnvelope;
+
+        // rectangles and ellipses with an affine polynomial are solved
+        // for exactly using the transform from pixel to element coords
+        double adfToPixel[6];
+        if( AOIElementIsAnalytic( sElement, sOptions ) 
+            && AOIElementGetAffine( sElement, adfToPixel ) )
+        {
+            AOIComposeAffine( adfToPixel, padfInv, adfToPixel );
+            if( sElement.dfSize1 > 0 && sElement.dfSize2 > 0
+                && GDALInvGeoTransform( adfToPixel, sShape.adfPixelToLocal ) )
+            {
+                sShape.bAnalytic = TRUE;
+                sShape.dfCenterX = sElement.dfCenterX;
+                sShape.dfCenterY = sElement.dfCenterY;
+                sShape.dfSize1 = sElement.dfSize1;
+                sShape.dfSize2 = sElement.dfSize2;
+                AOIElementGetAffineEnvelope( sElement, adfToPixel, &sEnvelope );
+                if( AddShape( sShape, sEnvelope ) )
+                    nAdded++;
+                continue;
+            }
+            // degenerate - use the outline
+        }
+
+        int nPoints = AOIElementGetOutline( sElement, sOptions, oScratch );
+        if( nPoints == 0 )
+            continue;
+
+        double *padfX = &oScratch.adfX[0];
+        double *padfY = &oScratch.adfY[0];
+        for( int i = 0; i < nPoints; i++ )
+        {
+            double dfX = padfInv[0] + padfInv[1] * padfX[i] + padfInv[2] * padfY[i];
+            double dfY = padfInv[3] + padfInv[4] * padfX[i] + padfInv[5] * padfY[i];
+            padfX[i] = dfX;
+            padfY[i] = dfY;
+            sEnvelope.Merge( dfX, dfY );
+        }
+
+        if( sElement.eKind == AOI_SHAPE_LINE || sElement.eKind == AOI_SHAPE_POINT )
+        {
+            sShape.nFirst = (int)adfX.size();
+            sShape.nCount = nPoints;
+            if( AddShape( sShape, sEnvelope ) )
+            {
+                adfX.insert( adfX.end(), padfX, padfX + nPoints );
+                adfY.insert( adfY.end(), padfY, padfY + nPoints );
+                nAdded++;
+            }
+        }
+        else
+        {
+            // the outline is closed so every point starts an edge
+            // except the last. Horizontal edges never cross a row centre.
+            sShape.nFirst = (int)aoEdges.size();
+            if( !AddShape( sShape, sEnvelope ) )
+                continue;
+
+            for( int i = 0; i < nPoints - 1; i++ )
+            {
+                if( padfY[i] == padfY[i+1] )
+                    continue;
+                int iLow = padfY[i] < padfY[i+1] ? i : i + 1;
+                int iHigh = iLow == i ? i + 1 : i;
+                Edge sEdge;
+                sEdge.dfYMin = padfY[iLow];
+                sEdge.dfYMax = padfY[iHigh];
+                sEdge.dfX = padfX[iLow];
+                sEdge.dfSlope = (padfX[iHigh] - padfX[iLow]) / (padfY[iHigh] - padfY[iLow]);
+                aoEdges.push_back( sEdge );
+            }
+            std::sort( aoEdges.begin() + sShape.nFirst, aoEdges.end(), EdgeStartsBefore );
+            aoShapes.back().nCount = (int)aoEdges.size() - sShape.nFirst;
+            nAdded++;
+        }
+    }
+    return nAdded;
+}
+
+// Scan convert a polygon with an active edge table. Pixels are in 
+// when their centre is, using the even-odd rule.
+void AOIPixelShapes::FillPolygon( const Shape &sShape, int nXOff, int nYOff, 
+                                  int nXSize, int nYSize, GByte *pabyMask,
+                                  AOIFillScratch &oScratch ) const
+{
+    if( sShape.nCount == 0 )
+        return;
+
+    const Edge *pasEdges = &aoEdges[sShape.nFirst];
+    std::vector<double> &adfCrossings = oScratch.adfCrossings;
+    std::vector<int> &anActive = oScratch.anActive;
+    anActive.clear();
+
+    int nRowStart = MAX( nYOff, sShape.nYOff );
+    int nRowEnd = MIN( nYOff + nYSize, sShape.nYEnd );
+    int nColStart = MAX( nXOff, sShape.nXOff );
+    int nColEnd = MIN( nXOff + nXSize, sShape.nXEnd );
+    int iNext = 0;
+    for( int iRow = nRowStart; iRow < nRowEnd; iRow++ )
+    {
+        double dfY = iRow + 0.5;
+
+        // activate the edges that have started 
+        while( iNext < sShape.nCount && pasEdges[iNext].dfYMin <= dfY )
+            anActive.push_back( iNext++ );
+
+        // drop the ones that have finished and find where the rest cross
+        adfCrossings.clear();
+        size_t nKept = 0;
+        for( size_t i = 0; i < anActive.size(); i++ )
+        {
+            const Edge &sEdge = pasEdges[anActive[i]];
+            if( dfY < sEdge.dfYMax )
+            {
+                anActive[nKept++] = anActive[i];
+                adfCrossings.push_back( sEdge.dfX + (dfY - sEdge.dfYMin) * sEdge.dfSlope );
+            }
+        }
+        anActive.resize( nKept );
+        std::sort( adfCrossings.begin(), adfCrossings.end() );
+
+        GByte *pabyRow = pabyMask + (size_t)(iRow - nYOff) * nXSize - nXOff;
+        for( size_t i = 0; i + 1 < adfCrossings.size(); i += 2 )
+        {
+            // pixel centres in [a, b)
+            double dfStart = MAX( ceil(adfCrossings[i] - 0.5), (double)nColStart );
+            double dfEnd = MIN( ceil(adfCrossings[i+1] - 0.5), (double)nColEnd );
+            for( int iCol = (int)dfStart; iCol < (int)dfEnd; iCol++ )
+                pabyRow[iCol] = 1;
+        }
+    }
+}
+
+// Rectangles and ellipses. The element coordinates are linear along
+// a row so the span inside the shape can be solved for directly.
+void AOIPixelShapes::FillAnalytic( const Shape &sShape, int nXOff, int nYOff, 
+                                   int nXSize, int nYSize, GByte *pabyMask ) const
+{
+    const double *padfM = sShape.adfPixelToLocal;
+    int nRowStart = MAX( nYOff, sShape.nYOff );
+    int nRowEnd = MIN( nYOff + nYSize, sShape.nYEnd );
+    int nColStart = MAX( nXOff, sShape.nXOff );
+    int nColEnd = MIN( nXOff + nXSize, sShape.nXEnd );
+    for( int iRow = nRowStart; iRow < nRowEnd; iRow++ )
+    {
+        double dfY = iRow + 0.5;
+        // u = dfUA + dfUB * x, v = dfVA + dfVB * x relative to the centre
+        double dfUA = padfM[0] + padfM[2] * dfY - sShape.dfCenterX;
+        double dfUB = padfM[1];
+        double dfVA = padfM[3] + padfM[5] * dfY - sShape.dfCenterY;
+        double dfVB = padfM[4];
+        double dfX0 = -HUGE_VAL, dfX1 = HUGE_VAL;
+
+        if( sShape.eKind == AOI_SHAPE_RECTANGLE )
+        {
+            if( !NarrowLinear( dfUA, dfUB, sShape.dfSize1 / 2, &dfX0, &dfX1 )
+                || !NarrowLinear( dfVA, dfVB, sShape.dfSize2 / 2, &dfX0, &dfX1 ) )
+                continue;
+        }
+        else
+        {
+            // (u/a)^2 + (v/b)^2 <= 1 is a quadratic in x
+            dfUA /= sShape.dfSize1;
+            dfUB /= sShape.dfSize1;
+            dfVA /= sShape.dfSize2;
+            dfVB /= sShape.dfSize2;
+            double dfA = dfUB * dfUB + dfVB * dfVB;
+            double dfB = 2 * (dfUA * dfUB + dfVA * dfVB);
+            double dfC = dfUA * dfUA + dfVA * dfVA - 1;
+            if( dfA == 0 )
+            {
+                if( dfC > 0 )
+                    continue;
+            }
+            else
+            {
+                double dfDisc = dfB * dfB - 4 * dfA * dfC;
+                if( dfDisc < 0 )
+                    continue;
+                dfDisc = sqrt( dfDisc );
+                dfX0 = (-dfB - dfDisc) / (2 * dfA);
+                dfX1 = (-dfB + dfDisc) / (2 * dfA);
+            }
+        }
+
+        // pixel centres in [x0, x1]
+        GByte *pabyRow = pabyMask + (size_t)(iRow - nYOff) * nXSize - nXOff;
+        double dfStart = MAX( ceil(dfX0 - 0.5), (double)nColStart );
+        double dfEnd = MIN( floor(dfX1 - 0.5) + 1, (double)nColEnd );
+        for( int iCol = (int)dfStart; iCol < (int)dfEnd; iCol++ )
+            pabyRow[iCol] = 1;
+    }
+}
+
+// Lines and points - every pixel touched
+void AOIPixelShapes::FillLine( const Shape &sShape, int nXOff, int nYOff, 
+                               int nXSize, int nYSize, GByte *pabyMask ) const
+{
+    const double *padfX = &adfX[sShape.nFirst];
+    const double *padfY = &adfY[sShape.nFirst];
+
+    for( int i = 0; i < sShape.nCount; i++ )
+    {
+        double dfX0 = padfX[i], dfY0 = padfY[i];
+        double dfDX = 0, dfDY = 0;
+        if( sShape.eKind == AOI_SHAPE_LINE && sShape.nCount > 1 )
+        {
+            if( i == sShape.nCount - 1 )
+                break;
+            dfDX = padfX[i+1] - dfX0;
+            dfDY = padfY[i+1] - dfY0;
+        }
+
+        // only walk the part of the segment near the window
+        double dfT0 = 0, dfT1 = 1;
+        if( !NarrowLinear( dfX0 - (nXOff + nXSize / 2.0), dfDX, nXSize / 2.0 + 1, &dfT0, &dfT1 )
+            || !NarrowLinear( dfY0 - (nYOff + nYSize / 2.0), dfDY, nYSize / 2.0 + 1, &dfT0, &dfT1 ) )
+            continue;
+
+        // step at most half a pixel at a time
+        double dfLength = (dfT1 - dfT0) * MAX( fabs(dfDX), fabs(dfDY) );
+        int nSteps = (int)ceil( dfLength * 2 );
+        for( int iStep = 0; iStep <= nSteps; iStep++ )
+        {
+            double dfT = nSteps == 0 ? dfT0 : dfT0 + (dfT1 - dfT0) * iStep / nSteps;
+            double dfCol = floor( dfX0 + dfT * dfDX );
+            double dfRow = floor( dfY0 + dfT * dfDY );
+            if( dfCol >= nXOff && dfCol < nXOff + nXSize 
+                && dfRow >= nYOff && dfRow < nYOff + nYSize )
+            {
+                pabyMask[((size_t)dfRow - nYOff) * nXSize + ((size_t)dfCol - nXOff)] = 1;
+            }
+        }
+    }
+}
+
+void AOIPixelShapes::Fill( int iShape, int nXOff, int nYOff, 
+                           int nXSize, int nYSize, GByte *pabyMask,
+                           AOIFillScratch &oScratch ) const
+{
+    const Shape &sShape = aoShapes[iShape];
+    if( sShape.nXEnd <= nXOff || sShape.nXOff >= nXOff + nXSize
+        || sShape.nYEnd <= nYOff || sShape.nYOff >= nYOff + nYSize )
+        return;
+
+    if( sShape.bAnalytic )
+        FillAnalytic( sShape, nXOff, nYOff, nXSize, nYSize, pabyMask );
+    else if( sShape.eKind == AOI_SHAPE_LINE || sShape.eKind == AOI_SHAPE_POINT )
+        FillLine( sShape, nXOff, nYOff, nXSize, nYSize, pabyMask );
+    else
+        FillPolygon( sShape, nXOff, nYOff, nXSize, nYSize, pabyMask, oScratch );
+}
+
+void AOIPixelShapes::GetBlockShapes( int nBlockXSize, int nBlockYSize,
+                    std::map<GIntBig, std::vector<int> > &oBlockShapes ) const
+{
+    int nBlocksPerRow = (m_nXSize + nBlockXSize - 1) / nBlockXSize;
+    for( size_t iShape = 0; iShape < aoShapes.size(); iShape++ )
+    {
+        const Shape &sShape = aoShapes[iShape];
+        for( int iBlockY = sShape.nYOff / nBlockYSize; 
+             iBlockY <= (sShape.nYEnd - 1) / nBlockYSize; iBlockY++ )
+        {
+            for( int iBlockX = sShape.nXOff / nBlockXSize; 
+                 iBlockX <= (sShape.nXEnd - 1) / nBlockXSize; iBlockX++ )
+            {
+                oBlockShapes[(GIntBig)iBlockY * nBlocksPerRow + iBlockX].push_back( (int)iShape );
+            }
+        }
+    }
+}
+
+// State for each thread burning blocks
+struct AOIBurnState
+{
+    std::vector<GByte>  abyMask;
+    std::vector<GByte>  abyBlock;
+    AOIFillScratch      oScratch;
+};
+
+CPLErr AOIRasterize( OGRAOILayer *poLayer, GDALRasterBand *poBand,
+                     const double *padfGeoTransform, double dfBurnValue,
+                     int nThreads )
+{
+    int nXSize = poBand->GetXSize();
+    int nYSize = poBand->GetYSize();
+
+    AOIPixelShapes oShapes;
+    if( !oShapes.Initialize( padfGeoTransform, nXSize, nYSize ) )
+    {
+        CPLError( CE_Failure, CPLE_AppDefined, "Can't invert geotransform" );
+        return CE_Failure;
+    }
+
+    // Decode everything first. This is small compared to the raster
+    // and lets the blocks be done in any order.
+    AOIScratch oScratch;
+    GIntBig nFID;
+    const AOIObject *poObject;
+    poLayer->ResetReading();
+    while( (poObject = poLayer->GetNextDecodedObject( &nFID )) != NULL )
+        oShapes.AddObject( *poObject, (int)nFID, poLayer->GetGeometryOptions(), oScratch );
+
+    // Find the shapes in each block from their bounding boxes. 
+    // Blocks that none touch are never read or written.
+    int nBlockXSize, nBlockYSize;
+    poBand->GetBlockSize( &nBlockXSize, &nBlockYSize );
+    int nBlocksPerRow = (nXSize + nBlockXSize - 1) / nBlockXSize;
+    std::map<GIntBig, std::vector<int> > oBlockShapes;
+    oShapes.GetBlockShapes( nBlockXSize, nBlockYSize, oBlockShapes );
+    std::vector<std::pair<GIntBig, std::vector<int>*> > aoBlocks;
+    for( std::map<GIntBig, std::vector<int> >::iterator oIter = oBlockShapes.begin();
+         oIter != oBlockShapes.end(); ++oIter )
+    {
+        aoBlocks.push_back( std::make_pair( oIter->first, &oIter->second ) );
+    }
+
+    // the burn value in the band's type
+    GDALDataType eType = poBand->GetRasterDataType();
+    int nPixelSize = GDALGetDataTypeSizeBytes( eType );
+    GByte abyBurn[16];
+    GDALCopyWords( &dfBurnValue, GDT_Float64, 0, abyBurn, eType, 0, 1 );
+
+    // Burn the blocks in parallel. GDAL's block IO isn't thread safe so 
+    // that is serialised - the scan conversion is what takes the time.
+    std::vector<AOIBurnState> asState( MAX( nThreads, 1 ) );
+    std::mutex oIOMutex;
+    std::atomic<int> bFailed( FALSE );
+    AOIParallelFor( (int)aoBlocks.size(), nThreads, 
+        [&]( int iThread, int iBlock )
+    {
+        if( bFailed )
+            return;
+
+        AOIBurnState &sState = asState[iThread];
+        int iBlockX = (int)(aoBlocks[iBlock].first % nBlocksPerRow);
+        int iBlockY = (int)(aoBlocks[iBlock].first / nBlocksPerRow);
+        int nXOff = iBlockX * nBlockXSize;
+        int nYOff = iBlockY * nBlockYSize;
+        int nWinXSize = MIN( nBlockXSize, nXSize - nXOff );
+        int nWinYSize = MIN( nBlockYSize, nYSize - nYOff );
+
+        sState.abyMask.assign( (size_t)nWinXSize * nWinYSize, 0 );
+        const std::vector<int> &anShapes = *aoBlocks[iBlock].second;
+        for( size_t i = 0; i < anShapes.size(); i++ )
+            oShapes.Fill( anShapes[i], nXOff, nYOff, nWinXSize, nWinYSize,
+                          &sState.abyMask[0], sState.oScratch );
+
+        // bounding boxes can touch a block the shape doesn't
+        if( std::find( sState.abyMask.begin(), sState.abyMask.end(), 1 ) 
+                == sState.abyMask.end() )
+            return;
+
+        sState.abyBlock.resize( (size_t)nBlockXSize * nBlockYSize * nPixelSize );
+        GByte *pabyBlock = &sState.abyBlock[0];
+        {
+            std::lock_guard<std::mutex> oLock( oIOMutex );
+            if( poBand->ReadBlock( iBlockX, iBlockY, pabyBlock ) != CE_None )
+            {
+                bFailed = TRUE;
+                return;
+            }
+        }
+
+        for( int iRow = 0; iRow < nWinYSize; iRow++ )
+        {
+            const GByte *pabyMaskRow = &sState.abyMask[(size_t)iRow * nWinXSize];
+            GByte *pabyRow = pabyBlock + (size_t)iRow * nBlockXSize * nPixelSize;
+            for( int iCol = 0; iCol < nWinXSize; iCol++ )
+            {
+                if( pabyMaskRow[iCol] )
+                    memcpy( pabyRow + (size_t)iCol * nPixelSize, abyBurn, nPixelSize );
+            }
+        }
+
+        std::lock_guard<std::mutex> oLock( oIOMutex );
+        if( poBand->WriteBlock( iBlockX, iBlockY, pabyBlock ) != CE_None )
+            bFailed = TRUE;
+    } );
+
+    return bFailed ? CE_Failure : CE_None;
+}
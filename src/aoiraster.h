@@ -0,0 +1,140 @@
+/* ******************************************************************************
+ * Copyright (c) 2015, Sam Gillingham <gillingham.sam@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef AOIRASTER_H
+#define AOIRASTER_H
+
+#include <gdal_priv.h>
+#include "aoilayer.h"
+#include <map>
+#include <vector>
+
+// Scratch space for AOIPixelShapes::Fill(), one per thread
+struct AOIFillScratch
+{
+    std::vector<double> adfCrossings;
+    std::vector<int>    anActive;
+};
+
+// The shapes of a set of objects converted to the pixel coordinates 
+// of a grid, ready to be scan converted a window at a time. 
+// Polygons (and rectangles and ellipses that can't be done exactly)
+// are kept as edge lists sorted by their first row so a window can be
+// filled with an active edge table. Rectangles and ellipses with an
+// affine polynomial keep a pixel to element transform so the span on
+// each row can be solved for directly.
+// Once built it is only read so windows can be burnt on many threads.
+class AOIPixelShapes
+{
+  public:
+    struct Shape
+    {
+        AOIShapeKind    eKind;
+        int             bAnalytic;
+        int             nObject;        // as passed to AddObject()
+
+        // window touched - clipped to the grid, end exclusive
+        int             nXOff;
+        int             nYOff;
+        int             nXEnd;
+        int             nYEnd;
+
+        // analytic shapes
+        double          adfPixelToLocal[6];
+        double          dfCenterX;
+        double          dfCenterY;
+        double          dfSize1;
+        double          dfSize2;
+
+        // polygons index aoEdges, lines and points index adfX/adfY
+        int             nFirst;
+        int             nCount;
+    };
+
+    // x = dfX + (y - dfYMin) * dfSlope between dfYMin and dfYMax
+    struct Edge
+    {
+        double          dfYMin;
+        double          dfYMax;
+        double          dfX;
+        double          dfSlope;
+    };
+
+  private:
+    double              m_adfInvGeoTransform[6];
+    int                 m_nXSize;
+    int                 m_nYSize;
+
+    int                 AddShape( Shape &sShape, const OGREnvelope &sEnvelope );
+    void                FillPolygon( const Shape &sShape, int nXOff, int nYOff, 
+                                     int nXSize, int nYSize, GByte *pabyMask,
+                                     AOIFillScratch &oScratch ) const;
+    void                FillAnalytic( const Shape &sShape, int nXOff, int nYOff, 
+                                      int nXSize, int nYSize, GByte *pabyMask ) const;
+    void                FillLine( const Shape &sShape, int nXOff, int nYOff, 
+                                  int nXSize, int nYSize, GByte *pabyMask ) const;
+
+  public:
+    std::vector<Shape>  aoShapes;
+    std::vector<Edge>   aoEdges;
+    std::vector<double> adfX;
+    std::vector<double> adfY;
+
+    // Returns FALSE if the geotransform can't be inverted
+    int                 Initialize( const double *padfGeoTransform, 
+                                    int nXSize, int nYSize );
+
+    // Add the elements of oObject. Elements that are outside the grid
+    // are dropped. Returns the number of shapes added.
+    int                 AddObject( const AOIObject &oObject, int nObject,
+                                   const AOIGeometryOptions &sOptions,
+                                   AOIScratch &oScratch );
+
+    // Set the pixels of pabyMask (nXSize by nYSize at nXOff, nYOff) 
+    // that shape iShape covers to 1
+    void                Fill( int iShape, int nXOff, int nYOff, 
+                              int nXSize, int nYSize, GByte *pabyMask,
+                              AOIFillScratch &oScratch ) const;
+
+    // The shapes whose windows overlap each block, keyed on 
+    // iBlockY * nBlocksPerRow + iBlockX so they come out in file
+    // order. Blocks no shape touches aren't included. The shapes
+    // for each block are in the order they were added.
+    void                GetBlockShapes( int nBlockXSize, int nBlockYSize,
+                                        std::map<GIntBig, std::vector<int> > &oBlockShapes ) const;
+};
+
+// Burn the shapes in poLayer into poBand. padfGeoTransform maps pixels
+// in the band to layer coordinates.
+// Pixels with their centre inside a polygon, rectangle or ellipse are 
+// burnt, as are pixels touched by lines and points. Rectangles and 
+// ellipses with an affine polynomial are burnt exactly without being 
+// tessellated.
+// Only the blocks that shapes touch are read and written back with 
+// ReadBlock()/WriteBlock() so the rest of the band is left as it is.
+// The blocks are burnt on nThreads threads.
+CPLErr AOIRasterize( OGRAOILayer *poLayer, GDALRasterBand *poBand,
+                     const double *padfGeoTransform, double dfBurnValue,
+                     int nThreads );
+
+#endif // AOIRASTER_H
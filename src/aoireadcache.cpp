@@ -0,0 +1,574 @@
+/* ******************************************************************************
+ * Copyright (c) 2015, Sam Gillingham <gillingham.sam@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <cpl_conv.h>
+#include <cpl_string.h>
+#include <algorithm>
+#include <set>
+#include "hfa.h"
+#include "aoireadcache.h"
+
+// Smallest read we will do on a cache miss
+#define AOI_MIN_READ_SIZE       16384
+// Largest the read ahead can grow to
+#define AOI_MAX_READ_AHEAD      (4 * 1024 * 1024)
+
+static bool CompareRanges( const AOIRange &a, const AOIRange &b )
+{
+    return a.nOffset < b.nOffset;
+}
+
+AOICachedHandle::AOICachedHandle( VSILFILE *fpBase, vsi_l_offset nFileSize )
+{
+    m_fpBase = fpBase;
+    m_nOffset = 0;
+    m_nFileSize = nFileSize;
+    m_bEOF = FALSE;
+
+    m_nCachedBytes = 0;
+    m_nMaxCachedBytes = (size_t)CPLAtoGIntBig(
+            CPLGetConfigOption("OGR_AOI_READ_CACHE_SIZE", "16777216") );
+    m_nUseCounter = 0;
+
+    // Small files are read in one request on the first miss. Most
+    // AOIs are only a few kilobytes.
+    vsi_l_offset nWholeFileSize = (vsi_l_offset)CPLAtoGIntBig(
+            CPLGetConfigOption("OGR_AOI_WHOLE_FILE_SIZE", "1048576") );
+    m_bWholeFile = (nFileSize <= nWholeFileSize
+                        && nFileSize <= m_nMaxCachedBytes);
+
+    m_nMinReadSize = AOI_MIN_READ_SIZE;
+    m_nReadAhead = m_nMinReadSize;
+    m_nMaxReadAhead = AOI_MAX_READ_AHEAD;
+    // Ranges closer than this are fetched as one, the extra bytes
+    // cost less than another round trip
+    m_nMergeGap = (size_t)CPLAtoGIntBig(
+            CPLGetConfigOption("OGR_AOI_MERGE_GAP", "65536") );
+    m_nLastFetchEnd = 0;
+
+    m_nRequests = 0;
+    m_nBytesFetched = 0;
+}
+
+AOICachedHandle::~AOICachedHandle()
+{
+    Close();
+}
+
+int AOICachedHandle::Close()
+{
+    if( m_fpBase != NULL )
+    {
+        CPLDebug( "AOI", "%d read requests, " CPL_FRMT_GUIB " bytes fetched",
+                  m_nRequests, m_nBytesFetched );
+        VSIFCloseL( m_fpBase );
+        m_fpBase = NULL;
+    }
+    m_oChunks.clear();
+    m_nCachedBytes = 0;
+    return 0;
+}
+
+int AOICachedHandle::Seek( vsi_l_offset nOffset, int nWhence )
+{
+    if( nWhence == SEEK_SET )
+        m_nOffset = nOffset;
+    else if( nWhence == SEEK_CUR )
+        m_nOffset += nOffset;
+    else if( nWhence == SEEK_END )
+        m_nOffset = m_nFileSize + nOffset;
+    else
+        return -1;
+
+    m_bEOF = FALSE;
+    return 0;
+}
+
+vsi_l_offset AOICachedHandle::Tell()
+{
+    return m_nOffset;
+}
+
+int AOICachedHandle::Eof()
+{
+    return m_bEOF;
+}
+
+int AOICachedHandle::Error()
+{
+    return FALSE;
+}
+
+void AOICachedHandle::ClearErr()
+{
+    m_bEOF = FALSE;
+}
+
+size_t AOICachedHandle::Write( const void *, size_t, size_t )
+{
+    CPLError( CE_Failure, CPLE_NotSupported,
+              "Write not supported on AOI read cache." );
+    return 0;
+}
+
+// Add a newly read block of data to the cache. Any chunks that it
+// overlaps or touches are merged with it so chunks never overlap.
+void AOICachedHandle::AddChunk( vsi_l_offset nOffset, std::vector<GByte> &abyData )
+{
+    vsi_l_offset nStart = nOffset;
+    vsi_l_offset nEnd = nOffset + abyData.size();
+
+    std::map<vsi_l_offset, Chunk>::iterator oFirst = m_oChunks.upper_bound( nStart );
+    if( oFirst != m_oChunks.begin() )
+    {
+        std::map<vsi_l_offset, Chunk>::iterator oPrev = oFirst;
+        --oPrev;
+        if( oPrev->first + oPrev->second.abyData.size() >= nStart )
+            oFirst = oPrev;
+    }
+
+    std::map<vsi_l_offset, Chunk>::iterator oLast = oFirst;
+    while( oLast != m_oChunks.end() && oLast->first <= nEnd )
+    {
+        nStart = std::min( nStart, oLast->first );
+        nEnd = std::max( nEnd, oLast->first + oLast->second.abyData.size() );
+        ++oLast;
+    }
+
+    Chunk sChunk;
+    sChunk.nLastUse = ++m_nUseCounter;
+    if( oFirst == oLast )
+    {
+        // nothing to merge with
+        sChunk.abyData.swap( abyData );
+    }
+    else
+    {
+        sChunk.abyData.resize( (size_t)(nEnd - nStart) );
+        for( std::map<vsi_l_offset, Chunk>::iterator oIter = oFirst;
+             oIter != oLast; ++oIter )
+        {
+            memcpy( &sChunk.abyData[(size_t)(oIter->first - nStart)],
+                    &oIter->second.abyData[0], oIter->second.abyData.size() );
+            m_nCachedBytes -= oIter->second.abyData.size();
+        }
+        if( !abyData.empty() )
+            memcpy( &sChunk.abyData[(size_t)(nOffset - nStart)], &abyData[0],
+                    abyData.size() );
+        m_oChunks.erase( oFirst, oLast );
+    }
+
+    m_nCachedBytes += sChunk.abyData.size();
+    m_oChunks[nStart].abyData.swap( sChunk.abyData );
+    m_oChunks[nStart].nLastUse = sChunk.nLastUse;
+}
+
+// Drop the least recently used chunks until we are under budget.
+// Always keeps at least one chunk.
+void AOICachedHandle::TrimCache()
+{
+    while( m_nCachedBytes > m_nMaxCachedBytes && m_oChunks.size() > 1 )
+    {
+        std::map<vsi_l_offset, Chunk>::iterator oOldest = m_oChunks.begin();
+        for( std::map<vsi_l_offset, Chunk>::iterator oIter = m_oChunks.begin();
+             oIter != m_oChunks.end(); ++oIter )
+        {
+            if( oIter->second.nLastUse < oOldest->second.nLastUse )
+                oOldest = oIter;
+        }
+        m_nCachedBytes -= oOldest->second.abyData.size();
+        m_oChunks.erase( oOldest );
+    }
+}
+
+// Work out which parts of the given range aren't in the cache
+void AOICachedHandle::FindMissing( vsi_l_offset nOffset, size_t nSize,
+                                   std::vector<AOIRange> &aoMissing )
+{
+    vsi_l_offset nCur = nOffset;
+    vsi_l_offset nEnd = nOffset + nSize;
+    if( nEnd > m_nFileSize )
+        nEnd = m_nFileSize;
+
+    std::map<vsi_l_offset, Chunk>::iterator oIter = m_oChunks.upper_bound( nCur );
+    if( oIter != m_oChunks.begin() )
+        --oIter;
+
+    while( nCur < nEnd )
+    {
+        if( oIter != m_oChunks.end() && oIter->first <= nCur )
+        {
+            vsi_l_offset nChunkEnd = oIter->first + oIter->second.abyData.size();
+            if( nChunkEnd > nCur )
+                nCur = nChunkEnd;
+            ++oIter;
+        }
+        else
+        {
+            vsi_l_offset nGapEnd = nEnd;
+            if( oIter != m_oChunks.end() && oIter->first < nEnd )
+                nGapEnd = oIter->first;
+
+            AOIRange sRange;
+            sRange.nOffset = nCur;
+            sRange.nSize = (size_t)(nGapEnd - nCur);
+            aoMissing.push_back( sRange );
+            nCur = nGapEnd;
+        }
+    }
+}
+
+// Read the given ranges into the cache. Ranges are sorted, and those
+// that are close together are merged, then all are read with one
+// VSIFReadMultiRangeL() call.
+int AOICachedHandle::FetchRanges( std::vector<AOIRange> &aoRanges )
+{
+    if( aoRanges.empty() )
+        return TRUE;
+
+    std::sort( aoRanges.begin(), aoRanges.end(), CompareRanges );
+
+    std::vector<AOIRange> aoMerged;
+    for( size_t i = 0; i < aoRanges.size(); i++ )
+    {
+        if( !aoMerged.empty() && aoRanges[i].nOffset <=
+                aoMerged.back().nOffset + aoMerged.back().nSize + m_nMergeGap )
+        {
+            vsi_l_offset nEnd = std::max(
+                    aoMerged.back().nOffset + aoMerged.back().nSize,
+                    aoRanges[i].nOffset + aoRanges[i].nSize );
+            aoMerged.back().nSize = (size_t)(nEnd - aoMerged.back().nOffset);
+        }
+        else
+        {
+            aoMerged.push_back( aoRanges[i] );
+        }
+    }
+
+    std::vector< std::vector<GByte> > aabyData( aoMerged.size() );
+    std::vector<void*> apData( aoMerged.size() );
+    std::vector<vsi_l_offset> anOffsets( aoMerged.size() );
+    std::vector<size_t> anSizes( aoMerged.size() );
+    for( size_t i = 0; i < aoMerged.size(); i++ )
+    {
+        aabyData[i].resize( aoMerged[i].nSize );
+        apData[i] = &aabyData[i][0];
+        anOffsets[i] = aoMerged[i].nOffset;
+        anSizes[i] = aoMerged[i].nSize;
+        m_nBytesFetched += aoMerged[i].nSize;
+    }
+
+    m_nRequests += (int)aoMerged.size();
+    if( VSIFReadMultiRangeL( (int)aoMerged.size(), &apData[0], &anOffsets[0],
+                             &anSizes[0], m_fpBase ) != 0 )
+    {
+        CPLError( CE_Failure, CPLE_FileIO, "Read of AOI file failed." );
+        return FALSE;
+    }
+
+    for( size_t i = 0; i < aoMerged.size(); i++ )
+        AddChunk( anOffsets[i], aabyData[i] );
+
+    m_nLastFetchEnd = aoMerged.back().nOffset + aoMerged.back().nSize;
+    return TRUE;
+}
+
+size_t AOICachedHandle::Read( void *pBuffer, size_t nSize, size_t nCount )
+{
+    if( nSize == 0 || nCount == 0 )
+        return 0;
+
+    size_t nToRead = nSize * nCount;
+    if( m_nOffset >= m_nFileSize )
+    {
+        m_bEOF = TRUE;
+        return 0;
+    }
+    if( m_nOffset + nToRead > m_nFileSize )
+        nToRead = (size_t)(m_nFileSize - m_nOffset);
+
+    std::vector<AOIRange> aoMissing;
+    FindMissing( m_nOffset, nToRead, aoMissing );
+    if( !aoMissing.empty() )
+    {
+        if( m_bWholeFile )
+        {
+            aoMissing.resize( 1 );
+            aoMissing[0].nOffset = 0;
+            aoMissing[0].nSize = (size_t)m_nFileSize;
+        }
+        else
+        {
+            // Is the traversal walking forwards? If so read further
+            // ahead each time, otherwise go back to small reads.
+            if( aoMissing[0].nOffset >= m_nLastFetchEnd
+                && aoMissing[0].nOffset <= m_nLastFetchEnd + m_nMergeGap )
+                m_nReadAhead = std::min( m_nReadAhead * 2, m_nMaxReadAhead );
+            else
+                m_nReadAhead = m_nMinReadSize;
+
+            AOIRange &sLast = aoMissing.back();
+            if( sLast.nSize < m_nReadAhead )
+            {
+                sLast.nSize = m_nReadAhead;
+                if( sLast.nOffset + sLast.nSize > m_nFileSize )
+                    sLast.nSize = (size_t)(m_nFileSize - sLast.nOffset);
+            }
+        }
+
+        if( !FetchRanges( aoMissing ) )
+            return 0;
+    }
+
+    // Now copy out of the cache
+    GByte *pabyOut = (GByte*)pBuffer;
+    size_t nDone = 0;
+    std::map<vsi_l_offset, Chunk>::iterator oIter = m_oChunks.upper_bound( m_nOffset );
+    if( oIter != m_oChunks.begin() )
+        --oIter;
+    while( nDone < nToRead && oIter != m_oChunks.end() )
+    {
+        vsi_l_offset nPos = m_nOffset + nDone;
+        vsi_l_offset nChunkEnd = oIter->first + oIter->second.abyData.size();
+        if( oIter->first > nPos )
+            break; // shouldn't happen - we just filled the gaps
+        if( nChunkEnd > nPos )
+        {
+            size_t nCopy = (size_t)std::min( (vsi_l_offset)(nToRead - nDone),
+                                             nChunkEnd - nPos );
+            memcpy( pabyOut + nDone, &oIter->second.abyData[(size_t)(nPos - oIter->first)],
+                    nCopy );
+            nDone += nCopy;
+            oIter->second.nLastUse = ++m_nUseCounter;
+        }
+        ++oIter;
+    }
+
+    m_nOffset += nDone;
+    if( nDone < nSize * nCount )
+        m_bEOF = TRUE;
+
+    TrimCache();
+
+    return nDone / nSize;
+}
+
+int AOICachedHandle::IsCached( vsi_l_offset nOffset, size_t nSize )
+{
+    std::vector<AOIRange> aoMissing;
+    FindMissing( nOffset, nSize, aoMissing );
+    return aoMissing.empty();
+}
+
+int AOICachedHandle::Prefetch( const std::vector<AOIRange> &aoRanges )
+{
+    std::vector<AOIRange> aoMissing;
+    for( size_t i = 0; i < aoRanges.size(); i++ )
+        FindMissing( aoRanges[i].nOffset, aoRanges[i].nSize, aoMissing );
+
+    if( aoMissing.empty() )
+        return TRUE;
+
+    if( m_bWholeFile )
+    {
+        aoMissing.resize( 1 );
+        aoMissing[0].nOffset = 0;
+        aoMissing[0].nSize = (size_t)m_nFileSize;
+    }
+    else
+    {
+        // Small ranges are mostly node headers, and the nodes near
+        // them are likely to be wanted soon
+        for( size_t i = 0; i < aoMissing.size(); i++ )
+        {
+            if( aoMissing[i].nSize < m_nMinReadSize )
+            {
+                aoMissing[i].nSize = m_nMinReadSize;
+                if( aoMissing[i].nOffset + aoMissing[i].nSize > m_nFileSize )
+                    aoMissing[i].nSize = (size_t)(m_nFileSize - aoMissing[i].nOffset);
+            }
+        }
+    }
+
+    int bRet = FetchRanges( aoMissing );
+    TrimCache();
+    return bRet;
+}
+
+// Is this on one of the network file systems where each read
+// is a separate request?
+static int IsNetworkFile( const char *pszFilename )
+{
+    static const char * const apszPrefixes[] = {
+        "/vsicurl/", "/vsicurl?", "/vsis3/", "/vsigs/", "/vsiaz/",
+        "/vsiadls/", "/vsioss/", "/vsiswift/", "/vsiwebhdfs/", "/vsihdfs/",
+        NULL };
+
+    for( int i = 0; apszPrefixes[i] != NULL; i++ )
+    {
+        if( STARTS_WITH_CI(pszFilename, apszPrefixes[i]) )
+            return TRUE;
+    }
+    return FALSE;
+}
+
+AOICachedHandle *AOICreateCachedHandle( VSILFILE *fp, const char *pszFilename )
+{
+    const char *pszMode = CPLGetConfigOption( "OGR_AOI_COALESCE_READS", "AUTO" );
+    int bUse;
+    if( EQUAL(pszMode, "AUTO") )
+        bUse = IsNetworkFile( pszFilename )
+            || CPLTestBool( CPLGetConfigOption("OGR_AOI_PREFETCH", "NO") );
+    else
+        bUse = CPLTestBool( pszMode );
+
+    if( !bUse )
+        return NULL;
+
+    if( VSIFSeekL( fp, 0, SEEK_END ) != 0 )
+        return NULL;
+    vsi_l_offset nFileSize = VSIFTellL( fp );
+
+    return new AOICachedHandle( fp, nFileSize );
+}
+
+// Unpack an Ehfa_Entry
+void AOIParseEntryHeader( const GByte *pabyHeader, AOIEntryHeader *psHeader )
+{
+    GUInt32 anPos[6];
+    memcpy( anPos, pabyHeader, sizeof(anPos) );
+    for( int i = 0; i < 6; i++ )
+        HFAStandard( 4, &anPos[i] );
+
+    psHeader->nNextPos = anPos[0];
+    psHeader->nPrevPos = anPos[1];
+    psHeader->nParentPos = anPos[2];
+    psHeader->nChildPos = anPos[3];
+    psHeader->nDataPos = anPos[4];
+    psHeader->nDataSize = anPos[5];
+
+    memcpy( psHeader->szName, pabyHeader + 24, 64 );
+    psHeader->szName[64] = '\0';
+    memcpy( psHeader->szType, pabyHeader + 88, 32 );
+    psHeader->szType[32] = '\0';
+}
+
+int AOIReadEntryHeader( VSILFILE *fp, GUInt32 nPos, AOIEntryHeader *psHeader )
+{
+    GByte abyHeader[HFA_ENTRY_HEADER_SIZE];
+    if( VSIFSeekL( fp, nPos, SEEK_SET ) != 0
+        || VSIFReadL( abyHeader, HFA_ENTRY_HEADER_SIZE, 1, fp ) < 1 )
+    {
+        CPLError( CE_Failure, CPLE_FileIO,
+                  "Failed to read entry header at %u.", nPos );
+        return FALSE;
+    }
+
+    AOIParseEntryHeader( abyHeader, psHeader );
+    return TRUE;
+}
+
+// Breadth first prefetch of a tree of entries.
+// The children and siblings of a node can only be found by reading
+// it, so each pass takes all the nodes we know about whose headers
+// are not yet cached, sorts them by offset and fetches them (plus the
+// data of the nodes found on the previous pass) in one go. Nodes whose
+// headers were pulled in as part of a larger read are followed
+// straight away without any I/O.
+void AOIPrefetchTree( AOICachedHandle *poHandle, GUInt32 nStartPos,
+                      size_t nMaxBytes )
+{
+    VSILFILE *fp = reinterpret_cast<VSILFILE*>( poHandle );
+    std::vector<GUInt32> anPending, anDeferred;
+    std::vector<AOIRange> aoWanted;
+    std::set<GUInt32> oSeen;
+    size_t nRequested = 0;
+    int nPasses = 0;
+
+    if( nStartPos == 0 )
+        return;
+    anPending.push_back( nStartPos );
+    oSeen.insert( nStartPos );
+
+    while( nRequested < nMaxBytes )
+    {
+        while( !anPending.empty() )
+        {
+            GUInt32 nPos = anPending.back();
+            anPending.pop_back();
+
+            if( !poHandle->IsCached( nPos, HFA_ENTRY_HEADER_SIZE ) )
+            {
+                anDeferred.push_back( nPos );
+                continue;
+            }
+
+            AOIEntryHeader sHeader;
+            if( !AOIReadEntryHeader( fp, nPos, &sHeader ) )
+                continue;
+
+            if( sHeader.nDataPos != 0 && sHeader.nDataSize > 0 )
+            {
+                AOIRange sRange;
+                sRange.nOffset = sHeader.nDataPos;
+                sRange.nSize = sHeader.nDataSize;
+                aoWanted.push_back( sRange );
+                nRequested += sHeader.nDataSize;
+            }
+
+            // don't wander off into the siblings of where we started
+            if( nPos != nStartPos && sHeader.nNextPos != 0
+                && oSeen.insert( sHeader.nNextPos ).second )
+                anPending.push_back( sHeader.nNextPos );
+            if( sHeader.nChildPos != 0
+                && oSeen.insert( sHeader.nChildPos ).second )
+                anPending.push_back( sHeader.nChildPos );
+        }
+
+        if( anDeferred.empty() )
+            break;
+
+        for( size_t i = 0; i < anDeferred.size(); i++ )
+        {
+            AOIRange sRange;
+            sRange.nOffset = anDeferred[i];
+            sRange.nSize = HFA_ENTRY_HEADER_SIZE;
+            aoWanted.push_back( sRange );
+            nRequested += HFA_ENTRY_HEADER_SIZE;
+        }
+
+        // Prefetch() sorts by offset and merges
+        if( !poHandle->Prefetch( aoWanted ) )
+            return;
+        aoWanted.clear();
+        nPasses++;
+
+        anPending.swap( anDeferred );
+        anDeferred.clear();
+    }
+
+    if( !aoWanted.empty() && nRequested < nMaxBytes )
+        poHandle->Prefetch( aoWanted );
+
+    CPLDebug( "AOI", "Prefetched tree in %d passes, %d requests", nPasses,
+              poHandle->GetRequestCount() );
+}
@@ -0,0 +1,138 @@
+/* ******************************************************************************
+ * Copyright (c) 2015, Sam Gillingham <gillingham.sam@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef AOIREADCACHE_H
+#define AOIREADCACHE_H
+
+#include <cpl_vsi_virtual.h>
+#include <map>
+#include <vector>
+
+// A range of bytes in the file
+struct AOIRange
+{
+    vsi_l_offset nOffset;
+    size_t       nSize;
+};
+
+// A read only VSI handle that sits on top of another one and
+// caches what has been read in chunks.
+// HFAEntry reads each node as a separate small read at a scattered
+// offset. On /vsicurl/ etc each of these becomes an HTTP request so
+// this class:
+//  - reads small files in one go
+//  - merges adjacent and nearby missing ranges into a few larger
+//    reads using VSIFReadMultiRangeL()
+//  - grows the read ahead while reads keep landing just past the
+//    last range fetched (ie the traversal is walking forwards)
+//  - allows callers that know what they will need to Prefetch() it
+class AOICachedHandle : public VSIVirtualHandle
+{
+    struct Chunk
+    {
+        std::vector<GByte>  abyData;
+        GUIntBig            nLastUse;
+    };
+
+    VSILFILE               *m_fpBase;
+    vsi_l_offset            m_nOffset;
+    vsi_l_offset            m_nFileSize;
+    int                     m_bEOF;
+    int                     m_bWholeFile;
+
+    std::map<vsi_l_offset, Chunk> m_oChunks; // keyed on start offset, never overlap
+    size_t                  m_nCachedBytes;
+    size_t                  m_nMaxCachedBytes;
+    GUIntBig                m_nUseCounter;
+
+    size_t                  m_nMinReadSize;
+    size_t                  m_nReadAhead;
+    size_t                  m_nMaxReadAhead;
+    size_t                  m_nMergeGap;
+    vsi_l_offset            m_nLastFetchEnd;
+
+    int                     m_nRequests;
+    GUIntBig                m_nBytesFetched;
+
+    void                AddChunk( vsi_l_offset nOffset, std::vector<GByte> &abyData );
+    void                TrimCache();
+    void                FindMissing( vsi_l_offset nOffset, size_t nSize,
+                                     std::vector<AOIRange> &aoMissing );
+    int                 FetchRanges( std::vector<AOIRange> &aoRanges );
+
+  public:
+                        AOICachedHandle( VSILFILE *fpBase, vsi_l_offset nFileSize );
+    virtual            ~AOICachedHandle();
+
+    virtual int         Seek( vsi_l_offset nOffset, int nWhence );
+    virtual vsi_l_offset Tell();
+    virtual size_t      Read( void *pBuffer, size_t nSize, size_t nCount );
+    virtual size_t      Write( const void *pBuffer, size_t nSize, size_t nCount );
+    virtual int         Eof();
+    virtual int         Error();
+    virtual void        ClearErr();
+    virtual int         Close();
+
+    // Make sure the given ranges are in the cache, fetching any
+    // missing parts with as few requests as possible.
+    int                 Prefetch( const std::vector<AOIRange> &aoRanges );
+    int                 IsCached( vsi_l_offset nOffset, size_t nSize );
+
+    int                 GetRequestCount() const { return m_nRequests; }
+};
+
+// Create an AOICachedHandle on top of fp if this looks like a network
+// file (or the OGR_AOI_COALESCE_READS / OGR_AOI_PREFETCH config options
+// say so). Returns NULL if fp should be used as is. The returned handle
+// takes ownership of fp. Local files aren't cached by default: the lean
+// reader used for read only layers reads them in one go anyway, so the
+// prefetch would only read the file twice.
+AOICachedHandle *AOICreateCachedHandle( VSILFILE *fp, const char *pszFilename );
+
+// Size of the Ehfa_Entry header on disk
+#define HFA_ENTRY_HEADER_SIZE 128
+
+// The Ehfa_Entry structure that is at the start of each node.
+// Read directly rather than through HFAEntry so we can look ahead
+// without creating the entries.
+struct AOIEntryHeader
+{
+    GUInt32     nNextPos;
+    GUInt32     nPrevPos;
+    GUInt32     nParentPos;
+    GUInt32     nChildPos;
+    GUInt32     nDataPos;
+    GUInt32     nDataSize;
+    char        szName[65];
+    char        szType[33];
+};
+
+void AOIParseEntryHeader( const GByte *pabyHeader, AOIEntryHeader *psHeader );
+int AOIReadEntryHeader( VSILFILE *fp, GUInt32 nPos, AOIEntryHeader *psHeader );
+
+// Read the headers and data of the tree starting at nStartPos into
+// the cache, a level at a time with the reads sorted by offset.
+// Stops once nMaxBytes have been requested.
+void AOIPrefetchTree( AOICachedHandle *poHandle, GUInt32 nStartPos,
+                      size_t nMaxBytes );
+
+#endif // AOIREADCACHE_H
@@ -0,0 +1,273 @@
+/* ******************************************************************************
+ * Copyright (c) 2015, Sam Gillingham <gillingham.sam@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <set>
+#include "aoisql.h"
+
+OGRAOISQLResultLayer::OGRAOISQLResultLayer( OGRFeatureDefn *poFeatureDefn )
+{
+    m_poFeatureDefn = poFeatureDefn;
+    m_poFeatureDefn->Reference();
+    m_iNext = 0;
+}
+
+OGRAOISQLResultLayer::~OGRAOISQLResultLayer()
+{
+    for( size_t i = 0; i < m_apoFeatures.size(); i++ )
+        delete m_apoFeatures[i];
+    m_poFeatureDefn->Release();
+}
+
+void OGRAOISQLResultLayer::AddFeature( OGRFeature *poFeature )
+{
+    poFeature->SetFID( (GIntBig)m_apoFeatures.size() );
+    m_apoFeatures.push_back( poFeature );
+}
+
+OGRFeature *OGRAOISQLResultLayer::GetNextFeature()
+{
+    while( m_iNext < m_apoFeatures.size() )
+    {
+        OGRFeature *poFeature = m_apoFeatures[m_iNext++];
+        if( m_poAttrQuery == NULL || m_poAttrQuery->Evaluate( poFeature ) )
+            return poFeature->Clone();
+    }
+    return NULL;
+}
+
+OGRFeature *OGRAOISQLResultLayer::GetFeature( GIntBig nFID )
+{
+    if( nFID < 0 || nFID >= (GIntBig)m_apoFeatures.size() )
+        return NULL;
+    return m_apoFeatures[nFID]->Clone();
+}
+
+GIntBig OGRAOISQLResultLayer::GetFeatureCount( int bForce )
+{
+    if( m_poAttrQuery != NULL )
+        return OGRLayer::GetFeatureCount( bForce );
+    return (GIntBig)m_apoFeatures.size();
+}
+
+int OGRAOISQLResultLayer::TestCapability( const char *pszCap )
+{
+    if( EQUAL(pszCap, OLCRandomRead) )
+        return TRUE;
+    if( EQUAL(pszCap, OLCFastFeatureCount) )
+        return m_poAttrQuery == NULL;
+    return FALSE;
+}
+
+// Split a statement into identifiers, 'strings' and single punctuation
+// characters. Strings are marked with a leading ' so they can't be
+// mistaken for keywords. Returns FALSE if it can't be split.
+static int Tokenize( const char *pszStatement, std::vector<CPLString> &aosTokens )
+{
+    const char *psz = pszStatement;
+    while( *psz != '\0' )
+    {
+        if( isspace( (unsigned char)*psz ) )
+        {
+            psz++;
+        }
+        else if( *psz == '\'' || *psz == '"' )
+        {
+            // '' and "" are the quote character
+            char chQuote = *psz++;
+            CPLString osToken;
+            if( chQuote == '\'' )
+                osToken += '\'';
+            while( TRUE )
+            {
+                if( *psz == '\0' )
+                    return FALSE;
+                if( *psz == chQuote )
+                {
+                    if( psz[1] != chQuote )
+                        break;
+                    psz++;
+                }
+                osToken += *psz++;
+            }
+            psz++;
+            aosTokens.push_back( osToken );
+        }
+        else if( isalnum( (unsigned char)*psz ) || *psz == '_' )
+        {
+            const char *pszStart = psz;
+            while( isalnum( (unsigned char)*psz ) || *psz == '_' )
+                psz++;
+            aosTokens.push_back( CPLString( pszStart, psz - pszStart ) );
+        }
+        else
+        {
+            aosTokens.push_back( CPLString( psz, 1 ) );
+            psz++;
+        }
+    }
+    // a trailing ; is allowed
+    if( !aosTokens.empty() && aosTokens.back() == ";" )
+        aosTokens.pop_back();
+    return TRUE;
+}
+
+// Index of the layer field for a column name, -1 if it isn't one
+static int GetFieldIndex( const CPLString &osToken )
+{
+    if( EQUAL(osToken, "Name") )
+        return 0;
+    if( EQUAL(osToken, "Description") )
+        return 1;
+    return -1;
+}
+
+OGRLayer *AOIExecuteSummarySQL( OGRAOILayer *poLayer, const char *pszStatement )
+{
+    // the object table has objects, not features
+    if( poLayer->HasElementFeatures() )
+        return NULL;
+
+    std::vector<CPLString> aosTokens;
+    if( !Tokenize( pszStatement, aosTokens ) )
+        return NULL;
+
+    size_t i = 0;
+    if( aosTokens.size() < 4 || !EQUAL(aosTokens[i++], "SELECT") )
+        return NULL;
+
+    // DISTINCT of one field, values in the order they are first seen
+    // and compared exactly as the generic engine does
+    int bDistinct = FALSE;
+    if( EQUAL(aosTokens[i], "DISTINCT") )
+    {
+        bDistinct = TRUE;
+        i++;
+    }
+
+    // what to select
+    int bCount = FALSE;
+    std::vector<int> anColumns;
+    if( !bDistinct && i + 3 < aosTokens.size() && EQUAL(aosTokens[i], "COUNT") 
+        && aosTokens[i + 1] == "(" && aosTokens[i + 2] == "*" && aosTokens[i + 3] == ")" )
+    {
+        bCount = TRUE;
+        i += 4;
+    }
+    else
+    {
+        while( i < aosTokens.size() )
+        {
+            int iField = GetFieldIndex( aosTokens[i++] );
+            if( iField < 0 )
+                return NULL;
+            anColumns.push_back( iField );
+            if( i < aosTokens.size() && aosTokens[i] == "," )
+                i++;
+            else
+                break;
+        }
+        if( anColumns.empty() || (bDistinct && anColumns.size() != 1) )
+            return NULL;
+    }
+
+    if( i + 1 >= aosTokens.size() || !EQUAL(aosTokens[i], "FROM") 
+        || !EQUAL(aosTokens[i + 1], poLayer->GetName()) )
+        return NULL;
+    i += 2;
+
+    // optional WHERE field = 'value'
+    int iWhereField = -1;
+    CPLString osWhereValue;
+    if( i < aosTokens.size() )
+    {
+        if( i + 4 != aosTokens.size() || !EQUAL(aosTokens[i], "WHERE") 
+            || aosTokens[i + 2] != "=" || aosTokens[i + 3][0] != '\'' )
+            return NULL;
+        iWhereField = GetFieldIndex( aosTokens[i + 1] );
+        if( iWhereField < 0 )
+            return NULL;
+        osWhereValue = aosTokens[i + 3].c_str() + 1;
+    }
+
+    // it is one of ours
+    GIntBig nObjects = poLayer->GetObjectCount();
+    if( nObjects < 0 )
+        return NULL;
+
+    OGRFeatureDefn *poSrcDefn = poLayer->GetLayerDefn();
+    OGRFeatureDefn *poDefn = new OGRFeatureDefn( poSrcDefn->GetName() );
+    poDefn->SetGeomType( wkbNone );
+    if( bCount )
+    {
+        // same name as the generic engine gives it
+        OGRFieldDefn oField( "COUNT_*", OFTInteger64 );
+        poDefn->AddFieldDefn( &oField );
+    }
+    else
+    {
+        for( size_t j = 0; j < anColumns.size(); j++ )
+            poDefn->AddFieldDefn( poSrcDefn->GetFieldDefn( anColumns[j] ) );
+    }
+    OGRAOISQLResultLayer *poResult = new OGRAOISQLResultLayer( poDefn );
+
+    // counting everything only needs the object table
+    if( bCount && iWhereField < 0 )
+    {
+        OGRFeature *poFeature = new OGRFeature( poDefn );
+        poFeature->SetField( 0, nObjects );
+        poResult->AddFeature( poFeature );
+        return poResult;
+    }
+
+    GIntBig nCount = 0;
+    CPLString aosValues[2];
+    std::set<CPLString> oSeen;
+    for( GIntBig nFID = 0; nFID < nObjects; nFID++ )
+    {
+        if( !poLayer->GetObjectStrings( nFID, aosValues[0], aosValues[1] ) )
+            continue;
+        // string comparisons in OGR SQL ignore case
+        if( iWhereField >= 0 && !EQUAL(aosValues[iWhereField], osWhereValue) )
+            continue;
+
+        if( bCount )
+        {
+            nCount++;
+            continue;
+        }
+        if( bDistinct && !oSeen.insert( aosValues[anColumns[0]] ).second )
+            continue;
+        OGRFeature *poFeature = new OGRFeature( poDefn );
+        for( size_t j = 0; j < anColumns.size(); j++ )
+            poFeature->SetField( (int)j, aosValues[anColumns[j]].c_str() );
+        poResult->AddFeature( poFeature );
+    }
+
+    if( bCount )
+    {
+        OGRFeature *poFeature = new OGRFeature( poDefn );
+        poFeature->SetField( 0, nCount );
+        poResult->AddFeature( poFeature );
+    }
+    return poResult;
+}
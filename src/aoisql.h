@@ -0,0 +1,63 @@
+/* ******************************************************************************
+ * Copyright (c) 2015, Sam Gillingham <gillingham.sam@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef AOISQL_H
+#define AOISQL_H
+
+#include <ogrsf_frmts.h>
+#include <vector>
+#include "aoilayer.h"
+
+// Layer holding the rows of a query answered by AOIExecuteSummarySQL()
+class OGRAOISQLResultLayer : public OGRLayer
+{
+    OGRFeatureDefn             *m_poFeatureDefn;
+    std::vector<OGRFeature*>    m_apoFeatures;
+    size_t                      m_iNext;
+
+  public:
+    explicit            OGRAOISQLResultLayer( OGRFeatureDefn *poFeatureDefn );
+                       ~OGRAOISQLResultLayer();
+
+    // takes ownership
+    void                AddFeature( OGRFeature *poFeature );
+
+    void                ResetReading() { m_iNext = 0; }
+    OGRFeature *        GetNextFeature();
+    OGRFeature *        GetFeature( GIntBig nFID );
+    GIntBig             GetFeatureCount( int bForce = TRUE );
+
+    OGRFeatureDefn *    GetLayerDefn() { return m_poFeatureDefn; }
+    int                 TestCapability( const char * );
+};
+
+// Answer simple queries from the object table and the name and 
+// description strings without decoding any shapes:
+//   SELECT COUNT(*) FROM layer [WHERE field = 'value']
+//   SELECT field[, field] FROM layer [WHERE field = 'value']
+//   SELECT DISTINCT field FROM layer [WHERE field = 'value']
+// where field is Name or Description. Returns NULL if the statement 
+// isn't one of these so it can be given to the generic SQL engine.
+OGRLayer *AOIExecuteSummarySQL( OGRAOILayer *poLayer, const char *pszStatement );
+
+#endif // AOISQL_H
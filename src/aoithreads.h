@@ -0,0 +1,77 @@
+/* ******************************************************************************
+ * Copyright (c) 2015, Sam Gillingham <gillingham.sam@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef AOITHREADS_H
+#define AOITHREADS_H
+
+#include <cpl_conv.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// Number of threads to use given a value like "4" or "ALL_CPUS".
+// NULL or "" means one thread.
+inline int AOIGetThreadCount( const char *pszValue )
+{
+    if( pszValue == NULL || *pszValue == '\0' )
+        return 1;
+    int nThreads;
+    if( EQUAL(pszValue, "ALL_CPUS") )
+        nThreads = CPLGetNumCPUs();
+    else
+        nThreads = atoi( pszValue );
+    return nThreads < 1 ? 1 : nThreads;
+}
+
+// Call oFunc( iThread, i ) for each i in [0, nCount) using up to 
+// nThreads threads. Items are handed out one at a time so uneven
+// work balances out. iThread is in [0, nThreads) so callers can 
+// keep per thread state in an array.
+template<class Func>
+void AOIParallelFor( int nCount, int nThreads, Func oFunc )
+{
+    if( nThreads > nCount )
+        nThreads = nCount;
+    if( nThreads <= 1 )
+    {
+        for( int i = 0; i < nCount; i++ )
+            oFunc( 0, i );
+        return;
+    }
+
+    std::atomic<int> nNext( 0 );
+    std::vector<std::thread> aoThreads;
+    for( int iThread = 0; iThread < nThreads; iThread++ )
+    {
+        aoThreads.push_back( std::thread( [&nNext, &oFunc, nCount, iThread]()
+        {
+            int i;
+            while( (i = nNext++) < nCount )
+                oFunc( iThread, i );
+        } ) );
+    }
+    for( size_t i = 0; i < aoThreads.size(); i++ )
+        aoThreads[i].join();
+}
+
+#endif // AOITHREADS_H
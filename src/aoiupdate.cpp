@@ -0,0 +1,352 @@
+/* ******************************************************************************
+ * Copyright (c) 2015, Sam Gillingham <gillingham.sam@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "aoiupdate.h"
+#include <set>
+#include <vector>
+
+// Bytes before the contents of a pointer field (count and offset)
+#define AOI_POINTER_HEADER_SIZE 8
+// Bytes before the values in a BASEDATA (rows, columns, item type 
+// and object type)
+#define AOI_BASEDATA_HEADER_SIZE 12
+
+static void AppendUInt32( std::vector<GByte> &abyOut, GUInt32 nValue )
+{
+    HFAStandard( 4, &nValue );
+    const GByte *pabyValue = reinterpret_cast<const GByte*>( &nValue );
+    abyOut.insert( abyOut.end(), pabyValue, pabyValue + 4 );
+}
+
+static void AppendUInt16( std::vector<GByte> &abyOut, GUInt16 nValue )
+{
+    HFAStandard( 2, &nValue );
+    const GByte *pabyValue = reinterpret_cast<const GByte*>( &nValue );
+    abyOut.insert( abyOut.end(), pabyValue, pabyValue + 2 );
+}
+
+static void AppendDouble( std::vector<GByte> &abyOut, double dfValue )
+{
+    HFAStandard( 8, &dfValue );
+    const GByte *pabyValue = reinterpret_cast<const GByte*>( &dfValue );
+    abyOut.insert( abyOut.end(), pabyValue, pabyValue + 8 );
+}
+
+static GUInt32 ReadUInt32( const GByte *pabyData )
+{
+    GUInt32 nValue;
+    memcpy( &nValue, pabyData, 4 );
+    HFAStandard( 4, &nValue );
+    return nValue;
+}
+
+static int GetFieldBytes( HFAField *poField, const GByte *pabyData, int nDataSize )
+{
+    std::set<HFAField*> oVisited;
+    return poField->GetInstBytes( const_cast<GByte*>(pabyData), nDataSize, oVisited );
+}
+
+// Copy the data of an instance of poType to abyOut replacing the
+// field at pszPath (fields separated by '.') with abyNew. Objects on 
+// the way to the field must be single instances. Returns FALSE if 
+// the field isn't there.
+static int SpliceField( HFAType *poType, const GByte *pabyData, int nDataSize,
+                        const char *pszPath, const std::vector<GByte> &abyNew,
+                        std::vector<GByte> &abyOut )
+{
+    const char *pszRest = strchr( pszPath, '.' );
+    CPLString osName( pszPath, pszRest ? pszRest - pszPath : strlen(pszPath) );
+    if( pszRest != NULL )
+        pszRest++;
+
+    int bFound = FALSE;
+    int nOffset = 0;
+    for( size_t i = 0; i < poType->apoFields.size(); i++ )
+    {
+        HFAField *poField = poType->apoFields[i].get();
+        int nBytes = GetFieldBytes( poField, pabyData + nOffset, nDataSize - nOffset );
+        if( nBytes < 0 || nOffset + nBytes > nDataSize )
+            return FALSE;
+
+        if( !bFound && EQUAL(poField->pszFieldName, osName) )
+        {
+            bFound = TRUE;
+            if( pszRest == NULL )
+            {
+                abyOut.insert( abyOut.end(), abyNew.begin(), abyNew.end() );
+            }
+            else
+            {
+                if( poField->chItemType != 'o' || poField->poItemObjectType == NULL )
+                    return FALSE;
+
+                int nHeader = 0;
+                if( poField->chPointer != '\0' )
+                {
+                    if( nBytes < AOI_POINTER_HEADER_SIZE 
+                        || ReadUInt32( pabyData + nOffset ) != 1 )
+                        return FALSE;
+                    nHeader = AOI_POINTER_HEADER_SIZE;
+                    // offset is set by AOIFixPointers()
+                    AppendUInt32( abyOut, 1 );
+                    AppendUInt32( abyOut, 0 );
+                }
+                if( !SpliceField( poField->poItemObjectType, pabyData + nOffset + nHeader,
+                                  nBytes - nHeader, pszRest, abyNew, abyOut ) )
+                    return FALSE;
+            }
+        }
+        else
+        {
+            abyOut.insert( abyOut.end(), pabyData + nOffset, pabyData + nOffset + nBytes );
+        }
+        nOffset += nBytes;
+    }
+    return bFound;
+}
+
+// The contents of the field at pszPath (fields separated by '.') of an
+// instance of poType, after the count and offset of a pointer field.
+// Objects on the way to the field must be single instances. Returns
+// NULL if the field isn't there.
+static const GByte *FindField( HFAType *poType, const GByte *pabyData, int nDataSize,
+                               const char *pszPath, int *pnSize )
+{
+    const char *pszRest = strchr( pszPath, '.' );
+    size_t nNameLength = pszRest ? pszRest - pszPath : strlen(pszPath);
+
+    int nOffset = 0;
+    for( size_t i = 0; i < poType->apoFields.size(); i++ )
+    {
+        HFAField *poField = poType->apoFields[i].get();
+        int nBytes = GetFieldBytes( poField, pabyData + nOffset, nDataSize - nOffset );
+        if( nBytes < 0 || nOffset + nBytes > nDataSize )
+            return NULL;
+
+        if( strlen(poField->pszFieldName) == nNameLength
+            && EQUALN(poField->pszFieldName, pszPath, nNameLength) )
+        {
+            int nHeader = poField->chPointer != '\0' ? AOI_POINTER_HEADER_SIZE : 0;
+            if( nBytes < nHeader )
+                return NULL;
+            const GByte *pabyField = pabyData + nOffset + nHeader;
+            if( pszRest == NULL )
+            {
+                *pnSize = nBytes - nHeader;
+                return pabyField;
+            }
+            if( poField->chItemType != 'o' || poField->poItemObjectType == NULL
+                || (nHeader > 0 && ReadUInt32( pabyData + nOffset ) != 1) )
+                return NULL;
+            return FindField( poField->poItemObjectType, pabyField, nBytes - nHeader,
+                              pszRest + 1, pnSize );
+        }
+        nOffset += nBytes;
+    }
+    return NULL;
+}
+
+const GByte *AOIGetEntryField( HFAEntry *poEntry, const char *pszPath, int *pnSize )
+{
+    HFAType *poType = poEntry->GetTypeObject();
+    GByte *pabyData = poEntry->GetData();
+    if( poType == NULL || pabyData == NULL )
+        return NULL;
+    return FindField( poType, pabyData, (int)poEntry->GetDataSize(), pszPath, pnSize );
+}
+
+// Put abyNew in as the data of the entry. HFAEntry::MakeData() moves
+// the entry to the end of the file if it has grown.
+static void ReplaceData( HFAEntry *poEntry, const std::vector<GByte> &abyNew )
+{
+    int bMoving = poEntry->GetFilePos() != 0 && abyNew.size() > poEntry->GetDataSize();
+    GByte *pabyData = poEntry->MakeData( (int)abyNew.size() );
+    memcpy( pabyData, &abyNew[0], abyNew.size() );
+    if( abyNew.size() < poEntry->GetDataSize() )
+        memset( pabyData + abyNew.size(), 0, poEntry->GetDataSize() - abyNew.size() );
+    poEntry->MarkDirty();
+
+    // MakeData() only marks the first child - they all point back to us
+    if( bMoving )
+    {
+        for( HFAEntry *poChild = poEntry->GetChild(); poChild != NULL; 
+             poChild = poChild->GetNext() )
+            poChild->MarkDirty();
+    }
+}
+
+// Replace the field at pszPath of poEntry with abyNew
+static int SetEntryField( HFAEntry *poEntry, const char *pszPath, 
+                          const std::vector<GByte> &abyNew )
+{
+    HFAType *poType = poEntry->GetTypeObject();
+    GByte *pabyData = poEntry->GetData();
+    if( poType == NULL || pabyData == NULL )
+        return FALSE;
+
+    std::vector<GByte> abyOut;
+    if( !SpliceField( poType, pabyData, poEntry->GetDataSize(), pszPath, abyNew, abyOut ) )
+    {
+        CPLError( CE_Failure, CPLE_AppDefined, "Can't find %s in %s", 
+                  pszPath, poEntry->GetName() );
+        return FALSE;
+    }
+    ReplaceData( poEntry, abyOut );
+    return TRUE;
+}
+
+int AOISetEntryString( HFAEntry *poEntry, const char *pszField, 
+                       const char *pszValue )
+{
+    // a pointer to chars including the terminating null
+    std::vector<GByte> abyNew;
+    size_t nLength = strlen( pszValue ) + 1;
+    AppendUInt32( abyNew, (GUInt32)nLength );
+    AppendUInt32( abyNew, 0 );
+    abyNew.insert( abyNew.end(), (const GByte*)pszValue, (const GByte*)pszValue + nLength );
+    return SetEntryField( poEntry, pszField, abyNew );
+}
+
+int AOISetEntryCoords( HFAEntry *poEntry, const char *pszField, int nPoints, 
+                       const double *padfX, const double *padfY )
+{
+    // a pointer to a single BASEDATA of 2 rows of doubles
+    std::vector<GByte> abyNew;
+    abyNew.reserve( AOI_POINTER_HEADER_SIZE + AOI_BASEDATA_HEADER_SIZE + nPoints * 16 );
+    AppendUInt32( abyNew, 1 );
+    AppendUInt32( abyNew, 0 );
+    AppendUInt32( abyNew, 2 );
+    AppendUInt32( abyNew, (GUInt32)nPoints );
+    AppendUInt16( abyNew, EPT_f64 );
+    AppendUInt16( abyNew, 0 );
+    for( int i = 0; i < nPoints; i++ )
+    {
+        AppendDouble( abyNew, padfX[i] );
+        AppendDouble( abyNew, padfY[i] );
+    }
+    return SetEntryField( poEntry, pszField, abyNew );
+}
+
+int AOISetIdentityPolynomial( HFAEntry *poElement )
+{
+    // see ReadXformPolynomial() - first order has 4 + 2 coefficients
+    // which any polynomial has room for so this is done in place
+    if( poElement->GetIntField( "xformMatrix.order" ) < 1 )
+        return TRUE;
+
+    static const double adfIdentity[4] = { 1, 0, 0, 1 };
+    int bOK = poElement->SetIntField( "xformMatrix.order", 1 ) == CE_None
+        && poElement->SetIntField( "xformMatrix.termcount", 3 ) == CE_None;
+    for( int i = 0; i < 4 && bOK; i++ )
+        bOK = poElement->SetDoubleField( CPLSPrintf( "xformMatrix.polycoefmtx[%d]", i ), 
+                                         adfIdentity[i] ) == CE_None;
+    for( int i = 0; i < 2 && bOK; i++ )
+        bOK = poElement->SetDoubleField( CPLSPrintf( "xformMatrix.polycoefvector[%d]", i ), 
+                                         0 ) == CE_None;
+    return bOK;
+}
+
+HFAEntry *AOICloneEntry( HFAInfo_t *psInfo, HFAEntry *poTemplate, 
+                         HFAEntry *poParent, const char *pszName, int bChildren )
+{
+    HFAEntry *poEntry = HFAEntry::New( psInfo, pszName, poTemplate->GetType(), poParent );
+    if( poEntry == NULL )
+        return NULL;
+
+    GByte *pabyTemplate = poTemplate->GetData();
+    int nSize = (int)poTemplate->GetDataSize();
+    if( pabyTemplate != NULL && nSize > 0 )
+    {
+        GByte *pabyData = poEntry->MakeData( nSize );
+        if( pabyData == NULL )
+            return NULL;
+        memcpy( pabyData, pabyTemplate, nSize );
+    }
+
+    if( bChildren )
+    {
+        for( HFAEntry *poChild = poTemplate->GetChild(); poChild != NULL;
+             poChild = poChild->GetNext() )
+        {
+            if( AOICloneEntry( psInfo, poChild, poEntry, poChild->GetName(), TRUE ) == NULL )
+                return NULL;
+        }
+    }
+    return poEntry;
+}
+
+// Set the offsets in the pointer fields of an instance of poType that
+// is at nPos in the file
+static void FixTypePointers( HFAType *poType, GByte *pabyData, int nDataSize, 
+                             GUInt32 nPos )
+{
+    int nOffset = 0;
+    for( size_t i = 0; i < poType->apoFields.size(); i++ )
+    {
+        HFAField *poField = poType->apoFields[i].get();
+        int nBytes = GetFieldBytes( poField, pabyData + nOffset, nDataSize - nOffset );
+        if( nBytes < 0 || nOffset + nBytes > nDataSize )
+            return;
+
+        int nHeader = 0;
+        int nCount = poField->nItemCount;
+        if( poField->chPointer != '\0' && nBytes >= AOI_POINTER_HEADER_SIZE )
+        {
+            nHeader = AOI_POINTER_HEADER_SIZE;
+            nCount = (int)ReadUInt32( pabyData + nOffset );
+            if( nCount > 0 )
+            {
+                GUInt32 nTarget = nPos + nOffset + AOI_POINTER_HEADER_SIZE;
+                HFAStandard( 4, &nTarget );
+                memcpy( pabyData + nOffset + 4, &nTarget, 4 );
+            }
+        }
+
+        // and any in objects inside this one
+        if( poField->chItemType == 'o' && poField->poItemObjectType != NULL )
+        {
+            int nInner = nOffset + nHeader;
+            for( int j = 0; j < nCount && nInner < nOffset + nBytes; j++ )
+            {
+                std::set<HFAField*> oVisited;
+                int nInstBytes = poField->poItemObjectType->GetInstBytes( 
+                            pabyData + nInner, nOffset + nBytes - nInner, oVisited );
+                if( nInstBytes <= 0 )
+                    break;
+                FixTypePointers( poField->poItemObjectType, pabyData + nInner, 
+                                 nInstBytes, nPos + nInner );
+                nInner += nInstBytes;
+            }
+        }
+        nOffset += nBytes;
+    }
+}
+
+void AOIFixPointers( HFAEntry *poEntry )
+{
+    poEntry->SetPosition();
+    HFAType *poType = poEntry->GetTypeObject();
+    GByte *pabyData = poEntry->GetData();
+    if( poType != NULL && pabyData != NULL && poEntry->GetDataPos() != 0 )
+        FixTypePointers( poType, pabyData, poEntry->GetDataSize(), poEntry->GetDataPos() );
+}
@@ -0,0 +1,67 @@
+/* ******************************************************************************
+ * Copyright (c) 2015, Sam Gillingham <gillingham.sam@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef AOIUPDATE_H
+#define AOIUPDATE_H
+
+#include "hfa_p.h"
+
+// Helpers for changing the entries of an open AOI file. HFAEntry can
+// only change fields in place, so these rebuild the data of an entry 
+// when a field changes size. If the new data fits in the space the 
+// entry already has it is rewritten there, otherwise the entry is 
+// moved to the end of the file by HFAEntry and the entries that point
+// at it are marked dirty. Nothing is written until HFAFlush() and
+// AOIFixPointers() must be called for each changed or new entry 
+// before then.
+
+// Where the field at pszPath (eg "coords.coords") is in the data of 
+// an entry and how many bytes it has, after the count and offset if
+// it is a pointer. For reading fields such as BASEDATA straight from 
+// the data. NULL if the entry hasn't got the field.
+const GByte *AOIGetEntryField( HFAEntry *poEntry, const char *pszPath, int *pnSize );
+
+// Set a string field (eg "name") of an entry to pszValue
+int AOISetEntryString( HFAEntry *poEntry, const char *pszField, 
+                       const char *pszValue );
+
+// Replace a BASEDATA field of x,y pairs (eg "coords.coords") with 
+// nPoints new points
+int AOISetEntryCoords( HFAEntry *poEntry, const char *pszField, int nPoints, 
+                       const double *padfX, const double *padfY );
+
+// Replace the xformMatrix polynomial of an element with the identity
+// so coordinates are written as they are. Does nothing if the element
+// doesn't have a polynomial.
+int AOISetIdentityPolynomial( HFAEntry *poElement );
+
+// Add a copy of poTemplate (type and data) as the last child of 
+// poParent. Children are copied too if bChildren.
+HFAEntry *AOICloneEntry( HFAInfo_t *psInfo, HFAEntry *poTemplate, 
+                         HFAEntry *poParent, const char *pszName, int bChildren );
+
+// Give the entry a place in the file if it doesn't have one and set 
+// the file offsets stored in its pointer fields to match
+void AOIFixPointers( HFAEntry *poEntry );
+
+#endif // AOIUPDATE_H
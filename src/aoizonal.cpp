@@ -0,0 +1,272 @@
+/* ******************************************************************************
+ * Copyright (c) 2015, Sam Gillingham <gillingham.sam@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "aoizonal.h"
+#include "aoiraster.h"
+#include "aoithreads.h"
+#include <algorithm>
+#include <mutex>
+
+// Results are merged under one of these picked by object so threads
+// working on different objects don't wait for each other
+#define AOI_ZONAL_LOCKS 64
+
+void AOIZonalStats::Merge( const AOIZonalStats &sOther )
+{
+    nCount += sOther.nCount;
+    dfSum += sOther.dfSum;
+    dfMin = MIN( dfMin, sOther.dfMin );
+    dfMax = MAX( dfMax, sOther.dfMax );
+    if( anHistogram.size() < sOther.anHistogram.size() )
+        anHistogram.resize( sOther.anHistogram.size(), 0 );
+    for( size_t i = 0; i < sOther.anHistogram.size(); i++ )
+        anHistogram[i] += sOther.anHistogram[i];
+}
+
+// Add the values that are under the mask to sStats. Kept to a simple
+// loop over contiguous arrays so the compiler can vectorise it.
+static void Accumulate( const double *padfValues, const GByte *pabyMask, 
+                        int nCount, int bHaveNoData, double dfNoData,
+                        const AOIZonalOptions &sOptions, AOIZonalStats &sStats )
+{
+    GIntBig nValid = 0;
+    double dfSum = 0;
+    double dfMin = sStats.dfMin;
+    double dfMax = sStats.dfMax;
+    for( int i = 0; i < nCount; i++ )
+    {
+        double dfValue = padfValues[i];
+        // NaN never equals itself
+        int bUse = pabyMask[i] && dfValue == dfValue 
+                    && !(bHaveNoData && dfValue == dfNoData);
+        if( bUse )
+        {
+            nValid++;
+            dfSum += dfValue;
+            dfMin = MIN( dfMin, dfValue );
+            dfMax = MAX( dfMax, dfValue );
+        }
+    }
+    sStats.nCount += nValid;
+    sStats.dfSum += dfSum;
+    sStats.dfMin = dfMin;
+    sStats.dfMax = dfMax;
+
+    if( sOptions.nHistogramBins > 0 && nValid > 0 )
+    {
+        double dfScale = sOptions.nHistogramBins 
+                / (sOptions.dfHistogramMax - sOptions.dfHistogramMin);
+        for( int i = 0; i < nCount; i++ )
+        {
+            double dfValue = padfValues[i];
+            if( !pabyMask[i] || dfValue != dfValue 
+                || (bHaveNoData && dfValue == dfNoData) )
+                continue;
+            // the maximum goes in the last bin
+            int iBin = (int)floor( (dfValue - sOptions.dfHistogramMin) * dfScale );
+            if( dfValue == sOptions.dfHistogramMax )
+                iBin = sOptions.nHistogramBins - 1;
+            if( iBin >= 0 && iBin < sOptions.nHistogramBins )
+                sStats.anHistogram[iBin]++;
+        }
+    }
+}
+
+// State for each thread
+struct AOIZonalState
+{
+    std::vector<double> adfData;    // each band for the current block
+    std::vector<GByte>  abyMask;
+    AOIFillScratch      oScratch;
+    AOIZonalStats       sStats;
+};
+
+CPLErr AOIComputeZonalStats( OGRAOILayer *poLayer, GDALDataset *poDS,
+                             const AOIZonalOptions &sOptions,
+                             std::vector<AOIZonalResult> &aoResults )
+{
+    std::vector<int> anBands = sOptions.anBands;
+    if( anBands.empty() )
+    {
+        for( int i = 1; i <= poDS->GetRasterCount(); i++ )
+            anBands.push_back( i );
+    }
+    std::vector<GDALRasterBand*> apoBands;
+    std::vector<int> abHaveNoData;
+    std::vector<double> adfNoData;
+    for( size_t i = 0; i < anBands.size(); i++ )
+    {
+        GDALRasterBand *poBand = poDS->GetRasterBand( anBands[i] );
+        if( poBand == NULL )
+            return CE_Failure;
+        int bHaveNoData = FALSE;
+        adfNoData.push_back( poBand->GetNoDataValue( &bHaveNoData ) );
+        abHaveNoData.push_back( bHaveNoData );
+        apoBands.push_back( poBand );
+    }
+    if( apoBands.empty() )
+    {
+        CPLError( CE_Failure, CPLE_AppDefined, "No bands to compute statistics for" );
+        return CE_Failure;
+    }
+    if( sOptions.nHistogramBins > 0 
+        && !(sOptions.dfHistogramMax > sOptions.dfHistogramMin) )
+    {
+        CPLError( CE_Failure, CPLE_IllegalArg, "Histogram maximum must be more than the minimum" );
+        return CE_Failure;
+    }
+
+    double adfGeoTransform[6];
+    AOIPixelShapes oShapes;
+    if( poDS->GetGeoTransform( adfGeoTransform ) != CE_None
+        || !oShapes.Initialize( adfGeoTransform, poDS->GetRasterXSize(), 
+                                poDS->GetRasterYSize() ) )
+    {
+        CPLError( CE_Failure, CPLE_AppDefined, "Raster has no usable geotransform" );
+        return CE_Failure;
+    }
+
+    // decode everything - each object gets a result even if it 
+    // doesn't cover any pixels
+    aoResults.clear();
+    AOIScratch oScratch;
+    GIntBig nFID;
+    const AOIObject *poObject;
+    poLayer->ResetReading();
+    while( (poObject = poLayer->GetNextDecodedObject( &nFID )) != NULL )
+    {
+        aoResults.resize( aoResults.size() + 1 );
+        AOIZonalResult &sResult = aoResults.back();
+        sResult.nFID = nFID;
+        sResult.osName = poObject->osName;
+        sResult.asBands.resize( apoBands.size() );
+        oShapes.AddObject( *poObject, (int)aoResults.size() - 1, 
+                           poLayer->GetGeometryOptions(), oScratch );
+    }
+
+    int nXSize = poDS->GetRasterXSize();
+    int nYSize = poDS->GetRasterYSize();
+    int nBlockXSize, nBlockYSize;
+    apoBands[0]->GetBlockSize( &nBlockXSize, &nBlockYSize );
+    int nBlocksPerRow = (nXSize + nBlockXSize - 1) / nBlockXSize;
+    std::map<GIntBig, std::vector<int> > oBlockShapes;
+    oShapes.GetBlockShapes( nBlockXSize, nBlockYSize, oBlockShapes );
+    std::vector<std::pair<GIntBig, std::vector<int>*> > aoBlocks;
+    for( std::map<GIntBig, std::vector<int> >::iterator oIter = oBlockShapes.begin();
+         oIter != oBlockShapes.end(); ++oIter )
+    {
+        aoBlocks.push_back( std::make_pair( oIter->first, &oIter->second ) );
+    }
+
+    int nThreads = MAX( sOptions.nThreads, 1 );
+    std::vector<AOIZonalState> asState( nThreads );
+    std::mutex oIOMutex;
+    std::vector<std::mutex> aoResultMutex( AOI_ZONAL_LOCKS );
+    std::atomic<int> bFailed( FALSE );
+    AOIParallelFor( (int)aoBlocks.size(), nThreads, 
+        [&]( int iThread, int iBlock )
+    {
+        if( bFailed )
+            return;
+
+        AOIZonalState &sState = asState[iThread];
+        int nBlockXOff = (int)(aoBlocks[iBlock].first % nBlocksPerRow) * nBlockXSize;
+        int nBlockYOff = (int)(aoBlocks[iBlock].first / nBlocksPerRow) * nBlockYSize;
+        int nWinXSize = MIN( nBlockXSize, nXSize - nBlockXOff );
+        int nWinYSize = MIN( nBlockYSize, nYSize - nBlockYOff );
+        size_t nWinPixels = (size_t)nWinXSize * nWinYSize;
+        int bRead = FALSE;
+
+        // the shapes of each object are next to each other
+        const std::vector<int> &anShapes = *aoBlocks[iBlock].second;
+        size_t iStart = 0;
+        while( iStart < anShapes.size() )
+        {
+            // window of this object's shapes within the block
+            int nObject = oShapes.aoShapes[anShapes[iStart]].nObject;
+            int nXOff = nBlockXOff + nWinXSize, nYOff = nBlockYOff + nWinYSize;
+            int nXEnd = nBlockXOff, nYEnd = nBlockYOff;
+            size_t iEnd = iStart;
+            while( iEnd < anShapes.size() 
+                   && oShapes.aoShapes[anShapes[iEnd]].nObject == nObject )
+            {
+                const AOIPixelShapes::Shape &sShape = oShapes.aoShapes[anShapes[iEnd]];
+                nXOff = MIN( nXOff, MAX( sShape.nXOff, nBlockXOff ) );
+                nYOff = MIN( nYOff, MAX( sShape.nYOff, nBlockYOff ) );
+                nXEnd = MAX( nXEnd, MIN( sShape.nXEnd, nBlockXOff + nWinXSize ) );
+                nYEnd = MAX( nYEnd, MIN( sShape.nYEnd, nBlockYOff + nWinYSize ) );
+                iEnd++;
+            }
+
+            int nObjXSize = nXEnd - nXOff;
+            int nObjYSize = nYEnd - nYOff;
+            sState.abyMask.assign( (size_t)nObjXSize * nObjYSize, 0 );
+            for( size_t i = iStart; i < iEnd; i++ )
+                oShapes.Fill( anShapes[i], nXOff, nYOff, nObjXSize, nObjYSize,
+                              &sState.abyMask[0], sState.oScratch );
+            iStart = iEnd;
+
+            if( std::find( sState.abyMask.begin(), sState.abyMask.end(), 1 ) 
+                    == sState.abyMask.end() )
+                continue;
+
+            // read the block the first time an object needs it
+            if( !bRead )
+            {
+                sState.adfData.resize( nWinPixels * apoBands.size() );
+                std::lock_guard<std::mutex> oLock( oIOMutex );
+                for( size_t iBand = 0; iBand < apoBands.size(); iBand++ )
+                {
+                    if( apoBands[iBand]->RasterIO( GF_Read, nBlockXOff, nBlockYOff, 
+                                nWinXSize, nWinYSize, &sState.adfData[iBand * nWinPixels],
+                                nWinXSize, nWinYSize, GDT_Float64, 0, 0, NULL ) != CE_None )
+                    {
+                        bFailed = TRUE;
+                        return;
+                    }
+                }
+                bRead = TRUE;
+            }
+
+            for( size_t iBand = 0; iBand < apoBands.size(); iBand++ )
+            {
+                AOIZonalStats &sStats = sState.sStats;
+                sStats = AOIZonalStats();
+                sStats.anHistogram.resize( sOptions.nHistogramBins, 0 );
+                const double *padfBand = &sState.adfData[iBand * nWinPixels];
+                for( int iRow = 0; iRow < nObjYSize; iRow++ )
+                {
+                    Accumulate( padfBand + (size_t)(nYOff - nBlockYOff + iRow) * nWinXSize 
+                                    + (nXOff - nBlockXOff),
+                                &sState.abyMask[(size_t)iRow * nObjXSize], nObjXSize,
+                                abHaveNoData[iBand], adfNoData[iBand], sOptions, sStats );
+                }
+
+                std::lock_guard<std::mutex> oLock( aoResultMutex[nObject % AOI_ZONAL_LOCKS] );
+                aoResults[nObject].asBands[iBand].Merge( sStats );
+            }
+        }
+    } );
+
+    return bFailed ? CE_Failure : CE_None;
+}
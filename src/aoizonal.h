@@ -0,0 +1,88 @@
+/* ******************************************************************************
+ * Copyright (c) 2015, Sam Gillingham <gillingham.sam@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef AOIZONAL_H
+#define AOIZONAL_H
+
+#include <gdal_priv.h>
+#include "aoilayer.h"
+#include <vector>
+
+// Statistics of the pixels of one band under one object
+struct AOIZonalStats
+{
+    GIntBig             nCount;
+    double              dfSum;
+    double              dfMin;
+    double              dfMax;
+    std::vector<GIntBig> anHistogram;
+
+                        AOIZonalStats() 
+                        { 
+                            nCount = 0; 
+                            dfSum = 0; 
+                            dfMin = HUGE_VAL; 
+                            dfMax = -HUGE_VAL; 
+                        }
+
+    double              GetMean() const { return nCount > 0 ? dfSum / nCount : 0; }
+    void                Merge( const AOIZonalStats &sOther );
+};
+
+// Statistics for one object, one AOIZonalStats per band
+struct AOIZonalResult
+{
+    GIntBig             nFID;
+    CPLString           osName;
+    std::vector<AOIZonalStats> asBands;
+};
+
+struct AOIZonalOptions
+{
+    std::vector<int>    anBands;        // 1 based, empty for all
+    int                 nThreads;
+    int                 nHistogramBins; // 0 for no histogram
+    double              dfHistogramMin;
+    double              dfHistogramMax;
+
+                        AOIZonalOptions()
+                        {
+                            nThreads = 1;
+                            nHistogramBins = 0;
+                            dfHistogramMin = 0;
+                            dfHistogramMax = 0;
+                        }
+};
+
+// Compute statistics for every object in poLayer over the bands of poDS.
+// A pixel is under an object when its centre is inside one of its 
+// polygons, rectangles or ellipses or it is touched by one of its lines
+// or points, the same as AOIRasterize(). Nodata and NaN are skipped.
+// Only the blocks that objects touch are read, once each in file 
+// order, however many objects overlap them. Blocks are worked on by
+// sOptions.nThreads threads.
+CPLErr AOIComputeZonalStats( OGRAOILayer *poLayer, GDALDataset *poDS,
+                             const AOIZonalOptions &sOptions,
+                             std::vector<AOIZonalResult> &aoResults );
+
+#endif // AOIZONAL_H
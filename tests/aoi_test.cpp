@@ -0,0 +1,781 @@
+/* ******************************************************************************
+ * Copyright (c) 2015, Sam Gillingham <gillingham.sam@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+// Checks of the driver against tests/data/shapes.aoi (written by
+// tests/make_fixture.py). Run by ctest as
+//   aoi_test <check> <file>
+// and exits with 1 if anything is wrong.
+
+#include <math.h>
+#include <stdlib.h>
+#include <atomic>
+#include <thread>
+#include <gdal_priv.h>
+#include <cpl_string.h>
+#include "aoidatasource.h"
+#include "aoisql.h"
+
+static std::atomic<int> nFailures( 0 );
+
+#define AOI_CHECK(x) if( !(x) ) { \
+    fprintf( stderr, "%s:%d: %s\n", __FILE__, __LINE__, #x ); nFailures++; }
+
+/* -------------------------------------------------------------------- */
+/*      What the file holds, in FID order. The object with no shapes    */
+/*      isn't a feature. ELLIPSIS_STEPS=4 keeps the ellipse exact.      */
+/* -------------------------------------------------------------------- */
+struct AOIExpected
+{
+    const char *pszName;
+    const char *pszDescription;
+    const char *pszWKT;
+};
+
+static const AOIExpected asExpected[] =
+{
+    { "square", "a square",
+      "GEOMETRYCOLLECTION (POLYGON ((0 0,10 0,10 10,0 10,0 0)))" },
+    { "rectangle", "shifted",
+      "GEOMETRYCOLLECTION (POLYGON ((103 206,107 206,107 204,103 204,103 206)))" },
+    { "group", "nested",
+      "GEOMETRYCOLLECTION (POLYGON ((53 50,50 52,47 50,50 48,53 50)),"
+      "LINESTRING (20 20,30 25,40 20),POINT (7.5 -2.5))" },
+    { "triangle", "last",
+      "GEOMETRYCOLLECTION (POLYGON ((0 0,5 8,10 0,0 0)))" }
+};
+#define AOI_EXPECTED_COUNT (int)(sizeof(asExpected) / sizeof(asExpected[0]))
+
+static OGRAOIDataSource *OpenFixture( const char *pszFilename,
+                                      const char *pszOptions )
+{
+    char **papszOptions = CSLTokenizeString2( pszOptions, " ", 0 );
+    papszOptions = CSLSetNameValue( papszOptions, "ELLIPSIS_STEPS", "4" );
+    OGRAOIDataSource *poDS = AOIOpenDataSource( pszFilename, papszOptions );
+    CSLDestroy( papszOptions );
+    if( poDS == NULL )
+    {
+        fprintf( stderr, "Can't open %s with %s\n", pszFilename, pszOptions );
+        nFailures++;
+    }
+    return poDS;
+}
+
+// Read every feature and compare it with asExpected
+static void CheckFeatures( OGRLayer *poLayer, const char *pszOptions )
+{
+    poLayer->ResetReading();
+    int nFeatures = 0;
+    OGRFeature *poFeature;
+    while( (poFeature = poLayer->GetNextFeature()) != NULL )
+    {
+        if( nFeatures < AOI_EXPECTED_COUNT )
+        {
+            const AOIExpected &sExpected = asExpected[nFeatures];
+            AOI_CHECK( poFeature->GetFID() == nFeatures );
+            AOI_CHECK( strcmp( poFeature->GetFieldAsString( 0 ), sExpected.pszName ) == 0 );
+            AOI_CHECK( strcmp( poFeature->GetFieldAsString( 1 ), sExpected.pszDescription ) == 0 );
+
+            char *pszWKT = NULL;
+            OGRGeometry *poGeom = poFeature->GetGeometryRef();
+            if( poGeom != NULL )
+                poGeom->exportToWkt( &pszWKT );
+            if( pszWKT == NULL || strcmp( pszWKT, sExpected.pszWKT ) != 0 )
+            {
+                fprintf( stderr, "%s feature %d is %s\n", pszOptions, nFeatures,
+                         pszWKT ? pszWKT : "(null)" );
+                nFailures++;
+            }
+            CPLFree( pszWKT );
+        }
+        nFeatures++;
+        delete poFeature;
+    }
+    AOI_CHECK( nFeatures == AOI_EXPECTED_COUNT );
+    AOI_CHECK( poLayer->GetFeatureCount() == AOI_EXPECTED_COUNT );
+}
+
+// The same features however the objects are read
+static void CheckReaders( const char *pszFilename )
+{
+    static const char * const apszOptions[] =
+    {
+        "READER=LEAN",
+        "READER=HFA",
+        "READER=LEAN STREAMING=YES STREAMING_MEMORY=0",
+        NULL
+    };
+    for( int i = 0; apszOptions[i] != NULL; i++ )
+    {
+        OGRAOIDataSource *poDS = OpenFixture( pszFilename, apszOptions[i] );
+        if( poDS == NULL )
+            continue;
+        OGRLayer *poLayer = poDS->GetLayer( 0 );
+        // twice to check the second pass over the object table
+        CheckFeatures( poLayer, apszOptions[i] );
+        CheckFeatures( poLayer, apszOptions[i] );
+        delete poDS;
+    }
+}
+
+/* -------------------------------------------------------------------- */
+/*      Read requests. Files are opened under /vsiaoicount/, a plugin   */
+/*      file system that passes everything on to the real file and      */
+/*      counts the reads that get to it, whatever the driver thinks it  */
+/*      is doing. Plugin file systems need GDAL 3.0.                    */
+/* -------------------------------------------------------------------- */
+#define AOI_SKIPPED 77      // SKIP_RETURN_CODE in CMakeLists.txt
+
+#if GDAL_VERSION_NUM >= 3000000
+static int nReadRequests = 0;
+
+static int CountStat( void *, const char *pszFilename, VSIStatBufL *psStat, int nFlags )
+{
+    return VSIStatExL( pszFilename, psStat, nFlags );
+}
+
+static void *CountOpen( void *, const char *pszFilename, const char *pszAccess )
+{
+    return VSIFOpenL( pszFilename, pszAccess );
+}
+
+static vsi_l_offset CountTell( void *pFile )
+{
+    return VSIFTellL( (VSILFILE*)pFile );
+}
+
+static int CountSeek( void *pFile, vsi_l_offset nOffset, int nWhence )
+{
+    return VSIFSeekL( (VSILFILE*)pFile, nOffset, nWhence );
+}
+
+static size_t CountRead( void *pFile, void *pBuffer, size_t nSize, size_t nCount )
+{
+    nReadRequests++;
+    return VSIFReadL( pBuffer, nSize, nCount, (VSILFILE*)pFile );
+}
+
+static int CountEof( void *pFile )
+{
+    return VSIFEofL( (VSILFILE*)pFile );
+}
+
+static int CountClose( void *pFile )
+{
+    return VSIFCloseL( (VSILFILE*)pFile );
+}
+
+static void InstallCountingFileSystem()
+{
+    static int bInstalled = FALSE;
+    if( bInstalled )
+        return;
+    bInstalled = TRUE;
+
+    // no buffering so each read the driver makes is one read here
+    VSIFilesystemPluginCallbacksStruct *psCallbacks = 
+        VSIAllocFilesystemPluginCallbacksStruct();
+    psCallbacks->stat = CountStat;
+    psCallbacks->open = CountOpen;
+    psCallbacks->tell = CountTell;
+    psCallbacks->seek = CountSeek;
+    psCallbacks->read = CountRead;
+    psCallbacks->eof = CountEof;
+    psCallbacks->close = CountClose;
+    VSIInstallPluginHandler( "/vsiaoicount/", psCallbacks );
+    VSIFreeFilesystemPluginCallbacksStruct( psCallbacks );
+}
+
+// Read requests made by opening the file, reading all the features
+// nPasses times and closing it. This includes the one GDALOpenInfo 
+// makes for the first 1024 bytes.
+static int CountReadRequests( const char *pszFilename, const char *pszOptions,
+                              int nPasses )
+{
+    InstallCountingFileSystem();
+    nReadRequests = 0;
+    CPLString osCounted = CPLString( "/vsiaoicount/" ) + pszFilename;
+    OGRAOIDataSource *poDS = OpenFixture( osCounted, pszOptions );
+    if( poDS == NULL )
+        return -1;
+    for( int i = 0; i < nPasses; i++ )
+        CheckFeatures( poDS->GetLayer( 0 ), pszOptions );
+    delete poDS;
+    return nReadRequests;
+}
+
+static void CheckReadRequests( const char *pszWhat, const char *pszOptions, 
+                               int nRequests, int nMaxRequests )
+{
+    if( nRequests < 1 || nRequests > nMaxRequests )
+    {
+        fprintf( stderr, "%s with %s made %d read requests, expected at most %d\n",
+                 pszWhat, pszOptions, nRequests, nMaxRequests );
+        nFailures++;
+    }
+}
+
+// The header is parsed from the bytes GDAL has already read and the 
+// dictionary and the entries under the AOI node are all in the first
+// read, so opening takes one request of our own. The in-memory lean
+// reader then reads the rest of the file in one more. Without 
+// coalescing HFAEntry reads each header and dictionary line itself.
+static void CheckOpenReads( const char *pszFilename )
+{
+    CPLSetConfigOption( "OGR_AOI_WHOLE_FILE_SIZE", "0" );
+
+    CPLSetConfigOption( "OGR_AOI_COALESCE_READS", "NO" );
+    int nUncoalesced = CountReadRequests( pszFilename, "READER=HFA", 0 );
+
+    CPLSetConfigOption( "OGR_AOI_COALESCE_READS", "YES" );
+    int nRequests = CountReadRequests( pszFilename, "READER=HFA", 0 );
+    CheckReadRequests( "Opening", "READER=HFA", nRequests, 2 );
+    AOI_CHECK( nUncoalesced > nRequests );
+    nRequests = CountReadRequests( pszFilename, "READER=LEAN STREAMING=YES", 0 );
+    CheckReadRequests( "Opening", "READER=LEAN STREAMING=YES", nRequests, 2 );
+    nRequests = CountReadRequests( pszFilename, "READER=LEAN", 0 );
+    CheckReadRequests( "Opening", "READER=LEAN", nRequests, 3 );
+
+    CPLSetConfigOption( "OGR_AOI_COALESCE_READS", NULL );
+    CPLSetConfigOption( "OGR_AOI_WHOLE_FILE_SIZE", NULL );
+}
+
+// A full scan as it would go over /vsicurl/: the file isn't fetched
+// whole, and the objects are past the first read, after the gap
+// tests/make_fixture.py leaves. Coalescing should get them all in one
+// more request, whether the objects are read through HFAEntry or the 
+// lean reader streams them.
+static void CheckScanReads( const char *pszFilename )
+{
+    static const char * const apszOptions[] =
+    {
+        "READER=HFA",
+        "READER=LEAN",
+        "READER=LEAN STREAMING=YES STREAMING_MEMORY=0",
+        NULL
+    };
+
+    CPLSetConfigOption( "OGR_AOI_COALESCE_READS", "YES" );
+    CPLSetConfigOption( "OGR_AOI_WHOLE_FILE_SIZE", "0" );
+
+    for( int bPrefetch = FALSE; bPrefetch <= TRUE; bPrefetch++ )
+    {
+        CPLSetConfigOption( "OGR_AOI_PREFETCH", bPrefetch ? "YES" : "NO" );
+        for( int i = 0; apszOptions[i] != NULL; i++ )
+        {
+            CheckReadRequests( bPrefetch ? "Two scans with OGR_AOI_PREFETCH=YES" 
+                                         : "Two scans",
+                               apszOptions[i],
+                               CountReadRequests( pszFilename, apszOptions[i], 2 ), 3 );
+        }
+    }
+
+    CPLSetConfigOption( "OGR_AOI_PREFETCH", NULL );
+    CPLSetConfigOption( "OGR_AOI_WHOLE_FILE_SIZE", NULL );
+    CPLSetConfigOption( "OGR_AOI_COALESCE_READS", NULL );
+}
+#else
+static void CheckOpenReads( const char * )
+{
+    fprintf( stderr, "Counting reads needs GDAL 3.0 or later\n" );
+    exit( AOI_SKIPPED );
+}
+
+static void CheckScanReads( const char *pszFilename )
+{
+    CheckOpenReads( pszFilename );
+}
+#endif
+
+/* -------------------------------------------------------------------- */
+/*      REFRESH. shapes_moved.aoi has the same objects as shapes.aoi    */
+/*      with their data further up the file, so the pointers in them    */
+/*      are all different.                                              */
+/* -------------------------------------------------------------------- */
+static int nReloadedChanged = -1;
+
+static void CPL_STDCALL ReloadHandler( CPLErr eErr, CPLErrorNum nErrorNum,
+                                       const char *pszMsg )
+{
+    const char *pszFound = strstr( pszMsg, " objects, " );
+    if( eErr == CE_Debug && STARTS_WITH(pszMsg, "AOI: Reloaded ") && pszFound != NULL )
+        nReloadedChanged = atoi( pszFound + 10 );
+    else if( eErr != CE_Debug )
+        CPLDefaultErrorHandler( eErr, nErrorNum, pszMsg );
+}
+
+static GIntBig GetCacheCount( OGRLayer *poLayer, const char *pszItem )
+{
+    const char *pszValue = poLayer->GetMetadataItem( pszItem, "AOI" );
+    return pszValue != NULL ? CPLAtoGIntBig( pszValue ) : -1;
+}
+
+// Objects that have only moved keep their cached features and 
+// envelopes when the file is reloaded
+static void CheckReload( const char *pszFilename )
+{
+    CPLString osMoved = CPLFormFilename( CPLGetPath( pszFilename ), 
+                                         "shapes_moved", "aoi" );
+    CPLString osCopy = CPLString( CPLGenerateTempFilename( "aoi_reload" ) ) + ".aoi";
+    if( CPLCopyFile( osCopy, pszFilename ) != 0 )
+    {
+        fprintf( stderr, "Can't copy %s to %s\n", pszFilename, osCopy.c_str() );
+        nFailures++;
+        return;
+    }
+
+    CPLSetConfigOption( "CPL_DEBUG", "ON" );
+    CPLPushErrorHandler( ReloadHandler );
+    OGRAOIDataSource *poDS = OpenFixture( osCopy, 
+                                "READER=LEAN REFRESH=YES FEATURE_CACHE_SIZE=1000000" );
+    if( poDS != NULL )
+    {
+        OGRLayer *poLayer = poDS->GetLayer( 0 );
+        OGREnvelope sBefore, sAfter;
+        CheckFeatures( poLayer, "REFRESH=YES" );
+        AOI_CHECK( poLayer->GetExtent( &sBefore ) == OGRERR_NONE );
+        GIntBig nMisses = GetCacheCount( poLayer, "FEATURE_CACHE_MISSES" );
+        GIntBig nHits = GetCacheCount( poLayer, "FEATURE_CACHE_HITS" );
+
+        // CheckFeatures() calls ResetReading(), which reloads the file
+        AOI_CHECK( CPLCopyFile( osCopy, osMoved ) == 0 );
+        CheckFeatures( poLayer, "REFRESH=YES" );
+        AOI_CHECK( nReloadedChanged == 0 );
+
+        // read from the cache, and the envelopes didn't need working out
+        AOI_CHECK( GetCacheCount( poLayer, "FEATURE_CACHE_MISSES" ) == nMisses );
+        AOI_CHECK( GetCacheCount( poLayer, "FEATURE_CACHE_HITS" ) 
+                        == nHits + AOI_EXPECTED_COUNT );
+        AOI_CHECK( poLayer->TestCapability( OLCFastGetExtent ) );
+        AOI_CHECK( poLayer->GetExtent( &sAfter, FALSE ) == OGRERR_NONE );
+        AOI_CHECK( sAfter.MinX == sBefore.MinX && sAfter.MaxX == sBefore.MaxX
+                   && sAfter.MinY == sBefore.MinY && sAfter.MaxY == sBefore.MaxY );
+        delete poDS;
+    }
+    CPLPopErrorHandler();
+    CPLSetConfigOption( "CPL_DEBUG", NULL );
+    VSIUnlink( osCopy );
+}
+
+/* -------------------------------------------------------------------- */
+/*      GRANULARITY=ELEMENT with the feature cache. Each shape is a      */
+/*      feature of its own and comes back from the cache the same.      */
+/* -------------------------------------------------------------------- */
+static const char * const apszElementWKT[] =
+{
+    "POLYGON ((0 0,10 0,10 10,0 10,0 0))",
+    "POLYGON ((103 206,107 206,107 204,103 204,103 206))",
+    "POLYGON ((53 50,50 52,47 50,50 48,53 50))",
+    "LINESTRING (20 20,30 25,40 20)",
+    "POINT (7.5 -2.5)",
+    "POLYGON ((0 0,5 8,10 0,0 0))",
+    NULL
+};
+
+static void CheckElementCache( const char *pszFilename )
+{
+    const char *pszOptions = "GRANULARITY=ELEMENT FEATURE_CACHE_SIZE=1000000";
+    OGRAOIDataSource *poDS = OpenFixture( pszFilename, pszOptions );
+    if( poDS == NULL )
+        return;
+    OGRLayer *poLayer = poDS->GetLayer( 0 );
+
+    int nElements = 0;
+    for( int i = 0; apszElementWKT[i] != NULL; i++ )
+    {
+        // the second time is from the cache
+        for( int iRead = 0; iRead < 2; iRead++ )
+        {
+            OGRFeature *poFeature = poLayer->GetFeature( i );
+            char *pszWKT = NULL;
+            if( poFeature != NULL && poFeature->GetGeometryRef() != NULL )
+                poFeature->GetGeometryRef()->exportToWkt( &pszWKT );
+            if( pszWKT == NULL || strcmp( pszWKT, apszElementWKT[i] ) != 0 )
+            {
+                fprintf( stderr, "%s element %d read %d is %s\n", pszOptions, i, iRead,
+                         pszWKT ? pszWKT : "(null)" );
+                nFailures++;
+            }
+            CPLFree( pszWKT );
+            delete poFeature;
+        }
+        nElements++;
+    }
+    AOI_CHECK( GetCacheCount( poLayer, "FEATURE_CACHE_HITS" ) == nElements );
+    delete poDS;
+}
+
+/* -------------------------------------------------------------------- */
+/*      SELECT DISTINCT from the object table gives the same rows as    */
+/*      the generic engine, which a spatial filter sends it to.         */
+/* -------------------------------------------------------------------- */
+static void CheckSQLRows( OGRLayer *poResult, const char * const *papszRows,
+                          const char *pszWhat )
+{
+    int nRows = 0;
+    OGRFeature *poFeature;
+    poResult->ResetReading();
+    while( (poFeature = poResult->GetNextFeature()) != NULL )
+    {
+        const char *pszValue = poFeature->GetFieldAsString( 0 );
+        if( papszRows[nRows] == NULL || strcmp( pszValue, papszRows[nRows] ) != 0 )
+        {
+            fprintf( stderr, "%s row %d is %s\n", pszWhat, nRows, pszValue );
+            nFailures++;
+        }
+        if( papszRows[nRows] != NULL )
+            nRows++;
+        delete poFeature;
+    }
+    AOI_CHECK( papszRows[nRows] == NULL );
+}
+
+static void CheckDistinct( const char *pszFilename )
+{
+    CPLString osCopy = CPLString( CPLGenerateTempFilename( "aoi_distinct" ) ) + ".aoi";
+    if( CPLCopyFile( osCopy, pszFilename ) != 0 )
+    {
+        fprintf( stderr, "Can't copy %s to %s\n", pszFilename, osCopy.c_str() );
+        nFailures++;
+        return;
+    }
+
+    // call the triangle a square too
+    GDALOpenInfo oOpenInfo( osCopy, GA_Update );
+    OGRAOIDataSource *poDS = new OGRAOIDataSource();
+    if( poDS->Open( &oOpenInfo ) )
+    {
+        OGRLayer *poLayer = poDS->GetLayer( 0 );
+        OGRFeature *poFeature = poLayer->GetFeature( 3 );
+        AOI_CHECK( poFeature != NULL );
+        if( poFeature != NULL )
+        {
+            poFeature->SetField( 0, asExpected[0].pszName );
+            AOI_CHECK( poLayer->SetFeature( poFeature ) == OGRERR_NONE );
+            delete poFeature;
+        }
+    }
+    else
+    {
+        fprintf( stderr, "Can't open %s for update\n", osCopy.c_str() );
+        nFailures++;
+    }
+    delete poDS;
+
+    static const char * const apszNames[] = { "square", "rectangle", "group", NULL };
+    static const char * const apszLast[] = { "square", NULL };
+    poDS = OpenFixture( osCopy, "" );
+    if( poDS != NULL )
+    {
+        OGRLayer *poLayer = poDS->GetLayer( 0 );
+        CPLString osSQL;
+        osSQL.Printf( "SELECT DISTINCT Name FROM %s", poLayer->GetName() );
+
+        OGRLayer *poResult = poDS->ExecuteSQL( osSQL, NULL, NULL );
+        AOI_CHECK( dynamic_cast<OGRAOISQLResultLayer*>( poResult ) != NULL );
+        if( poResult != NULL )
+        {
+            CheckSQLRows( poResult, apszNames, "object table" );
+            poDS->ReleaseResultSet( poResult );
+        }
+
+        OGRPolygon oEverywhere;
+        OGRLinearRing oRing;
+        oRing.addPoint( -1e6, -1e6 );
+        oRing.addPoint( -1e6, 1e6 );
+        oRing.addPoint( 1e6, 1e6 );
+        oRing.addPoint( 1e6, -1e6 );
+        oRing.addPoint( -1e6, -1e6 );
+        oEverywhere.addRing( &oRing );
+        poResult = poDS->ExecuteSQL( osSQL, &oEverywhere, NULL );
+        AOI_CHECK( dynamic_cast<OGRAOISQLResultLayer*>( poResult ) == NULL );
+        if( poResult != NULL )
+        {
+            CheckSQLRows( poResult, apszNames, "generic engine" );
+            poDS->ReleaseResultSet( poResult );
+        }
+
+        osSQL += " WHERE Description = 'LAST'";
+        poResult = poDS->ExecuteSQL( osSQL, NULL, NULL );
+        AOI_CHECK( dynamic_cast<OGRAOISQLResultLayer*>( poResult ) != NULL );
+        if( poResult != NULL )
+        {
+            CheckSQLRows( poResult, apszLast, "object table WHERE" );
+            poDS->ReleaseResultSet( poResult );
+        }
+        delete poDS;
+    }
+    VSIUnlink( osCopy );
+}
+
+/* -------------------------------------------------------------------- */
+/*      Allocations. malloc() and the rest are replaced so everything   */
+/*      is counted, operator new, CPLMalloc() and VSIMalloc() alike,    */
+/*      in GDAL as well as the driver. The real work is done by         */
+/*      glibc's __libc_ functions so this needs glibc.                  */
+/* -------------------------------------------------------------------- */
+#ifdef __GLIBC__
+static int nAllocations = 0;
+
+extern "C" 
+{
+void *__libc_malloc( size_t nSize );
+void *__libc_calloc( size_t nCount, size_t nSize );
+void *__libc_realloc( void *p, size_t nSize );
+void __libc_free( void *p );
+
+void *malloc( size_t nSize ) __THROW
+{
+    nAllocations++;
+    return __libc_malloc( nSize );
+}
+
+void *calloc( size_t nCount, size_t nSize ) __THROW
+{
+    nAllocations++;
+    return __libc_calloc( nCount, nSize );
+}
+
+// growing an array a bit at a time shows up here
+void *realloc( void *p, size_t nSize ) __THROW
+{
+    nAllocations++;
+    return __libc_realloc( p, nSize );
+}
+
+void free( void *p ) __THROW
+{
+    __libc_free( p );
+}
+}
+
+// Allocations made by GetNextFeature() for each feature on one pass
+static void CountFeatureAllocations( OGRLayer *poLayer, int nFeatures, 
+                                     int *panAllocations )
+{
+    poLayer->ResetReading();
+    for( int i = 0; i < nFeatures; i++ )
+    {
+        int nBefore = nAllocations;
+        OGRFeature *poFeature = poLayer->GetNextFeature();
+        panAllocations[i] = nAllocations - nBefore;
+        AOI_CHECK( poFeature != NULL );
+        delete poFeature;
+    }
+}
+
+// Copy the fixture and add a polygon with AOI_MANY_VERTICES vertices
+// to the end of it
+#define AOI_MANY_VERTICES 1000
+
+static CPLString CopyWithManyVertices( const char *pszFilename )
+{
+    CPLString osCopy = CPLString( CPLGenerateTempFilename( "aoi_alloc" ) ) + ".aoi";
+    if( CPLCopyFile( osCopy, pszFilename ) != 0 )
+    {
+        fprintf( stderr, "Can't copy %s to %s\n", pszFilename, osCopy.c_str() );
+        nFailures++;
+        return "";
+    }
+
+    GDALOpenInfo oOpenInfo( osCopy, GA_Update );
+    OGRAOIDataSource *poDS = new OGRAOIDataSource();
+    if( !poDS->Open( &oOpenInfo ) )
+    {
+        fprintf( stderr, "Can't open %s for update\n", osCopy.c_str() );
+        nFailures++;
+        delete poDS;
+        VSIUnlink( osCopy );
+        return "";
+    }
+
+    OGRLayer *poLayer = poDS->GetLayer( 0 );
+    OGRLinearRing *poRing = new OGRLinearRing();
+    for( int i = 0; i <= AOI_MANY_VERTICES; i++ )
+    {
+        double dfAngle = 2 * M_PI * (i % AOI_MANY_VERTICES) / AOI_MANY_VERTICES;
+        poRing->addPoint( 100 * cos( dfAngle ), 100 * sin( dfAngle ) );
+    }
+    OGRPolygon *poPolygon = new OGRPolygon();
+    poPolygon->addRingDirectly( poRing );
+
+    OGRFeature *poFeature = new OGRFeature( poLayer->GetLayerDefn() );
+    poFeature->SetField( 0, "circle" );
+    poFeature->SetGeometryDirectly( poPolygon );
+    AOI_CHECK( poLayer->CreateFeature( poFeature ) == OGRERR_NONE );
+    delete poFeature;
+    delete poDS;
+    return osCopy;
+}
+
+// Once the object table has been built and the scratch buffers have
+// grown, each feature should cost the same number of allocations every
+// time it is read, and it shouldn't depend on how many vertices it has.
+// The square has 4 and the circle AOI_MANY_VERTICES.
+static void CheckAllocations( const char *pszFilename )
+{
+    static const char * const apszOptions[] = { "READER=LEAN", "READER=HFA", NULL };
+    const int nFeatures = AOI_EXPECTED_COUNT + 1;
+
+    CPLString osCopy = CopyWithManyVertices( pszFilename );
+    if( osCopy.empty() )
+        return;
+
+    for( int iOption = 0; apszOptions[iOption] != NULL; iOption++ )
+    {
+        const char *pszOptions = apszOptions[iOption];
+        OGRAOIDataSource *poDS = OpenFixture( osCopy, pszOptions );
+        if( poDS == NULL )
+            continue;
+        OGRLayer *poLayer = poDS->GetLayer( 0 );
+        AOI_CHECK( poLayer->GetFeatureCount() == nFeatures );
+
+        int anFirst[AOI_EXPECTED_COUNT + 1], anSecond[AOI_EXPECTED_COUNT + 1];
+        CountFeatureAllocations( poLayer, nFeatures, anFirst );
+        CountFeatureAllocations( poLayer, nFeatures, anFirst );
+        CountFeatureAllocations( poLayer, nFeatures, anSecond );
+        for( int i = 0; i < nFeatures; i++ )
+        {
+            if( anFirst[i] != anSecond[i] )
+            {
+                fprintf( stderr, "%s: feature %d took %d allocations then %d\n",
+                         pszOptions, i, anFirst[i], anSecond[i] );
+                nFailures++;
+            }
+        }
+
+        if( anSecond[0] != anSecond[AOI_EXPECTED_COUNT] )
+        {
+            fprintf( stderr, "%s: %d vertices took %d allocations but %d took %d\n",
+                     pszOptions, 4, anSecond[0], 
+                     AOI_MANY_VERTICES, anSecond[AOI_EXPECTED_COUNT] );
+            nFailures++;
+        }
+        delete poDS;
+    }
+    VSIUnlink( osCopy );
+}
+#else
+static void CheckAllocations( const char * )
+{
+    fprintf( stderr, "Counting allocations needs glibc\n" );
+    exit( AOI_SKIPPED );
+}
+#endif
+
+/* -------------------------------------------------------------------- */
+/*      Shared dictionaries. The Eaoi_ types the objects use aren't in  */
+/*      the driver's list of GDAL's built in types, so reading them     */
+/*      with READER=HFA has FindType() look them up in the shared       */
+/*      dictionary from every thread, as does reading the projection.   */
+/*      None of that may add to a dictionary once it is shared.         */
+/* -------------------------------------------------------------------- */
+#define AOI_DICTIONARY_PASSES 20
+
+static int GetDictionarySize( OGRLayer *poLayer )
+{
+    const char *pszValue = poLayer->GetMetadataItem( "DICTIONARY_SIZE", "AOI" );
+    return pszValue != NULL ? atoi( pszValue ) : -1;
+}
+
+static void ReadInThread( const char *pszFilename, int nExpectedSize )
+{
+    for( int iPass = 0; iPass < AOI_DICTIONARY_PASSES; iPass++ )
+    {
+        OGRAOIDataSource *poDS = OpenFixture( pszFilename, "READER=HFA" );
+        if( poDS == NULL )
+            return;
+        OGRLayer *poLayer = poDS->GetLayer( 0 );
+        AOI_CHECK( GetDictionarySize( poLayer ) == nExpectedSize );
+        poLayer->GetSpatialRef();
+        CheckFeatures( poLayer, "READER=HFA" );
+        AOI_CHECK( GetDictionarySize( poLayer ) == nExpectedSize );
+        delete poDS;
+    }
+}
+
+static void CheckDictionaryThreads( const char *pszFilename )
+{
+    // holds the dictionary in the cache for the threads
+    OGRAOIDataSource *poDS = OpenFixture( pszFilename, "READER=HFA" );
+    if( poDS == NULL )
+        return;
+    OGRLayer *poLayer = poDS->GetLayer( 0 );
+    int nSize = GetDictionarySize( poLayer );
+    AOI_CHECK( nSize > 0 );
+
+    std::thread oFirst( ReadInThread, pszFilename, nSize );
+    std::thread oSecond( ReadInThread, pszFilename, nSize );
+    oFirst.join();
+    oSecond.join();
+
+    poLayer->GetSpatialRef();
+    CheckFeatures( poLayer, "READER=HFA" );
+    if( GetDictionarySize( poLayer ) != nSize )
+    {
+        fprintf( stderr, "Shared dictionary grew from %d to %d bytes. A type GDAL "
+                 "has built in is missing from apszAOIDictionaryTypes.\n", 
+                 nSize, GetDictionarySize( poLayer ) );
+        nFailures++;
+    }
+    delete poDS;
+}
+
+int main( int nArgc, char **papszArgv )
+{
+    if( nArgc != 3 )
+    {
+        fprintf( stderr, "Usage: aoi_test readers|open_reads|scan_reads|allocations|reload|element_cache|distinct|dictionary_threads file.aoi\n" );
+        return 1;
+    }
+    const char *pszCheck = papszArgv[1];
+    const char *pszFilename = papszArgv[2];
+
+    if( EQUAL(pszCheck, "readers") )
+        CheckReaders( pszFilename );
+    else if( EQUAL(pszCheck, "open_reads") )
+        CheckOpenReads( pszFilename );
+    else if( EQUAL(pszCheck, "scan_reads") )
+        CheckScanReads( pszFilename );
+    else if( EQUAL(pszCheck, "allocations") )
+        CheckAllocations( pszFilename );
+    else if( EQUAL(pszCheck, "reload") )
+        CheckReload( pszFilename );
+    else if( EQUAL(pszCheck, "element_cache") )
+        CheckElementCache( pszFilename );
+    else if( EQUAL(pszCheck, "distinct") )
+        CheckDistinct( pszFilename );
+    else if( EQUAL(pszCheck, "dictionary_threads") )
+        CheckDictionaryThreads( pszFilename );
+    else
+    {
+        fprintf( stderr, "Unknown check %s\n", pszCheck );
+        return 1;
+    }
+
+    if( nFailures > 0 )
+    {
+        fprintf( stderr, "%d failures\n", nFailures.load() );
+        return 1;
+    }
+    return 0;
+}
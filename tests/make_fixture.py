@@ -0,0 +1,190 @@
+# ******************************************************************************
+# * Copyright (c) 2015, Sam Gillingham <gillingham.sam@gmail.com>
+# *
+# * Permission is hereby granted, free of charge, to any person obtaining a
+# * copy of this software and associated documentation files (the "Software"),
+# * to deal in the Software without restriction, including without limitation
+# * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# * and/or sell copies of the Software, and to permit persons to whom the
+# * Software is furnished to do so, subject to the following conditions:
+# *
+# * The above copyright notice and this permission notice shall be included
+# * in all copies or substantial portions of the Software.
+# *
+# * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+# * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+# * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+# * DEALINGS IN THE SOFTWARE.
+
+# Writes tests/data/shapes.aoi, the small AOI file aoi_test reads.
+# The dictionary only has the types and fields the driver looks at so
+# it is easy to see what the file holds. Run from the top of the tree:
+#   python tests/make_fixture.py tests/data/shapes.aoi
+#   python tests/make_fixture.py tests/data/shapes_moved.aoi 30000
+# The second is the same objects with their data somewhere else, as
+# if the file had been saved again.
+
+import struct, sys
+
+DICT = (
+    "{1:lversion,}Eaoi_AreaOfInterest,"
+    "{1:lversion,}Eaoi_AoiObjectType,"
+    "{1:lversion,}Eaoi_AntAoiInfo,"
+    "{1:lversion,}AntHeader_Eant,"
+    "{1:lversion,}ElementNode_Eant,"
+    "{1:lorder,1:lnumdimtransform,1:lnumdimpolynomial,1:ltermcount,0:pdpolycoefmtx,0:pdpolycoefvector,}Efga_Polynomial,"
+    "{0:pcname,0:pcdescription,1:oEfga_Polynomial,xformMatrix,}Element_2_Eant,"
+    "{0:*bcoords,}Eant_Coords,"
+    "{1:dx,1:dy,}Eant_Point,"
+    "{1:oEant_Coords,coords,}Polygon_2_Eant,"
+    "{1:oEant_Coords,coords,}Polyline_2_Eant,"
+    "{1:oEant_Coords,coord,}Point_2_Eant,"
+    "{1:oEant_Point,center,1:dwidth,1:dheight,1:dorientation,}Rectangle_2_Eant,"
+    "{1:oEant_Point,center,1:dsemiMajorAxis,1:dsemiMinorAxis,1:dorientation,}Ellipse_2_Eant,"
+    ".")
+
+class Data(bytes):
+    """Entry data, with where its pointers are so they can be set to
+    the file offset of what they point at once it is known"""
+    def __new__(cls, b=b"", pointers=()):
+        o = bytes.__new__(cls, b)
+        o.pointers = list(pointers)
+        return o
+    def __add__(self, other):
+        other = other if isinstance(other, Data) else Data(other)
+        return Data(bytes(self) + bytes(other), self.pointers
+                    + [p + len(self) for p in other.pointers])
+
+class Entry:
+    def __init__(self, name, type, data=b""):
+        self.name, self.type = name, type
+        self.data = data if isinstance(data, Data) else Data(data)
+        self.children = []
+    def add(self, e):
+        self.children.append(e)
+        return e
+
+def pointer(count, b):
+    return Data(struct.pack("<II", count, 0) + b, [4])
+
+def pstr(s):
+    b = s.encode() + b"\0"
+    return pointer(len(b), b)
+
+def pdoubles(a):
+    return pointer(len(a), b"".join(struct.pack("<d", v) for v in a))
+
+def poly(order=0, coefs=(), vector=()):
+    if order == 0:
+        return Data(struct.pack("<llll", 0, 0, 0, 0)) + pdoubles([]) + pdoubles([])
+    terms = {1: 3, 2: 6, 3: 10}[order]
+    return Data(struct.pack("<llll", order, 2, 2, terms)) + pdoubles(coefs) + pdoubles(vector)
+
+# two rows of EPT_f64, a column for each point
+def basedata(points):
+    b = struct.pack("<IIhh", 2, len(points), 10, 0)
+    for x, y in points:
+        b += struct.pack("<dd", x, y)
+    return pointer(2 * len(points), b)
+
+def element(name, desc, polynomial=None):
+    return Entry("AntElement", "Element_2_Eant",
+                 pstr(name) + pstr(desc) + (polynomial or poly()))
+
+def aoi_object(parent, index):
+    obj = parent.add(Entry("AOIobject_%d" % index, "Eaoi_AoiObjectType", struct.pack("<l", 1)))
+    ant = obj.add(Entry("AOIantObject", "Eaoi_AntAoiInfo", struct.pack("<l", 1)))
+    info = ant.add(Entry("antInfo", "AntHeader_Eant", struct.pack("<l", 1)))
+    return info.add(Entry("ElementList", "ElementNode_Eant", struct.pack("<l", 1)))
+
+root = Entry("root", "root")
+aoinode = root.add(Entry("AOInode", "Eaoi_AreaOfInterest", struct.pack("<l", 1)))
+
+# 0: a square polygon
+lst = aoi_object(aoinode, 0)
+head = lst.add(element("square", "a square"))
+head.add(Entry("Polygon", "Polygon_2_Eant",
+               basedata([(0, 0), (10, 0), (10, 10), (0, 10)])))
+
+# 1: a rectangle moved by a first order polynomial
+lst = aoi_object(aoinode, 1)
+head = lst.add(element("rectangle", "shifted",
+                       poly(1, [1, 0, 0, 1], [100, 200])))
+head.add(Entry("Rectangle", "Rectangle_2_Eant",
+               struct.pack("<ddddd", 5, 5, 4, 2, 0)))
+
+# 2: an object with no shapes, which isn't a feature
+lst = aoi_object(aoinode, 2)
+lst.add(element("empty", ""))
+
+# 3: an ellipse, a line and a point in nested groups
+lst = aoi_object(aoinode, 3)
+head = lst.add(element("group", "nested"))
+head.add(Entry("Ellipse", "Ellipse_2_Eant",
+               struct.pack("<ddddd", 50, 50, 3, 2, 0)))
+group = head.add(element("inner", ""))
+group.add(Entry("Polyline", "Polyline_2_Eant",
+                basedata([(20, 20), (30, 25), (40, 20)])))
+group.add(Entry("Point", "Point_2_Eant", basedata([(7.5, -2.5)])))
+
+# something else under the AOI node that isn't an object
+aoinode.add(Entry("Projection", "Eprj_ProParameters"))
+
+# 4: a triangle, after the entry that isn't an object
+lst = aoi_object(aoinode, 4)
+head = lst.add(element("triangle", "last"))
+head.add(Entry("Polygon", "Polygon_2_Eant",
+               basedata([(0, 0), (5, 8), (10, 0)])))
+
+# lay out: tag, Ehfa_File, dictionary, then entries and their data
+HEADER_POS = 20
+DATA_GAP = int(sys.argv[2]) if len(sys.argv) > 2 else 40000
+ROOT_POS_FIELD = HEADER_POS + 8
+out = bytearray(b"EHFA_HEADER_TAG\0" + struct.pack("<I", HEADER_POS))
+out += struct.pack("<IIIhI", 1, 0, 0, 128, 0)
+dict_pos = len(out)
+out += DICT.encode() + b"\0"
+
+entries = []
+def walk(e, parent):
+    e.parent = parent
+    entries.append(e)
+    for c in e.children:
+        walk(c, e)
+walk(root, None)
+pos = len(out)
+for e in entries:
+    e.pos = pos
+    pos += 128
+# leave a gap before the data, as edited files have, so a reader that
+# fetches the start of the file doesn't get the objects too
+pos += DATA_GAP
+for e in entries:
+    e.data_pos = pos if e.data else 0
+    pos += len(e.data)
+
+for e in entries:
+    siblings = e.parent.children if e.parent else [e]
+    i = siblings.index(e)
+    nxt = siblings[i + 1].pos if i + 1 < len(siblings) else 0
+    prv = siblings[i - 1].pos if i > 0 else 0
+    hdr = struct.pack("<IIIIII", nxt, prv, e.parent.pos if e.parent else 0,
+                      e.children[0].pos if e.children else 0,
+                      e.data_pos, len(e.data))
+    hdr += e.name.encode().ljust(64, b"\0") + e.type.encode().ljust(32, b"\0")
+    hdr += b"\0" * 8
+    assert len(hdr) == 128
+    out += hdr
+out += b"\0" * DATA_GAP
+for e in entries:
+    data = bytearray(e.data)
+    for p in e.data.pointers:
+        struct.pack_into("<I", data, p, e.data_pos + p + 4)
+    out += data
+
+struct.pack_into("<I", out, HEADER_POS + 8, root.pos)
+struct.pack_into("<I", out, HEADER_POS + 14, dict_pos)
+open(sys.argv[1], "wb").write(out)